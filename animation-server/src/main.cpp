@@ -59,7 +59,7 @@ static void sendVoxelEditMessage(PACKET_HEADER header, VoxelDetail& detail) {
             printf("sending packet of size=%d\n",sizeOut);
         }
 
-        AgentList::getInstance()->broadcastToAgents(bufferOut, sizeOut, &AGENT_TYPE_VOXEL_SERVER, 1);
+        AgentList::getInstance()->sendVoxelEditToOwners(bufferOut, sizeOut);
         delete[] bufferOut;
     }
 }
@@ -168,7 +168,7 @@ static void renderMovingBug() {
         if (::shouldShowPacketsPerSecond) {
             printf("sending packet of size=%d\n", sizeOut);
         }
-        AgentList::getInstance()->broadcastToAgents(bufferOut, sizeOut, &AGENT_TYPE_VOXEL_SERVER, 1);
+        AgentList::getInstance()->sendVoxelEditToOwners(bufferOut, sizeOut);
         delete[] bufferOut;
     }
 
@@ -238,7 +238,7 @@ static void renderMovingBug() {
         if (::shouldShowPacketsPerSecond) {
             printf("sending packet of size=%d\n", sizeOut);
         }
-        AgentList::getInstance()->broadcastToAgents(bufferOut, sizeOut, &AGENT_TYPE_VOXEL_SERVER, 1);
+        AgentList::getInstance()->sendVoxelEditToOwners(bufferOut, sizeOut);
         delete[] bufferOut;
     }
 }
@@ -344,7 +344,7 @@ static void sendBlinkingStringOfLights() {
                 if (::shouldShowPacketsPerSecond) {
                     printf("sending packet of size=%d\n",sizeOut);
                 }
-                AgentList::getInstance()->broadcastToAgents(bufferOut, sizeOut, &AGENT_TYPE_VOXEL_SERVER, 1);
+                AgentList::getInstance()->sendVoxelEditToOwners(bufferOut, sizeOut);
                 delete[] bufferOut;
             }
 
@@ -386,7 +386,7 @@ static void sendBlinkingStringOfLights() {
             if (::shouldShowPacketsPerSecond) {
                 printf("sending packet of size=%d\n",sizeOut);
             }
-            AgentList::getInstance()->broadcastToAgents(bufferOut, sizeOut, &AGENT_TYPE_VOXEL_SERVER, 1);
+            AgentList::getInstance()->sendVoxelEditToOwners(bufferOut, sizeOut);
             delete[] bufferOut;
         }
     }
@@ -509,7 +509,7 @@ void sendDanceFloor() {
                     if (::shouldShowPacketsPerSecond) {
                         printf("sending packet of size=%d\n", sizeOut);
                     }
-                    AgentList::getInstance()->broadcastToAgents(bufferOut, sizeOut, &AGENT_TYPE_VOXEL_SERVER, 1);
+                    AgentList::getInstance()->sendVoxelEditToOwners(bufferOut, sizeOut);
                     delete[] bufferOut;
                 }
             }
@@ -606,7 +606,7 @@ static void sendBillboard() {
                     if (::shouldShowPacketsPerSecond) {
                         printf("sending packet of size=%d\n", sizeOut);
                     }
-                    AgentList::getInstance()->broadcastToAgents(bufferOut, sizeOut, &AGENT_TYPE_VOXEL_SERVER, 1);
+                    AgentList::getInstance()->sendVoxelEditToOwners(bufferOut, sizeOut);
                     delete[] bufferOut;
                 }
             }
@@ -614,6 +614,49 @@ static void sendBillboard() {
     }
 }
 
+// --editLoad paints this many voxels a frame, in a patch that wanders around the ground, to see how many edits a
+// second the voxel server can keep up with
+int editLoadVoxelsPerFrame = 0;
+unsigned long voxelsSent = 0;
+const float EDIT_LOAD_VOXEL_SIZE = 0.25f / TREE_SCALE;
+const float EDIT_LOAD_PATCH_SIZE = 16.0f / TREE_SCALE;
+const int EDIT_LOAD_VOXELS_PER_PACKET = 100;
+glm::vec3 editLoadPatchPosition(0.5f, 0.0f, 0.5f);
+
+static void sendEditLoad() {
+    PACKET_HEADER message = PACKET_HEADER_SET_VOXEL;
+    static VoxelDetail details[EDIT_LOAD_VOXELS_PER_PACKET];
+    unsigned char* bufferOut;
+    int sizeOut;
+
+    // wander a little each frame, staying on the ground
+    editLoadPatchPosition.x += randFloatInRange(-EDIT_LOAD_VOXEL_SIZE, EDIT_LOAD_VOXEL_SIZE);
+    editLoadPatchPosition.z += randFloatInRange(-EDIT_LOAD_VOXEL_SIZE, EDIT_LOAD_VOXEL_SIZE);
+    editLoadPatchPosition.x = std::max(0.0f, std::min(1.0f - EDIT_LOAD_PATCH_SIZE, editLoadPatchPosition.x));
+    editLoadPatchPosition.z = std::max(0.0f, std::min(1.0f - EDIT_LOAD_PATCH_SIZE, editLoadPatchPosition.z));
+
+    for (int i = 0; i < ::editLoadVoxelsPerFrame; i++) {
+        int item = i % EDIT_LOAD_VOXELS_PER_PACKET;
+        details[item].s = EDIT_LOAD_VOXEL_SIZE;
+        details[item].x = editLoadPatchPosition.x + randFloat() * EDIT_LOAD_PATCH_SIZE;
+        details[item].y = editLoadPatchPosition.y;
+        details[item].z = editLoadPatchPosition.z + randFloat() * EDIT_LOAD_PATCH_SIZE;
+        details[item].red   = randIntInRange(0, 255);
+        details[item].green = randIntInRange(0, 255);
+        details[item].blue  = randIntInRange(0, 255);
+
+        if (item == EDIT_LOAD_VOXELS_PER_PACKET - 1 || i == ::editLoadVoxelsPerFrame - 1) {
+            if (createVoxelEditMessage(message, 0, item + 1, (VoxelDetail*)&details, bufferOut, sizeOut)){
+                ::packetsSent++;
+                ::bytesSent += sizeOut;
+                ::voxelsSent += item + 1;
+                AgentList::getInstance()->sendVoxelEditToOwners(bufferOut, sizeOut);
+                delete[] bufferOut;
+            }
+        }
+    }
+}
+
 double start = 0;
 
 
@@ -642,12 +685,15 @@ void* animateVoxels(void* args) {
         if (::includeDanceFloor) {
             sendDanceFloor();
         }
+        if (::editLoadVoxelsPerFrame) {
+            sendEditLoad();
+        }
         
         long long end = usecTimestampNow();
-        long long elapsedSeconds = (end - ::start) / 1000000;
-        if (::shouldShowPacketsPerSecond) {
-            printf("packetsSent=%ld, bytesSent=%ld pps=%f bps=%f\n",packetsSent,bytesSent,
-                (float)(packetsSent/elapsedSeconds),(float)(bytesSent/elapsedSeconds));
+        float elapsedSeconds = (end - ::start) / 1000000.0f;
+        if (::shouldShowPacketsPerSecond && elapsedSeconds > 0.0f) {
+            printf("packetsSent=%ld, bytesSent=%ld, voxelsSent=%ld pps=%f bps=%f vps=%f\n",packetsSent,bytesSent,voxelsSent,
+                packetsSent / elapsedSeconds, bytesSent / elapsedSeconds, voxelsSent / elapsedSeconds);
         }
         // dynamically sleep until we need to fire off the next set of voxels
         long long usecToSleep =  ANIMATE_VOXELS_INTERVAL_USECS - (usecTimestampNow() - usecTimestamp(&lastSendTime));
@@ -686,6 +732,14 @@ int main(int argc, const char * argv[])
     const char* NO_DANCE_FLOOR = "--NoDanceFloor";
     ::includeDanceFloor = !cmdOptionExists(argc, argv, NO_DANCE_FLOOR);
 
+    const char* EDIT_LOAD = "--editLoad";
+    const char* editLoad = getCmdOption(argc, argv, EDIT_LOAD);
+    if (editLoad) {
+        ::editLoadVoxelsPerFrame = atoi(editLoad);
+        printf("editLoad=%d voxels per frame, %d voxels per second\n", ::editLoadVoxelsPerFrame,
+               ::editLoadVoxelsPerFrame * ACTUAL_FPS);
+    }
+
     // Handle Local Domain testing with the --local command line
     const char* showPPS = "--showPPS";
     ::shouldShowPacketsPerSecond = cmdOptionExists(argc, argv, showPPS);
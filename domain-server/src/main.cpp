@@ -54,6 +54,11 @@ unsigned char* addAgentToBroadcastPacket(unsigned char* currentPosition, Agent*
     currentPosition += packSocket(currentPosition, agentToAdd->getPublicSocket());
     currentPosition += packSocket(currentPosition, agentToAdd->getLocalSocket());
     
+    // voxel servers own part of the voxel tree, so agents know which edits to send them
+    if (agentToAdd->getType() == AGENT_TYPE_VOXEL_SERVER) {
+        currentPosition += agentToAdd->getVoxelRegion().pack(currentPosition);
+    }
+    
     // return the new unsigned char * for broadcast packet
     return currentPosition;
 }
@@ -133,6 +138,14 @@ int main(int argc, const char * argv[])
                 + numBytesSocket + sizeof(unsigned char);
             int numInterestTypes = *(agentTypesOfInterest - 1);
             
+            // voxel servers follow that with the region of the voxel tree they own
+            if (agentType == AGENT_TYPE_VOXEL_SERVER) {
+                VoxelRegion voxelRegion;
+                unsigned char* packedRegion = agentTypesOfInterest + numInterestTypes;
+                voxelRegion.unpack(packedRegion, receivedBytes - (packedRegion - packetData));
+                newAgent->setVoxelRegion(voxelRegion);
+            }
+            
             if (numInterestTypes > 0) {
                 // if the agent has sent no types of interest, assume they want nothing but their own ID back
                 for (AgentList::iterator agent = agentList->begin(); agent != agentList->end(); agent++) {
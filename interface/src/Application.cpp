@@ -1069,6 +1069,10 @@ void Application::setWantsOcclusionCulling(bool wantsOcclusionCulling) {
     _myAvatar.setWantOcclusionCulling(wantsOcclusionCulling);
 }
 
+void Application::setWantsCompression(bool wantsCompression) {
+    _myAvatar.setWantCompression(wantsCompression);
+}
+
 void Application::updateVoxelModeActions() {
     // only the sender can be checked
     foreach (QAction* action, _voxelModeActions->actions()) {
@@ -1083,7 +1087,7 @@ static void sendVoxelEditMessage(PACKET_HEADER header, VoxelDetail& detail) {
     int sizeOut;
 
     if (createVoxelEditMessage(header, 0, 1, &detail, bufferOut, sizeOut)){
-        AgentList::getInstance()->broadcastToAgents(bufferOut, sizeOut, &AGENT_TYPE_VOXEL_SERVER, 1);
+        AgentList::getInstance()->sendVoxelEditToOwners(bufferOut, sizeOut);
         delete[] bufferOut;
     }
 }
@@ -1158,7 +1162,7 @@ bool Application::sendVoxelsOperation(VoxelNode* node, void* extraData) {
 
         // if we have room don't have room in the buffer, then send the previously generated message first
         if (args->bufferInUse + codeAndColorLength > MAXIMUM_EDIT_VOXEL_MESSAGE_SIZE) {
-            AgentList::getInstance()->broadcastToAgents(args->messageBuffer, args->bufferInUse, &AGENT_TYPE_VOXEL_SERVER, 1);
+            AgentList::getInstance()->sendVoxelEditToOwners(args->messageBuffer, args->bufferInUse);
             args->bufferInUse = sizeof(PACKET_HEADER_SET_VOXEL_DESTRUCTIVE) + sizeof(unsigned short int); // reset
         }
         
@@ -1222,7 +1226,7 @@ void Application::importVoxels() {
 
     // If we have voxels left in the packet, then send the packet
     if (args.bufferInUse > (sizeof(PACKET_HEADER_SET_VOXEL_DESTRUCTIVE) + sizeof(unsigned short int))) {
-        AgentList::getInstance()->broadcastToAgents(args.messageBuffer, args.bufferInUse, &AGENT_TYPE_VOXEL_SERVER, 1);
+        AgentList::getInstance()->sendVoxelEditToOwners(args.messageBuffer, args.bufferInUse);
     }
     
     if (calculatedOctCode) {
@@ -1274,7 +1278,7 @@ void Application::pasteVoxels() {
     
     // If we have voxels left in the packet, then send the packet
     if (args.bufferInUse > (sizeof(PACKET_HEADER_SET_VOXEL_DESTRUCTIVE) + sizeof(unsigned short int))) {
-        AgentList::getInstance()->broadcastToAgents(args.messageBuffer, args.bufferInUse, &AGENT_TYPE_VOXEL_SERVER, 1);
+        AgentList::getInstance()->sendVoxelEditToOwners(args.messageBuffer, args.bufferInUse);
     }
     
     if (calculatedOctCode) {
@@ -1412,6 +1416,7 @@ void Application::initMenu() {
     debugMenu->addAction("Wants Monochrome", this, SLOT(setWantsMonochrome(bool)))->setCheckable(true);
     debugMenu->addAction("Wants View Delta Sending", this, SLOT(setWantsDelta(bool)))->setCheckable(true);
     debugMenu->addAction("Wants Occlusion Culling", this, SLOT(setWantsOcclusionCulling(bool)))->setCheckable(true);
+    debugMenu->addAction("Wants Compressed Voxel Packets", this, SLOT(setWantsCompression(bool)))->setCheckable(true);
 
     QMenu* settingsMenu = menuBar->addMenu("Settings");
     (_settingsAutosave = settingsMenu->addAction("Autosave"))->setCheckable(true);
@@ -1796,6 +1801,12 @@ void Application::updateAvatar(float deltaTime) {
         if (shouldDo(AVATAR_VOXEL_URL_SEND_INTERVAL, deltaTime)) {
             sendAvatarVoxelURLMessage(_myAvatar.getVoxels()->getVoxelURL());
         }
+
+        // tell the voxel servers how their packets are getting through, so they can send as fast as we can take them
+        const float VOXEL_RECEIVE_REPORT_SEND_INTERVAL = 0.1f; // seconds
+        if (shouldDo(VOXEL_RECEIVE_REPORT_SEND_INTERVAL, deltaTime)) {
+            _voxels.sendReceiveReports(AgentList::getInstance()->getAgentSocket());
+        }
     }
 
     // If I'm in paint mode, send a voxel out to VOXEL server agents.
@@ -2659,9 +2670,11 @@ void* Application::networkReceive(void* args) {
                     break;
                 case PACKET_HEADER_VOXEL_DATA:
                 case PACKET_HEADER_VOXEL_DATA_MONOCHROME:
+                case PACKET_HEADER_VOXEL_DATA_COMPRESSED:
+                case PACKET_HEADER_VOXEL_DATA_MONOCHROME_COMPRESSED:
                 case PACKET_HEADER_Z_COMMAND:
                 case PACKET_HEADER_ERASE_VOXEL:
-                    app->_voxels.parseData(app->_incomingPacket, bytesReceived);
+                    app->_voxels.parseData(&senderAddress, app->_incomingPacket, bytesReceived);
                     break;
                 case PACKET_HEADER_ENVIRONMENT_DATA:
                     app->_environment.parseData(&senderAddress, app->_incomingPacket, bytesReceived);
@@ -120,6 +120,7 @@ private slots:
     void setWantsResIn(bool wantsResIn);
     void setWantsDelta(bool wantsDelta);
     void setWantsOcclusionCulling(bool wantsOcclusionCulling);
+    void setWantsCompression(bool wantsCompression);
     void updateVoxelModeActions();
     void decreaseVoxelSize();
     void increaseVoxelSize();
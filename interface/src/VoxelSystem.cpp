@@ -47,11 +47,12 @@ GLubyte identityIndices[] = { 0,2,1,    0,3,2,    // Z-
                               4,5,6,    4,6,7 };  // Z+
 
 VoxelSystem::VoxelSystem(float treeScale, int maxVoxels) :
-        AgentData(NULL), _treeScale(treeScale), _maxVoxels(maxVoxels) {
+        AgentData(NULL), _treeScale(treeScale), _maxVoxels(maxVoxels), _voxelServerCount(0) {
     _voxelsInReadArrays = _voxelsInWriteArrays = _voxelsUpdated = 0;
     _writeRenderFullVBO = true;
     _readRenderFullVBO = true;
     _tree = new VoxelTree();
+    _collider = new VoxelCollider(_tree);
     pthread_mutex_init(&_bufferWriteLock, NULL);
     pthread_mutex_init(&_treeLock, NULL);
 }
@@ -63,14 +64,17 @@ VoxelSystem::~VoxelSystem() {
     delete[] _writeColorsArray;
     delete[] _writeVoxelDirtyArray;
     delete[] _readVoxelDirtyArray;
+    delete _collider;
     delete _tree;
     pthread_mutex_destroy(&_bufferWriteLock);
     pthread_mutex_destroy(&_treeLock);
 }
 
 void VoxelSystem::loadVoxelsFile(const char* fileName, bool wantColorRandomizer) {
+    pthread_mutex_lock(&_treeLock);
     _tree->loadVoxelsFile(fileName, wantColorRandomizer);
     setupNewVoxelsForDrawing();
+    pthread_mutex_unlock(&_treeLock);
 }
 
 void VoxelSystem::writeToSVOFile(const char* filename, VoxelNode* node) const {
@@ -78,10 +82,12 @@ void VoxelSystem::writeToSVOFile(const char* filename, VoxelNode* node) const {
 }
 
 bool VoxelSystem::readFromSVOFile(const char* filename) {
+    pthread_mutex_lock(&_treeLock);
     bool result = _tree->readFromSVOFile(filename);
     if (result) {
         setupNewVoxelsForDrawing();
     }
+    pthread_mutex_unlock(&_treeLock);
     return result;
 }
 
@@ -90,7 +96,7 @@ long int VoxelSystem::getVoxelsCreated() {
 }
 
 float VoxelSystem::getVoxelsCreatedPerSecondAverage() {
-    return (1 / _tree->voxelsCreatedStats.getEventDeltaAverage());
+    return _tree->voxelsCreatedStats.getAverageSampleValuePerSecond();
 }
 
 long int VoxelSystem::getVoxelsColored() {
@@ -98,7 +104,7 @@ long int VoxelSystem::getVoxelsColored() {
 }
 
 float VoxelSystem::getVoxelsColoredPerSecondAverage() {
-    return (1 / _tree->voxelsColoredStats.getEventDeltaAverage());
+    return _tree->voxelsColoredStats.getAverageSampleValuePerSecond();
 }
 
 long int VoxelSystem::getVoxelsBytesRead() {
@@ -109,26 +115,77 @@ float VoxelSystem::getVoxelsBytesReadPerSecondAverage() {
     return _tree->voxelsBytesReadStats.getAverageSampleValuePerSecond();
 }
 
-int VoxelSystem::parseData(unsigned char* sourceBuffer, int numBytes) {
+ReceiveTracker* VoxelSystem::receiveTrackerFor(sockaddr* senderAddress) {
+    for (int i = 0; i < _voxelServerCount; i++) {
+        if (socketMatch(&_voxelServerAddresses[i], senderAddress)) {
+            return &_receiveTrackers[i];
+        }
+    }
+    if (_voxelServerCount == MAX_VOXEL_SERVERS) {
+        return NULL;
+    }
+    memcpy(&_voxelServerAddresses[_voxelServerCount], senderAddress, sizeof(sockaddr));
+    return &_receiveTrackers[_voxelServerCount++];
+}
+
+void VoxelSystem::sendReceiveReports(UDPSocket* socket) {
+    unsigned char reportPacket[ReceiveReport::PACKED_BYTES];
+    long long now = usecTimestampNow();
+    pthread_mutex_lock(&_treeLock);
+    for (int i = 0; i < _voxelServerCount; i++) {
+        ReceiveReport report;
+        if (_receiveTrackers[i].makeReport(report, now)) {
+            int reportBytes = report.pack(reportPacket);
+            socket->send(&_voxelServerAddresses[i], reportPacket, reportBytes);
+        }
+    }
+    pthread_mutex_unlock(&_treeLock);
+}
+
+int VoxelSystem::parseData(sockaddr* senderAddress, unsigned char* sourceBuffer, int numBytes) {
 
     unsigned char command = *sourceBuffer;
-    unsigned char *voxelData = sourceBuffer + 1;
+    unsigned char *voxelData = sourceBuffer + VOXEL_PACKET_HEADER_BYTES;
 
     pthread_mutex_lock(&_treeLock);
 
+    // voxel data is paced by the voxel server that sent it, so it's tracked by sender
+    if (command == PACKET_HEADER_VOXEL_DATA || command == PACKET_HEADER_VOXEL_DATA_MONOCHROME ||
+        command == PACKET_HEADER_VOXEL_DATA_COMPRESSED || command == PACKET_HEADER_VOXEL_DATA_MONOCHROME_COMPRESSED) {
+        ReceiveTracker* receiveTracker = receiveTrackerFor(senderAddress);
+        if (receiveTracker) {
+            receiveTracker->packetReceived(sourceBuffer + 1, numBytes, usecTimestampNow());
+        }
+    }
+
     switch(command) {
         case PACKET_HEADER_VOXEL_DATA:
         {
             PerformanceWarning warn(_renderWarningsOn, "readBitstreamToTree()");
             // ask the VoxelTree to read the bitstream into the tree
-            _tree->readBitstreamToTree(voxelData, numBytes - 1, WANT_COLOR, WANT_EXISTS_BITS);
+            _tree->readBitstreamToTree(voxelData, numBytes - VOXEL_PACKET_HEADER_BYTES, WANT_COLOR, WANT_EXISTS_BITS);
         }
         break;
         case PACKET_HEADER_VOXEL_DATA_MONOCHROME:
         {
             PerformanceWarning warn(_renderWarningsOn, "readBitstreamToTree()");
             // ask the VoxelTree to read the MONOCHROME bitstream into the tree
-            _tree->readBitstreamToTree(voxelData, numBytes - 1, NO_COLOR, WANT_EXISTS_BITS);
+            _tree->readBitstreamToTree(voxelData, numBytes - VOXEL_PACKET_HEADER_BYTES, NO_COLOR, WANT_EXISTS_BITS);
+        }
+        break;
+        case PACKET_HEADER_VOXEL_DATA_COMPRESSED:
+        case PACKET_HEADER_VOXEL_DATA_MONOCHROME_COMPRESSED:
+        {
+            PerformanceWarning warn(_renderWarningsOn, "readBitstreamToTree()");
+            bool includeColor = (command == PACKET_HEADER_VOXEL_DATA_COMPRESSED);
+            int bitstreamBytes = _packetDecoder.decode(voxelData, numBytes - VOXEL_PACKET_HEADER_BYTES, includeColor,
+                                                       WANT_EXISTS_BITS, _decompressedPacket,
+                                                       sizeof(_decompressedPacket));
+            if (bitstreamBytes > 0) {
+                _tree->readBitstreamToTree(_decompressedPacket, bitstreamBytes, includeColor, WANT_EXISTS_BITS);
+            } else if (bitstreamBytes < 0) {
+                printLog("WARNING! got a compressed voxel packet that doesn't decode\n");
+            }
         }
         break;
         case PACKET_HEADER_Z_COMMAND:
@@ -146,6 +203,7 @@ int VoxelSystem::parseData(unsigned char* sourceBuffer, int numBytes) {
             while (totalLength <= numBytes) {
                 if (0==strcmp(command,(char*)"erase all")) {
                     printLog("got Z message == erase all\n");
+                    _removedVoxels.deleteAll(); // erasing the tree also releases the storage of removed voxels
                     _tree->eraseAllVoxels();
                     _voxelsInReadArrays = _voxelsInWriteArrays = 0; // better way to do this??
                 }
@@ -692,6 +750,7 @@ void VoxelSystem::removeScaleAndReleaseProgram(bool texture) {
 int VoxelSystem::_nodeCount = 0;
 
 void VoxelSystem::killLocalVoxels() {
+    _removedVoxels.deleteAll(); // erasing the tree also releases the storage of removed voxels
     _tree->eraseAllVoxels();
     _voxelsInWriteArrays = _voxelsInReadArrays = 0; // better way to do this??
     //setupNewVoxelsForDrawing();
@@ -709,9 +768,11 @@ bool VoxelSystem::randomColorOperation(VoxelNode* node, void* extraData) {
 
 void VoxelSystem::randomizeVoxelColors() {
     _nodeCount = 0;
+    pthread_mutex_lock(&_treeLock);
     _tree->recurseTreeWithOperation(randomColorOperation);
     printLog("setting randomized true color for %d nodes\n", _nodeCount);
     setupNewVoxelsForDrawing();
+    pthread_mutex_unlock(&_treeLock);
 }
 
 bool VoxelSystem::falseColorizeRandomOperation(VoxelNode* node, void* extraData) {
@@ -723,9 +784,11 @@ bool VoxelSystem::falseColorizeRandomOperation(VoxelNode* node, void* extraData)
 
 void VoxelSystem::falseColorizeRandom() {
     _nodeCount = 0;
+    pthread_mutex_lock(&_treeLock);
     _tree->recurseTreeWithOperation(falseColorizeRandomOperation);
     printLog("setting randomized false color for %d nodes\n", _nodeCount);
     setupNewVoxelsForDrawing();
+    pthread_mutex_unlock(&_treeLock);
 }
 
 bool VoxelSystem::trueColorizeOperation(VoxelNode* node, void* extraData) {
@@ -737,9 +800,11 @@ bool VoxelSystem::trueColorizeOperation(VoxelNode* node, void* extraData) {
 void VoxelSystem::trueColorize() {
     PerformanceWarning warn(true, "trueColorize()",true);
     _nodeCount = 0;
+    pthread_mutex_lock(&_treeLock);
     _tree->recurseTreeWithOperation(trueColorizeOperation);
     printLog("setting true color for %d nodes\n", _nodeCount);
     setupNewVoxelsForDrawing();
+    pthread_mutex_unlock(&_treeLock);
 }
 
 // Will false colorize voxels that are not in view
@@ -757,9 +822,11 @@ bool VoxelSystem::falseColorizeInViewOperation(VoxelNode* node, void* extraData)
 
 void VoxelSystem::falseColorizeInView(ViewFrustum* viewFrustum) {
     _nodeCount = 0;
+    pthread_mutex_lock(&_treeLock);
     _tree->recurseTreeWithOperation(falseColorizeInViewOperation,(void*)viewFrustum);
     printLog("setting in view false color for %d nodes\n", _nodeCount);
     setupNewVoxelsForDrawing();
+    pthread_mutex_unlock(&_treeLock);
 }
 
 // Will false colorize voxels based on distance from view
@@ -807,12 +874,14 @@ void VoxelSystem::falseColorizeDistanceFromView(ViewFrustum* viewFrustum) {
     _nodeCount = 0;
     _maxDistance = 0.0;
     _minDistance = FLT_MAX;
+    pthread_mutex_lock(&_treeLock);
     _tree->recurseTreeWithOperation(getDistanceFromViewRangeOperation,(void*)viewFrustum);
     printLog("determining distance range for %d nodes\n", _nodeCount);
     _nodeCount = 0;
     _tree->recurseTreeWithOperation(falseColorizeDistanceFromViewOperation,(void*)viewFrustum);
     printLog("setting in distance false color for %d nodes\n", _nodeCount);
     setupNewVoxelsForDrawing();
+    pthread_mutex_unlock(&_treeLock);
 }
 
 // combines the removeOutOfView args into a single class
@@ -965,6 +1034,17 @@ bool VoxelSystem::findCapsulePenetration(const glm::vec3& start, const glm::vec3
     return result;
 }
 
+bool VoxelSystem::findCapsulePenetration(const glm::vec3& start, const glm::vec3& end, float radius, const void* owner,
+                                         glm::vec3& penetration) {
+    VoxelCollisionQuery query = { start, end, radius, owner };
+    pthread_mutex_lock(&_treeLock);
+    _collider->findContacts(&query, 1, _contacts);
+    VoxelCollider::combinePenetrations(_contacts, 1, &penetration);
+    bool result = !_contacts.empty();
+    pthread_mutex_unlock(&_treeLock);
+    return result;
+}
+
 class falseColorizeRandomEveryOtherArgs {
 public:
     falseColorizeRandomEveryOtherArgs() : totalNodes(0), colorableNodes(0), coloredNodes(0), colorThis(true) {};
@@ -990,10 +1070,12 @@ bool VoxelSystem::falseColorizeRandomEveryOtherOperation(VoxelNode* node, void*
 
 void VoxelSystem::falseColorizeRandomEveryOther() {
     falseColorizeRandomEveryOtherArgs args;
+    pthread_mutex_lock(&_treeLock);
     _tree->recurseTreeWithOperation(falseColorizeRandomEveryOtherOperation,&args);
     printLog("randomized false color for every other node: total %ld, colorable %ld, colored %ld\n", 
         args.totalNodes, args.colorableNodes, args.coloredNodes);
     setupNewVoxelsForDrawing();
+    pthread_mutex_unlock(&_treeLock);
 }
 
 class collectStatsForTreesAndVBOsArgs {
@@ -1139,14 +1221,18 @@ void VoxelSystem::createVoxel(float x, float y, float z, float s,
 };
 
 void VoxelSystem::createLine(glm::vec3 point1, glm::vec3 point2, float unitSize, rgbColor color, bool destructive) { 
+    pthread_mutex_lock(&_treeLock);
     _tree->createLine(point1, point2, unitSize, color, destructive); 
     setupNewVoxelsForDrawing(); 
+    pthread_mutex_unlock(&_treeLock);
 };
 
 void VoxelSystem::createSphere(float r,float xc, float yc, float zc, float s, bool solid, 
                                creationMode mode, bool destructive, bool debug) { 
+    pthread_mutex_lock(&_treeLock);
     _tree->createSphere(r, xc, yc, zc, s, solid, mode, destructive, debug); 
     setupNewVoxelsForDrawing(); 
+    pthread_mutex_unlock(&_treeLock);
 };
 
 void VoxelSystem::copySubTreeIntoNewTree(VoxelNode* startNode, VoxelTree* destinationTree, bool rebaseToRoot) {
@@ -1281,6 +1367,7 @@ void VoxelSystem::falseColorizeOccluded() {
     
     glm::vec3 position = args.viewFrustum->getPosition() * (1.0f/TREE_SCALE);
 
+    pthread_mutex_lock(&_treeLock);
     _tree->recurseTreeWithOperationDistanceSorted(falseColorizeOccludedOperation, position, (void*)&args);
 
     printLog("falseColorizeOccluded()\n    total=%ld\n    colored=%ld\n    occluded=%ld\n    notOccluded=%ld\n    outOfView=%ld\n    subtreeVoxelsSkipped=%ld\n    stagedForDeletion=%ld\n    nonLeaves=%ld\n    nonLeavesOutOfView=%ld\n    nonLeavesOccluded=%ld\n", 
@@ -1291,5 +1378,6 @@ void VoxelSystem::falseColorizeOccluded() {
 
 
     setupNewVoxelsForDrawing();
+    pthread_mutex_unlock(&_treeLock);
 }
 
@@ -15,7 +15,10 @@
 #include <UDPSocket.h>
 #include <AgentData.h>
 #include <VoxelTree.h>
+#include <VoxelCollider.h>
 #include <ViewFrustum.h>
+#include <BandwidthPacer.h>
+#include <VoxelPacketCoder.h>
 #include "Camera.h"
 #include "Util.h"
 #include "world.h"
@@ -29,7 +32,10 @@ public:
     VoxelSystem(float treeScale = TREE_SCALE, int maxVoxels = MAX_VOXELS_PER_SYSTEM);
     ~VoxelSystem();
 
-    int parseData(unsigned char* sourceBuffer, int numBytes);
+    int parseData(sockaddr* senderAddress, unsigned char* sourceBuffer, int numBytes);
+
+    // tells each voxel server that has sent us packets how they're getting through, for it to pace them by
+    void sendReceiveReports(UDPSocket* socket);
     
     virtual void init();
     void simulate(float deltaTime) { };
@@ -71,6 +77,10 @@ public:
     
     bool findSpherePenetration(const glm::vec3& center, float radius, glm::vec3& penetration);
     bool findCapsulePenetration(const glm::vec3& start, const glm::vec3& end, float radius, glm::vec3& penetration);
+
+    // the same, but an owner that queries every frame, like an avatar, gets to reuse what its last query found
+    bool findCapsulePenetration(const glm::vec3& start, const glm::vec3& end, float radius, const void* owner,
+                                glm::vec3& penetration);
     
     void collectStatsForTreesAndVBOs();
 
@@ -89,9 +99,12 @@ protected:
     float _treeScale; 
     int _maxVoxels;      
     VoxelTree* _tree;
+    VoxelCollider* _collider;
+    std::vector<VoxelContact> _contacts;
     
     glm::vec3 computeVoxelVertex(const glm::vec3& startVertex, float voxelScale, int index) const;
     
+    // call with _treeLock held, it frees and allocates nodes and their client data in the pool parseData() uses
     void setupNewVoxelsForDrawing();
     
     virtual void updateNodeInArrays(glBufferIndex nodeIndex, const glm::vec3& startVertex,
@@ -161,6 +174,14 @@ private:
     GLuint _vboIndicesID;
     pthread_mutex_t _bufferWriteLock;
     pthread_mutex_t _treeLock;
+    // a tracker for each voxel server we hear from, there can be several when the tree is split between them
+    static const int MAX_VOXEL_SERVERS = 16;
+    sockaddr _voxelServerAddresses[MAX_VOXEL_SERVERS];
+    ReceiveTracker _receiveTrackers[MAX_VOXEL_SERVERS];
+    int _voxelServerCount;
+    ReceiveTracker* receiveTrackerFor(sockaddr* senderAddress);
+    VoxelPacketDecoder _packetDecoder;
+    unsigned char _decompressedPacket[MAX_DECOMPRESSED_VOXEL_PACKET_BYTES];
 
     ViewFrustum _lastKnowViewFrustum;
     ViewFrustum _lastStableViewFrustum;
@@ -36,6 +36,7 @@ AvatarData::AvatarData(Agent* owningAgent) :
     _wantColor(true),
     _wantDelta(false),
     _wantOcclusionCulling(false),
+    _wantCompression(false),
     _headData(NULL)
 {
     
@@ -117,6 +118,11 @@ int AvatarData::getBroadcastData(unsigned char* destinationBuffer) {
     // hand state
     setSemiNibbleAt(bitItems,HAND_STATE_START_BIT,_handState);
     *destinationBuffer++ = bitItems;
+
+    // the first byte of bit items is full, so more voxel sending features go in a second one
+    unsigned char moreBitItems = 0;
+    if (_wantCompression) { setAtBit(moreBitItems, WANT_COMPRESSION_AT_BIT); }
+    *destinationBuffer++ = moreBitItems;
     
     return destinationBuffer - bufferStart;
 }
@@ -205,6 +211,10 @@ int AvatarData::parseData(unsigned char* sourceBuffer, int numBytes) {
     // hand state, stored as a semi-nibble in the bitItems
     _handState = getSemiNibbleAt(bitItems,HAND_STATE_START_BIT);
 
+    // more voxel sending features...
+    unsigned char moreBitItems = (unsigned char)*sourceBuffer++;
+    _wantCompression = oneAtBit(moreBitItems, WANT_COMPRESSION_AT_BIT);
+
     return sourceBuffer - startPosition;
 }
 
@@ -25,6 +25,9 @@ const int KEY_STATE_START_BIT = 3;  // 4th and 5th bits
 const int HAND_STATE_START_BIT = 5; // 6th and 7th bits
 const int WANT_OCCLUSION_CULLING_BIT = 7; // 8th bit
 
+// the bits of the second bit items byte
+const int WANT_COMPRESSION_AT_BIT = 0;
+
 const float MAX_AUDIO_LOUDNESS = 1000.0; // close enough for mouth animation
 
 
@@ -91,10 +94,12 @@ public:
     bool getWantColor() const { return _wantColor; }
     bool getWantDelta() const { return _wantDelta; }
     bool getWantOcclusionCulling() const { return _wantOcclusionCulling; }
+    bool getWantCompression() const { return _wantCompression; }
     void setWantResIn(bool wantResIn) { _wantResIn = wantResIn; }
     void setWantColor(bool wantColor) { _wantColor = wantColor; }
     void setWantDelta(bool wantDelta) { _wantDelta = wantDelta; }
     void setWantOcclusionCulling(bool wantOcclusionCulling) { _wantOcclusionCulling = wantOcclusionCulling; }
+    void setWantCompression(bool wantCompression) { _wantCompression = wantCompression; }
     
     void setHeadData(HeadData* headData) { _headData = headData; }
     
@@ -129,6 +134,7 @@ protected:
     bool _wantColor;
     bool _wantDelta;
     bool _wantOcclusionCulling;
+    bool _wantCompression;
     
     HeadData* _headData;
 private:
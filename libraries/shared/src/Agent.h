@@ -20,6 +20,7 @@
 
 #include "SimpleMovingAverage.h"
 #include "AgentData.h"
+#include "VoxelRegion.h"
 
 class Agent {    
 public:
@@ -56,6 +57,10 @@ public:
     AgentData* getLinkedData() const { return _linkedData; }
     void setLinkedData(AgentData* linkedData) { _linkedData = linkedData; }
     
+    // for voxel servers, the part of the voxel tree they own
+    const VoxelRegion& getVoxelRegion() const { return _voxelRegion; }
+    void setVoxelRegion(const VoxelRegion& voxelRegion) { _voxelRegion = voxelRegion; }
+    
     bool isAlive() const { return _isAlive; };
     void setAlive(bool isAlive) { _isAlive = isAlive; };
     
@@ -78,6 +83,7 @@ private:
     sockaddr* _activeSocket;
     SimpleMovingAverage* _bytesReceivedMovingAverage;
     AgentData* _linkedData;
+    VoxelRegion _voxelRegion;
     bool _isAlive;
 };
 
@@ -10,6 +10,7 @@
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
+#include <algorithm>
 
 #include "AgentList.h"
 #include "AgentTypes.h"
@@ -23,10 +24,10 @@
 #include <arpa/inet.h>
 #endif
 
-const char SOLO_AGENT_TYPES[3] = {
+// there can be several voxel servers, each owning part of the voxel tree, see VoxelRegion
+const char SOLO_AGENT_TYPES[2] = {
     AGENT_TYPE_AVATAR_MIXER,
-    AGENT_TYPE_AUDIO_MIXER,
-    AGENT_TYPE_VOXEL_SERVER
+    AGENT_TYPE_AUDIO_MIXER
 };
 
 char DOMAIN_HOSTNAME[] = "highfidelity.below92.com";
@@ -210,9 +211,10 @@ void AgentList::sendDomainServerCheckIn() {
     if (!checkInPacket) {
         int numBytesAgentsOfInterest = _agentTypesOfInterest ? strlen((char*) _agentTypesOfInterest) : 0;
         
-        // check in packet has header, agent type, port, IP, agent types of interest, null termination
+        // check in packet has header, agent type, port, IP, agent types of interest, null termination, and for voxel
+        // servers the region they own
         int numPacketBytes = sizeof(PACKET_HEADER) + sizeof(AGENT_TYPE) + sizeof(uint16_t) + (sizeof(char) * 4) +
-            numBytesAgentsOfInterest + sizeof(unsigned char);
+            numBytesAgentsOfInterest + sizeof(unsigned char) + VoxelRegion::MAX_PACKED_BYTES;
         
         checkInPacket = new unsigned char[numPacketBytes];
         unsigned char* packetPosition = checkInPacket;
@@ -237,6 +239,10 @@ void AgentList::sendDomainServerCheckIn() {
             packetPosition += numBytesAgentsOfInterest;
         }
         
+        if (_ownerType == AGENT_TYPE_VOXEL_SERVER) {
+            packetPosition += _ownerVoxelRegion.pack(packetPosition);
+        }
+        
         checkInPacketSize = packetPosition - checkInPacket;
     }
     
@@ -264,7 +270,15 @@ int AgentList::processDomainServerList(unsigned char *packetData, size_t dataByt
         readPtr += unpackSocket(readPtr, (sockaddr *)&agentPublicSocket);
         readPtr += unpackSocket(readPtr, (sockaddr *)&agentLocalSocket);
         
-        addOrUpdateAgent((sockaddr *)&agentPublicSocket, (sockaddr *)&agentLocalSocket, agentType, agentId);
+        // voxel servers come with the part of the voxel tree they own
+        VoxelRegion voxelRegion;
+        if (agentType == AGENT_TYPE_VOXEL_SERVER) {
+            readPtr += voxelRegion.unpack(readPtr, dataBytes - (readPtr - startPtr));
+        }
+        
+        Agent* agent = addOrUpdateAgent((sockaddr *)&agentPublicSocket, (sockaddr *)&agentLocalSocket, agentType,
+                                        agentId);
+        agent->setVoxelRegion(voxelRegion);
     }
     
     // read out our ID from the packet
@@ -346,6 +360,23 @@ void AgentList::broadcastToAgents(unsigned char *broadcastData, size_t dataBytes
     }
 }
 
+void AgentList::sendVoxelEditToOwners(unsigned char* editData, size_t dataBytes) {
+    unsigned char ownedEditData[MAX_PACKET_SIZE];
+    for(AgentList::iterator agent = begin(); agent != end(); agent++) {
+        if (agent->getActiveSocket() != NULL && agent->getType() == AGENT_TYPE_VOXEL_SERVER) {
+            if (agent->getVoxelRegion().isWholeTree()) {
+                _agentSocket.send(agent->getActiveSocket(), editData, dataBytes);
+            } else {
+                int ownedBytes = agent->getVoxelRegion().copyOverlappingEdits(editData, std::min(dataBytes,
+                    (size_t)MAX_PACKET_SIZE), ownedEditData);
+                if (ownedBytes > VoxelRegion::EDIT_PACKET_HEADER_BYTES) {
+                    _agentSocket.send(agent->getActiveSocket(), ownedEditData, ownedBytes);
+                }
+            }
+        }
+    }
+}
+
 void AgentList::handlePingReply(sockaddr *agentAddress) {
     for(AgentList::iterator agent = begin(); agent != end(); agent++) {
         // check both the public and local addresses for each agent to see if we find a match
@@ -28,7 +28,7 @@ const unsigned int AGENT_SOCKET_LISTEN_PORT = 40103;
 const int AGENT_SILENCE_THRESHOLD_USECS = 2 * 1000000;
 const int DOMAIN_SERVER_CHECK_IN_USECS = 1 * 1000000;
 
-extern const char SOLO_AGENT_TYPES[3];
+extern const char SOLO_AGENT_TYPES[2];
 
 extern char DOMAIN_HOSTNAME[];
 extern char DOMAIN_IP[100];    //  IP Address will be re-set by lookup on startup
@@ -68,6 +68,11 @@ public:
     void unlock() { pthread_mutex_unlock(&mutex); }
     
     void setAgentTypesOfInterest(const char* agentTypesOfInterest, int numAgentTypesOfInterest);
+    
+    // for voxel servers, the part of the voxel tree we own, which we tell the domain server when we check in
+    const VoxelRegion& getOwnerVoxelRegion() const { return _ownerVoxelRegion; }
+    void setOwnerVoxelRegion(const VoxelRegion& voxelRegion) { _ownerVoxelRegion = voxelRegion; }
+    
     void sendDomainServerCheckIn();
     int processDomainServerList(unsigned char *packetData, size_t dataBytes);
     
@@ -84,6 +89,10 @@ public:
     
     void broadcastToAgents(unsigned char *broadcastData, size_t dataBytes, const char* agentTypes, int numAgentTypes);
     
+    // sends a PACKET_HEADER_SET_VOXEL, PACKET_HEADER_SET_VOXEL_DESTRUCTIVE or PACKET_HEADER_ERASE_VOXEL packet to the
+    // voxel servers, each gets just the voxels in its part of the tree, and none that own none of them get anything
+    void sendVoxelEditToOwners(unsigned char* editData, size_t dataBytes);
+    
     Agent* soloAgentOfType(char agentType);
     
     void startSilentAgentRemovalThread();
@@ -107,6 +116,7 @@ private:
     UDPSocket _agentSocket;
     char _ownerType;
     char* _agentTypesOfInterest;
+    VoxelRegion _ownerVoxelRegion;
     unsigned int _socketListenPort;
     uint16_t _ownerID;
     uint16_t _lastAgentID;
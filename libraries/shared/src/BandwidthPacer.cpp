@@ -0,0 +1,286 @@
+//
+//  BandwidthPacer.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include "PacketHeaders.h"
+#include "BandwidthPacer.h"
+
+// round trips this much longer than the shortest one mean packets are waiting in a queue somewhere
+const float QUEUEING_TOLERANCE = 0.5f;
+const float MIN_QUEUEING_USECS = 20000.0f;
+// the shortest round trip is forgotten after this long, in case the route changed
+const long long MIN_ROUND_TRIP_WINDOW_USECS = 10 * 1000 * 1000;
+// round trip samples longer than this are garbage
+const long long MAX_ROUND_TRIP_USECS = 10 * 1000 * 1000;
+// losing more than this much in a report is more than a noisy link, so we don't probe for more on top of it
+const float HEAVY_LOSS = 0.2f;
+
+// until what gets through stops growing, send at twice that. After that, send at what gets through, except for one
+// report in every cycle where we send a little faster in case more would get through, followed by one a little
+// slower to drain whatever that queued up
+const float STARTUP_GAIN = 2.0f;
+const float STARTUP_GROWTH = 1.25f;
+const int STARTUP_REPORTS_WITHOUT_GROWTH = 3;
+const float PROBE_CYCLE_GAINS[] = { 1.25f, 0.75f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f };
+const int PROBE_CYCLE_LENGTH = sizeof(PROBE_CYCLE_GAINS) / sizeof(PROBE_CYCLE_GAINS[0]);
+const float STALLED_DECREASE = 0.5f;
+
+// the bucket holds up to this long of sending at the current rate
+const float MAX_BURST_SECONDS = 0.2f;
+// reports can come in before the packets sent just before them arrive, so only give up on them after this long
+const long long MIN_STALL_USECS = 100 * 1000;
+const float SMOOTHING = 0.25f;
+
+int ReceiveReport::pack(unsigned char* destination) const {
+    unsigned char* at = destination;
+    *at++ = PACKET_HEADER_RECEIVE_REPORT;
+    memcpy(at, &highestSequence, sizeof(highestSequence));
+    at += sizeof(highestSequence);
+    memcpy(at, &packetsReceived, sizeof(packetsReceived));
+    at += sizeof(packetsReceived);
+    memcpy(at, &bytesReceived, sizeof(bytesReceived));
+    at += sizeof(bytesReceived);
+    memcpy(at, &echoedSentAt, sizeof(echoedSentAt));
+    at += sizeof(echoedSentAt);
+    memcpy(at, &holdUsecs, sizeof(holdUsecs));
+    at += sizeof(holdUsecs);
+    return at - destination;
+}
+
+bool ReceiveReport::unpack(const unsigned char* source, int bytes) {
+    if (bytes < PACKED_BYTES || source[0] != PACKET_HEADER_RECEIVE_REPORT) {
+        return false;
+    }
+    const unsigned char* at = source + 1;
+    memcpy(&highestSequence, at, sizeof(highestSequence));
+    at += sizeof(highestSequence);
+    memcpy(&packetsReceived, at, sizeof(packetsReceived));
+    at += sizeof(packetsReceived);
+    memcpy(&bytesReceived, at, sizeof(bytesReceived));
+    at += sizeof(bytesReceived);
+    memcpy(&echoedSentAt, at, sizeof(echoedSentAt));
+    at += sizeof(echoedSentAt);
+    memcpy(&holdUsecs, at, sizeof(holdUsecs));
+    return true;
+}
+
+// true if sequence number a comes after b, allowing for them wrapping around
+static bool isNewer(uint16_t a, uint16_t b) {
+    return (int16_t)(a - b) > 0;
+}
+
+ReceiveTracker::ReceiveTracker() :
+    _anyReceived(false),
+    _highestSequence(0),
+    _highestSentAt(0),
+    _highestReceivedAt(0),
+    _packetsReceived(0),
+    _bytesReceived(0)
+{
+}
+
+void ReceiveTracker::packetReceived(const unsigned char* stamp, int bytes, long long now) {
+    uint16_t sequence;
+    uint32_t sentAt;
+    memcpy(&sequence, stamp, sizeof(sequence));
+    memcpy(&sentAt, stamp + sizeof(sequence), sizeof(sentAt));
+
+    if (!_anyReceived || isNewer(sequence, _highestSequence)) {
+        _highestSequence = sequence;
+        _highestSentAt = sentAt;
+        _highestReceivedAt = now;
+        _anyReceived = true;
+    }
+    _packetsReceived++;
+    _bytesReceived += bytes;
+}
+
+bool ReceiveTracker::makeReport(ReceiveReport& report, long long now) const {
+    if (!_anyReceived) {
+        return false;
+    }
+    report.highestSequence = _highestSequence;
+    report.packetsReceived = _packetsReceived;
+    report.bytesReceived = _bytesReceived;
+    report.echoedSentAt = _highestSentAt;
+    report.holdUsecs = (uint32_t)(now - _highestReceivedAt);
+    return true;
+}
+
+BandwidthPacer::BandwidthPacer(float bytesPerSecond, float minBytesPerSecond, float maxBytesPerSecond) :
+    _bytesPerSecond(bytesPerSecond),
+    _minBytesPerSecond(minBytesPerSecond),
+    _maxBytesPerSecond(maxBytesPerSecond),
+    _tokens(0.0f),
+    _lastRefill(0),
+    _nextSequence(0),
+    _bytesSentSinceRefill(0),
+    _bytesSentSinceReport(0),
+    _appLimited(false),
+    _idle(false),
+    _hasFeedback(false),
+    _lastReportAt(0),
+    _lastHighestSequence(0),
+    _lastPacketsReceived(0),
+    _lastBytesReceived(0),
+    _loss(0.0f),
+    _roundTripUsecs(0.0f),
+    _minRoundTripUsecs(0.0f),
+    _minRoundTripAt(0),
+    _lastStallAt(0),
+    _deliveredSampleIndex(0),
+    _startingUp(true),
+    _fullBandwidth(0.0f),
+    _reportsWithoutGrowth(0),
+    _probeCycleIndex(0)
+{
+    memset(_deliveredSamples, 0, sizeof(_deliveredSamples));
+    pthread_mutex_init(&_mutex, NULL);
+}
+
+BandwidthPacer::~BandwidthPacer() {
+    pthread_mutex_destroy(&_mutex);
+}
+
+int BandwidthPacer::stampPacket(unsigned char* destination, long long now) {
+    uint16_t sequence = _nextSequence++;
+    uint32_t sentAt = (uint32_t)now;
+    memcpy(destination, &sequence, sizeof(sequence));
+    memcpy(destination + sizeof(sequence), &sentAt, sizeof(sentAt));
+    return PACED_PACKET_STAMP_BYTES;
+}
+
+void BandwidthPacer::refill(long long now, float shareBytesPerSecond) {
+    pthread_mutex_lock(&_mutex);
+    float bytesPerSecond = std::min(_bytesPerSecond, shareBytesPerSecond);
+    if (_lastRefill) {
+        // tokens left over mean the sender ran out of things to send, its bag emptied, before it ran out of tokens,
+        // so until the next report what gets through is what it had to send, not what the link can take
+        _appLimited = _appLimited || _tokens > 0.0f;
+        _idle = _bytesSentSinceRefill == 0;
+    }
+    pthread_mutex_unlock(&_mutex);
+    _bytesSentSinceRefill = 0;
+
+    float seconds = _lastRefill ? (now - _lastRefill) / 1000000.0f : MAX_BURST_SECONDS;
+    _tokens = std::min(_tokens + bytesPerSecond * seconds, bytesPerSecond * MAX_BURST_SECONDS);
+    _lastRefill = now;
+}
+
+void BandwidthPacer::sent(int bytes) {
+    _tokens -= bytes;
+    _bytesSentSinceRefill += bytes;
+    pthread_mutex_lock(&_mutex);
+    if (_idle) {
+        // sending again after a while with nothing to send, which no report can have said anything about, so what gets
+        // through, and whether it stalls, is counted from now
+        _lastReportAt = _lastRefill;
+        _idle = false;
+    }
+    _bytesSentSinceReport += bytes;
+    pthread_mutex_unlock(&_mutex);
+}
+
+void BandwidthPacer::processReport(const ReceiveReport& report, long long now) {
+    pthread_mutex_lock(&_mutex);
+
+    // the round trip is how long ago we sent the newest packet, less the time it sat with the receiver
+    long long roundTripUsecs = (int32_t)((uint32_t)now - report.echoedSentAt - report.holdUsecs);
+    if (roundTripUsecs >= 0 && roundTripUsecs < MAX_ROUND_TRIP_USECS) {
+        _roundTripUsecs = _roundTripUsecs ? _roundTripUsecs + SMOOTHING * (roundTripUsecs - _roundTripUsecs)
+                                          : roundTripUsecs;
+        if (!_minRoundTripAt || roundTripUsecs < _minRoundTripUsecs ||
+            now - _minRoundTripAt > MIN_ROUND_TRIP_WINDOW_USECS) {
+            _minRoundTripUsecs = roundTripUsecs;
+            _minRoundTripAt = now;
+        }
+    }
+
+    if (!_hasFeedback) {
+        // the first report is only where we start counting from
+        _hasFeedback = true;
+    } else if (isNewer(report.highestSequence, _lastHighestSequence) && now > _lastReportAt) {
+        int expected = (uint16_t)(report.highestSequence - _lastHighestSequence);
+        int received = report.packetsReceived - _lastPacketsReceived;
+        float loss = std::max(0.0f, std::min(1.0f, 1.0f - (float)received / expected));
+        _loss += SMOOTHING * (loss - _loss);
+
+        // the link carries at least the most that got through recently. Random loss doesn't slow us down, it just
+        // comes off what gets through, and when we send too fast the extra waits in a queue or gets dropped there,
+        // so what gets through is the most the link can take either way. Unless we didn't have enough to send to fill
+        // it, then what got through only says the link takes at least that much, so it's only kept if it's more than
+        // the samples we have
+        float seconds = (now - _lastReportAt) / 1000000.0f;
+        float sample = (report.bytesReceived - _lastBytesReceived) / seconds;
+        float deliveredBytesPerSecond = 0.0f;
+        for (int i = 0; i < DELIVERY_WINDOW; i++) {
+            deliveredBytesPerSecond = std::max(deliveredBytesPerSecond, _deliveredSamples[i]);
+        }
+        if (!_appLimited || sample > deliveredBytesPerSecond) {
+            _deliveredSamples[_deliveredSampleIndex++ % DELIVERY_WINDOW] = sample;
+            deliveredBytesPerSecond = std::max(deliveredBytesPerSecond, sample);
+        }
+
+        float gain;
+        if (_startingUp) {
+            if (deliveredBytesPerSecond >= _fullBandwidth * STARTUP_GROWTH) {
+                _fullBandwidth = deliveredBytesPerSecond;
+                _reportsWithoutGrowth = 0;
+            } else if (!_appLimited && ++_reportsWithoutGrowth >= STARTUP_REPORTS_WITHOUT_GROWTH) {
+                _startingUp = false;
+            }
+            gain = STARTUP_GAIN;
+        } else {
+            gain = PROBE_CYCLE_GAINS[_probeCycleIndex++ % PROBE_CYCLE_LENGTH];
+        }
+        bool queueing = roundTripUsecs > _minRoundTripUsecs +
+                                         std::max(_minRoundTripUsecs * QUEUEING_TOLERANCE, MIN_QUEUEING_USECS);
+        if (queueing || loss > HEAVY_LOSS) {
+            _startingUp = false;
+            gain = std::min(gain, 1.0f);
+        }
+        float bytesPerSecond = std::max(_minBytesPerSecond,
+                                        std::min(_maxBytesPerSecond, deliveredBytesPerSecond * gain));
+        _bytesPerSecond = _appLimited ? std::max(_bytesPerSecond, bytesPerSecond) : bytesPerSecond;
+    } else {
+        // nothing new got through since the last report. If we've been sending for a while, that's as congested as
+        // it gets, so back off once for every stretch of that
+        long long stalledUsecs = 2 * std::max((long long)_roundTripUsecs, MIN_STALL_USECS);
+        if (_bytesSentSinceReport > 0 && now - std::max(_lastReportAt, _lastStallAt) > stalledUsecs) {
+            _bytesPerSecond = std::max(_minBytesPerSecond, _bytesPerSecond * STALLED_DECREASE);
+            _lastStallAt = now;
+        }
+        pthread_mutex_unlock(&_mutex);
+        return;
+    }
+    _lastReportAt = now;
+    _lastHighestSequence = report.highestSequence;
+    _lastPacketsReceived = report.packetsReceived;
+    _lastBytesReceived = report.bytesReceived;
+    _bytesSentSinceReport = 0;
+    _appLimited = false;
+
+    pthread_mutex_unlock(&_mutex);
+}
+
+void BandwidthPacer::shareBudget(float budget, const float* demands, float* shares, int count) {
+    // hand out the budget starting with whoever wants least, each getting what they want or an equal share of what's
+    // left, whichever is less
+    std::vector<std::pair<float, int> > byDemand(count);
+    for (int i = 0; i < count; i++) {
+        byDemand[i] = std::make_pair(demands[i], i);
+    }
+    std::sort(byDemand.begin(), byDemand.end());
+    float remaining = budget;
+    for (int i = 0; i < count; i++) {
+        float share = std::min(byDemand[i].first, remaining / (count - i));
+        shares[byDemand[i].second] = share;
+        remaining -= share;
+    }
+}
@@ -0,0 +1,123 @@
+//
+//  BandwidthPacer.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Paces a stream of packets to one receiver. The sender stamps each packet with a sequence number and the time it was
+//  sent, the receiver keeps a ReceiveTracker that notes them as they arrive, and every so often sends back a
+//  ReceiveReport. From the reports the sender's BandwidthPacer works out how fast packets are getting through, the
+//  loss and the round trip time, and sets the rate of a token bucket to about what gets through: a little faster now
+//  and then to find out if more would, but never while the round trip says packets are queueing up somewhere. While the
+//  sender doesn't have enough to send to use up its tokens, what gets through says nothing about the link, so it can
+//  only raise the rate.
+//
+
+#ifndef __hifi__BandwidthPacer__
+#define __hifi__BandwidthPacer__
+
+#include <pthread.h>
+#include <stdint.h>
+
+// the sequence number and send time right after the packet header of a paced packet
+const int PACED_PACKET_STAMP_BYTES = sizeof(uint16_t) + sizeof(uint32_t);
+
+// what the receiver of a paced stream tells the sender, see PACKET_HEADER_RECEIVE_REPORT
+class ReceiveReport {
+public:
+    static const int PACKED_BYTES = 1 + sizeof(uint16_t) + 4 * sizeof(uint32_t); // including the packet header
+
+    uint16_t highestSequence;   // the newest packet received
+    uint32_t packetsReceived;   // since the stream started
+    uint32_t bytesReceived;     // since the stream started
+    uint32_t echoedSentAt;      // the send time stamped on the newest packet
+    uint32_t holdUsecs;         // how long the receiver had the newest packet before sending this report
+
+    int pack(unsigned char* destination) const;
+    bool unpack(const unsigned char* source, int bytes);
+};
+
+// the receiving side of a paced stream
+class ReceiveTracker {
+public:
+    ReceiveTracker();
+
+    // stamp is the PACED_PACKET_STAMP_BYTES after the packet header, bytes the size of the whole packet
+    void packetReceived(const unsigned char* stamp, int bytes, long long now);
+
+    // false if nothing has been received yet
+    bool makeReport(ReceiveReport& report, long long now) const;
+
+private:
+    bool        _anyReceived;
+    uint16_t    _highestSequence;
+    uint32_t    _highestSentAt;
+    long long   _highestReceivedAt;
+    uint32_t    _packetsReceived;
+    uint32_t    _bytesReceived;
+};
+
+// the sending side of a paced stream
+class BandwidthPacer {
+public:
+    BandwidthPacer(float bytesPerSecond, float minBytesPerSecond, float maxBytesPerSecond);
+    ~BandwidthPacer();
+
+    // writes the PACED_PACKET_STAMP_BYTES for the next packet to destination
+    int stampPacket(unsigned char* destination, long long now);
+
+    // adds the tokens for the time since the last refill, at the pacer's rate or shareBytesPerSecond, whichever is lower
+    void refill(long long now, float shareBytesPerSecond);
+    bool hasTokens() const { return _tokens > 0.0f; };
+    void sent(int bytes);
+
+    // adjusts the rate, called when a report comes in from the receiver, possibly from another thread
+    void processReport(const ReceiveReport& report, long long now);
+
+    bool hasFeedback() const { return _hasFeedback; };
+    float getBytesPerSecond() const { return _bytesPerSecond; };
+    float getLoss() const { return _loss; };                    // smoothed over the recent reports
+    float getRoundTripUsecs() const { return _roundTripUsecs; };  // smoothed over the recent reports
+
+    // divides budget between senders that want demands, max-min fairly: nobody gets more than they want, and what they
+    // don't want is shared equally by the rest
+    static void shareBudget(float budget, const float* demands, float* shares, int count);
+
+private:
+    // disallow copying of BandwidthPacer objects
+    BandwidthPacer(const BandwidthPacer&);
+    BandwidthPacer& operator= (const BandwidthPacer&);
+
+    pthread_mutex_t _mutex;
+    float       _bytesPerSecond;
+    float       _minBytesPerSecond;
+    float       _maxBytesPerSecond;
+    float       _tokens;
+    long long   _lastRefill;
+    uint16_t    _nextSequence;
+    uint32_t    _bytesSentSinceRefill;
+    uint32_t    _bytesSentSinceReport;
+    bool        _appLimited;    // since the last report, the sender had tokens left over when it refilled
+    bool        _idle;          // the sender sent nothing between its last two refills
+
+    bool        _hasFeedback;
+    long long   _lastReportAt;
+    uint16_t    _lastHighestSequence;
+    uint32_t    _lastPacketsReceived;
+    uint32_t    _lastBytesReceived;
+    float       _loss;
+    float       _roundTripUsecs;
+    float       _minRoundTripUsecs;
+    long long   _minRoundTripAt;
+    long long   _lastStallAt;
+
+    static const int DELIVERY_WINDOW = 10; // reports
+    float       _deliveredSamples[DELIVERY_WINDOW];
+    int         _deliveredSampleIndex;
+    bool        _startingUp;
+    float       _fullBandwidth;
+    int         _reportsWithoutGrowth;
+    int         _probeCycleIndex;
+};
+
+#endif /* defined(__hifi__BandwidthPacer__) */
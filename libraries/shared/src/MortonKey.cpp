@@ -0,0 +1,189 @@
+//
+//  MortonKey.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include "MortonKey.h"
+
+// std::min() and std::max() take references, so these need a home
+const int MortonKey::SECTIONS_PER_WORD;
+const int MortonKey::WORDS;
+const int MortonKey::MAX_LEVELS;
+const int MortonKey::MAX_OCTAL_CODE_BYTES;
+
+const int BITS_PER_WORD = MortonKey::SECTIONS_PER_WORD * 3;
+const uint64_t WORD_MASK = ((uint64_t)1 << BITS_PER_WORD) - 1;
+
+const unsigned char MortonKey::SECTION_WORD[MAX_LEVELS] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
+};
+
+const unsigned char MortonKey::SECTION_SHIFT[MAX_LEVELS] = {
+    60, 57, 54, 51, 48, 45, 42, 39, 36, 33, 30, 27, 24, 21, 18, 15, 12, 9, 6, 3, 0,
+    60, 57, 54, 51, 48, 45, 42, 39, 36, 33, 30, 27, 24, 21, 18, 15, 12, 9, 6, 3, 0
+};
+
+// the top bits of a word, where its first sections are
+static uint64_t highBits(int bits) {
+    return bits ? (WORD_MASK >> (BITS_PER_WORD - bits)) << (BITS_PER_WORD - bits) : 0;
+}
+
+MortonKey MortonKey::fromOctalCode(const unsigned char* octalCode) {
+    MortonKey key;
+    if (*octalCode > MAX_LEVELS) {
+        key._level = INVALID_LEVEL;
+        return key;
+    }
+    key._level = *octalCode;
+    const unsigned char* data = octalCode + 1;
+    uint32_t bits = 0;
+    int bitCount = 0;
+    for (int i = 0; i < key._level; i++) {
+        if (bitCount < 3) {
+            bits = (bits << 8) | *data++;
+            bitCount += 8;
+        }
+        bitCount -= 3;
+        key._words[SECTION_WORD[i]] |= (uint64_t)((bits >> bitCount) & 7) << SECTION_SHIFT[i];
+    }
+    return key;
+}
+
+MortonKey MortonKey::fromPoint(float x, float y, float z, float s) {
+    // the same tests pointToVoxel() makes, so we get the same voxel for points on the edges
+    float xTest, yTest, zTest, sTest;
+    xTest = yTest = zTest = sTest = 0.5f;
+    int levels = 1;
+    while (sTest > s && levels < MAX_LEVELS) {
+        sTest /= 2.0;
+        levels++;
+    }
+
+    MortonKey key;
+    key._level = levels;
+    sTest = 0.5f;
+    for (int i = 0; i < levels; i++) {
+        int section = 0;
+        if (x >= xTest) {
+            section |= 4;
+            xTest += sTest / 2.0;
+        } else {
+            xTest -= sTest / 2.0;
+        }
+        if (y >= yTest) {
+            section |= 2;
+            yTest += sTest / 2.0;
+        } else {
+            yTest -= sTest / 2.0;
+        }
+        if (z >= zTest) {
+            section |= 1;
+            zTest += sTest / 2.0;
+        } else {
+            zTest -= sTest / 2.0;
+        }
+        key._words[SECTION_WORD[i]] |= (uint64_t)section << SECTION_SHIFT[i];
+        sTest /= 2.0;
+    }
+    return key;
+}
+
+int MortonKey::toOctalCode(unsigned char* output) const {
+    output[0] = _level;
+    unsigned char* data = output + 1;
+    uint32_t bits = 0;
+    int bitCount = 0;
+    for (int i = 0; i < _level; i++) {
+        bits = (bits << 3) | getSection(i);
+        bitCount += 3;
+        if (bitCount >= 8) {
+            bitCount -= 8;
+            *data++ = bits >> bitCount;
+        }
+    }
+    if (bitCount > 0) {
+        *data++ = bits << (8 - bitCount);
+    }
+    return data - output;
+}
+
+MortonKey MortonKey::getChild(int childIndex) const {
+    MortonKey child = *this;
+    if (_level >= MAX_LEVELS) {
+        return child; // as deep as keys go
+    }
+    child._words[SECTION_WORD[_level]] |= (uint64_t)childIndex << SECTION_SHIFT[_level];
+    child._level++;
+    return child;
+}
+
+MortonKey MortonKey::getAncestor(int level) const {
+    MortonKey ancestor;
+    if (level > 0) {
+        ancestor._level = std::min(level, _level);
+        ancestor._words[0] = _words[0] & highBits(std::min(ancestor._level, SECTIONS_PER_WORD) * 3);
+        ancestor._words[1] = _words[1] & highBits(std::max(ancestor._level - SECTIONS_PER_WORD, 0) * 3);
+    }
+    return ancestor;
+}
+
+MortonKey MortonKey::chop(int levels) const {
+    if (levels >= _level) {
+        return MortonKey();
+    }
+    MortonKey chopped = *this;
+    chopped.shiftLeft(levels);
+    chopped._level -= levels;
+    return chopped;
+}
+
+MortonKey MortonKey::rebase(const MortonKey& newParent) const {
+    MortonKey rebased = *this;
+    rebased.shiftRight(newParent._level);
+    rebased._words[0] |= newParent._words[0];
+    rebased._words[1] |= newParent._words[1];
+    rebased._level = std::min(newParent._level + _level, MAX_LEVELS);
+    return rebased;
+}
+
+void MortonKey::getCorner(float* output) const {
+    output[0] = output[1] = output[2] = 0.0f;
+    float scale = 0.5f;
+    for (int i = 0; i < _level; i++) {
+        int section = getSection(i);
+        output[0] += scale * ((section >> 2) & 1);
+        output[1] += scale * ((section >> 1) & 1);
+        output[2] += scale * (section & 1);
+        scale *= 0.5f;
+    }
+}
+
+void MortonKey::shiftLeft(int sections) {
+    int bits = sections * 3;
+    if (bits >= BITS_PER_WORD * WORDS) {
+        _words[0] = _words[1] = 0;
+    } else if (bits >= BITS_PER_WORD) {
+        _words[0] = (_words[1] << (bits - BITS_PER_WORD)) & WORD_MASK;
+        _words[1] = 0;
+    } else if (bits > 0) {
+        _words[0] = ((_words[0] << bits) | (_words[1] >> (BITS_PER_WORD - bits))) & WORD_MASK;
+        _words[1] = (_words[1] << bits) & WORD_MASK;
+    }
+}
+
+void MortonKey::shiftRight(int sections) {
+    int bits = sections * 3;
+    if (bits >= BITS_PER_WORD * WORDS) {
+        _words[0] = _words[1] = 0;
+    } else if (bits >= BITS_PER_WORD) {
+        _words[1] = _words[0] >> (bits - BITS_PER_WORD);
+        _words[0] = 0;
+    } else if (bits > 0) {
+        _words[1] = (_words[1] >> bits) | ((_words[0] << (BITS_PER_WORD - bits)) & WORD_MASK);
+        _words[0] >>= bits;
+    }
+}
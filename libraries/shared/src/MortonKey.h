@@ -0,0 +1,91 @@
+//
+//  MortonKey.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A fixed width alternative to octal codes. A key holds the same path down the tree, the child index taken at each
+//  level, three bits per level, but in two 64 bit words at fixed places rather than a length byte followed by however
+//  many bytes the path needs. So the branch at any level is a shift and a mask, keys are compared a word at a time, and
+//  nothing about them is ever allocated. Octal codes are still what goes on the wire and into files, so there are
+//  conversions both ways.
+//
+
+#ifndef __hifi__MortonKey__
+#define __hifi__MortonKey__
+
+#include <stdint.h>
+
+class MortonKey {
+public:
+    static const int SECTIONS_PER_WORD = 21;                // the top bit of each word is left unused
+    static const int WORDS = 2;
+    static const int MAX_LEVELS = SECTIONS_PER_WORD * WORDS;
+    static const int MAX_OCTAL_CODE_BYTES = 1 + (MAX_LEVELS * 3 + 7) / 8; // for toOctalCode()
+
+    MortonKey() : _level(0) { _words[0] = _words[1] = 0; }; // the root
+
+    // an invalid key for codes deeper than MAX_LEVELS, which no tree goes down to, so callers can turn them away
+    static MortonKey fromOctalCode(const unsigned char* octalCode);
+
+    // the key for the voxel of size s whose lowest corner is at x, y, z, the same one pointToVoxel() would code
+    static MortonKey fromPoint(float x, float y, float z, float s);
+
+    // writes the octal code for the key to output, which needs room for MAX_OCTAL_CODE_BYTES, returns the bytes written
+    int toOctalCode(unsigned char* output) const;
+
+    int getLevel() const { return _level; };
+    bool isValid() const { return _level != INVALID_LEVEL; }; // nothing else works on an invalid key
+
+    // the child index the path takes from level to level + 1
+    int getSection(int level) const { return (int)(_words[SECTION_WORD[level]] >> SECTION_SHIFT[level]) & 7; };
+
+    MortonKey getChild(int childIndex) const;
+    MortonKey getAncestor(int level) const;  // the path down to level
+    MortonKey getParent() const { return getAncestor(_level - 1); };
+
+    // the path below the first levels, like chopOctalCode(), the root if that's all of it
+    MortonKey chop(int levels) const;
+
+    // newParent's path followed by ours, like rebaseOctalCode()
+    MortonKey rebase(const MortonKey& newParent) const;
+
+    bool isAncestorOf(const MortonKey& descendant) const {
+        return descendant._level > _level && descendant.getAncestor(_level) == *this;
+    };
+
+    // the lowest corner of the voxel, in voxel coordinates, like copyFirstVertexForCode()
+    void getCorner(float* output) const;
+
+    bool operator==(const MortonKey& other) const {
+        return _level == other._level && _words[0] == other._words[0] && _words[1] == other._words[1];
+    };
+    bool operator!=(const MortonKey& other) const { return !(*this == other); };
+
+    // tree order: a voxel comes before its descendants, which come before its next sibling
+    bool operator<(const MortonKey& other) const {
+        if (_words[0] != other._words[0]) {
+            return _words[0] < other._words[0];
+        }
+        if (_words[1] != other._words[1]) {
+            return _words[1] < other._words[1];
+        }
+        return _level < other._level;
+    };
+
+private:
+    static const int INVALID_LEVEL = -1;
+
+    // the word and the shift within it of each level's section, the first level's in the highest bits of the first
+    static const unsigned char SECTION_WORD[MAX_LEVELS];
+    static const unsigned char SECTION_SHIFT[MAX_LEVELS];
+
+    // shifts the path, as one number, toward the root (left) or away from it (right) by whole sections
+    void shiftLeft(int sections);
+    void shiftRight(int sections);
+
+    uint64_t _words[WORDS];
+    int _level;
+};
+
+#endif /* defined(__hifi__MortonKey__) */
@@ -14,11 +14,11 @@
 #include "Log.h"
 
 int numberOfThreeBitSectionsInCode(unsigned char * octalCode) {
-    if (*octalCode == 255) {
-        return *octalCode + numberOfThreeBitSectionsInCode(octalCode + 1);
-    } else {
-        return *octalCode;
+    int sections = 0;
+    while (*octalCode == 255) {
+        sections += *octalCode++;
     }
+    return sections + *octalCode;
 }
 
 void printOctalCode(unsigned char * octalCode) {
@@ -43,11 +43,7 @@ char sectionValue(unsigned char * startByte, char startIndexInByte) {
 }
 
 int bytesRequiredForCodeLength(unsigned char threeBitCodes) {
-    if (threeBitCodes == 0) {
-        return 1;
-    } else {
-        return 1 + (int)ceilf((threeBitCodes * 3) / 8.0f);
-    }
+    return 1 + (threeBitCodes * BITS_IN_OCTAL + BITS_IN_BYTE - 1) / BITS_IN_BYTE;
 }
 
 int branchIndexWithDescendant(unsigned char * ancestorOctalCode, unsigned char * descendantOctalCode) {
@@ -58,6 +54,17 @@ int branchIndexWithDescendant(unsigned char * ancestorOctalCode, unsigned char *
 }
 
 unsigned char * childOctalCode(unsigned char * parentOctalCode, char childNumber) {
+    int parentCodeSections = parentOctalCode != NULL
+        ? numberOfThreeBitSectionsInCode(parentOctalCode)
+        : 0;
+    
+    // create a new buffer to hold the new octal code
+    unsigned char *newCode = new unsigned char[bytesRequiredForCodeLength(parentCodeSections + 1)];
+    copyChildOctalCode(parentOctalCode, childNumber, newCode);
+    return newCode;
+}
+
+void copyChildOctalCode(unsigned char * parentOctalCode, char childNumber, unsigned char* newCode) {
     
     // find the length (in number of three bit code sequences)
     // in the parent
@@ -71,9 +78,6 @@ unsigned char * childOctalCode(unsigned char * parentOctalCode, char childNumber
     // child code will have one more section than the parent
     int childCodeBytes = bytesRequiredForCodeLength(parentCodeSections + 1);
     
-    // create a new buffer to hold the new octal code
-    unsigned char *newCode = new unsigned char[childCodeBytes];
-    
     // copy the parent code to the child
     if (parentOctalCode != NULL) {
         memcpy(newCode, parentOctalCode, parentCodeBytes);
@@ -107,8 +111,6 @@ unsigned char * childOctalCode(unsigned char * parentOctalCode, char childNumber
         // no wraparound, left shift and add
         newCode[(startBit / 8) + 1] += (childNumber << leftShift);
     }
-    
-    return newCode;
 }
 
 void copyFirstVertexForCode(unsigned char * octalCode, float* output) {
@@ -116,8 +118,18 @@ void copyFirstVertexForCode(unsigned char * octalCode, float* output) {
     
     float currentScale = 0.5;
     
-    for (int i = 0; i < numberOfThreeBitSectionsInCode(octalCode); i++) {
-        int sectionIndex = sectionValue(octalCode + 1 + (3 * i / 8), (3 * i) % 8);
+    // read the sections off the bytes as we go, rather than working out where each one is
+    int sections = numberOfThreeBitSectionsInCode(octalCode);
+    unsigned char* data = octalCode + 1;
+    unsigned int bits = 0;
+    int bitCount = 0;
+    for (int i = 0; i < sections; i++) {
+        if (bitCount < BITS_IN_OCTAL) {
+            bits = (bits << BITS_IN_BYTE) | *data++;
+            bitCount += BITS_IN_BYTE;
+        }
+        bitCount -= BITS_IN_OCTAL;
+        int sectionIndex = (bits >> bitCount) & 7;
         
         for (int j = 0; j < 3; j++) {
             output[j] += currentScale * (int)oneAtBit(sectionIndex, 5 + j);
@@ -24,7 +24,13 @@ int bytesRequiredForCodeLength(unsigned char threeBitCodes);
 bool isDirectParentOfChild(unsigned char *parentOctalCode, unsigned char * childOctalCode);
 int branchIndexWithDescendant(unsigned char * ancestorOctalCode, unsigned char * descendantOctalCode);
 unsigned char * childOctalCode(unsigned char * parentOctalCode, char childNumber);
+// Note: copyChildOctalCode() is preferred because it doesn't allocate memory for the return, output must have room
+// for bytesRequiredForCodeLength() of the parent's length plus one
+void copyChildOctalCode(unsigned char * parentOctalCode, char childNumber, unsigned char* output);
 int numberOfThreeBitSectionsInCode(unsigned char * octalCode);
+// the value of the three bit section starting at bit startIndexInByte of startByte, sections can span two bytes
+char sectionValue(unsigned char * startByte, char startIndexInByte);
+// Note: MortonKey::chop() and MortonKey::rebase() do the same without allocating memory
 unsigned char* chopOctalCode(unsigned char* originalOctalCode, int chopLevels);
 unsigned char* rebaseOctalCode(unsigned char* originalOctalCode, unsigned char* newParentOctalCode, 
                                bool includeColorSpace = false);
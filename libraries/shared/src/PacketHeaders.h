@@ -27,12 +27,16 @@ const PACKET_HEADER PACKET_HEADER_SET_VOXEL_DESTRUCTIVE = 'O';
 const PACKET_HEADER PACKET_HEADER_ERASE_VOXEL = 'E';
 const PACKET_HEADER PACKET_HEADER_VOXEL_DATA = 'V';
 const PACKET_HEADER PACKET_HEADER_VOXEL_DATA_MONOCHROME = 'v';
+const PACKET_HEADER PACKET_HEADER_VOXEL_DATA_COMPRESSED = 'W';
+const PACKET_HEADER PACKET_HEADER_VOXEL_DATA_MONOCHROME_COMPRESSED = 'w';
 const PACKET_HEADER PACKET_HEADER_BULK_AVATAR_DATA = 'X';
 const PACKET_HEADER PACKET_HEADER_AVATAR_VOXEL_URL = 'U';
 const PACKET_HEADER PACKET_HEADER_TRANSMITTER_DATA_V2 = 'T';
 const PACKET_HEADER PACKET_HEADER_ENVIRONMENT_DATA = 'e';
 const PACKET_HEADER PACKET_HEADER_DOMAIN_LIST_REQUEST = 'L';
 const PACKET_HEADER PACKET_HEADER_DOMAIN_REPORT_FOR_DUTY = 'C';
+const PACKET_HEADER PACKET_HEADER_RECEIVE_REPORT = 'K';
+const PACKET_HEADER PACKET_HEADER_VOXEL_SEND_STATS = 's';
 
 
 // These are supported Z-Command
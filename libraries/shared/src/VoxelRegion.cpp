@@ -0,0 +1,129 @@
+//
+//  VoxelRegion.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstring>
+#include "OctalCode.h"
+#include "VoxelRegion.h"
+
+bool VoxelRegion::parse(const char* prefixes) {
+    MortonKey parsed[MAX_PREFIXES];
+    int parsedCount = 0;
+    const char* at = prefixes;
+    while (*at) {
+        if (parsedCount == MAX_PREFIXES) {
+            return false;
+        }
+        MortonKey prefix;
+        while (*at >= '0' && *at <= '7' && prefix.getLevel() < MortonKey::MAX_LEVELS) {
+            prefix = prefix.getChild(*at++ - '0');
+        }
+        if (prefix.getLevel() == 0 || (*at && *at != ',')) {
+            return false;
+        }
+        parsed[parsedCount++] = prefix;
+        if (*at == ',') {
+            at++;
+        }
+    }
+    for (int i = 0; i < parsedCount; i++) {
+        _prefixes[i] = parsed[i];
+    }
+    _prefixCount = parsedCount;
+    return true;
+}
+
+bool VoxelRegion::contains(const MortonKey& key) const {
+    if (isWholeTree()) {
+        return true;
+    }
+    for (int i = 0; i < _prefixCount; i++) {
+        if (_prefixes[i] == key || _prefixes[i].isAncestorOf(key)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool VoxelRegion::overlaps(const MortonKey& key) const {
+    if (contains(key)) {
+        return true;
+    }
+    for (int i = 0; i < _prefixCount; i++) {
+        if (key.isAncestorOf(_prefixes[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int VoxelRegion::pack(unsigned char* destination) const {
+    unsigned char* at = destination;
+    *at++ = _prefixCount;
+    for (int i = 0; i < _prefixCount; i++) {
+        at += _prefixes[i].toOctalCode(at);
+    }
+    return at - destination;
+}
+
+int VoxelRegion::unpack(const unsigned char* source, int bytes) {
+    if (bytes < 1 || *source > MAX_PREFIXES) {
+        return 0;
+    }
+    int prefixCount = *source;
+    MortonKey prefixes[MAX_PREFIXES];
+    int atByte = 1;
+    for (int i = 0; i < prefixCount; i++) {
+        if (atByte >= bytes || bytesRequiredForCodeLength(source[atByte]) > bytes - atByte) {
+            return 0;
+        }
+        prefixes[i] = MortonKey::fromOctalCode(source + atByte);
+        if (!prefixes[i].isValid()) {
+            return 0;
+        }
+        atByte += bytesRequiredForCodeLength(source[atByte]);
+    }
+    for (int i = 0; i < prefixCount; i++) {
+        _prefixes[i] = prefixes[i];
+    }
+    _prefixCount = prefixCount;
+    return atByte;
+}
+
+int VoxelRegion::copyOverlappingEdits(const unsigned char* packet, int bytes, unsigned char* destination) const {
+    if (bytes < EDIT_PACKET_HEADER_BYTES) {
+        return 0;
+    }
+    memcpy(destination, packet, EDIT_PACKET_HEADER_BYTES);
+    int atByte = EDIT_PACKET_HEADER_BYTES;
+    int copiedBytes = EDIT_PACKET_HEADER_BYTES;
+    while (atByte < bytes) {
+        const unsigned char* voxelData = packet + atByte;
+        int voxelDataSize = bytesRequiredForCodeLength(*voxelData) + SIZE_OF_COLOR_DATA;
+        if (voxelDataSize > bytes - atByte) {
+            break; // a truncated voxel, the voxel server would ignore it too
+        }
+        MortonKey key = MortonKey::fromOctalCode(voxelData);
+        if (key.isValid() && overlaps(key)) { // the voxel server would ignore one too deep for a key
+            memcpy(destination + copiedBytes, voxelData, voxelDataSize);
+            copiedBytes += voxelDataSize;
+        }
+        atByte += voxelDataSize;
+    }
+    return copiedBytes;
+}
+
+bool VoxelRegion::operator==(const VoxelRegion& other) const {
+    if (_prefixCount != other._prefixCount) {
+        return false;
+    }
+    for (int i = 0; i < _prefixCount; i++) {
+        if (_prefixes[i] != other._prefixes[i]) {
+            return false;
+        }
+    }
+    return true;
+}
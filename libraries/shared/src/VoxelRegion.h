@@ -0,0 +1,62 @@
+//
+//  VoxelRegion.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  The part of the voxel tree a voxel server owns, when the tree is split between several of them. A region is a list
+//  of octal code prefixes, and owns every voxel in or below those. A region with no prefixes is the whole tree, which
+//  is what a voxel server owns unless it's told otherwise.
+//
+//  Voxel servers tell the domain server their region when they check in, the domain server passes it on with the
+//  voxel server in its agent lists, and agents send each voxel server just the edits in its region.
+//
+
+#ifndef __hifi__VoxelRegion__
+#define __hifi__VoxelRegion__
+
+#include "MortonKey.h"
+
+class VoxelRegion {
+public:
+    static const int MAX_PREFIXES = 16;
+    static const int MAX_PACKED_BYTES = 1 + MAX_PREFIXES * MortonKey::MAX_OCTAL_CODE_BYTES;
+    static const int EDIT_PACKET_HEADER_BYTES = sizeof(char) + sizeof(unsigned short); // ahead of an edit's voxels
+
+    VoxelRegion() : _prefixCount(0) { }; // the whole tree
+
+    // reads a comma separated list of prefixes, each the child indexes (0 to 7) from the root down, like "0,1,27" for
+    // the first two children of the root and the last child of its third child. False if that isn't what's there, in
+    // which case the region is unchanged
+    bool parse(const char* prefixes);
+
+    bool isWholeTree() const { return _prefixCount == 0; };
+    int getPrefixCount() const { return _prefixCount; };
+    const MortonKey& getPrefix(int i) const { return _prefixes[i]; };
+
+    // whether the voxel is in the region
+    bool contains(const MortonKey& key) const;
+
+    // whether any of the voxel is in the region, which it is if the voxel contains one of the prefixes
+    bool overlaps(const MortonKey& key) const;
+
+    // the number of prefixes followed by their octal codes, returns the bytes written, at most MAX_PACKED_BYTES
+    int pack(unsigned char* destination) const;
+
+    // returns the bytes read, 0 if what's there isn't a packed region, in which case the region is unchanged
+    int unpack(const unsigned char* source, int bytes);
+
+    // copies a PACKET_HEADER_SET_VOXEL, PACKET_HEADER_SET_VOXEL_DESTRUCTIVE or PACKET_HEADER_ERASE_VOXEL packet to
+    // destination, with just the voxels that overlap the region, and returns its length. Nothing overlaps if that's
+    // the length of the packet's header
+    int copyOverlappingEdits(const unsigned char* packet, int bytes, unsigned char* destination) const;
+
+    bool operator==(const VoxelRegion& other) const;
+    bool operator!=(const VoxelRegion& other) const { return !(*this == other); };
+
+private:
+    MortonKey _prefixes[MAX_PREFIXES];
+    int _prefixCount;
+};
+
+#endif /* defined(__hifi__VoxelRegion__) */
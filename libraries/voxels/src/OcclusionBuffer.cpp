@@ -0,0 +1,245 @@
+//
+//  OcclusionBuffer.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "OcclusionBuffer.h"
+
+const int SUBSAMPLE_RESOLUTION = OcclusionBuffer::RESOLUTION * OcclusionBuffer::SUBSAMPLES;
+const uint64_t FULLY_COVERED = ~(uint64_t)0;
+
+OcclusionBuffer::OcclusionBuffer() {
+    int offset = 0;
+    for (int i = 0; i < LEVELS; i++) {
+        _levelOffsets[i] = offset;
+        int resolution = RESOLUTION >> i;
+        offset += resolution * resolution;
+    }
+    erase();
+}
+
+void OcclusionBuffer::erase() {
+    memset(_coverage, 0, sizeof(_coverage));
+    memset(_partialDepths, 0, sizeof(_partialDepths));
+    std::fill(_depths, _depths + MIP_TEXELS, FLT_MAX);
+    _queries = 0;
+    _occluded = 0;
+    _occludersStored = 0;
+}
+
+float OcclusionBuffer::nearDistance(const AABox& box, const glm::vec3& position) {
+    glm::vec3 closest = glm::clamp(position, box.getCorner(), box.getCorner() + box.getSize());
+    return glm::distance(position, closest);
+}
+
+float OcclusionBuffer::farDistance(const AABox& box, const glm::vec3& position) {
+    glm::vec3 toCorner = glm::abs(position - box.getCorner());
+    glm::vec3 toFarCorner = glm::abs(position - (box.getCorner() + box.getSize()));
+    return glm::length(glm::max(toCorner, toFarCorner));
+}
+
+// screen coordinates run from -1 to 1, scale them to subsamples
+static inline float toSubsamples(float coordinate) {
+    return (coordinate + 1.0f) * (SUBSAMPLE_RESOLUTION * 0.5f);
+}
+
+// the leftmost and rightmost points of a convex polygon on the row y, false if y misses it
+static bool spanAt(const float* xs, const float* ys, int vertexCount, float y, float& left, float& right) {
+    left = FLT_MAX;
+    right = -FLT_MAX;
+    for (int i = 0, j = vertexCount - 1; i < vertexCount; j = i++) {
+        float y0 = ys[j], y1 = ys[i];
+        if ((y < y0 && y < y1) || (y > y0 && y > y1)) {
+            continue;
+        }
+        if (y0 == y1) {
+            left = std::min(left, std::min(xs[i], xs[j]));
+            right = std::max(right, std::max(xs[i], xs[j]));
+        } else {
+            float x = xs[j] + (y - y0) * (xs[i] - xs[j]) / (y1 - y0);
+            left = std::min(left, x);
+            right = std::max(right, x);
+        }
+    }
+    return left <= right;
+}
+
+bool OcclusionBuffer::isOccluded(const VoxelProjectedPolygon& shadow, float nearDistance) {
+    _queries++;
+
+    // the pixels the shadow's bounding rectangle touches, parts of it off the screen can't be seen anyway
+    int left   = std::max((int)floorf(toSubsamples(shadow.getMinX())) / SUBSAMPLES, 0);
+    int right  = std::min((int)floorf(toSubsamples(shadow.getMaxX())) / SUBSAMPLES, RESOLUTION - 1);
+    int top    = std::max((int)floorf(toSubsamples(shadow.getMinY())) / SUBSAMPLES, 0);
+    int bottom = std::min((int)floorf(toSubsamples(shadow.getMaxY())) / SUBSAMPLES, RESOLUTION - 1);
+    if (left > right || top > bottom) {
+        return false;
+    }
+
+    // start at the finest level where the rectangle is at most two texels wide and high, and work down from there
+    int startLevel = 0;
+    while (startLevel < LEVELS - 1 &&
+           ((right >> startLevel) - (left >> startLevel) > 1 || (bottom >> startLevel) - (top >> startLevel) > 1)) {
+        startLevel++;
+    }
+    for (int y = top >> startLevel; y <= bottom >> startLevel; y++) {
+        for (int x = left >> startLevel; x <= right >> startLevel; x++) {
+            if (!isOccluded(startLevel, x, y, left, top, right, bottom, nearDistance)) {
+                return false;
+            }
+        }
+    }
+    _occluded++;
+    return true;
+}
+
+bool OcclusionBuffer::isOccluded(int levelIndex, int x, int y, int left, int top, int right, int bottom,
+                                 float nearDistance) const {
+    if (level(levelIndex)[y * (RESOLUTION >> levelIndex) + x] < nearDistance) {
+        return true;
+    }
+    if (levelIndex == 0) {
+        return false;
+    }
+    // this texel can't decide, so ask its children that are in the rectangle
+    int childLevel = levelIndex - 1;
+    int firstX = std::max(x * 2, left >> childLevel), lastX = std::min(x * 2 + 1, right >> childLevel);
+    int firstY = std::max(y * 2, top >> childLevel), lastY = std::min(y * 2 + 1, bottom >> childLevel);
+    for (int childY = firstY; childY <= lastY; childY++) {
+        for (int childX = firstX; childX <= lastX; childX++) {
+            if (!isOccluded(childLevel, childX, childY, left, top, right, bottom, nearDistance)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void OcclusionBuffer::storeOccluder(const VoxelProjectedPolygon& shadow, float farDistance) {
+    int vertexCount = shadow.getVertexCount();
+    if (vertexCount < 3) {
+        return;
+    }
+    float xs[MAX_SHADOW_VERTEX_COUNT], ys[MAX_SHADOW_VERTEX_COUNT];
+    float minY = FLT_MAX, maxY = -FLT_MAX;
+    for (int i = 0; i < vertexCount; i++) {
+        xs[i] = toSubsamples(shadow.getVertex(i).x);
+        ys[i] = toSubsamples(shadow.getVertex(i).y);
+        minY = std::min(minY, ys[i]);
+        maxY = std::max(maxY, ys[i]);
+    }
+
+    // only the rows of subsamples that are entirely within the shadow's height
+    int firstRow = std::max((int)ceilf(minY), 0);
+    int endRow = std::min((int)floorf(maxY), SUBSAMPLE_RESOLUTION);
+    if (firstRow >= endRow) {
+        return;
+    }
+
+    int changedLeft = RESOLUTION, changedRight = -1, changedTop = RESOLUTION, changedBottom = -1;
+    float rowLeft, rowRight;
+    bool rowHit = spanAt(xs, ys, vertexCount, firstRow, rowLeft, rowRight);
+
+    for (int pixelY = firstRow / SUBSAMPLES; pixelY <= (endRow - 1) / SUBSAMPLES; pixelY++) {
+        // the subsamples of each row in this row of pixels that are inside the shadow. The polygon is convex, so a
+        // subsample is inside if it is inside at both the top and bottom of its row
+        int spanLeft[SUBSAMPLES], spanRight[SUBSAMPLES];
+        int pixelsLeft = SUBSAMPLE_RESOLUTION, pixelsRight = 0;
+        for (int i = 0; i < SUBSAMPLES; i++) {
+            int row = pixelY * SUBSAMPLES + i;
+            spanLeft[i] = spanRight[i] = 0;
+            if (row < firstRow || row >= endRow) {
+                continue;
+            }
+            float nextLeft, nextRight;
+            bool nextHit = spanAt(xs, ys, vertexCount, row + 1, nextLeft, nextRight);
+            if (rowHit && nextHit) {
+                spanLeft[i] = std::max((int)ceilf(std::max(rowLeft, nextLeft)), 0);
+                spanRight[i] = std::min((int)floorf(std::min(rowRight, nextRight)), SUBSAMPLE_RESOLUTION);
+                if (spanLeft[i] < spanRight[i]) {
+                    pixelsLeft = std::min(pixelsLeft, spanLeft[i] / SUBSAMPLES);
+                    pixelsRight = std::max(pixelsRight, (spanRight[i] - 1) / SUBSAMPLES);
+                }
+            }
+            rowHit = nextHit;
+            rowLeft = nextLeft;
+            rowRight = nextRight;
+        }
+
+        for (int pixelX = pixelsLeft; pixelX <= pixelsRight; pixelX++) {
+            int pixelLeft = pixelX * SUBSAMPLES;
+            uint64_t mask = 0;
+            for (int i = 0; i < SUBSAMPLES; i++) {
+                int first = std::max(spanLeft[i], pixelLeft);
+                int end = std::min(spanRight[i], pixelLeft + SUBSAMPLES);
+                if (first < end) {
+                    uint64_t bits = ((1 << (end - first)) - 1) << (first - pixelLeft);
+                    mask |= bits << (i * SUBSAMPLES);
+                }
+            }
+            if (mask && coverPixel(pixelY * RESOLUTION + pixelX, mask, farDistance)) {
+                changedLeft = std::min(changedLeft, pixelX);
+                changedRight = std::max(changedRight, pixelX);
+                changedTop = std::min(changedTop, pixelY);
+                changedBottom = std::max(changedBottom, pixelY);
+            }
+        }
+    }
+
+    if (changedLeft <= changedRight) {
+        updateMips(changedLeft, changedTop, changedRight, changedBottom);
+    }
+    _occludersStored++;
+}
+
+// returns true if the pixel's depth changed
+bool OcclusionBuffer::coverPixel(int pixel, uint64_t mask, float farDistance) {
+    uint64_t covered = _coverage[pixel];
+    if (covered == FULLY_COVERED) {
+        // only an occluder covering all of the pixel by itself can bring it nearer
+        if (mask == FULLY_COVERED && farDistance < _depths[pixel]) {
+            _depths[pixel] = farDistance;
+            return true;
+        }
+        return false;
+    }
+    if ((covered | mask) == covered) {
+        return false;
+    }
+    _partialDepths[pixel] = std::max(_partialDepths[pixel], farDistance);
+    _coverage[pixel] = covered | mask;
+    if (_coverage[pixel] != FULLY_COVERED) {
+        return false;
+    }
+    // the subsamples may be covered by occluders at different distances, so the pixel is only occluding behind the
+    // farthest of them, unless this one covers it all
+    _depths[pixel] = (mask == FULLY_COVERED) ? farDistance : _partialDepths[pixel];
+    return true;
+}
+
+void OcclusionBuffer::updateMips(int left, int top, int right, int bottom) {
+    for (int i = 1; i < LEVELS; i++) {
+        const float* finer = level(i - 1);
+        float* coarser = level(i);
+        int finerResolution = RESOLUTION >> (i - 1);
+        int coarserResolution = RESOLUTION >> i;
+        left >>= 1;
+        top >>= 1;
+        right >>= 1;
+        bottom >>= 1;
+        for (int y = top; y <= bottom; y++) {
+            for (int x = left; x <= right; x++) {
+                const float* children = &finer[(y * 2) * finerResolution + x * 2];
+                coarser[y * coarserResolution + x] = std::max(std::max(children[0], children[1]),
+                                                              std::max(children[finerResolution],
+                                                                       children[finerResolution + 1]));
+            }
+        }
+    }
+}
@@ -0,0 +1,78 @@
+//
+//  OcclusionBuffer.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A low resolution raster alternative to the CoverageMap for occlusion culling while encoding. Voxel shadows (see
+//  ViewFrustum::getProjectedShadow()) are rasterized into a fixed grid of pixels over the screen, each pixel remembering
+//  which of its 8x8 subsamples are covered and, once all of them are, the distance behind which everything in the pixel
+//  is hidden. A max-depth mip chain over the pixels lets a query answer for a big shadow by looking at a handful of
+//  coarse texels, only going down to finer ones where the coarse ones can't decide.
+//
+//  Both sides are conservative: occluders only cover the subsamples that lie entirely inside their shadow, and a shadow
+//  is only occluded when every pixel its bounding rectangle touches is fully covered by occluders that are all nearer
+//  than the nearest point of its box. Everything lives in the object, so nothing is allocated while encoding.
+//
+
+#ifndef __hifi__OcclusionBuffer__
+#define __hifi__OcclusionBuffer__
+
+#include <stdint.h>
+#include <glm/glm.hpp>
+#include "AABox.h"
+#include "VoxelProjectedPolygon.h"
+
+class OcclusionBuffer {
+public:
+    static const int RESOLUTION = 64;       // pixels across the screen in each direction
+    static const int SUBSAMPLES = 8;        // per pixel in each direction, one bit each in the pixel's coverage mask
+    static const int LEVELS = 7;            // the pixels and their mips, RESOLUTION x RESOLUTION down to 1 x 1
+
+    OcclusionBuffer();
+
+    void erase(); // forget all the occluders, for a new view
+
+    // the distances from the camera to the nearest and farthest points of box, which are what isOccluded() and
+    // storeOccluder() want for its shadow
+    static float nearDistance(const AABox& box, const glm::vec3& position);
+    static float farDistance(const AABox& box, const glm::vec3& position);
+
+    // true if everything in shadow, which should be all in view, is behind occluders nearer than nearDistance
+    bool isOccluded(const VoxelProjectedPolygon& shadow, float nearDistance);
+
+    // adds shadow, which should be all in view, as an occluder of everything farther than farDistance
+    void storeOccluder(const VoxelProjectedPolygon& shadow, float farDistance);
+
+    // counters since the last erase()
+    int getQueries() const { return _queries; };
+    int getOccluded() const { return _occluded; };
+    int getOccludersStored() const { return _occludersStored; };
+
+private:
+    // disallow copying of OcclusionBuffer objects
+    OcclusionBuffer(const OcclusionBuffer&);
+    OcclusionBuffer& operator= (const OcclusionBuffer&);
+
+    static const int PIXELS = RESOLUTION * RESOLUTION;
+    static const int MIP_TEXELS = PIXELS + PIXELS / 4 + PIXELS / 16 + PIXELS / 64 + PIXELS / 256 + PIXELS / 1024 +
+                                  PIXELS / 4096; // a term for each of the LEVELS
+
+    float* level(int level) { return &_depths[_levelOffsets[level]]; };
+    const float* level(int level) const { return &_depths[_levelOffsets[level]]; };
+
+    bool isOccluded(int level, int x, int y, int left, int top, int right, int bottom, float nearDistance) const;
+    bool coverPixel(int pixel, uint64_t mask, float farDistance);
+    void updateMips(int left, int top, int right, int bottom);
+
+    uint64_t    _coverage[PIXELS];          // subsamples covered, row by row, one byte per row
+    float       _partialDepths[PIXELS];     // farthest of the occluders that covered some of a pixel's subsamples
+    float       _depths[MIP_TEXELS];        // farthest occluding distance, FLT_MAX until a pixel is fully covered
+    int         _levelOffsets[LEVELS];
+
+    int _queries;
+    int _occluded;
+    int _occludersStored;
+};
+
+#endif /* defined(__hifi__OcclusionBuffer__) */
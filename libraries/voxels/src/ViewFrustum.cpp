@@ -10,6 +10,10 @@
 
 #include <algorithm>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #include <glm/gtx/transform.hpp>
 
 #include "ViewFrustum.h"
@@ -37,7 +41,8 @@ ViewFrustum::ViewFrustum() :
     _nearTopLeft(0,0,0),
     _nearTopRight(0,0,0),
     _nearBottomLeft(0,0,0),
-    _nearBottomRight(0,0,0)
+    _nearBottomRight(0,0,0),
+    _viewProjection()
 {
 }
     
@@ -115,6 +120,13 @@ void ViewFrustum::calculate() {
     _planes[NEAR_PLANE  ].set3Points(_nearBottomRight,_nearBottomLeft,_nearTopLeft);
     _planes[FAR_PLANE   ].set3Points(_farBottomLeft,_farBottomRight,_farTopRight);
 
+    // Projection matrix : Field of View, ratio, display range : near to far. Built here rather than in projectPoint(),
+    // which is called for every vertex of every shadow
+    glm::mat4 projection = glm::perspective(_fieldOfView, _aspectRatio, _nearClip, _farClip);
+    glm::vec3 lookAt     = _position + _direction;
+    glm::mat4 view       = glm::lookAt(_position, lookAt, _up);
+    // Our ModelViewProjection : multiplication of our 3 matrices (note: model is identity, so we can drop it)
+    _viewProjection      = projection * view; // Remember, matrix multiplication is the other way around
 }
 
 //enum { TOP_PLANE = 0, BOTTOM_PLANE, LEFT_PLANE, RIGHT_PLANE, NEAR_PLANE, FAR_PLANE };
@@ -288,6 +300,154 @@ ViewFrustum::location ViewFrustum::boxInFrustum(const AABox& box) const {
     return regularResult;
 }
 
+// The children are classified four at a time, children 0-3 are the low x half of the parent and 4-7 the high x half.
+// Within each half child j is offset by ((j >> 1) & 1, j & 1) in y and z. Every distance is computed with the same float
+// operations in the same order as boxInFrustum(), boxInSphere() and VoxelNode::distanceToCamera(), so the answers match
+// theirs bit for bit, and all the planes are tested instead of stopping at the first one a child is outside of, which
+// gives the same answer without branching.
+void ViewFrustum::classifyChildren(const AABox& parentBox, float boundaryDistance, ChildLocations& locations) const {
+    const glm::vec3& corner = parentBox.getCorner();
+    const float childSize = parentBox.getSize().x * 0.5f;
+    const float halfChildSize = childSize * 0.5f;
+    const bool checkKeyhole = (_keyholeRadius >= 0.0f);
+    
+    // findSpherePenetration() counts a box as touching the keyhole if it's closer than the radius or than EPSILON
+    const float keyholeTouchDistance = std::max(_keyholeRadius, EPSILON);
+
+    // which corner of the children is the P and N vertex is the same for all of them
+    glm::vec3 vertexPOffset[6];
+    glm::vec3 vertexNOffset[6];
+    for (int i = 0; i < 6; i++) {
+        const glm::vec3& normal = _planes[i].getNormal();
+        vertexPOffset[i] = glm::vec3(normal.x > 0 ? childSize : 0.0f, normal.y > 0 ? childSize : 0.0f,
+                                     normal.z > 0 ? childSize : 0.0f);
+        vertexNOffset[i] = glm::vec3(normal.x < 0 ? childSize : 0.0f, normal.y < 0 ? childSize : 0.0f,
+                                     normal.z < 0 ? childSize : 0.0f);
+    }
+
+    locations.inside = 0;
+    locations.intersect = 0;
+    locations.inLOD = 0;
+
+#ifdef __SSE__
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 childY = _mm_add_ps(_mm_set1_ps(corner.y), _mm_set_ps(childSize, childSize, 0.0f, 0.0f));
+    const __m128 childZ = _mm_add_ps(_mm_set1_ps(corner.z), _mm_set_ps(childSize, 0.0f, childSize, 0.0f));
+    const __m128 childMaxY = _mm_add_ps(childY, _mm_set1_ps(childSize));
+    const __m128 childMaxZ = _mm_add_ps(childZ, _mm_set1_ps(childSize));
+    const __m128 positionX = _mm_set1_ps(_position.x);
+    const __m128 positionY = _mm_set1_ps(_position.y);
+    const __m128 positionZ = _mm_set1_ps(_position.z);
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+
+    for (int half = 0; half < 2; half++) {
+        const int shift = half * 4;
+        const __m128 childX = _mm_set1_ps(half ? corner.x + childSize : corner.x);
+        const __m128 childMaxX = _mm_add_ps(childX, _mm_set1_ps(childSize));
+
+        // the keyhole, the box touches it if the closest point in the box is close enough, and is inside it if the
+        // farthest corner is
+        int keyholeTouches = 0;
+        int keyholeInside = 0;
+        if (checkKeyhole) {
+            __m128 closestX = _mm_sub_ps(_mm_min_ps(_mm_max_ps(positionX, childX), childMaxX), positionX);
+            __m128 closestY = _mm_sub_ps(_mm_min_ps(_mm_max_ps(positionY, childY), childMaxY), positionY);
+            __m128 closestZ = _mm_sub_ps(_mm_min_ps(_mm_max_ps(positionZ, childZ), childMaxZ), positionZ);
+            __m128 closest = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(closestX, closestX),
+                                                               _mm_mul_ps(closestY, closestY)),
+                                                    _mm_mul_ps(closestZ, closestZ)));
+            keyholeTouches = _mm_movemask_ps(_mm_cmplt_ps(closest, _mm_set1_ps(keyholeTouchDistance)));
+
+            __m128 farthestX = _mm_max_ps(_mm_andnot_ps(signBit, _mm_sub_ps(childX, positionX)),
+                                          _mm_andnot_ps(signBit, _mm_sub_ps(childMaxX, positionX)));
+            __m128 farthestY = _mm_max_ps(_mm_andnot_ps(signBit, _mm_sub_ps(childY, positionY)),
+                                          _mm_andnot_ps(signBit, _mm_sub_ps(childMaxY, positionY)));
+            __m128 farthestZ = _mm_max_ps(_mm_andnot_ps(signBit, _mm_sub_ps(childZ, positionZ)),
+                                          _mm_andnot_ps(signBit, _mm_sub_ps(childMaxZ, positionZ)));
+            __m128 farthest = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(farthestX, farthestX),
+                                                                _mm_mul_ps(farthestY, farthestY)),
+                                                     _mm_mul_ps(farthestZ, farthestZ)));
+            keyholeInside = keyholeTouches & _mm_movemask_ps(_mm_cmple_ps(farthest, _mm_set1_ps(_keyholeRadius)));
+        }
+
+        // the regular frustum
+        int outsideAPlane = 0;
+        int crossesAPlane = 0;
+        for (int i = 0; i < 6; i++) {
+            const glm::vec3& normal = _planes[i].getNormal();
+            const __m128 d = _mm_set1_ps(_planes[i].getDCoefficient());
+            const __m128 normalX = _mm_set1_ps(normal.x);
+            const __m128 normalY = _mm_set1_ps(normal.y);
+            const __m128 normalZ = _mm_set1_ps(normal.z);
+            
+            __m128 distanceP = _mm_add_ps(d, _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(normalX, _mm_add_ps(childX, _mm_set1_ps(vertexPOffset[i].x))),
+                _mm_mul_ps(normalY, _mm_add_ps(childY, _mm_set1_ps(vertexPOffset[i].y)))),
+                _mm_mul_ps(normalZ, _mm_add_ps(childZ, _mm_set1_ps(vertexPOffset[i].z)))));
+            __m128 distanceN = _mm_add_ps(d, _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(normalX, _mm_add_ps(childX, _mm_set1_ps(vertexNOffset[i].x))),
+                _mm_mul_ps(normalY, _mm_add_ps(childY, _mm_set1_ps(vertexNOffset[i].y)))),
+                _mm_mul_ps(normalZ, _mm_add_ps(childZ, _mm_set1_ps(vertexNOffset[i].z)))));
+            outsideAPlane |= _mm_movemask_ps(_mm_cmplt_ps(distanceP, zero));
+            crossesAPlane |= _mm_movemask_ps(_mm_cmplt_ps(distanceN, zero));
+        }
+
+        // outside a plane means we're only as much in view as we are in the keyhole
+        int inside = keyholeInside | (~outsideAPlane & ~crossesAPlane & 0xF);
+        int intersect = ~inside & ((keyholeTouches & ~keyholeInside) | (~outsideAPlane & crossesAPlane)) & 0xF;
+        locations.inside |= inside << shift;
+        locations.intersect |= intersect << shift;
+
+        // and the level of detail, from the center of each child
+        __m128 halfChildSizes = _mm_set1_ps(halfChildSize);
+        __m128 toCenterX = _mm_sub_ps(positionX, _mm_add_ps(childX, halfChildSizes));
+        __m128 toCenterY = _mm_sub_ps(positionY, _mm_add_ps(childY, halfChildSizes));
+        __m128 toCenterZ = _mm_sub_ps(positionZ, _mm_add_ps(childZ, halfChildSizes));
+        __m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(toCenterX, toCenterX), _mm_mul_ps(toCenterY, toCenterY)),
+                                            _mm_mul_ps(toCenterZ, toCenterZ));
+        _mm_storeu_ps(&locations.distanceSquared[shift], distanceSquared);
+        locations.inLOD |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sqrt_ps(distanceSquared),
+                                                        _mm_set1_ps(boundaryDistance))) << shift;
+    }
+#else
+    for (int child = 0; child < NUMBER_OF_CHILDREN; child++) {
+        glm::vec3 childCorner(corner.x + ((child >> 2) & 1 ? childSize : 0.0f),
+                              corner.y + ((child >> 1) & 1 ? childSize : 0.0f),
+                              corner.z + (child & 1 ? childSize : 0.0f));
+        glm::vec3 childMax = childCorner + glm::vec3(childSize, childSize, childSize);
+        unsigned char bit = 1 << child;
+
+        bool keyholeTouches = false;
+        bool keyholeInside = false;
+        if (checkKeyhole) {
+            glm::vec3 closest = glm::clamp(_position, childCorner, childMax) - _position;
+            keyholeTouches = sqrtf(glm::dot(closest, closest)) < keyholeTouchDistance;
+            glm::vec3 farthest = glm::max(glm::abs(childCorner - _position), glm::abs(childMax - _position));
+            keyholeInside = keyholeTouches && sqrtf(glm::dot(farthest, farthest)) <= _keyholeRadius;
+        }
+
+        bool outsideAPlane = false;
+        bool crossesAPlane = false;
+        for (int i = 0; i < 6; i++) {
+            outsideAPlane = outsideAPlane || _planes[i].distance(childCorner + vertexPOffset[i]) < 0;
+            crossesAPlane = crossesAPlane || _planes[i].distance(childCorner + vertexNOffset[i]) < 0;
+        }
+
+        if (keyholeInside || (!outsideAPlane && !crossesAPlane)) {
+            locations.inside |= bit;
+        } else if (keyholeTouches || !outsideAPlane) {
+            locations.intersect |= bit;
+        }
+
+        glm::vec3 toCenter = _position - (childCorner + glm::vec3(halfChildSize, halfChildSize, halfChildSize));
+        locations.distanceSquared[child] = glm::dot(toCenter, toCenter);
+        if (sqrtf(locations.distanceSquared[child]) < boundaryDistance) {
+            locations.inLOD |= bit;
+        }
+    }
+#endif
+}
+
 bool testMatches(glm::quat lhs, glm::quat rhs) {
     return (fabs(lhs.x - rhs.x) <= EPSILON && fabs(lhs.y - rhs.y) <= EPSILON && fabs(lhs.z - rhs.z) <= EPSILON
             && fabs(lhs.w - rhs.w) <= EPSILON);
@@ -427,16 +587,8 @@ void ViewFrustum::printDebugDetails() const {
 
 
 glm::vec2 ViewFrustum::projectPoint(glm::vec3 point, bool& pointInView) const {
-
-    // Projection matrix : Field of View, ratio, display range : near to far
-    glm::mat4 projection = glm::perspective(_fieldOfView, _aspectRatio, _nearClip, _farClip);
-    glm::vec3 lookAt     = _position + _direction;
-    glm::mat4 view       = glm::lookAt(_position, lookAt, _up);
-    // Our ModelViewProjection : multiplication of our 3 matrices (note: model is identity, so we can drop it)
-    glm::mat4 VP         = projection * view; // Remember, matrix multiplication is the other way around
-    
     glm::vec4 pointVec4 = glm::vec4(point,1);
-    glm::vec4 projectedPointVec4 = VP * pointVec4;
+    glm::vec4 projectedPointVec4 = _viewProjection * pointVec4; // see calculate()
     pointInView = (projectedPointVec4.w > 0); // math! If the w result is negative then the point is behind the viewer
     
     // what happens with w is 0???
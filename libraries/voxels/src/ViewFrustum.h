@@ -76,6 +76,23 @@ public:
     ViewFrustum::location pointInFrustum(const glm::vec3& point) const;
     ViewFrustum::location sphereInFrustum(const glm::vec3& center, float radius) const;
     ViewFrustum::location boxInFrustum(const AABox& box) const;
+
+    // Where all eight children of a voxel are, bit i of each mask is for child index i. The answers are exactly the ones
+    // boxInFrustum() and VoxelNode::distanceToCamera() would give for each child on its own
+    class ChildLocations {
+    public:
+        unsigned char inside;               // wholly in view
+        unsigned char intersect;            // partly in view
+        unsigned char inLOD;                // closer to the camera than the boundary distance that was passed in
+        float distanceSquared[8];           // from the camera to each child's center
+
+        unsigned char inView() const { return inside | intersect; };
+        unsigned char outside() const { return ~(inside | intersect); };
+    };
+
+    // classifies the children of the voxel whose box (in tree scale) is parentBox all at once, which is much cheaper
+    // than calling boxInFrustum() on them one at a time
+    void classifyChildren(const AABox& parentBox, float boundaryDistance, ChildLocations& locations) const;
     
     // some frustum comparisons
     bool matches(const ViewFrustum& compareTo, bool debug = false) const;
@@ -132,6 +149,7 @@ private:
     glm::vec3   _nearTopRight;
     glm::vec3   _nearBottomLeft;
     glm::vec3   _nearBottomRight;
+    glm::mat4   _viewProjection;
     enum { TOP_PLANE = 0, BOTTOM_PLANE, LEFT_PLANE, RIGHT_PLANE, NEAR_PLANE, FAR_PLANE };
     Plane _planes[6]; // How will this be used?
     
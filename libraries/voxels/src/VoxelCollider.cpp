@@ -0,0 +1,192 @@
+//
+//  VoxelCollider.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include "AABox.h"
+#include "GeometryUtil.h"
+#include "VoxelCollider.h"
+
+// how far past its query an owner's bounds reach, as a multiple of the query's radius. Bigger bounds keep an owner's
+// leaves good for more frames of movement, but give it more leaves to check each frame
+const float OWNER_MARGIN_SCALE = 1.0f;
+
+VoxelCollider::VoxelCollider(VoxelTree* tree) :
+    _tree(tree),
+    _levelStride(0),
+    _nodesVisited(0),
+    _leavesChecked(0),
+    _coherentQueries(0) {
+}
+
+static bool boundsOverlap(const glm::vec3& corner, float size, const glm::vec3& minimum, const glm::vec3& maximum) {
+    return corner.x <= maximum.x && corner.y <= maximum.y && corner.z <= maximum.z &&
+        corner.x + size >= minimum.x && corner.y + size >= minimum.y && corner.z + size >= minimum.z;
+}
+
+static bool boundsContain(const glm::vec3& outerMinimum, const glm::vec3& outerMaximum,
+                          const glm::vec3& minimum, const glm::vec3& maximum) {
+    return minimum.x >= outerMinimum.x && minimum.y >= outerMinimum.y && minimum.z >= outerMinimum.z &&
+        maximum.x <= outerMaximum.x && maximum.y <= outerMaximum.y && maximum.z <= outerMaximum.z;
+}
+
+void VoxelCollider::findContacts(const VoxelCollisionQuery* queries, int queryCount,
+                                 std::vector<VoxelContact>& contacts) {
+    contacts.clear();
+    if (queryCount <= 0) {
+        return;
+    }
+    unsigned long generation = _tree->getNodePool().getGeneration();
+
+    // work out everyone's bounds, and which queries can use their owner's leaves rather than descend
+    _minimums.resize(queryCount);
+    _maximums.resize(queryCount);
+    _usesOwnerLeaves.assign(queryCount, false);
+    _levelStride = queryCount;
+    if ((int)_levelQueries.size() < _levelStride) {
+        _levelQueries.resize(_levelStride);
+    }
+    int descendingCount = 0;
+    for (int i = 0; i < queryCount; i++) {
+        const VoxelCollisionQuery& query = queries[i];
+        glm::vec3 start = query.start / (float)TREE_SCALE;
+        glm::vec3 end = query.end / (float)TREE_SCALE;
+        float radius = query.radius / TREE_SCALE;
+        glm::vec3 minimum = glm::min(start, end) - glm::vec3(radius, radius, radius);
+        glm::vec3 maximum = glm::max(start, end) + glm::vec3(radius, radius, radius);
+        if (query.owner) {
+            std::map<const void*, OwnerLeaves>::const_iterator owner = _owners.find(query.owner);
+            if (owner != _owners.end() && owner->second.generation == generation &&
+                    boundsContain(owner->second.minimum, owner->second.maximum, minimum, maximum)) {
+                _usesOwnerLeaves[i] = true;
+                continue;
+            }
+            float margin = radius * OWNER_MARGIN_SCALE;
+            minimum -= glm::vec3(margin, margin, margin);
+            maximum += glm::vec3(margin, margin, margin);
+        }
+        _minimums[i] = minimum;
+        _maximums[i] = maximum;
+        _levelQueries[descendingCount++] = i;
+    }
+
+    // one descent for all the rest, which finds their leaves in tree order
+    _candidates.clear();
+    if (descendingCount > 0) {
+        descend(_tree->rootNode, glm::vec3(0.0f, 0.0f, 0.0f), 1.0f, 0, descendingCount);
+    }
+
+    // sort the leaves by query, keeping tree order within each query
+    _firstCandidates.assign(queryCount + 1, 0);
+    for (int i = 0; i < (int)_candidates.size(); i++) {
+        _firstCandidates[_candidates[i].query + 1]++;
+    }
+    for (int i = 0; i < queryCount; i++) {
+        _firstCandidates[i + 1] += _firstCandidates[i];
+    }
+    _sortedCandidates.resize(_candidates.size());
+    for (int i = 0; i < (int)_candidates.size(); i++) {
+        _sortedCandidates[_firstCandidates[_candidates[i].query]++] = _candidates[i];
+    }
+    for (int i = queryCount; i > 0; i--) {
+        _firstCandidates[i] = _firstCandidates[i - 1]; // the increments above left each start at the next one's
+    }
+    _firstCandidates[0] = 0;
+
+    for (int i = 0; i < queryCount; i++) {
+        const VoxelCollisionQuery& query = queries[i];
+        const Candidate* leaves = _sortedCandidates.empty() ? NULL : &_sortedCandidates[0] + _firstCandidates[i];
+        int leafCount = _firstCandidates[i + 1] - _firstCandidates[i];
+        if (query.owner) {
+            OwnerLeaves& owner = _owners[query.owner];
+            if (_usesOwnerLeaves[i]) {
+                _coherentQueries++;
+                leaves = owner.leaves.empty() ? NULL : &owner.leaves[0];
+                leafCount = owner.leaves.size();
+            } else {
+                owner.generation = generation;
+                owner.minimum = _minimums[i];
+                owner.maximum = _maximums[i];
+                owner.leaves.assign(leaves, leaves + leafCount);
+            }
+        }
+        checkLeaves(query, i, leaves, leafCount, contacts);
+    }
+}
+
+void VoxelCollider::descend(VoxelNode* node, const glm::vec3& corner, float size, int level, int parentQueryCount) {
+    _nodesVisited++;
+
+    // the queries still in the running are in the slice for our level, we put the ones that reach us in the next
+    if ((int)_levelQueries.size() < (level + 2) * _levelStride) {
+        _levelQueries.resize((level + 2) * _levelStride);
+    }
+    const int* parentQueries = &_levelQueries[level * _levelStride];
+    int* queries = &_levelQueries[(level + 1) * _levelStride];
+    int queryCount = 0;
+    for (int i = 0; i < parentQueryCount; i++) {
+        if (boundsOverlap(corner, size, _minimums[parentQueries[i]], _maximums[parentQueries[i]])) {
+            queries[queryCount++] = parentQueries[i];
+        }
+    }
+    if (queryCount == 0) {
+        return;
+    }
+    if (node->isLeaf()) {
+        Candidate candidate = { 0, node, corner, size };
+        for (int i = 0; i < queryCount; i++) {
+            candidate.query = queries[i];
+            _candidates.push_back(candidate);
+        }
+        return;
+    }
+    float childSize = size * 0.5f;
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* child = node->getChildAtIndex(i);
+        if (child) {
+            glm::vec3 childCorner = corner + glm::vec3((i >> 2) & 1, (i >> 1) & 1, i & 1) * childSize;
+            descend(child, childCorner, childSize, level + 1, queryCount);
+        }
+    }
+}
+
+void VoxelCollider::checkLeaves(const VoxelCollisionQuery& query, int queryIndex, const Candidate* leaves,
+                                int leafCount, std::vector<VoxelContact>& contacts) {
+    glm::vec3 start = query.start / (float)TREE_SCALE;
+    glm::vec3 end = query.end / (float)TREE_SCALE;
+    float radius = query.radius / TREE_SCALE;
+    bool isSphere = (start == end);
+    for (int i = 0; i < leafCount; i++) {
+        const Candidate& leaf = leaves[i];
+        if (!leaf.node->isColored()) {
+            continue;
+        }
+        _leavesChecked++;
+        AABox box;
+        box.setBox(leaf.corner, glm::vec3(leaf.size, leaf.size, leaf.size));
+        glm::vec3 penetration;
+        bool found;
+        if (isSphere) {
+            found = box.expandedContains(start, radius) && box.findSpherePenetration(start, radius, penetration);
+        } else {
+            found = box.expandedIntersectsSegment(start, end, radius) &&
+                box.findCapsulePenetration(start, end, radius, penetration);
+        }
+        if (found) {
+            VoxelContact contact = { queryIndex, leaf.node, penetration * (float)TREE_SCALE };
+            contacts.push_back(contact);
+        }
+    }
+}
+
+void VoxelCollider::combinePenetrations(const std::vector<VoxelContact>& contacts, int queryCount,
+                                        glm::vec3* penetrations) {
+    for (int i = 0; i < queryCount; i++) {
+        penetrations[i] = glm::vec3(0.0f, 0.0f, 0.0f);
+    }
+    for (int i = 0; i < (int)contacts.size(); i++) {
+        penetrations[contacts[i].query] = addPenetrations(penetrations[contacts[i].query], contacts[i].penetration);
+    }
+}
@@ -0,0 +1,110 @@
+//
+//  VoxelCollider.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Sphere and capsule collisions against a voxel tree, a batch at a time. One descent from the root carries every
+//  query in the batch, each level keeps just the queries whose bounds overlap the node, and a subtree no query reaches
+//  is never visited. The colored leaves a query reaches are then checked exactly, with the same AABox tests
+//  VoxelTree::findCapsulePenetration() uses, so each contact is what that would have found, in the same order.
+//
+//  Queries that give an owner (an avatar, say) also get temporal coherence. The leaves found for an owner are kept,
+//  with bounds a little bigger than its query, and as long as its next query fits in those bounds and nothing has
+//  been added to or removed from the tree, that query skips the descent and only checks the kept leaves.
+//
+//  Note: like the VoxelTree itself, a collider is not thread safe. Callers must hold the tree lock.
+//
+
+#ifndef __hifi__VoxelCollider__
+#define __hifi__VoxelCollider__
+
+#include <map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "VoxelTree.h"
+
+// a capsule from start to end, or a sphere if the two are the same, in meters
+class VoxelCollisionQuery {
+public:
+    glm::vec3   start;
+    glm::vec3   end;
+    float       radius;
+    const void* owner;      // NULL for a query that shouldn't be remembered
+};
+
+// a colored leaf one of the queries overlaps, and how far the query went into it, in meters
+class VoxelContact {
+public:
+    int         query;      // index of the query in the batch
+    VoxelNode*  node;
+    glm::vec3   penetration;
+};
+
+class VoxelCollider {
+public:
+    VoxelCollider(VoxelTree* tree);
+
+    // replaces contacts with every contact of every query, grouped by query in batch order, and in tree order within
+    // each query
+    void findContacts(const VoxelCollisionQuery* queries, int queryCount, std::vector<VoxelContact>& contacts);
+
+    // combines the contacts of each query into the single penetration VoxelTree::findCapsulePenetration() gives,
+    // penetrations needs room for queryCount
+    static void combinePenetrations(const std::vector<VoxelContact>& contacts, int queryCount, glm::vec3* penetrations);
+
+    // an owner that's gone can be forgotten to free its leaves, though keeping it does no harm
+    void forgetOwner(const void* owner) { _owners.erase(owner); };
+    void forgetOwners() { _owners.clear(); };
+
+    long getNodesVisited() const { return _nodesVisited; };
+    long getLeavesChecked() const { return _leavesChecked; };
+    long getCoherentQueries() const { return _coherentQueries; };    // that skipped the descent
+    void resetStats() { _nodesVisited = _leavesChecked = _coherentQueries = 0; };
+
+private:
+    // disallow copying of VoxelCollider objects
+    VoxelCollider(const VoxelCollider&);
+    VoxelCollider& operator= (const VoxelCollider&);
+
+    // a leaf a query's bounds reach, all in voxel coordinates
+    class Candidate {
+    public:
+        int         query;
+        VoxelNode*  node;
+        glm::vec3   corner;
+        float       size;
+    };
+
+    // the leaves one owner's bounds reached the last time it had to descend
+    class OwnerLeaves {
+    public:
+        unsigned long           generation;     // of the tree's node pool when they were found
+        glm::vec3               minimum;
+        glm::vec3               maximum;
+        std::vector<Candidate>  leaves;
+    };
+
+    void descend(VoxelNode* node, const glm::vec3& corner, float size, int level, int parentQueryCount);
+    void checkLeaves(const VoxelCollisionQuery& query, int queryIndex, const Candidate* leaves, int leafCount,
+                     std::vector<VoxelContact>& contacts);
+
+    VoxelTree*                          _tree;
+    std::map<const void*, OwnerLeaves>  _owners;
+
+    // scratch for findContacts(), kept between calls so a batch doesn't allocate once they've grown
+    std::vector<glm::vec3>      _minimums;          // each query's bounds, in voxel coordinates
+    std::vector<glm::vec3>      _maximums;
+    std::vector<bool>           _usesOwnerLeaves;   // rather than descending
+    std::vector<int>            _levelQueries;      // the queries still in the running, a slice per level of descent
+    int                         _levelStride;
+    std::vector<Candidate>      _candidates;        // in tree order, for all the queries
+    std::vector<int>            _firstCandidates;   // where each query's candidates start once sorted by query
+    std::vector<Candidate>      _sortedCandidates;
+
+    long _nodesVisited;
+    long _leavesChecked;
+    long _coherentQueries;
+};
+
+#endif /* defined(__hifi__VoxelCollider__) */
@@ -14,6 +14,7 @@
 
 #include <limits.h>
 #include <OctalCode.h>
+#include <BandwidthPacer.h>
 
 // this is where the coordinate system is represented
 const glm::vec3 IDENTITY_RIGHT = glm::vec3( 1.0f, 0.0f, 0.0f);
@@ -24,6 +25,9 @@ const int TREE_SCALE = 128;
 
 const int NUMBER_OF_CHILDREN = 8;
 const int MAX_VOXEL_PACKET_SIZE = 1492;
+// voxel data packets start with their packet header, then the stamp the voxel server paces them with
+const int VOXEL_PACKET_HEADER_BYTES = 1 + PACED_PACKET_STAMP_BYTES;
+const int MAX_VOXEL_PACKET_DATA_BYTES = MAX_VOXEL_PACKET_SIZE - VOXEL_PACKET_HEADER_BYTES;
 const int MAX_TREE_SLICE_BYTES = 26;
 const int MAX_VOXELS_PER_SYSTEM = 200000;
 const int VERTICES_PER_VOXEL = 24;
@@ -0,0 +1,263 @@
+//
+//  VoxelEditLog.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstring>
+#include <fstream>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "Log.h"
+#include "OctalCode.h"
+#include "PacketHeaders.h"
+#include "VoxelTree.h"
+#include "VoxelEditLog.h"
+
+static const char MAGIC[4] = { 'V', 'L', 'O', 'G' };
+static const uint32_t FORMAT_VERSION = 2;
+static const int INITIAL_BUFFER_SIZE = 64 * 1024;
+
+VoxelEditLog::VoxelEditLog() :
+    _file(NULL),
+    _baseGeneration(0),
+    _fileSize(0),
+    _bufferBytes(0),
+    _bufferSize(INITIAL_BUFFER_SIZE),
+    _writeBufferSize(INITIAL_BUFFER_SIZE)
+{
+    pthread_mutex_init(&_bufferMutex, NULL);
+    _buffer = new unsigned char[_bufferSize];
+    _writeBuffer = new unsigned char[_writeBufferSize];
+}
+
+VoxelEditLog::~VoxelEditLog() {
+    close();
+    pthread_mutex_destroy(&_bufferMutex);
+    delete[] _buffer;
+    delete[] _writeBuffer;
+}
+
+std::string VoxelEditLog::fileNameFor(const char* snapshotFileName, uint32_t baseGeneration) {
+    char suffix[32];
+    sprintf(suffix, ".%u.log", baseGeneration);
+    return std::string(snapshotFileName) + suffix;
+}
+
+bool VoxelEditLog::open(const char* fileName, uint32_t baseGeneration) {
+    close();
+    _file = fopen(fileName, "ab");
+    if (!_file) {
+        printLog("unable to open edit log %s\n", fileName);
+        return false;
+    }
+    fseek(_file, 0, SEEK_END);
+    _fileSize = ftell(_file);
+    _baseGeneration = baseGeneration;
+
+    // a brand new log needs its header
+    if (_fileSize == 0) {
+        Header header;
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = FORMAT_VERSION;
+        header.baseGeneration = baseGeneration;
+        header.reserved = 0;
+        fwrite(&header, sizeof(header), 1, _file);
+        fflush(_file);
+        _fileSize = sizeof(header);
+    }
+    return true;
+}
+
+void VoxelEditLog::close() {
+    if (_file) {
+        flush();
+        fclose(_file);
+        _file = NULL;
+    }
+    _fileSize = 0;
+}
+
+// FNV-1a, we only need to notice a batch that didn't make it to disk in one piece
+uint32_t VoxelEditLog::checksum(const unsigned char* data, long bytes) {
+    uint32_t hash = 2166136261u;
+    for (long i = 0; i < bytes; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+void VoxelEditLog::appendToBuffer(const unsigned char* data, int bytes) {
+    if (_bufferBytes + bytes > _bufferSize) {
+        while (_bufferBytes + bytes > _bufferSize) {
+            _bufferSize *= 2;
+        }
+        unsigned char* biggerBuffer = new unsigned char[_bufferSize];
+        memcpy(biggerBuffer, _buffer, _bufferBytes);
+        delete[] _buffer;
+        _buffer = biggerBuffer;
+    }
+    memcpy(_buffer + _bufferBytes, data, bytes);
+    _bufferBytes += bytes;
+}
+
+void VoxelEditLog::logSetVoxel(unsigned char* codeColorBuffer, bool destructive) {
+    unsigned char type = destructive ? PACKET_HEADER_SET_VOXEL_DESTRUCTIVE : PACKET_HEADER_SET_VOXEL;
+    int bytes = bytesRequiredForCodeLength(*codeColorBuffer) + SIZE_OF_COLOR_DATA;
+    pthread_mutex_lock(&_bufferMutex);
+    appendToBuffer(&type, sizeof(type));
+    appendToBuffer(codeColorBuffer, bytes);
+    pthread_mutex_unlock(&_bufferMutex);
+}
+
+void VoxelEditLog::logEraseVoxelBitstream(unsigned char* bitstream, int bufferSizeBytes) {
+    // same layout processRemoveVoxelBitstream() expects, each code is followed by a color we don't need
+    unsigned char type = PACKET_HEADER_ERASE_VOXEL;
+    int atByte = sizeof(short int) + sizeof(PACKET_HEADER);
+    pthread_mutex_lock(&_bufferMutex);
+    while (atByte < bufferSizeBytes) {
+        unsigned char* voxelCode = bitstream + atByte;
+        int codeBytes = bytesRequiredForCodeLength(*voxelCode);
+        appendToBuffer(&type, sizeof(type));
+        appendToBuffer(voxelCode, codeBytes);
+        atByte += codeBytes + SIZE_OF_COLOR_DATA;
+    }
+    pthread_mutex_unlock(&_bufferMutex);
+}
+
+void VoxelEditLog::logEraseAll() {
+    unsigned char type = PACKET_HEADER_Z_COMMAND;
+    pthread_mutex_lock(&_bufferMutex);
+    appendToBuffer(&type, sizeof(type));
+    pthread_mutex_unlock(&_bufferMutex);
+}
+
+bool VoxelEditLog::hasBufferedEdits() {
+    pthread_mutex_lock(&_bufferMutex);
+    bool hasEdits = _bufferBytes > 0;
+    pthread_mutex_unlock(&_bufferMutex);
+    return hasEdits;
+}
+
+long VoxelEditLog::flush() {
+    if (!_file) {
+        return 0;
+    }
+
+    // swap buffers, so edits can keep being logged while we write
+    pthread_mutex_lock(&_bufferMutex);
+    unsigned char* writeBuffer = _buffer;
+    int writeBufferSize = _bufferSize;
+    int writeBytes = _bufferBytes;
+    _buffer = _writeBuffer;
+    _bufferSize = _writeBufferSize;
+    _bufferBytes = 0;
+    _writeBuffer = writeBuffer;
+    _writeBufferSize = writeBufferSize;
+    pthread_mutex_unlock(&_bufferMutex);
+
+    if (writeBytes) {
+        BatchHeader batch;
+        batch.bytes = writeBytes;
+        batch.checksum = checksum(writeBuffer, writeBytes);
+        fwrite(&batch, sizeof(batch), 1, _file);
+        fwrite(writeBuffer, writeBytes, 1, _file);
+        fflush(_file);
+#ifdef _WIN32
+        _commit(_fileno(_file));
+#else
+        fsync(fileno(_file));
+#endif
+        _fileSize += sizeof(batch) + writeBytes;
+    }
+    return writeBytes;
+}
+
+long VoxelEditLog::replay(const char* fileName, VoxelTree* tree) {
+    std::ifstream file(fileName, std::ios::in|std::ios::binary|std::ios::ate);
+    if (!file.is_open()) {
+        return NO_LOG;
+    }
+    long fileLength = file.tellg();
+    file.seekg(0, std::ios::beg);
+    unsigned char* entireFile = new unsigned char[fileLength];
+    file.read((char*)entireFile, fileLength);
+    file.close();
+
+    Header* header = (Header*)entireFile;
+    if (fileLength < (long)sizeof(Header) || memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 
+            || header->version != FORMAT_VERSION) {
+        printLog("%s is not an edit log we can read\n", fileName);
+        delete[] entireFile;
+        return 0;
+    }
+
+    long edits = 0;
+    long atByte = sizeof(Header);
+    while (atByte < fileLength) {
+        // if we went down in the middle of writing a batch, the rest of it never made it to disk
+        BatchHeader* batch = (BatchHeader*)(entireFile + atByte);
+        atByte += sizeof(BatchHeader);
+        if (atByte > fileLength || batch->bytes > fileLength - atByte
+                || checksum(entireFile + atByte, batch->bytes) != batch->checksum) {
+            printLog("%s ends with a partial batch of edits, ignoring it\n", fileName);
+            atByte -= sizeof(BatchHeader);
+            break;
+        }
+        long batchEdits = replayBatch(entireFile + atByte, batch->bytes, tree);
+        if (batchEdits == NO_LOG) {
+            printLog("%s has a batch of edits we can't read, ignoring the rest of it\n", fileName);
+            atByte -= sizeof(BatchHeader);
+            break;
+        }
+        edits += batchEdits;
+        atByte += batch->bytes;
+    }
+
+    // cut off whatever we ignored, otherwise edits appended to this log later would be stuck behind it
+    if (atByte < fileLength) {
+        std::ofstream truncatedFile(fileName, std::ios::out|std::ios::binary|std::ios::trunc);
+        truncatedFile.write((const char*)entireFile, atByte);
+    }
+    delete[] entireFile;
+    return edits;
+}
+
+long VoxelEditLog::replayBatch(const unsigned char* batch, long bytes, VoxelTree* tree) {
+    long edits = 0;
+    long atByte = 0;
+    while (atByte < bytes) {
+        unsigned char type = batch[atByte];
+        unsigned char* voxelCode = (unsigned char*)batch + atByte + sizeof(type);
+        int recordBytes = sizeof(type);
+        if (type != PACKET_HEADER_Z_COMMAND) {
+            if (atByte + recordBytes >= bytes) {
+                return NO_LOG;
+            }
+            recordBytes += bytesRequiredForCodeLength(*voxelCode);
+            if (type != PACKET_HEADER_ERASE_VOXEL) {
+                recordBytes += SIZE_OF_COLOR_DATA;
+            }
+        }
+        if (atByte + recordBytes > bytes) {
+            return NO_LOG;
+        }
+
+        if (type == PACKET_HEADER_SET_VOXEL || type == PACKET_HEADER_SET_VOXEL_DESTRUCTIVE) {
+            tree->readCodeColorBufferToTree(voxelCode, type == PACKET_HEADER_SET_VOXEL_DESTRUCTIVE);
+        } else if (type == PACKET_HEADER_ERASE_VOXEL) {
+            tree->deleteVoxelCodeFromTree(voxelCode, ACTUALLY_DELETE, COLLAPSE_EMPTY_TREE);
+        } else if (type == PACKET_HEADER_Z_COMMAND) {
+            tree->eraseAllVoxels();
+        } else {
+            return NO_LOG;
+        }
+        edits++;
+        atByte += recordBytes;
+    }
+    return edits;
+}
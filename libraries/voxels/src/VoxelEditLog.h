@@ -0,0 +1,97 @@
+//
+//  VoxelEditLog.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Append-only log of the edits made to a VoxelTree since its last snapshot was saved. Each log starts with a header
+//  holding the generation of the snapshot it applies on top of, followed by batches of edits. Each flush() writes one
+//  batch, a byte count and checksum followed by one record per edit:
+//
+//      PACKET_HEADER_SET_VOXEL             octal code, then 3 bytes of color
+//      PACKET_HEADER_SET_VOXEL_DESTRUCTIVE octal code, then 3 bytes of color
+//      PACKET_HEADER_ERASE_VOXEL           octal code
+//      PACKET_HEADER_Z_COMMAND             nothing, the whole tree was erased
+//
+//  Edits are buffered in memory by whoever applies them, and written out by flush(), usually on another thread. flush()
+//  doesn't return until the batch is on disk, so flushing every few milliseconds commits the edits from that whole
+//  window with a single fsync. A batch that was only partly written when we went down fails its checksum, and it and
+//  anything after it are ignored by replay().
+//
+
+#ifndef __hifi__VoxelEditLog__
+#define __hifi__VoxelEditLog__
+
+#include <cstdio>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+class VoxelTree;
+
+class VoxelEditLog {
+public:
+    static const int NO_LOG = -1;
+
+    VoxelEditLog();
+    ~VoxelEditLog();
+
+    // logs are named after the snapshot they belong to, and the generation of the snapshot they apply on top of
+    static std::string fileNameFor(const char* snapshotFileName, uint32_t baseGeneration);
+
+    // opens the log for appending, creating it if it doesn't exist yet
+    bool open(const char* fileName, uint32_t baseGeneration);
+    void close();
+    bool isOpen() const { return _file != NULL; };
+    uint32_t getBaseGeneration() const { return _baseGeneration; };
+    long getFileSize() const { return _fileSize; };
+
+    // these only buffer the edit, they're safe to call while another thread is flushing
+    void logSetVoxel(unsigned char* codeColorBuffer, bool destructive);
+    void logEraseVoxelBitstream(unsigned char* bitstream, int bufferSizeBytes); // a PACKET_HEADER_ERASE_VOXEL packet
+    void logEraseAll();
+    bool hasBufferedEdits();
+
+    // writes the buffered edits to the file as one batch and syncs it to disk, returns the number of bytes of edits
+    // written. Only one thread should be flushing, opening or closing the log
+    long flush();
+
+    // applies the edits in a log to the tree, returns the number of edits, or NO_LOG if there's no log by that name. A
+    // partly written batch at the end of the log is dropped from the file, so the log can be appended to again
+    static long replay(const char* fileName, VoxelTree* tree);
+
+private:
+    // disallow copying of VoxelEditLog objects
+    VoxelEditLog(const VoxelEditLog&);
+    VoxelEditLog& operator= (const VoxelEditLog&);
+
+    class Header {
+    public:
+        char        magic[4];
+        uint32_t    version;
+        uint32_t    baseGeneration;
+        uint32_t    reserved;
+    };
+
+    class BatchHeader {
+    public:
+        uint32_t    bytes;      // of edit records that follow
+        uint32_t    checksum;   // of those records
+    };
+
+    static uint32_t checksum(const unsigned char* data, long bytes);
+    static long replayBatch(const unsigned char* batch, long bytes, VoxelTree* tree); // NO_LOG if it can't be read
+    void appendToBuffer(const unsigned char* data, int bytes);
+
+    FILE*           _file;
+    uint32_t        _baseGeneration;
+    long            _fileSize;
+    pthread_mutex_t _bufferMutex;
+    unsigned char*  _buffer;            // edits that haven't been written yet
+    int             _bufferBytes;
+    int             _bufferSize;
+    unsigned char*  _writeBuffer;       // swapped with _buffer while flushing, so editing doesn't wait for the disk
+    int             _writeBufferSize;
+};
+
+#endif /* defined(__hifi__VoxelEditLog__) */
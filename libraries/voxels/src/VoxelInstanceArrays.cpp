@@ -0,0 +1,192 @@
+//
+//  VoxelInstanceArrays.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include "VoxelInstanceArrays.h"
+
+// the cube VoxelSystem draws, three times over so each face gets its own vertices and normals
+static const float IDENTITY_VERTICES[VERTEX_POINTS_PER_VOXEL] = {
+    0,0,0, 1,0,0, 1,1,0, 0,1,0, 0,0,1, 1,0,1, 1,1,1, 0,1,1,
+    0,0,0, 1,0,0, 1,1,0, 0,1,0, 0,0,1, 1,0,1, 1,1,1, 0,1,1,
+    0,0,0, 1,0,0, 1,1,0, 0,1,0, 0,0,1, 1,0,1, 1,1,1, 0,1,1 };
+
+VoxelInstanceArrays::VoxelInstanceArrays(int maxVoxels) :
+    _maxVoxels(maxVoxels),
+    _voxelsInWriteArrays(0),
+    _voxelsInReadArrays(0),
+    _writeFullRebuild(true),
+    _wroteFullRebuild(false) {
+    _writeInstances = new VoxelInstance[_maxVoxels];
+    _readInstances = new VoxelInstance[_maxVoxels];
+    _writeVoxelDirtyArray = new bool[_maxVoxels];
+    _readVoxelDirtyArray = new bool[_maxVoxels];
+    memset(_writeVoxelDirtyArray, false, _maxVoxels * sizeof(bool));
+    memset(_readVoxelDirtyArray, false, _maxVoxels * sizeof(bool));
+}
+
+VoxelInstanceArrays::~VoxelInstanceArrays() {
+    delete[] _writeInstances;
+    delete[] _readInstances;
+    delete[] _writeVoxelDirtyArray;
+    delete[] _readVoxelDirtyArray;
+}
+
+int VoxelInstanceArrays::treeToArrays(VoxelTree* tree, const ViewFrustum& viewFrustum) {
+    _wroteFullRebuild = _writeFullRebuild;
+    if (_writeFullRebuild) {
+        _voxelsInWriteArrays = 0;
+    }
+    int voxelsUpdated = treeToArraysRecursion(tree, tree->rootNode, glm::vec3(0.0f, 0.0f, 0.0f), 1.0f, viewFrustum);
+    tree->clearDirtyBit();
+    _writeFullRebuild = false;
+    return voxelsUpdated;
+}
+
+// the node's corner and scale come down from its parent rather than from its octal code, they're the same floats
+int VoxelInstanceArrays::treeToArraysRecursion(VoxelTree* tree, VoxelNode* node, const glm::vec3& corner, float scale,
+                                               const ViewFrustum& viewFrustum) {
+    int voxelsUpdated = 0;
+    bool shouldRender = false;
+    if (node->isColored()) {
+        glm::vec3 center = (corner + glm::vec3(scale * 0.5f)) * (float)TREE_SCALE;
+        glm::vec3 temp = viewFrustum.getPosition() - center;
+        float distanceToNode = sqrtf(glm::dot(temp, temp));
+        float boundary = boundaryDistanceForRenderLevel(node->getLevel());
+        float childBoundary = boundaryDistanceForRenderLevel(node->getLevel() + 1);
+        bool inBoundary = (distanceToNode <= boundary);
+        bool inChildBoundary = (distanceToNode <= childBoundary);
+        shouldRender = (node->isLeaf() && inChildBoundary) || (inBoundary && !inChildBoundary);
+    }
+    node->setShouldRender(shouldRender && !node->isStagedForDeletion());
+    if (!node->isLeaf()) {
+        float childScale = scale * 0.5f;
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            VoxelNode* child = node->getChildAtIndex(i);
+            if (child) {
+                glm::vec3 childCorner = corner + glm::vec3((i >> 2) & 1, (i >> 1) & 1, i & 1) * childScale;
+                voxelsUpdated += treeToArraysRecursion(tree, child, childCorner, childScale, viewFrustum);
+            }
+        }
+    }
+    voxelsUpdated += updateNodeInArrays(node, corner, scale);
+    node->clearDirtyBit();
+
+    // the arrays no longer have the node, so it can go
+    if (node->isStagedForDeletion()) {
+        tree->deleteVoxelCodeFromTree(node->getOctalCode());
+    }
+    return voxelsUpdated;
+}
+
+int VoxelInstanceArrays::updateNodeInArrays(VoxelNode* node, const glm::vec3& corner, float scale) {
+    if (_voxelsInWriteArrays >= (unsigned long)_maxVoxels) {
+        return 0;
+    }
+    if (_wroteFullRebuild) {
+        if (!node->getShouldRender()) {
+            node->setBufferIndex(GLBUFFER_INDEX_UNKNOWN);
+            return 0;
+        }
+        glBufferIndex index = _voxelsInWriteArrays++;
+        writeInstance(index, corner, scale, node->getColor());
+        node->setBufferIndex(index);
+        return 1;
+    }
+    if (!node->isDirty()) {
+        return 0;
+    }
+
+    // a voxel that's no longer drawn keeps its place, but far away and infinitely small
+    glm::vec3 drawnCorner(FLT_MAX, FLT_MAX, FLT_MAX);
+    float drawnScale = 0.0f;
+    if (node->getShouldRender()) {
+        drawnCorner = corner;
+        drawnScale = scale;
+    }
+    glBufferIndex index;
+    if (node->isKnownBufferIndex()) {
+        index = node->getBufferIndex();
+    } else {
+        index = _voxelsInWriteArrays++;
+        node->setBufferIndex(index);
+    }
+    writeInstance(index, drawnCorner, drawnScale, node->getColor());
+    return 1;
+}
+
+void VoxelInstanceArrays::writeInstance(glBufferIndex index, const glm::vec3& corner, float scale,
+                                        const nodeColor& color) {
+    VoxelInstance& instance = _writeInstances[index];
+    instance.corner[0] = corner.x;
+    instance.corner[1] = corner.y;
+    instance.corner[2] = corner.z;
+    instance.scale = scale;
+    instance.color[0] = color[0];
+    instance.color[1] = color[1];
+    instance.color[2] = color[2];
+    instance.color[3] = 0;
+    _writeVoxelDirtyArray[index] = true;
+}
+
+void VoxelInstanceArrays::copyWrittenDataToReadArrays() {
+    if (_wroteFullRebuild) {
+        if (_voxelsInWriteArrays > 0) {
+            copyWrittenDataSegmentToReadArrays(0, _voxelsInWriteArrays - 1);
+        }
+        memset(_writeVoxelDirtyArray, false, _voxelsInWriteArrays * sizeof(bool));
+        memset(_readVoxelDirtyArray, true, _voxelsInWriteArrays * sizeof(bool));
+        _wroteFullRebuild = false;
+    } else {
+        // just the runs of dirty voxels
+        glBufferIndex segmentStart = 0;
+        bool inSegment = false;
+        for (glBufferIndex i = 0; i < _voxelsInWriteArrays; i++) {
+            bool thisVoxelDirty = _writeVoxelDirtyArray[i];
+            _readVoxelDirtyArray[i] |= thisVoxelDirty;
+            _writeVoxelDirtyArray[i] = false;
+            if (!inSegment && thisVoxelDirty) {
+                segmentStart = i;
+                inSegment = true;
+            } else if (inSegment && !thisVoxelDirty) {
+                copyWrittenDataSegmentToReadArrays(segmentStart, i - 1);
+                inSegment = false;
+            }
+        }
+        if (inSegment) {
+            copyWrittenDataSegmentToReadArrays(segmentStart, _voxelsInWriteArrays - 1);
+        }
+    }
+    _voxelsInReadArrays = _voxelsInWriteArrays;
+}
+
+void VoxelInstanceArrays::copyWrittenDataSegmentToReadArrays(glBufferIndex segmentStart, glBufferIndex segmentEnd) {
+    memcpy(_readInstances + segmentStart, _writeInstances + segmentStart,
+           (segmentEnd - segmentStart + 1) * sizeof(VoxelInstance));
+}
+
+void VoxelInstanceArrays::clearReadVoxelDirtyArray() {
+    memset(_readVoxelDirtyArray, false, _voxelsInReadArrays * sizeof(bool));
+}
+
+void VoxelInstanceArrays::expandVertices(const VoxelInstance* instances, int count, float* vertices,
+                                         unsigned char* colors) {
+    for (int i = 0; i < count; i++) {
+        const VoxelInstance& instance = instances[i];
+        for (int j = 0; j < VERTEX_POINTS_PER_VOXEL; j++) {
+            vertices[j] = instance.corner[j % 3] + IDENTITY_VERTICES[j] * instance.scale;
+            colors[j] = instance.color[j % 3];
+        }
+        vertices += VERTEX_POINTS_PER_VOXEL;
+        colors += VERTEX_POINTS_PER_VOXEL;
+    }
+}
+
+long VoxelInstanceArrays::getMemoryUsage() const {
+    return (long)_maxVoxels * 2 * (sizeof(VoxelInstance) + sizeof(bool));
+}
@@ -0,0 +1,82 @@
+//
+//  VoxelInstanceArrays.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  The voxels a client should render, one compact record per voxel rather than the VERTICES_PER_VOXEL vertices and
+//  colors VoxelSystem expands each voxel to as it writes its arrays. The arrays are built from the tree the way
+//  VoxelSystem::newTreeToArrays() builds its own, either all of them or just the voxels whose nodes are dirty, into
+//  write arrays that are then copied to read arrays for the renderer. Making vertices from the records is left to
+//  whoever draws them, see expandVertices().
+//
+//  Note: this needs no GL context, so the array building can be timed headlessly, see voxel-benchmarks.
+//
+
+#ifndef __hifi__VoxelInstanceArrays__
+#define __hifi__VoxelInstanceArrays__
+
+#include "ViewFrustum.h"
+#include "VoxelConstants.h"
+#include "VoxelTree.h"
+
+// one voxel as it's drawn, in voxel coordinates
+class VoxelInstance {
+public:
+    float           corner[3];  // FLT_MAX for a voxel that's no longer drawn
+    float           scale;      // 0 for a voxel that's no longer drawn
+    unsigned char   color[4];   // red, green and blue, the last byte is padding
+};
+
+class VoxelInstanceArrays {
+public:
+    VoxelInstanceArrays(int maxVoxels = MAX_VOXELS_PER_SYSTEM);
+    ~VoxelInstanceArrays();
+
+    // writes the voxels of the tree that should be drawn from the view, all of them after setWantFullRebuild() or
+    // the first time, otherwise just the ones whose nodes are dirty. Like VoxelSystem, this sets each node's
+    // shouldRender and buffer index, clears its dirty bit and deletes the nodes staged for deletion. Returns the
+    // number of voxels written.
+    int treeToArrays(VoxelTree* tree, const ViewFrustum& viewFrustum);
+
+    // once some voxels have been removed, the arrays have to be built from scratch
+    void setWantFullRebuild() { _writeFullRebuild = true; };
+
+    // copies what the last treeToArrays() wrote to the read arrays
+    void copyWrittenDataToReadArrays();
+
+    const VoxelInstance* getReadInstances() const { return _readInstances; };
+    unsigned long getVoxelsInReadArrays() const { return _voxelsInReadArrays; };
+    bool isReadVoxelDirty(glBufferIndex index) const { return _readVoxelDirtyArray[index]; };
+    void clearReadVoxelDirtyArray();
+
+    // the later stage, the VERTEX_POINTS_PER_VOXEL vertex points and colors VoxelSystem would have written for each
+    // record, vertices and colors need room for count * VERTEX_POINTS_PER_VOXEL
+    static void expandVertices(const VoxelInstance* instances, int count, float* vertices, unsigned char* colors);
+
+    // what the arrays take, in bytes
+    long getMemoryUsage() const;
+
+private:
+    // disallow copying of VoxelInstanceArrays objects
+    VoxelInstanceArrays(const VoxelInstanceArrays&);
+    VoxelInstanceArrays& operator= (const VoxelInstanceArrays&);
+
+    int treeToArraysRecursion(VoxelTree* tree, VoxelNode* node, const glm::vec3& corner, float scale,
+                              const ViewFrustum& viewFrustum);
+    int updateNodeInArrays(VoxelNode* node, const glm::vec3& corner, float scale);
+    void writeInstance(glBufferIndex index, const glm::vec3& corner, float scale, const nodeColor& color);
+    void copyWrittenDataSegmentToReadArrays(glBufferIndex segmentStart, glBufferIndex segmentEnd);
+
+    int _maxVoxels;
+    VoxelInstance* _writeInstances;
+    VoxelInstance* _readInstances;
+    bool* _writeVoxelDirtyArray;
+    bool* _readVoxelDirtyArray;
+    unsigned long _voxelsInWriteArrays;
+    unsigned long _voxelsInReadArrays;
+    bool _writeFullRebuild;     // for the next treeToArrays()
+    bool _wroteFullRebuild;     // in the last one, so it's all copied to the read arrays
+};
+
+#endif /* defined(__hifi__VoxelInstanceArrays__) */
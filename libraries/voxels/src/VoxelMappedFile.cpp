@@ -0,0 +1,289 @@
+//
+//  VoxelMappedFile.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "Log.h"
+#include "OctalCode.h"
+#include "VoxelNode.h"
+#include "VoxelMappedFile.h"
+
+const char* VoxelMappedFile::FILE_EXTENSION = ".msvo";
+
+static const char MAGIC[4] = { 'M', 'S', 'V', 'O' };
+
+VoxelMappedFile::VoxelMappedFile() :
+    _mapping(NULL),
+    _fileSize(0),
+    _header(NULL),
+    _levelIndex(NULL),
+    _records(NULL)
+{
+}
+
+VoxelMappedFile::~VoxelMappedFile() {
+    close();
+}
+
+// counts the nodes at each level below node, level 0 being node itself
+static void countNodesInLevels(VoxelNode* node, int level, std::vector<uint32_t>& nodesInLevel) {
+    if ((int)nodesInLevel.size() <= level) {
+        nodesInLevel.push_back(0);
+    }
+    nodesInLevel[level]++;
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* child = node->getChildAtIndex(i);
+        if (child) {
+            countNodesInLevels(child, level + 1, nodesInLevel);
+        }
+    }
+}
+
+unsigned char* VoxelMappedFile::serialize(VoxelNode* rootNode, uint32_t generation, long& bytes) {
+    std::vector<uint32_t> nodesInLevel;
+    countNodesInLevels(rootNode, 0, nodesInLevel);
+
+    Header header;
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FORMAT_VERSION;
+    header.levelCount = nodesInLevel.size();
+    header.nodeCount = 0;
+    header.levelIndexOffset = sizeof(Header);
+    header.recordsOffset = sizeof(Header) + header.levelCount * sizeof(LevelIndexEntry);
+    header.generation = generation;
+    header.reserved = 0;
+    for (uint32_t level = 0; level < header.levelCount; level++) {
+        header.nodeCount += nodesInLevel[level];
+    }
+    if (header.nodeCount & Record::COLORED_BIT) {
+        printLog("%u nodes is too many for the mapped SVO format\n", header.nodeCount);
+        bytes = 0;
+        return NULL;
+    }
+
+    bytes = header.recordsOffset + (long)header.nodeCount * sizeof(Record);
+    unsigned char* image = new unsigned char[bytes];
+    memcpy(image, &header, sizeof(header));
+    LevelIndexEntry* levelIndex = (LevelIndexEntry*)(image + header.levelIndexOffset);
+    uint32_t firstRecord = 0;
+    for (uint32_t level = 0; level < header.levelCount; level++) {
+        levelIndex[level].firstRecord = firstRecord;
+        levelIndex[level].recordCount = nodesInLevel[level];
+        firstRecord += nodesInLevel[level];
+    }
+
+    // lay the records out a level at a time, each node's children go in the next level in the same order as their
+    // parents, so we always know where a node's children will land
+    Record* record = (Record*)(image + header.recordsOffset);
+    std::vector<VoxelNode*> thisLevel(1, rootNode);
+    std::vector<VoxelNode*> nextLevel;
+    for (uint32_t level = 0; level < header.levelCount; level++) {
+        uint32_t nextChildRecord = (level + 1 < header.levelCount) ? levelIndex[level + 1].firstRecord : 0;
+        nextLevel.clear();
+        for (int n = 0; n < (int)thisLevel.size(); n++) {
+            VoxelNode* levelNode = thisLevel[n];
+            record->firstChildAndColored = nextChildRecord | (levelNode->isColored() ? Record::COLORED_BIT : 0);
+            memcpy(record->color, levelNode->getTrueColor(), sizeof(record->color));
+            record->childBitmask = levelNode->getChildBitmask();
+            record->density = levelNode->getDensity();
+            record++;
+
+            for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+                VoxelNode* child = levelNode->getChildAtIndex(i);
+                if (child) {
+                    nextLevel.push_back(child);
+                    nextChildRecord++;
+                }
+            }
+        }
+        thisLevel.swap(nextLevel);
+    }
+    return image;
+}
+
+bool VoxelMappedFile::write(const char* fileName, const unsigned char* image, long bytes) {
+    std::string temporaryFileName = std::string(fileName) + ".tmp";
+    FILE* file = fopen(temporaryFileName.c_str(), "wb");
+    if (!file) {
+        printLog("unable to save %s\n", fileName);
+        return false;
+    }
+    bool written = fwrite(image, bytes, 1, file) == 1 && fflush(file) == 0;
+
+    // make sure it's really on disk before it replaces the old one, edit logs are removed once a snapshot is saved
+#ifdef _WIN32
+    written = written && _commit(_fileno(file)) == 0;
+#else
+    written = written && fsync(fileno(file)) == 0;
+#endif
+    fclose(file);
+
+    // rename() replaces the old file in one step, anyone who has it mapped keeps seeing the old contents
+    if (!written || rename(temporaryFileName.c_str(), fileName) != 0) {
+        printLog("unable to save %s\n", fileName);
+        remove(temporaryFileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool VoxelMappedFile::write(const char* fileName, VoxelNode* rootNode, uint32_t generation) {
+    long bytes = 0;
+    unsigned char* image = serialize(rootNode, generation, bytes);
+    bool written = image && write(fileName, image, bytes);
+    delete[] image;
+    return written;
+}
+
+bool VoxelMappedFile::isMappedFile(const char* fileName) {
+    char magic[sizeof(MAGIC)];
+    std::ifstream file(fileName, std::ios::in|std::ios::binary);
+    return file.is_open() && file.read(magic, sizeof(magic)) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+bool VoxelMappedFile::open(const char* fileName) {
+    close();
+
+#ifdef _WIN32
+    // no mmap here, so just read the whole thing in, the records are still used in place
+    std::ifstream file(fileName, std::ios::in|std::ios::binary|std::ios::ate);
+    if (!file.is_open()) {
+        return false;
+    }
+    _fileSize = file.tellg();
+    file.seekg(0, std::ios::beg);
+    _mapping = new unsigned char[_fileSize];
+    file.read((char*)_mapping, _fileSize);
+#else
+    int fileDescriptor = ::open(fileName, O_RDONLY);
+    if (fileDescriptor < 0) {
+        return false;
+    }
+    struct stat fileStats;
+    if (fstat(fileDescriptor, &fileStats) != 0 || fileStats.st_size < (off_t)sizeof(Header)) {
+        ::close(fileDescriptor);
+        return false;
+    }
+    _fileSize = fileStats.st_size;
+    void* mapping = mmap(NULL, _fileSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    ::close(fileDescriptor); // the mapping keeps the file alive
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    _mapping = (unsigned char*)mapping;
+#endif
+
+    _header = (const Header*)_mapping;
+    if (_fileSize < (long)sizeof(Header) || memcmp(_header->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        printLog("%s is not a mapped SVO file\n", fileName);
+        close();
+        return false;
+    }
+    if (_header->version != FORMAT_VERSION) {
+        printLog("%s is version %u of the mapped SVO format, we only read version %u\n",
+                 fileName, _header->version, FORMAT_VERSION);
+        close();
+        return false;
+    }
+    if (_header->levelCount == 0 || _header->nodeCount == 0 ||
+        _header->levelIndexOffset > (uint64_t)_fileSize || _header->recordsOffset > (uint64_t)_fileSize ||
+        _header->levelIndexOffset + (uint64_t)_header->levelCount * sizeof(LevelIndexEntry) > (uint64_t)_fileSize ||
+        _header->recordsOffset + (uint64_t)_header->nodeCount * sizeof(Record) > (uint64_t)_fileSize) {
+        printLog("%s is truncated\n", fileName);
+        close();
+        return false;
+    }
+    _levelIndex = (const LevelIndexEntry*)(_mapping + _header->levelIndexOffset);
+    _records = (const Record*)(_mapping + _header->recordsOffset);
+    if (!isLaidOutRight()) {
+        printLog("%s is damaged\n", fileName);
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool VoxelMappedFile::isLaidOutRight() const {
+    uint64_t firstRecord = 0;
+    for (uint32_t level = 0; level < _header->levelCount; level++) {
+        if (_levelIndex[level].firstRecord != firstRecord) {
+            return false;
+        }
+        firstRecord += _levelIndex[level].recordCount;
+    }
+    if (firstRecord != _header->nodeCount) {
+        return false;
+    }
+
+    // the records are laid out a level at a time, so every node's children start right after the children of the
+    // nodes before it. Checking that once here is what lets everything else follow child indexes without bounds checks
+    uint64_t nextChildRecord = 1;
+    for (uint32_t index = 0; index < _header->nodeCount; index++) {
+        const Record& record = _records[index];
+        if (record.childBitmask) {
+            if (record.getFirstChild() != nextChildRecord || nextChildRecord <= index) {
+                return false;
+            }
+            for (unsigned char bits = record.childBitmask; bits; bits &= bits - 1) {
+                nextChildRecord++;
+            }
+        }
+    }
+    return nextChildRecord == _header->nodeCount;
+}
+
+void VoxelMappedFile::close() {
+    if (_mapping) {
+#ifdef _WIN32
+        delete[] _mapping;
+#else
+        munmap(_mapping, _fileSize);
+#endif
+    }
+    _mapping = NULL;
+    _fileSize = 0;
+    _header = NULL;
+    _levelIndex = NULL;
+    _records = NULL;
+}
+
+uint32_t VoxelMappedFile::getChildRecord(uint32_t index, int childIndex) const {
+    const Record& record = _records[index];
+    if (!(record.childBitmask & (1 << childIndex))) {
+        return NO_RECORD;
+    }
+    // our children's records are in child index order, so skip over the ones before this child
+    uint32_t childRecord = record.getFirstChild();
+    for (int i = 0; i < childIndex; i++) {
+        if (record.childBitmask & (1 << i)) {
+            childRecord++;
+        }
+    }
+    return childRecord;
+}
+
+uint32_t VoxelMappedFile::findRecord(unsigned char* octalCode) const {
+    uint32_t index = 0;
+    int sections = numberOfThreeBitSectionsInCode(octalCode);
+    for (int i = 0; i < sections && index != NO_RECORD; i++) {
+        int childIndex = sectionValue(octalCode + 1 + (BITS_IN_OCTAL * i / BITS_IN_BYTE),
+                                      (BITS_IN_OCTAL * i) % BITS_IN_BYTE);
+        index = getChildRecord(index, childIndex);
+    }
+    return index;
+}
@@ -0,0 +1,112 @@
+//
+//  VoxelMappedFile.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  The mapped SVO file format. Unlike the wire format SVO files, which have to be decoded front to back, these files
+//  are laid out so they can be mmap'ed and used in place:
+//
+//      header          magic "MSVO", format version, level count, node count, offsets of the level index and records,
+//                      and a generation number that edit logs use to tell which snapshot they apply to
+//      level index     for each level of the tree, the index of its first record and its record count
+//      records         one 12 byte record per node, the root first, then each level of the tree in order
+//
+//  Every record knows where its children start, so any node can be found from its octal code by walking down from
+//  the root without touching the rest of the file, which is what lets a VoxelTree materialize subtrees lazily.
+//
+//  Note: integers are stored in the native byte order, files aren't meant to move between machines of different
+//  endianness.
+//
+
+#ifndef __hifi__VoxelMappedFile__
+#define __hifi__VoxelMappedFile__
+
+#include <stdint.h>
+
+class VoxelNode;
+
+class VoxelMappedFile {
+public:
+    static const char* FILE_EXTENSION;
+    static const uint32_t FORMAT_VERSION = 2;
+    static const uint32_t NO_RECORD = 0xFFFFFFFF;
+
+    class Header {
+    public:
+        char        magic[4];
+        uint32_t    version;
+        uint32_t    levelCount;
+        uint32_t    nodeCount;
+        uint64_t    levelIndexOffset;
+        uint64_t    recordsOffset;
+        uint32_t    generation;
+        uint32_t    reserved;
+    };
+
+    class LevelIndexEntry {
+    public:
+        uint32_t    firstRecord;
+        uint32_t    recordCount;
+    };
+
+    class Record {
+    public:
+        static const uint32_t COLORED_BIT = 0x80000000;
+
+        uint32_t        firstChildAndColored; // index of our first child's record, high bit set if we're colored
+        unsigned char   color[3];
+        unsigned char   childBitmask;         // same bit order as VoxelNode, bit i is child index i
+        float           density;
+
+        uint32_t getFirstChild() const { return firstChildAndColored & ~COLORED_BIT; };
+        bool isColored() const { return (firstChildAndColored & COLORED_BIT) != 0; };
+    };
+
+    VoxelMappedFile();
+    ~VoxelMappedFile();
+
+    // writes a whole tree in the mapped format, to a temporary file which then replaces fileName. That way a file
+    // which is currently mapped can be safely overwritten
+    static bool write(const char* fileName, VoxelNode* rootNode, uint32_t generation = 0);
+
+    // the same thing in two steps, so the tree only needs to be locked while it's being laid out in memory. The caller
+    // owns the returned image and needs to delete[] it
+    static unsigned char* serialize(VoxelNode* rootNode, uint32_t generation, long& bytes);
+    static bool write(const char* fileName, const unsigned char* image, long bytes);
+
+    // true if the file starts with a mapped SVO header, so callers can tell the formats apart
+    static bool isMappedFile(const char* fileName);
+
+    // false if the file can't be mapped, or its header, level index or the child indexes in its records don't add up
+    bool open(const char* fileName);
+    void close();
+    bool isOpen() const { return _records != 0; };
+
+    int getLevelCount() const { return _header ? _header->levelCount : 0; };
+    int getNodeCount() const { return _header ? _header->nodeCount : 0; };
+    uint32_t getGeneration() const { return _header ? _header->generation : 0; };
+    long getFileSize() const { return _fileSize; };
+    const LevelIndexEntry& getLevel(int level) const { return _levelIndex[level]; };
+
+    const Record& getRecord(uint32_t index) const { return _records[index]; };
+    uint32_t getChildRecord(uint32_t index, int childIndex) const;
+
+    // walks down from the root, returns NO_RECORD if there's no node with this octal code in the file
+    uint32_t findRecord(unsigned char* octalCode) const;
+
+private:
+    // disallow copying of VoxelMappedFile objects
+    VoxelMappedFile(const VoxelMappedFile&);
+    VoxelMappedFile& operator= (const VoxelMappedFile&);
+
+    bool isLaidOutRight() const;
+
+    unsigned char*          _mapping;
+    long                    _fileSize;
+    const Header*           _header;
+    const LevelIndexEntry*  _levelIndex;
+    const Record*           _records;
+};
+
+#endif /* defined(__hifi__VoxelMappedFile__) */
@@ -0,0 +1,212 @@
+//
+//  VoxelMesher.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cmath>
+#include "VoxelMesher.h"
+
+void VoxelMesh::clear() {
+    vertices.clear();
+    normals.clear();
+    colors.clear();
+    indices.clear();
+}
+
+long VoxelMesh::getMemoryUsage() const {
+    return vertices.size() * sizeof(float) + normals.size() * sizeof(float) + colors.size() +
+        indices.size() * sizeof(uint32_t);
+}
+
+VoxelMesher::VoxelMesher(VoxelTree* tree) :
+    _tree(tree),
+    _cullHiddenFaces(true),
+    _mergeFaces(true),
+    _voxels(0),
+    _facesCulled(0),
+    _facesEmitted(0),
+    _quadsEmitted(0) {
+}
+
+bool VoxelMesher::Face::operator<(const Face& other) const {
+    if (direction != other.direction) {
+        return direction < other.direction;
+    }
+    if (level != other.level) {
+        return level < other.level;
+    }
+    if (plane != other.plane) {
+        return plane < other.plane;
+    }
+    if (color != other.color) {
+        return color < other.color;
+    }
+    if (v != other.v) {
+        return v < other.v;
+    }
+    return u < other.u;
+}
+
+void VoxelMesher::build(const VoxelInstance* instances, int count, VoxelMesh& mesh) {
+    mesh.clear();
+    _faces.clear();
+    for (int i = 0; i < count; i++) {
+        const VoxelInstance& instance = instances[i];
+        if (instance.scale == 0.0f) {
+            continue; // no longer drawn
+        }
+        int exponent;
+        frexpf(instance.scale, &exponent);
+        int level = 1 - exponent;
+        if (level > MAX_MESH_LEVEL) {
+            continue; // a tree never gets this deep, see MortonKey::MAX_LEVELS
+        }
+        _voxels++;
+        uint64_t cell[3];
+        for (int axis = 0; axis < 3; axis++) {
+            cell[axis] = (uint64_t)ldexp((double)instance.corner[axis], level);
+        }
+        uint32_t color = instance.color[0] | (instance.color[1] << 8) | (instance.color[2] << 16);
+        for (int direction = 0; direction < FACES_PER_VOXEL; direction++) {
+            int axis = direction / 2;
+            bool positive = (direction & 1);
+            if (_cullHiddenFaces) {
+                // a neighbor past either edge of the world wraps around to a coordinate that's out of range
+                uint64_t neighbor[3] = { cell[0], cell[1], cell[2] };
+                neighbor[axis] += positive ? 1 : -1;
+                if (isSolidCell(level, neighbor[0], neighbor[1], neighbor[2])) {
+                    _facesCulled++;
+                    continue;
+                }
+            }
+            _facesEmitted++;
+            Face face;
+            face.direction = direction;
+            face.level = level;
+            face.plane = cell[axis] + (positive ? 1 : 0);
+            face.color = color;
+            face.u = cell[(axis + 1) % 3];
+            face.v = cell[(axis + 2) % 3];
+            if (_mergeFaces) {
+                _faces.push_back(face);
+            } else {
+                Quad quad = { face.u, face.u + 1, face.v, face.v + 1 };
+                addQuad(face, quad, mesh);
+            }
+        }
+    }
+    if (!_mergeFaces || _faces.empty()) {
+        return;
+    }
+
+    // faces that could merge end up next to each other, by row and then along it
+    std::sort(_faces.begin(), _faces.end());
+    int start = 0;
+    for (int i = 1; i <= (int)_faces.size(); i++) {
+        if (i == (int)_faces.size() || !_faces[i].isCoplanarWith(_faces[start])) {
+            mergeFaces(&_faces[start], i - start, mesh);
+            start = i;
+        }
+    }
+}
+
+bool VoxelMesher::isSolidCell(int level, uint64_t x, uint64_t y, uint64_t z) const {
+    uint64_t cells = (uint64_t)1 << level;
+    if (x >= cells || y >= cells || z >= cells) {
+        return false;
+    }
+    VoxelNode* node = _tree->rootNode;
+    for (int nodeLevel = 0; nodeLevel < level; nodeLevel++) {
+        if (node->isLeaf()) {
+            return node->isColored() && !node->isStagedForDeletion();
+        }
+        int shift = level - 1 - nodeLevel;
+        int childIndex = (int)((((x >> shift) & 1) << 2) | (((y >> shift) & 1) << 1) | ((z >> shift) & 1));
+        node = node->getChildAtIndex(childIndex);
+        if (!node) {
+            return false;
+        }
+    }
+    return node->isColored() && !node->isStagedForDeletion() && (node->isLeaf() || node->getShouldRender());
+}
+
+// Faces that all face the same way in the same plane with the same color, sorted by row and along it. Each row is cut
+// into runs of neighboring faces, and a run that exactly spans a quad from the row before grows that quad instead of
+// starting a new one.
+void VoxelMesher::mergeFaces(const Face* faces, int count, VoxelMesh& mesh) {
+    _openQuads.clear();
+    uint64_t lastRow = 0;
+    int i = 0;
+    while (i < count) {
+        uint64_t row = faces[i].v;
+        if (row != lastRow + 1) {
+            for (int j = 0; j < (int)_openQuads.size(); j++) {
+                addQuad(faces[0], _openQuads[j], mesh);
+            }
+            _openQuads.clear();
+        }
+        _nextOpenQuads.clear();
+        int open = 0;
+        while (i < count && faces[i].v == row) {
+            Quad run = { faces[i].u, faces[i].u + 1, row, row + 1 };
+            for (i++; i < count && faces[i].v == row && faces[i].u == run.u1; i++) {
+                run.u1++;
+            }
+            // the quads from the last row that start before this run, or with it but aren't as long, are done
+            while (open < (int)_openQuads.size() && (_openQuads[open].u0 < run.u0 ||
+                    (_openQuads[open].u0 == run.u0 && _openQuads[open].u1 != run.u1))) {
+                addQuad(faces[0], _openQuads[open++], mesh);
+            }
+            if (open < (int)_openQuads.size() && _openQuads[open].u0 == run.u0) {
+                run.v0 = _openQuads[open++].v0;
+            }
+            _nextOpenQuads.push_back(run);
+        }
+        for (; open < (int)_openQuads.size(); open++) {
+            addQuad(faces[0], _openQuads[open], mesh);
+        }
+        _openQuads.swap(_nextOpenQuads);
+        lastRow = row;
+    }
+    for (int j = 0; j < (int)_openQuads.size(); j++) {
+        addQuad(faces[0], _openQuads[j], mesh);
+    }
+}
+
+void VoxelMesher::addQuad(const Face& face, const Quad& quad, VoxelMesh& mesh) {
+    _quadsEmitted++;
+    int axis = face.direction / 2;
+    bool positive = (face.direction & 1);
+    int uAxis = (axis + 1) % 3;
+    int vAxis = (axis + 2) % 3;
+    double scale = ldexp(1.0, -face.level);
+
+    // counterclockwise seen from outside the voxel, u cross v points along the positive axis
+    uint64_t corners[VoxelMesh::VERTICES_PER_QUAD][2] = {
+        { quad.u0, quad.v0 }, { quad.u1, quad.v0 }, { quad.u1, quad.v1 }, { quad.u0, quad.v1 } };
+    if (!positive) {
+        std::swap(corners[1][0], corners[3][0]);
+        std::swap(corners[1][1], corners[3][1]);
+    }
+    uint32_t firstVertex = mesh.vertices.size() / 3;
+    for (int i = 0; i < VoxelMesh::VERTICES_PER_QUAD; i++) {
+        float vertex[3];
+        vertex[axis] = (float)(face.plane * scale);
+        vertex[uAxis] = (float)(corners[i][0] * scale);
+        vertex[vAxis] = (float)(corners[i][1] * scale);
+        float normal[3] = { 0.0f, 0.0f, 0.0f };
+        normal[axis] = positive ? 1.0f : -1.0f;
+        for (int j = 0; j < 3; j++) {
+            mesh.vertices.push_back(vertex[j]);
+            mesh.normals.push_back(normal[j]);
+            mesh.colors.push_back((face.color >> (8 * j)) & 0xFF);
+        }
+    }
+    const uint32_t QUAD_INDICES[VoxelMesh::INDICES_PER_QUAD] = { 0, 1, 2, 0, 2, 3 };
+    for (int i = 0; i < VoxelMesh::INDICES_PER_QUAD; i++) {
+        mesh.indices.push_back(firstVertex + QUAD_INDICES[i]);
+    }
+}
@@ -0,0 +1,111 @@
+//
+//  VoxelMesher.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Builds the faces of the voxels a client draws, rather than the whole cube VoxelSystem draws for every one of them.
+//  A face is dropped when the cell of the same size on the other side of it is solid, which is found by descending the
+//  tree to that cell: a colored leaf on the way down fills it, and so does a colored node at its level that's a leaf
+//  or being drawn. Anything less, a node whose children only partly fill the cell say, keeps the face, so culling
+//  never opens a hole. The faces that are left can be merged greedily into bigger quads when they face the same way,
+//  lie in the same plane, have the same color and belong to voxels of the same level.
+//
+//  Note: the voxels come from VoxelInstanceArrays, whose treeToArrays() also sets the shouldRender the neighbor test
+//  looks at. Like the tree, a mesher is not thread safe, callers must hold the tree lock.
+//
+
+#ifndef __hifi__VoxelMesher__
+#define __hifi__VoxelMesher__
+
+#include <stdint.h>
+#include <vector>
+#include "VoxelInstanceArrays.h"
+#include "VoxelTree.h"
+
+// quads, in voxel coordinates, as two triangles each
+class VoxelMesh {
+public:
+    static const int VERTICES_PER_QUAD = 4;
+    static const int INDICES_PER_QUAD = 6;
+
+    std::vector<float>          vertices;   // x, y and z of each vertex
+    std::vector<float>          normals;    // of each vertex
+    std::vector<unsigned char>  colors;     // red, green and blue of each vertex
+    std::vector<uint32_t>       indices;
+
+    void clear();
+    int getQuadCount() const { return vertices.size() / (VERTICES_PER_QUAD * 3); };
+    long getMemoryUsage() const;
+};
+
+class VoxelMesher {
+public:
+    VoxelMesher(VoxelTree* tree);
+
+    void setCullHiddenFaces(bool cullHiddenFaces) { _cullHiddenFaces = cullHiddenFaces; };
+    void setMergeFaces(bool mergeFaces) { _mergeFaces = mergeFaces; };
+
+    // replaces the mesh with the faces of the voxels, skipping the ones that aren't drawn
+    void build(const VoxelInstance* instances, int count, VoxelMesh& mesh);
+
+    // since the last resetStats()
+    long getVoxels() const { return _voxels; };
+    long getFacesCulled() const { return _facesCulled; };
+    long getFacesEmitted() const { return _facesEmitted; };     // before merging
+    long getQuadsEmitted() const { return _quadsEmitted; };     // after merging
+    void resetStats() { _voxels = _facesCulled = _facesEmitted = _quadsEmitted = 0; };
+
+private:
+    // disallow copying of VoxelMesher objects
+    VoxelMesher(const VoxelMesher&);
+    VoxelMesher& operator= (const VoxelMesher&);
+
+    static const int FACES_PER_VOXEL = 6;
+    static const int MAX_MESH_LEVEL = 62;   // so a level's cell coordinates fit in 64 bits
+
+    // one face of a voxel, in the cell coordinates of its level. Directions are -x, +x, -y, +y, -z and +z, for a face
+    // along axis a, u is along axis a + 1 and v along axis a + 2, wrapping around
+    class Face {
+    public:
+        int         direction;
+        int         level;
+        uint64_t    plane;
+        uint32_t    color;
+        uint64_t    v;
+        uint64_t    u;
+
+        bool operator<(const Face& other) const;
+        bool isCoplanarWith(const Face& other) const {
+            return direction == other.direction && level == other.level && plane == other.plane &&
+                color == other.color;
+        };
+    };
+
+    // faces merged along u and v
+    class Quad {
+    public:
+        uint64_t    u0;
+        uint64_t    u1;
+        uint64_t    v0;
+        uint64_t    v1;
+    };
+
+    bool isSolidCell(int level, uint64_t x, uint64_t y, uint64_t z) const;
+    void mergeFaces(const Face* faces, int count, VoxelMesh& mesh);
+    void addQuad(const Face& face, const Quad& quad, VoxelMesh& mesh);
+
+    VoxelTree*          _tree;
+    bool                _cullHiddenFaces;
+    bool                _mergeFaces;
+    std::vector<Face>   _faces;             // scratch for build(), kept so it doesn't allocate once it's grown
+    std::vector<Quad>   _openQuads;         // merging, the quads that reached the last row
+    std::vector<Quad>   _nextOpenQuads;
+
+    long _voxels;
+    long _facesCulled;
+    long _facesEmitted;
+    long _quadsEmitted;
+};
+
+#endif /* defined(__hifi__VoxelMesher__) */
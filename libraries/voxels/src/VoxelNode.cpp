@@ -18,48 +18,114 @@
 #include "AABox.h"
 
 VoxelNode::VoxelNode() {
-    unsigned char* rootCode = new unsigned char[1];
-    *rootCode = 0;
-    init(rootCode);
+    init();
+    *allocateOctalCode(1) = 0;
 }
 
 VoxelNode::VoxelNode(unsigned char * octalCode) {
-    init(octalCode);
+    // keep our own copy of the code, the caller still owns their buffer
+    init();
+    int codeBytes = bytesRequiredForCodeLength(*octalCode);
+    memcpy(allocateOctalCode(codeBytes), octalCode, codeBytes);
 }
 
-void VoxelNode::init(unsigned char * octalCode) {
-    _octalCode = octalCode;
-    
-#ifndef NO_FALSE_COLOR // !NO_FALSE_COLOR means, does have false color
-    _falseColored = false; // assume true color
-    _currentColor[0] = _currentColor[1] = _currentColor[2] = _currentColor[3] = 0;
-#endif
+VoxelNode::VoxelNode(VoxelNode* parent, int childIndex) {
+    // build the child's code directly in place, rather than new[]'ing it with childOctalCode()
+    init();
+    int codeBytes = bytesRequiredForCodeLength(*parent->getOctalCode() + 1);
+    copyChildOctalCode(parent->getOctalCode(), childIndex, allocateOctalCode(codeBytes));
+}
+
+void VoxelNode::init() {
     _trueColor[0] = _trueColor[1] = _trueColor[2] = _trueColor[3] = 0;
     _density = 0.0f;
-    
-    // default pointers to child nodes to NULL
-    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-        _children[i] = NULL;
-    }
-    _childCount = 0;
-    
-    _glBufferIndex = GLBUFFER_INDEX_UNKNOWN;
-    _isDirty = true;
-    _shouldRender = false;
-    _isStagedForDeletion = false;
+    _children = NULL;
+    _childBitmask = 0;
+    _clientData = NULL;
+    _flags = DIRTY_BIT;
     markWithChangedTime();
-    calculateAABox();
+}
+
+// short codes live inside the node, longer ones come from our pool
+unsigned char* VoxelNode::allocateOctalCode(int bytes) {
+    if (bytes <= MAX_INLINE_OCTAL_CODE_BYTES) {
+        _flags |= INLINE_OCTAL_CODE_BIT;
+        return _octalCode.buffer;
+    }
+    _octalCode.pointer = VoxelNodePool::poolFor(this)->allocateOctalCode(bytes);
+    return _octalCode.pointer;
 }
 
 VoxelNode::~VoxelNode() {
-    delete[] _octalCode;
+    if (!(_flags & INLINE_OCTAL_CODE_BIT)) {
+        VoxelNodePool::releaseOctalCode(_octalCode.pointer, bytesRequiredForCodeLength(*_octalCode.pointer));
+    }
+    if (_clientData) {
+        VoxelNodePool::release(_clientData, sizeof(VoxelNodeClientData));
+    }
     
     // delete all of this node's children
-    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-        if (_children[i]) {
-            delete _children[i];
+    int childCount = getChildCount();
+    for (int i = 0; i < childCount; i++) {
+        delete _children[i];
+    }
+    if (_children) {
+        VoxelNodePool::release(_children, childCount * sizeof(VoxelNode*));
+    }
+}
+
+VoxelNodeClientData* VoxelNode::getClientData() {
+    if (!_clientData) {
+        _clientData = (VoxelNodeClientData*)VoxelNodePool::poolFor(this)->allocate(sizeof(VoxelNodeClientData));
+        _clientData->bufferIndex = GLBUFFER_INDEX_UNKNOWN;
+        memset(_clientData->falseColor, 0, sizeof(nodeColor));
+        _clientData->falseColored = false;
+        _clientData->shouldRender = false;
+    }
+    return _clientData;
+}
+
+void VoxelNode::setBufferIndex(glBufferIndex index) {
+    if (_clientData || index != GLBUFFER_INDEX_UNKNOWN) {
+        getClientData()->bufferIndex = index;
+    }
+}
+
+// Moves our existing children into a child array of a new size, leaving a gap at insertAtSlot or dropping the child
+// at removeFromSlot (pass -1 for neither). Call this before updating _childBitmask.
+void VoxelNode::resizeChildren(int childCount, int insertAtSlot, int removeFromSlot) {
+    int oldChildCount = getChildCount();
+    VoxelNode** children = NULL;
+    if (childCount > 0) {
+        children = (VoxelNode**)VoxelNodePool::poolFor(this)->allocate(childCount * sizeof(VoxelNode*));
+        int slot = 0;
+        for (int oldSlot = 0; oldSlot < oldChildCount; oldSlot++) {
+            if (slot == insertAtSlot) {
+                children[slot++] = NULL;
+            }
+            if (oldSlot != removeFromSlot) {
+                children[slot++] = _children[oldSlot];
+            }
+        }
+        if (slot == insertAtSlot) {
+            children[slot] = NULL;
         }
     }
+    if (_children) {
+        VoxelNodePool::release(_children, oldChildCount * sizeof(VoxelNode*));
+    }
+    _children = children;
+}
+
+int VoxelNode::getMemoryUsage() const {
+    int bytes = sizeof(VoxelNode) + sizeof(VoxelNode*); // every node but the root has a slot in its parent's array
+    if (!(_flags & INLINE_OCTAL_CODE_BIT)) {
+        bytes += bytesRequiredForCodeLength(*_octalCode.pointer);
+    }
+    if (_clientData) {
+        bytes += sizeof(VoxelNodeClientData);
+    }
+    return bytes;
 }
 
 // This method is called by VoxelTree when the subtree below this node
@@ -69,6 +135,9 @@ VoxelNode::~VoxelNode() {
 // localized, because this method will get called for every node in an
 // recursive unwinding case like delete or add voxel
 void VoxelNode::handleSubtreeChanged(VoxelTree* myTree) {
+    // we're called after the changed descendants have marked themselves, so this leaves our _lastChanged at least
+    // as new as anything below us. That's what lets the encoder skip whole subtrees that haven't changed since a
+    // client last received them, see EncodeBitstreamParams::lastSentTime
     markWithChangedTime();
     
     // here's a good place to do color re-averaging...
@@ -80,58 +149,98 @@ void VoxelNode::handleSubtreeChanged(VoxelTree* myTree) {
 
 void VoxelNode::setShouldRender(bool shouldRender) {
     // if shouldRender is changing, then consider ourselves dirty
-    if (shouldRender != _shouldRender) {
-        _shouldRender = shouldRender;
-        _isDirty = true;
+    if (shouldRender != getShouldRender()) {
+        getClientData()->shouldRender = shouldRender;
+        setDirty();
         markWithChangedTime();
     }
 }
 
-void VoxelNode::calculateAABox() {
-    
+glm::vec3 VoxelNode::getCorner() const {
     glm::vec3 corner;
-    glm::vec3 size;
-    
-    // copy corner into box
-    copyFirstVertexForCode(_octalCode,(float*)&corner);
-    
+    copyFirstVertexForCode(getOctalCode(), (float*)&corner);
+    return corner;
+}
+
+float VoxelNode::getScale() const {
     // this tells you the "size" of the voxel
-    float voxelScale = 1 / powf(2, *_octalCode);
-    size = glm::vec3(voxelScale,voxelScale,voxelScale);
-    
-    _box.setBox(corner,size);
+    return ldexpf(1.0f, -*getOctalCode());
+}
+
+glm::vec3 VoxelNode::getCenter() const {
+    return getCorner() + glm::vec3(getScale() * 0.5f);
+}
+
+AABox VoxelNode::getAABox() const {
+    AABox box;
+    float scale = getScale();
+    box.setBox(getCorner(), glm::vec3(scale, scale, scale));
+    return box;
 }
 
 void VoxelNode::deleteChildAtIndex(int childIndex) {
-    if (_children[childIndex]) {
-        delete _children[childIndex];
-        _children[childIndex] = NULL;
-        _isDirty = true;
-        markWithChangedTime();
-        _childCount--;
+    VoxelNode* childToDelete = removeChildAtIndex(childIndex);
+    if (childToDelete) {
+        delete childToDelete;
     }
 }
 
 // does not delete the node!
 VoxelNode* VoxelNode::removeChildAtIndex(int childIndex) {
-    VoxelNode* returnedChild = _children[childIndex];
-    if (_children[childIndex]) {
-        _children[childIndex] = NULL;
-        _isDirty = true;
+    VoxelNode* returnedChild = getChildAtIndex(childIndex);
+    if (returnedChild) {
+        resizeChildren(getChildCount() - 1, -1, childSlotFor(childIndex));
+        _childBitmask &= ~(1 << childIndex);
+        setDirty();
         markWithChangedTime();
-        _childCount--;
     }
     return returnedChild;
 }
 
 VoxelNode* VoxelNode::addChildAtIndex(int childIndex) {
-    if (!_children[childIndex]) {
-        _children[childIndex] = new VoxelNode(childOctalCode(_octalCode, childIndex));
-        _isDirty = true;
+    VoxelNode* child = getChildAtIndex(childIndex);
+    if (!child) {
+        child = new (*VoxelNodePool::poolFor(this)) VoxelNode(this, childIndex);
+        int slot = childSlotFor(childIndex);
+        resizeChildren(getChildCount() + 1, slot, -1);
+        _children[slot] = child;
+        _childBitmask |= (1 << childIndex);
+        setDirty();
         markWithChangedTime();
-        _childCount++;
     }
-    return _children[childIndex];
+    return child;
+}
+
+// adds every child in childBits (bit i for child index i) that doesn't exist yet, making the child array once for all
+// of them rather than once per child as addChildAtIndex() would, returns the bits of the children it added
+unsigned char VoxelNode::addChildrenAtIndexes(unsigned char childBits) {
+    unsigned char addedBits = childBits & ~_childBitmask;
+    if (addedBits) {
+        int oldChildCount = getChildCount();
+        int childCount = 0;
+        for (unsigned char bits = _childBitmask | addedBits; bits; bits &= bits - 1) {
+            childCount++;
+        }
+        VoxelNodePool* pool = VoxelNodePool::poolFor(this);
+        VoxelNode** children = (VoxelNode**)pool->allocate(childCount * sizeof(VoxelNode*));
+        int slot = 0;
+        int oldSlot = 0;
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            if (addedBits & (1 << i)) {
+                children[slot++] = new (*pool) VoxelNode(this, i);
+            } else if (_childBitmask & (1 << i)) {
+                children[slot++] = _children[oldSlot++];
+            }
+        }
+        if (_children) {
+            VoxelNodePool::release(_children, oldChildCount * sizeof(VoxelNode*));
+        }
+        _children = children;
+        _childBitmask |= addedBits;
+        setDirty();
+        markWithChangedTime();
+    }
+    return addedBits;
 }
 
 // handles staging or deletion of all deep children
@@ -152,10 +261,10 @@ void VoxelNode::safeDeepDeleteChildAtIndex(int childIndex, bool& stagedForDeleti
         }
         if (stagedForDeletion) {
             childToDelete->stageForDeletion();
-            _isDirty = true;
+            setDirty();
         } else {
             deleteChildAtIndex(childIndex);
-            _isDirty = true;
+            setDirty();
         } 
         markWithChangedTime();
     }
@@ -165,16 +274,15 @@ void VoxelNode::safeDeepDeleteChildAtIndex(int childIndex, bool& stagedForDeleti
 void VoxelNode::setColorFromAverageOfChildren() {
     int colorArray[4] = {0,0,0,0};
     float density = 0.0f;
-    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-        if (_children[i] && !_children[i]->isStagedForDeletion() && _children[i]->isColored()) {
+    int childCount = getChildCount();
+    for (int i = 0; i < childCount; i++) {
+        if (!_children[i]->isStagedForDeletion() && _children[i]->isColored()) {
             for (int j = 0; j < 3; j++) {
                 colorArray[j] += _children[i]->getTrueColor()[j]; // color averaging should always be based on true colors
             }
             colorArray[3]++;
         }
-        if (_children[i]) {
-            density += _children[i]->getDensity();
-        }
+        density += _children[i]->getDensity();
     }
     density /= (float) NUMBER_OF_CHILDREN;    
     //
@@ -206,25 +314,27 @@ void VoxelNode::setColorFromAverageOfChildren() {
 //       the actual NO_FALSE_COLOR version are inline in the VoxelNode.h
 #ifndef NO_FALSE_COLOR // !NO_FALSE_COLOR means, does have false color
 void VoxelNode::setFalseColor(colorPart red, colorPart green, colorPart blue) {
-    if (_falseColored != true || _currentColor[0] != red || _currentColor[1] != green || _currentColor[2] != blue) {
-        _falseColored=true;
-        _currentColor[0] = red;
-        _currentColor[1] = green;
-        _currentColor[2] = blue;
-        _currentColor[3] = 1; // XXXBHG - False colors are always considered set
-        _isDirty = true;
+    if (!getFalseColored() || _clientData->falseColor[0] != red || _clientData->falseColor[1] != green 
+            || _clientData->falseColor[2] != blue) {
+        VoxelNodeClientData* clientData = getClientData();
+        clientData->falseColored = true;
+        clientData->falseColor[0] = red;
+        clientData->falseColor[1] = green;
+        clientData->falseColor[2] = blue;
+        clientData->falseColor[3] = 1; // XXXBHG - False colors are always considered set
+        setDirty();
         markWithChangedTime();
     }
 }
 
 void VoxelNode::setFalseColored(bool isFalseColored) {
-    if (_falseColored != isFalseColored) {
-        // if we were false colored, and are no longer false colored, then swap back
-        if (_falseColored && !isFalseColored) {
-            memcpy(&_currentColor,&_trueColor,sizeof(nodeColor));
+    if (getFalseColored() != isFalseColored) {
+        // if we are becoming false colored, we keep showing our true color until we're given a false one
+        if (isFalseColored) {
+            memcpy(&getClientData()->falseColor, &_trueColor, sizeof(nodeColor));
         }
-        _falseColored = isFalseColored; 
-        _isDirty = true;
+        _clientData->falseColored = isFalseColored; 
+        setDirty();
         markWithChangedTime();
         _density = 1.0f;       //   If color set, assume leaf, re-averaging will update density if needed.
 
@@ -235,10 +345,7 @@ void VoxelNode::setFalseColored(bool isFalseColored) {
 void VoxelNode::setColor(const nodeColor& color) {
     if (_trueColor[0] != color[0] || _trueColor[1] != color[1] || _trueColor[2] != color[2]) {
         memcpy(&_trueColor,&color,sizeof(nodeColor));
-        if (!_falseColored) {
-            memcpy(&_currentColor,&color,sizeof(nodeColor));
-        }
-        _isDirty = true;
+        setDirty();
         markWithChangedTime();
         _density = 1.0f;       //   If color set, assume leaf, re-averaging will update density if needed.
     }
@@ -255,17 +362,18 @@ bool VoxelNode::collapseIdenticalLeaves() {
     int red,green,blue;
     for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
         // if no child, child isn't a leaf, or child doesn't have a color
-        if (!_children[i] || _children[i]->isStagedForDeletion() || !_children[i]->isLeaf() || !_children[i]->isColored()) {
+        VoxelNode* child = getChildAtIndex(i);
+        if (!child || child->isStagedForDeletion() || !child->isLeaf() || !child->isColored()) {
             allChildrenMatch=false;
             //printLog("SADNESS child missing or not colored! i=%d\n",i);
             break;
         } else {
             if (i==0) {
-                red   = _children[i]->getColor()[0];
-                green = _children[i]->getColor()[1];
-                blue  = _children[i]->getColor()[2];
-            } else if (red != _children[i]->getColor()[0] || 
-                    green != _children[i]->getColor()[1] || blue != _children[i]->getColor()[2]) {
+                red   = child->getColor()[0];
+                green = child->getColor()[1];
+                blue  = child->getColor()[2];
+            } else if (red != child->getColor()[0] || 
+                    green != child->getColor()[1] || blue != child->getColor()[2]) {
                 allChildrenMatch=false;
                 break;
             }
@@ -276,10 +384,8 @@ bool VoxelNode::collapseIdenticalLeaves() {
     if (allChildrenMatch) {
         //printLog("allChildrenMatch: pruning tree\n");
         for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-            delete _children[i]; // delete all the child nodes
-            _children[i]=NULL; // set it to NULL
+            deleteChildAtIndex(i); // delete all the child nodes
         }
-        _childCount = 0;
         nodeColor collapsedColor;
         collapsedColor[0]=red;        
         collapsedColor[1]=green;        
@@ -301,21 +407,17 @@ void VoxelNode::setRandomColor(int minimumBrightness) {
 }
 
 void VoxelNode::printDebugDetails(const char* label) const {
-    unsigned char childBits = 0;
-    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-        if (_children[i]) {
-            setAtBit(childBits,i);            
-        }
-    }
+    unsigned char childBits = _childBitmask;
+    glm::vec3 corner = getCorner();
 
     printLog("%s - Voxel at corner=(%f,%f,%f) size=%f\n isLeaf=%s isColored=%s (%d,%d,%d,%d) isDirty=%s shouldRender=%s\n children=", label,
-        _box.getCorner().x, _box.getCorner().y, _box.getCorner().z, _box.getSize().x,
+        corner.x, corner.y, corner.z, getScale(),
         debug::valueOf(isLeaf()), debug::valueOf(isColored()), getColor()[0], getColor()[1], getColor()[2], getColor()[3],
         debug::valueOf(isDirty()), debug::valueOf(getShouldRender()));
         
     outputBits(childBits, false);
     printLog("\n octalCode=");
-    printOctalCode(_octalCode);
+    printOctalCode(getOctalCode());
 }
 
 float VoxelNode::getEnclosingRadius() const {
@@ -323,34 +425,38 @@ float VoxelNode::getEnclosingRadius() const {
 }
 
 bool VoxelNode::isInView(const ViewFrustum& viewFrustum) const {
-    AABox box = _box; // use temporary box so we can scale it
+    AABox box = getAABox();
     box.scale(TREE_SCALE);
     bool inView = (ViewFrustum::OUTSIDE != viewFrustum.boxInFrustum(box));
     return inView;
 }
 
 ViewFrustum::location VoxelNode::inFrustum(const ViewFrustum& viewFrustum) const {
-    AABox box = _box; // use temporary box so we can scale it
+    AABox box = getAABox();
     box.scale(TREE_SCALE);
     return viewFrustum.boxInFrustum(box);
 }
 
 float VoxelNode::distanceToCamera(const ViewFrustum& viewFrustum) const {
-    glm::vec3 center = _box.getCenter() * (float)TREE_SCALE;
+    glm::vec3 center = getCenter() * (float)TREE_SCALE;
     glm::vec3 temp = viewFrustum.getPosition() - center;
     float distanceSquared = glm::dot(temp, temp);
     float distanceToVoxelCenter = sqrtf(distanceSquared);
     return distanceToVoxelCenter;
 }
 
+float VoxelNode::lodDistanceToCamera(const ViewFrustum& viewFrustum) const {
+    return distanceToCamera(viewFrustum) / boundaryDistanceForRenderLevel(getLevel());
+}
+
 float VoxelNode::distanceSquareToPoint(const glm::vec3& point) const {
-    glm::vec3 temp = point - _box.getCenter();
+    glm::vec3 temp = point - getCenter();
     float distanceSquare = glm::dot(temp, temp);
     return distanceSquare;
 }
 
 float VoxelNode::distanceToPoint(const glm::vec3& point) const {
-    glm::vec3 temp = point - _box.getCenter();
+    glm::vec3 temp = point - getCenter();
     float distanceSquare = glm::dot(temp, temp);
     float distance = sqrtf(distanceSquare);
     return distance;
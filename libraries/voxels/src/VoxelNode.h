@@ -13,6 +13,7 @@
 #include "AABox.h"
 #include "ViewFrustum.h"
 #include "VoxelConstants.h"
+#include "VoxelNodePool.h"
 
 class VoxelTree; // forward delclaration
 
@@ -20,49 +21,90 @@ typedef unsigned char colorPart;
 typedef unsigned char nodeColor[4];
 typedef unsigned char rgbColor[3];
 
+// State that only matters to a client that renders the tree (VoxelSystem). Servers never touch it, so it's kept out
+// of VoxelNode and only allocated the first time one of these fields is set to something other than its default.
+class VoxelNodeClientData {
+public:
+    glBufferIndex   bufferIndex;
+    nodeColor       falseColor;
+    bool            falseColored;
+    bool            shouldRender;
+};
+
 class VoxelNode {
 private:
-    nodeColor _trueColor;
-#ifndef NO_FALSE_COLOR // !NO_FALSE_COLOR means, does have false color
-    nodeColor _currentColor;
-    bool      _falseColored;
-#endif
-    glBufferIndex _glBufferIndex;
-    bool _isDirty;
-    long long _lastChanged;
-    bool _shouldRender;
-    bool _isStagedForDeletion;
-    AABox _box;
-    unsigned char* _octalCode;
-    VoxelNode* _children[8];
-    int _childCount;
+    // flags bits
+    static const unsigned char DIRTY_BIT                = 0x01;
+    static const unsigned char STAGED_FOR_DELETION_BIT  = 0x02;
+    static const unsigned char INLINE_OCTAL_CODE_BIT    = 0x04;
+    static const unsigned char CHILDREN_ON_DISK_BIT     = 0x08;
+    static const unsigned char DESCENDANTS_ON_DISK_BIT  = 0x10;
+
+    // codes up to this size are kept inside the node, deeper codes are allocated from the pool
+    static const int MAX_INLINE_OCTAL_CODE_BYTES = sizeof(unsigned char*);
+
+    union {
+        unsigned char*  pointer;
+        unsigned char   buffer[MAX_INLINE_OCTAL_CODE_BYTES];
+    } _octalCode;
+    VoxelNode** _children;      // only the children that exist, in child index order, see _childBitmask
+    VoxelNodeClientData* _clientData;
+    long long _lastChanged;     // newest change to this node or anything below it, see handleSubtreeChanged()
     float _density;             // If leaf: density = 1, if internal node: 0-1 density of voxels inside
+    nodeColor _trueColor;
+    unsigned char _childBitmask;
+    unsigned char _flags;
 
-    void calculateAABox();
+    void init();
+    unsigned char* allocateOctalCode(int bytes);
+    void setDirty() { _flags |= DIRTY_BIT; };
+    VoxelNodeClientData* getClientData();
+    void resizeChildren(int childCount, int insertAtSlot, int removeFromSlot);
 
-    void init(unsigned char * octalCode);
+    // position of a child in _children, which is the number of existing children before it
+    int childSlotFor(int childIndex) const {
+        unsigned char before = _childBitmask & ((1 << childIndex) - 1);
+        before = before - ((before >> 1) & 0x55);
+        before = (before & 0x33) + ((before >> 2) & 0x33);
+        return (before + (before >> 4)) & 0x0F;
+    };
+
+    VoxelNode(VoxelNode* parent, int childIndex); // child constructor, used by addChildAtIndex()
 
 public:
     VoxelNode(); // root node constructor
-    VoxelNode(unsigned char * octalCode); // regular constructor
+    VoxelNode(unsigned char * octalCode); // regular constructor, copies the octal code
     ~VoxelNode();
+
+    // VoxelNodes always live in a VoxelNodePool, and their children are allocated from the same pool. A plain new
+    // uses the default pool, VoxelTree uses placement new with its own pool. Don't create VoxelNodes on the stack.
+    static void* operator new(size_t size) { return VoxelNodePool::getDefaultPool()->allocate(size); };
+    static void* operator new(size_t size, VoxelNodePool& pool) { return pool.allocate(size); };
+    static void operator delete(void* node, size_t size) { VoxelNodePool::release(node, size); };
+    static void operator delete(void* node, VoxelNodePool& pool) { VoxelNodePool::release(node, sizeof(VoxelNode)); };
     
-    unsigned char* getOctalCode() const { return _octalCode; };
-    VoxelNode* getChildAtIndex(int childIndex) const { return _children[childIndex]; };
+    unsigned char* getOctalCode() const { 
+        return (_flags & INLINE_OCTAL_CODE_BIT) ? (unsigned char*)_octalCode.buffer : _octalCode.pointer; 
+    };
+    VoxelNode* getChildAtIndex(int childIndex) const {
+        return (_childBitmask & (1 << childIndex)) ? _children[childSlotFor(childIndex)] : NULL;
+    };
     void deleteChildAtIndex(int childIndex);
     VoxelNode* removeChildAtIndex(int childIndex);
     VoxelNode* addChildAtIndex(int childIndex);
+    unsigned char addChildrenAtIndexes(unsigned char childBits); // returns the bits of the children added
     void safeDeepDeleteChildAtIndex(int childIndex, bool& stagedForDeletion); // handles staging or deletion of all descendents
 
     void setColorFromAverageOfChildren();
     void setRandomColor(int minimumBrightness);
     bool collapseIdenticalLeaves();
 
-    const AABox& getAABox() const { return _box; };
-    const glm::vec3& getCenter() const { return _box.getCenter(); };
-    const glm::vec3& getCorner() const { return _box.getCorner(); };
-    float getScale() const { return _box.getSize().x;  /* voxelScale = (1 / powf(2, *node->getOctalCode())); */ };
-    int getLevel() const { return *_octalCode + 1; /* one based or zero based? */ };
+    // the box isn't stored in the node, these are all calculated from the octal code
+    AABox getAABox() const;
+    glm::vec3 getCenter() const;
+    glm::vec3 getCorner() const;
+    float getScale() const;
+    int getLevel() const { return *getOctalCode() + 1; /* one based or zero based? */ };
     
     float getEnclosingRadius() const;
     
@@ -70,39 +112,59 @@ public:
     bool isInView(const ViewFrustum& viewFrustum) const; 
     ViewFrustum::location inFrustum(const ViewFrustum& viewFrustum) const;
     float distanceToCamera(const ViewFrustum& viewFrustum) const; 
+    // distanceToCamera() relative to the LOD boundary for our level, below 1 we're in range and the smaller it is the
+    // bigger we are on screen
+    float lodDistanceToCamera(const ViewFrustum& viewFrustum) const;
     
     // points are assumed to be in Voxel Coordinates (not TREE_SCALE'd)
     float distanceSquareToPoint(const glm::vec3& point) const; // when you don't need the actual distance, use this.
     float distanceToPoint(const glm::vec3& point) const;
 
-    bool isLeaf() const { return _childCount == 0; }
-    int getChildCount() const { return _childCount; }
+    bool isLeaf() const { return _childBitmask == 0; }
+    int getChildCount() const { return childSlotFor(NUMBER_OF_CHILDREN); }
+    unsigned char getChildBitmask() const { return _childBitmask; }
     void printDebugDetails(const char* label) const;
-    bool isDirty() const { return _isDirty; };
-    void clearDirtyBit() { _isDirty = false; };
+    bool isDirty() const { return (_flags & DIRTY_BIT) != 0; };
+    void clearDirtyBit() { _flags &= ~DIRTY_BIT; };
     bool hasChangedSince(long long time) const { return (_lastChanged > time);  };
     void markWithChangedTime() { _lastChanged = usecTimestampNow();  };
     void handleSubtreeChanged(VoxelTree* myTree);
     
-    glBufferIndex getBufferIndex() const { return _glBufferIndex; };
-    bool isKnownBufferIndex() const { return (_glBufferIndex != GLBUFFER_INDEX_UNKNOWN); };
-    void setBufferIndex(glBufferIndex index) { _glBufferIndex = index; };
+    glBufferIndex getBufferIndex() const { return _clientData ? _clientData->bufferIndex : GLBUFFER_INDEX_UNKNOWN; };
+    bool isKnownBufferIndex() const { return (getBufferIndex() != GLBUFFER_INDEX_UNKNOWN); };
+    void setBufferIndex(glBufferIndex index);
 
     // Used by VoxelSystem for rendering in/out of view and LOD
     void setShouldRender(bool shouldRender);
-    bool getShouldRender() const { return _shouldRender; }
+    bool getShouldRender() const { return _clientData && _clientData->shouldRender; }
 
     // Used by VoxelSystem to mark a node as to be deleted on next render pass
-    void stageForDeletion() { _isStagedForDeletion = true; _isDirty = true; };
-    bool isStagedForDeletion() const { return _isStagedForDeletion; }
+    void stageForDeletion() { _flags |= (STAGED_FOR_DELETION_BIT | DIRTY_BIT); };
+    bool isStagedForDeletion() const { return (_flags & STAGED_FOR_DELETION_BIT) != 0; }
+
+    // Used by VoxelTree when it lazily loads a VoxelMappedFile. A node with children on disk looks like a leaf until
+    // they're materialized, a node with descendants on disk has children on disk itself or somewhere below it
+    bool hasChildrenOnDisk() const { return (_flags & CHILDREN_ON_DISK_BIT) != 0; };
+    void setChildrenOnDisk(bool onDisk) { 
+        _flags = onDisk ? (_flags | CHILDREN_ON_DISK_BIT) : (_flags & ~CHILDREN_ON_DISK_BIT); 
+    };
+    bool hasDescendantsOnDisk() const { return (_flags & DESCENDANTS_ON_DISK_BIT) != 0; };
+    void setDescendantsOnDisk(bool onDisk) { 
+        _flags = onDisk ? (_flags | DESCENDANTS_ON_DISK_BIT) : (_flags & ~DESCENDANTS_ON_DISK_BIT); 
+    };
+
+    // bytes used by this node, its octal code, its share of its parent's child array and any client data
+    int getMemoryUsage() const;
 
 #ifndef NO_FALSE_COLOR // !NO_FALSE_COLOR means, does have false color
     void setFalseColor(colorPart red, colorPart green, colorPart blue);
     void setFalseColored(bool isFalseColored);
-    bool getFalseColored() { return _falseColored; };
+    bool getFalseColored() { return _clientData && _clientData->falseColored; };
     void setColor(const nodeColor& color);
     const nodeColor& getTrueColor() const { return _trueColor; };
-    const nodeColor& getColor() const { return _currentColor; };
+    const nodeColor& getColor() const { 
+        return (_clientData && _clientData->falseColored) ? _clientData->falseColor : _trueColor; 
+    };
     void setDensity(float density) { _density = density; };
     float getDensity() const { return _density; };
 #else
@@ -111,6 +173,7 @@ public:
     bool getFalseColored() { return false; };
     void setColor(const nodeColor& color) { memcpy(_trueColor,color,sizeof(nodeColor)); };
     void setDensity(const float density) { _density = density; };
+    float getDensity() const { return _density; };
     const nodeColor& getTrueColor() const { return _trueColor; };
     const nodeColor& getColor() const { return _trueColor; };
 #endif
@@ -8,113 +8,239 @@
 
 #include "VoxelNodeBag.h"
 #include <OctalCode.h>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <stdint.h>
 
 VoxelNodeBag::~VoxelNodeBag() {
     deleteAll();
 }
 
 void VoxelNodeBag::deleteAll() {
-    if (_bagElements) {
-        delete[] _bagElements;
-    }
+    delete[] _bagElements;
+    delete[] _priorities;
+    delete[] _elementSlots;
+    delete[] _slots;
     _bagElements = NULL;
+    _priorities = NULL;
+    _elementSlots = NULL;
+    _slots = NULL;
+    _slotBits = 0;
     _elementsInUse = 0;
     _sizeOfElementsArray = 0;
 }
 
+const int MIN_BAG_SIZE = 64;
 
-const int GROW_BAG_BY = 100;
+int VoxelNodeBag::homeSlotFor(VoxelNode* node) const {
+    // fibonacci hashing, nodes are at least 8 byte aligned so the low bits carry nothing
+    uint32_t hash = (uint32_t)((uintptr_t)node >> 3) * 2654435769u;
+    return hash >> (32 - _slotBits);
+}
 
-// put a node into the bag
-void VoxelNodeBag::insert(VoxelNode* node) {
+int VoxelNodeBag::findSlot(VoxelNode* node) const {
+    int mask = (1 << _slotBits) - 1;
+    int slot = homeSlotFor(node);
+    while (_slots[slot] != EMPTY_SLOT && _bagElements[_slots[slot]] != node) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
 
-    // Search for where we should live in the bag (sorted)
-    // Note: change this to binary search... instead of linear!
-    int insertAt = _elementsInUse;
+// empties a slot, and shifts back any later entries in its probe run so that lookups never need tombstones
+void VoxelNodeBag::clearSlot(int slot) {
+    int mask = (1 << _slotBits) - 1;
+    int next = slot;
+    while (true) {
+        next = (next + 1) & mask;
+        if (_slots[next] == EMPTY_SLOT) {
+            break;
+        }
+        // the entry at next can move back to slot if its home isn't cyclically within (slot, next]
+        int home = homeSlotFor(_bagElements[_slots[next]]);
+        bool homeBetween = (slot <= next) ? (home > slot && home <= next) : (home > slot || home <= next);
+        if (!homeBetween) {
+            _slots[slot] = _slots[next];
+            _elementSlots[_slots[slot]] = slot;
+            slot = next;
+        }
+    }
+    _slots[slot] = EMPTY_SLOT;
+}
+
+// doubles the element arrays, and rebuilds the hash table at twice their size to keep it at most half full
+void VoxelNodeBag::grow() {
+    int newSize = _sizeOfElementsArray ? _sizeOfElementsArray * 2 : MIN_BAG_SIZE;
+
+    VoxelNode** oldElements = _bagElements;
+    float* oldPriorities = _priorities;
+    _bagElements = new VoxelNode*[newSize];
+    _priorities = new float[newSize];
+    memcpy(_bagElements, oldElements, _elementsInUse * sizeof(VoxelNode*));
+    memcpy(_priorities, oldPriorities, _elementsInUse * sizeof(float));
+    delete[] oldElements;
+    delete[] oldPriorities;
+
+    delete[] _elementSlots;
+    delete[] _slots;
+    _elementSlots = new int[newSize];
+    _sizeOfElementsArray = newSize;
+    _slotBits = 1;
+    while ((1 << _slotBits) < newSize * 2) {
+        _slotBits++;
+    }
+    _slots = new int[1 << _slotBits];
+    memset(_slots, EMPTY_SLOT, (1 << _slotBits) * sizeof(int));
     for (int i = 0; i < _elementsInUse; i++) {
-        // just compare the pointers... that's good enough
-        if (_bagElements[i] == node) {
-            return; // exit early!!
+        int slot = findSlot(_bagElements[i]);
+        _slots[slot] = i;
+        _elementSlots[i] = slot;
+    }
+}
+
+float VoxelNodeBag::priorityFor(VoxelNode* node) const {
+    return _prioritizeFrom ? node->lodDistanceToCamera(*_prioritizeFrom) : 0.0f;
+}
+
+void VoxelNodeBag::moveElement(int from, int to) {
+    _bagElements[to] = _bagElements[from];
+    _priorities[to] = _priorities[from];
+    _elementSlots[to] = _elementSlots[from];
+    _slots[_elementSlots[to]] = to;
+}
+
+// the priorities form a binary min heap when we're prioritized
+void VoxelNodeBag::siftUp(int index) {
+    VoxelNode* node = _bagElements[index];
+    float priority = _priorities[index];
+    int slot = _elementSlots[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (_priorities[parent] <= priority) {
+            break;
+        }
+        moveElement(parent, index);
+        index = parent;
+    }
+    _bagElements[index] = node;
+    _priorities[index] = priority;
+    _elementSlots[index] = slot;
+    _slots[slot] = index;
+}
+
+void VoxelNodeBag::siftDown(int index) {
+    VoxelNode* node = _bagElements[index];
+    float priority = _priorities[index];
+    int slot = _elementSlots[index];
+    while (true) {
+        int child = index * 2 + 1;
+        if (child >= _elementsInUse) {
+            break;
+        }
+        if (child + 1 < _elementsInUse && _priorities[child + 1] < _priorities[child]) {
+            child++;
         }
-        
-        if (_bagElements[i] > node) {
-            insertAt = i;
+        if (_priorities[child] >= priority) {
             break;
         }
+        moveElement(child, index);
+        index = child;
     }
-    // at this point, inserAt will be the location we want to insert at.
-    
-    // If we don't have room in our bag, then grow the bag
+    _bagElements[index] = node;
+    _priorities[index] = priority;
+    _elementSlots[index] = slot;
+    _slots[slot] = index;
+}
+
+// put a node into the bag
+void VoxelNodeBag::insert(VoxelNode* node) {
     if (_sizeOfElementsArray < _elementsInUse + 1) {
-        VoxelNode** oldBag = _bagElements;
-        _bagElements = new VoxelNode * [_sizeOfElementsArray + GROW_BAG_BY];
-        _sizeOfElementsArray += GROW_BAG_BY;
-        
-        // If we had an old bag...
-        if (oldBag) {
-            // copy old elements into the new bag, but leave a space where we need to
-            // insert the new node
-            memcpy(_bagElements, oldBag, insertAt * sizeof(VoxelNode*));
-            memcpy(&_bagElements[insertAt + 1], &oldBag[insertAt], (_elementsInUse - insertAt) * sizeof(VoxelNode*));
-            delete[] oldBag;
-        }
-    } else {
-        // move existing elements further back in the bag array, leave a space where we need to
-        // insert the new node
-        memmove(&_bagElements[insertAt + 1], &_bagElements[insertAt], (_elementsInUse - insertAt) * sizeof(VoxelNode*));
+        grow();
+    }
+    int slot = findSlot(node);
+    if (_slots[slot] != EMPTY_SLOT) {
+        return; // already in the bag
+    }
+    int index = _elementsInUse++;
+    _bagElements[index] = node;
+    _priorities[index] = priorityFor(node);
+    _elementSlots[index] = slot;
+    _slots[slot] = index;
+    if (_extractClosestFirst) {
+        siftUp(index);
     }
-    _bagElements[insertAt] = node;
-    _elementsInUse++;
 }
  
-// pull a node out of the bag (could come in any order)
+// pull a node out of the bag, the last one in unless we're prioritized, in which case the closest
 VoxelNode* VoxelNodeBag::extract() {
-    // pull the last node out, and shrink our list...
     if (_elementsInUse) {
-        
-        // get the last element
-        VoxelNode* node = _bagElements[_elementsInUse - 1];
-        
-        // reduce the count
-        _elementsInUse--;
-
+        VoxelNode* node = _bagElements[0];
+        if (_extractClosestFirst) {
+            remove(node);
+        } else {
+            node = _bagElements[_elementsInUse - 1];
+            clearSlot(_elementSlots[_elementsInUse - 1]);
+            _elementsInUse--;
+        }
         return node;
     }
     return NULL;
 }
 
 bool VoxelNodeBag::contains(VoxelNode* node) {
-    for (int i = 0; i < _elementsInUse; i++) {
-        // just compare the pointers... that's good enough
-        if (_bagElements[i] == node) {
-            return true; // exit early!!
-        }
-        // if we're past where it should be, then it's not here!
-        if (_bagElements[i] > node) {
-            return false;
+    return _elementsInUse && _slots[findSlot(node)] != EMPTY_SLOT;
+}
+
+void VoxelNodeBag::remove(VoxelNode* node) {
+    if (!_elementsInUse) {
+        return;
+    }
+    int slot = findSlot(node);
+    int foundAt = _slots[slot];
+    if (foundAt == EMPTY_SLOT) {
+        return;
+    }
+    clearSlot(slot);
+
+    // fill the hole with our last element
+    _elementsInUse--;
+    if (foundAt != _elementsInUse) {
+        moveElement(_elementsInUse, foundAt);
+        if (_extractClosestFirst) {
+            siftDown(foundAt);
+            siftUp(foundAt);
         }
     }
-    // if we made it through the entire bag, it's not here!
-    return false;
 }
 
-void VoxelNodeBag::remove(VoxelNode* node) {
-    int foundAt = -1;
+void VoxelNodeBag::setPrioritizeByDistanceFrom(const ViewFrustum* viewFrustum, bool extractClosestFirst) {
+    _prioritizeFrom = viewFrustum;
+    _extractClosestFirst = viewFrustum && extractClosestFirst;
+    reprioritize();
+}
+
+void VoxelNodeBag::reprioritize() {
     for (int i = 0; i < _elementsInUse; i++) {
-        // just compare the pointers... that's good enough
-        if (_bagElements[i] == node) {
-            foundAt = i;
-            break;
-        }
-        // if we're past where it should be, then it's not here!
-        if (_bagElements[i] > node) {
-            break;
-        }
+        _priorities[i] = priorityFor(_bagElements[i]);
     }
-    // if we found it, then we need to remove it....
-    if (foundAt != -1) {
-        memmove(&_bagElements[foundAt], &_bagElements[foundAt + 1], (_elementsInUse - foundAt) * sizeof(VoxelNode*));
-        _elementsInUse--;
+    if (_extractClosestFirst) {
+        for (int i = _elementsInUse / 2 - 1; i >= 0; i--) {
+            siftDown(i);
+        }
     }
 }
 
+float VoxelNodeBag::getClosestDistance() const {
+    if (!_prioritizeFrom || !_elementsInUse) {
+        return FLT_MAX;
+    }
+    if (_extractClosestFirst) {
+        return _priorities[0]; // top of the heap
+    }
+    float closest = _priorities[0];
+    for (int i = 1; i < _elementsInUse; i++) {
+        closest = std::min(closest, _priorities[i]);
+    }
+    return closest;
+}
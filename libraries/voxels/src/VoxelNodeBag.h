@@ -10,6 +10,9 @@
 //  more than once (in other words, it de-dupes automatically), also, it supports collapsing it's several peer nodes
 //  into a parent node in cases where you add enough peers that it makes more sense to just add the parent.
 //
+//  The nodes live in a dense array, and an open addressing hash table of indexes into that array handles the
+//  de-duping, so insert(), contains() and remove() don't depend on how many nodes are in the bag.
+//
 
 #ifndef __hifi__VoxelNodeBag__
 #define __hifi__VoxelNodeBag__
@@ -21,13 +24,19 @@ class VoxelNodeBag {
 public:
     VoxelNodeBag() : 
         _bagElements(NULL),
+        _priorities(NULL),
+        _elementSlots(NULL),
         _elementsInUse(0),
-        _sizeOfElementsArray(0) {};
+        _sizeOfElementsArray(0),
+        _slots(NULL),
+        _slotBits(0),
+        _prioritizeFrom(NULL),
+        _extractClosestFirst(false) {};
         
     ~VoxelNodeBag();
     
     void insert(VoxelNode* node); // put a node into the bag
-    VoxelNode* extract(); // pull a node out of the bag (could come in any order)
+    VoxelNode* extract(); // pull a node out of the bag, the last one inserted, or the closest one if prioritized
     bool contains(VoxelNode* node); // is this node in the bag?
     void remove(VoxelNode* node); // remove a specific item from the bag
     
@@ -36,11 +45,40 @@ public:
 
     void deleteAll();
 
+    // When set, extract() returns the closest node to the view frustum instead of the last one inserted. Closest is
+    // measured with VoxelNode::lodDistanceToCamera(), so big nodes near the camera come out first. Pass NULL to go back
+    // to last in, first out. Distances are taken when nodes are inserted, so call reprioritize() if the view frustum
+    // moves while there are nodes in the bag. If extractClosestFirst is false the distances are kept up to date for
+    // getClosestDistance(), but nodes still come out last in, first out.
+    void setPrioritizeByDistanceFrom(const ViewFrustum* viewFrustum, bool extractClosestFirst = true);
+    void reprioritize();
+
+    // the smallest lodDistanceToCamera() of the nodes in the bag, FLT_MAX if it's empty or not prioritized
+    float getClosestDistance() const;
+
 private:
-    
+    static const int EMPTY_SLOT = -1;
+
+    int homeSlotFor(VoxelNode* node) const;
+    int findSlot(VoxelNode* node) const; // the slot holding node, or the empty slot where it would go
+    void clearSlot(int slot);
+    void grow();
+
+    float priorityFor(VoxelNode* node) const;
+    void moveElement(int from, int to);
+    void siftUp(int index);
+    void siftDown(int index);
+
     VoxelNode** _bagElements;
+    float*      _priorities;    // only used when prioritized, smaller is extracted first
+    int*        _elementSlots;  // the hash slot pointing at each element
     int         _elementsInUse;
     int         _sizeOfElementsArray;
+    int*        _slots;         // open addressing hash table of indexes into _bagElements
+    int         _slotBits;
+
+    const ViewFrustum* _prioritizeFrom;
+    bool        _extractClosestFirst;
 };
 
 #endif /* defined(__hifi__VoxelNodeBag__) */
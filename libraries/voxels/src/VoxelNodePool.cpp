@@ -0,0 +1,134 @@
+//
+//  VoxelNodePool.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdint.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "VoxelNodePool.h"
+
+static void* allocateAlignedBlock(int size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, size);
+#else
+    void* block = NULL;
+    if (posix_memalign(&block, size, size) != 0) {
+        return NULL;
+    }
+    return block;
+#endif
+}
+
+static void freeAlignedBlock(void* block) {
+#ifdef _WIN32
+    _aligned_free(block);
+#else
+    free(block);
+#endif
+}
+
+VoxelNodePool::VoxelNodePool() :
+    _blocks(NULL),
+    _blockCount(0),
+    _blockAt(NULL),
+    _blockEnd(NULL),
+    _bytesInUse(0),
+    _generation(0) {
+    memset(_freeLists, 0, sizeof(_freeLists));
+}
+
+VoxelNodePool::~VoxelNodePool() {
+    releaseAll();
+}
+
+VoxelNodePool* VoxelNodePool::getDefaultPool() {
+    static VoxelNodePool defaultPool;
+    return &defaultPool;
+}
+
+VoxelNodePool* VoxelNodePool::poolFor(const void* storage) {
+    Block* block = (Block*)((uintptr_t)storage & ~(uintptr_t)(BLOCK_SIZE - 1));
+    return block->pool;
+}
+
+void VoxelNodePool::addBlock() {
+    Block* block = (Block*)allocateAlignedBlock(BLOCK_SIZE);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    block->pool = this;
+    block->next = _blocks;
+    _blocks = block;
+    _blockCount++;
+
+    // the first chunk starts after the block header, rounded up to our granularity
+    int headerBytes = ((sizeof(Block) + ALLOCATION_GRANULARITY - 1) / ALLOCATION_GRANULARITY) * ALLOCATION_GRANULARITY;
+    _blockAt = (unsigned char*)block + headerBytes;
+    _blockEnd = (unsigned char*)block + BLOCK_SIZE;
+}
+
+void* VoxelNodePool::allocate(int bytes) {
+    _generation++;
+
+    // oversized requests are rare (very deep octal codes), so just hand them to the heap
+    if (bytes > MAX_POOLED_ALLOCATION) {
+        return ::operator new(bytes);
+    }
+
+    int sizeClass = sizeClassFor(bytes);
+    int chunkBytes = (sizeClass + 1) * ALLOCATION_GRANULARITY;
+    _bytesInUse += chunkBytes;
+
+    // recycle a previously released chunk of this size if we have one
+    if (_freeLists[sizeClass]) {
+        FreeChunk* chunk = _freeLists[sizeClass];
+        _freeLists[sizeClass] = chunk->next;
+        return chunk;
+    }
+
+    // otherwise carve a new chunk out of the newest block
+    if (_blockAt + chunkBytes > _blockEnd) {
+        addBlock();
+    }
+    void* chunk = _blockAt;
+    _blockAt += chunkBytes;
+    return chunk;
+}
+
+void VoxelNodePool::release(void* storage, int bytes) {
+    if (!storage) {
+        return;
+    }
+    if (bytes > MAX_POOLED_ALLOCATION) {
+        ::operator delete(storage);
+        return;
+    }
+    VoxelNodePool* pool = poolFor(storage);
+    int sizeClass = sizeClassFor(bytes);
+    pool->_generation++;
+
+    FreeChunk* chunk = (FreeChunk*)storage;
+    chunk->next = pool->_freeLists[sizeClass];
+    pool->_freeLists[sizeClass] = chunk;
+    pool->_bytesInUse -= (sizeClass + 1) * ALLOCATION_GRANULARITY;
+}
+
+void VoxelNodePool::releaseAll() {
+    while (_blocks) {
+        Block* next = _blocks->next;
+        freeAlignedBlock(_blocks);
+        _blocks = next;
+    }
+    _blockCount = 0;
+    _blockAt = _blockEnd = NULL;
+    _bytesInUse = 0;
+    _generation++;
+    memset(_freeLists, 0, sizeof(_freeLists));
+}
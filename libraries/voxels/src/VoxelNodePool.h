@@ -0,0 +1,83 @@
+//
+//  VoxelNodePool.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Slab allocator for VoxelNodes and their octal codes. Each VoxelTree owns a pool, nodes and codes are carved out of
+//  large aligned blocks, and freed storage is recycled through per size class free lists. Because the blocks are
+//  aligned to their size, the owning pool of any pooled pointer can be found from the pointer alone, which lets a
+//  node allocate its children from the same pool without carrying a pool pointer around.
+//
+//  Note: like the VoxelTree itself, a pool is not thread safe. Callers must hold the tree lock.
+//
+
+#ifndef __hifi__VoxelNodePool__
+#define __hifi__VoxelNodePool__
+
+#include <cstddef>
+
+class VoxelNodePool {
+public:
+    static const int BLOCK_SIZE = 64 * 1024; // blocks are also aligned to this size
+    static const int ALLOCATION_GRANULARITY = 8;
+    static const int MAX_POOLED_ALLOCATION = 256;
+
+    VoxelNodePool();
+    ~VoxelNodePool();
+
+    void* allocate(int bytes);
+    unsigned char* allocateOctalCode(int bytes) { return (unsigned char*)allocate(bytes); };
+
+    // returns storage to the pool that allocated it, bytes must match the size that was allocated
+    static void release(void* storage, int bytes);
+    static void releaseOctalCode(unsigned char* octalCode, int bytes) { release(octalCode, bytes); };
+
+    // finds the pool that owns a pointer returned by allocate()
+    static VoxelNodePool* poolFor(const void* storage);
+
+    // the pool used by VoxelNodes which are created with a plain new, outside of any VoxelTree
+    static VoxelNodePool* getDefaultPool();
+
+    // frees every block in the pool in one pass, all storage handed out by this pool becomes invalid
+    void releaseAll();
+
+    int getBlockCount() const { return _blockCount; };
+    long getBytesInUse() const { return _bytesInUse; };
+    long getBytesReserved() const { return (long)_blockCount * BLOCK_SIZE; };
+
+    // changes whenever storage is allocated from or released to the pool, so a caller holding node pointers can tell
+    // that nothing has been added to or removed from the tree since it took them
+    unsigned long getGeneration() const { return _generation; };
+
+private:
+    // disallow copying of VoxelNodePool objects
+    VoxelNodePool(const VoxelNodePool&);
+    VoxelNodePool& operator= (const VoxelNodePool&);
+
+    class Block {
+    public:
+        VoxelNodePool*  pool;
+        Block*          next;
+    };
+
+    class FreeChunk {
+    public:
+        FreeChunk*      next;
+    };
+
+    static const int SIZE_CLASSES = MAX_POOLED_ALLOCATION / ALLOCATION_GRANULARITY;
+
+    static int sizeClassFor(int bytes) { return (bytes - 1) / ALLOCATION_GRANULARITY; };
+    void addBlock();
+
+    Block*          _blocks;
+    int             _blockCount;
+    unsigned char*  _blockAt;        // next unused byte in the newest block
+    unsigned char*  _blockEnd;
+    long            _bytesInUse;
+    unsigned long   _generation;
+    FreeChunk*      _freeLists[SIZE_CLASSES];
+};
+
+#endif /* defined(__hifi__VoxelNodePool__) */
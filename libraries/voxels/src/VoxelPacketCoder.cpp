@@ -0,0 +1,384 @@
+//
+//  VoxelPacketCoder.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  The range coder is the usual binary one: each yes or no is coded against the probability its model gives it, in
+//  11 bits, and the model moves 1/32 of the way toward what it saw. A symbol of 8 bits goes through a binary tree of
+//  255 models, one for each of the bits that came before it, so the tree learns the whole distribution of the symbol.
+//
+
+#include <cstring>
+#include <SharedUtil.h>
+#include <OctalCode.h>
+#include "VoxelPacketCoder.h"
+
+const uint32_t PROBABILITY_ONE = 1 << VoxelPacketModel::PROBABILITY_BITS;
+const int ADAPT_SHIFT = 5;
+const uint32_t TOP = 1 << 24;
+const int COLOR_BYTES = 3;
+
+void VoxelPacketModel::reset() {
+    more = PROBABILITY_ONE / 2;
+    for (int i = 0; i < 256; i++) {
+        colorMasks[i] = paletteIndexes[i] = PROBABILITY_ONE / 2;
+    }
+    for (int i = 0; i < NUMBER_OF_CHILDREN * 2; i++) {
+        existsBits[i] = PROBABILITY_ONE / 2;
+    }
+    for (int i = 0; i < NUMBER_OF_CHILDREN * 4; i++) {
+        inPacketBits[i] = PROBABILITY_ONE / 2;
+    }
+    paletteCount = 0;
+    nextReplaced = 0;
+    memset(_lookup, 0, sizeof(_lookup));
+}
+
+int VoxelPacketModel::hashColor(const unsigned char* color) {
+    return (color[0] * 7 + color[1] * 61 + color[2] * 251) % LOOKUP_SIZE;
+}
+
+int VoxelPacketModel::findColor(const unsigned char* color) const {
+    int index = _lookup[hashColor(color)];
+    return (index && memcmp(palette[index - 1], color, COLOR_BYTES) == 0) ? index : 0;
+}
+
+void VoxelPacketModel::addColor(const unsigned char* color) {
+    int slot;
+    if (paletteCount < PALETTE_SIZE) {
+        slot = paletteCount++;
+    } else {
+        slot = nextReplaced;
+        nextReplaced = (nextReplaced + 1) % PALETTE_SIZE;
+        int replacedHash = hashColor(palette[slot]);
+        if (_lookup[replacedHash] == slot + 1) {
+            _lookup[replacedHash] = 0;
+        }
+    }
+    memcpy(palette[slot], color, COLOR_BYTES);
+    _lookup[hashColor(color)] = slot + 1;
+}
+
+VoxelPacketEncoder::VoxelPacketEncoder(unsigned char* destination, int capacity) :
+    _destination(destination),
+    _capacity(capacity),
+    _includeColor(true),
+    _includeExistsBits(true)
+{
+    reset(true, true);
+}
+
+void VoxelPacketEncoder::reset(bool includeColor, bool includeExistsBits) {
+    _includeColor = includeColor;
+    _includeExistsBits = includeExistsBits;
+    _state.low = 0;
+    _state.range = 0xFFFFFFFF;
+    _state.cache = 0;
+    _state.cacheSize = 1;
+    _state.written = -1; // the first byte out of the coder is always zero, so it isn't written, see decode()
+    _state.bitstreamBytes = 0;
+    _state.model.reset();
+}
+
+bool VoxelPacketEncoder::append(const unsigned char* bitstream, int bytes) {
+    if (_state.bitstreamBytes + bytes > MAX_DECOMPRESSED_VOXEL_PACKET_BYTES) {
+        return false;
+    }
+    // the models are small next to the work of coding a bitstream, so just keep them in case it doesn't fit
+    _saved = _state;
+
+    const unsigned char* at = bitstream;
+    const unsigned char* end = bitstream + bytes;
+    bool parsed = true;
+    while (parsed && at < end) {
+        encodeBit(_state.model.more, 1);
+        parsed = encodeSubtree(at, end);
+    }
+    if (!parsed || bytesAfterFinish() > _capacity) {
+        _state = _saved;
+        return false;
+    }
+    _state.bitstreamBytes += bytes;
+    return true;
+}
+
+int VoxelPacketEncoder::finish() {
+    encodeBit(_state.model.more, 0);
+    for (int i = 0; i < 5; i++) {
+        shiftLow();
+    }
+    // the decoder reads zeros past the end of the packet, so there's no need to send them
+    int length = _state.written;
+    while (length > 0 && _destination[length - 1] == 0) {
+        length--;
+    }
+    return length;
+}
+
+// the bytes the packet would be if it were finished now, or a little more
+int VoxelPacketEncoder::bytesAfterFinish() const {
+    const int FLUSH_BYTES = 4;
+    const int END_BYTES = 2;
+    return _state.written + _state.cacheSize + FLUSH_BYTES + END_BYTES;
+}
+
+void VoxelPacketEncoder::shiftLow() {
+    if ((uint32_t)_state.low < 0xFF000000 || (_state.low >> 32) != 0) {
+        unsigned char carry = (unsigned char)(_state.low >> 32);
+        unsigned char byte = _state.cache;
+        do {
+            if (_state.written >= 0 && _state.written < _capacity) {
+                _destination[_state.written] = byte + carry;
+            }
+            _state.written++;
+            byte = 0xFF;
+        } while (--_state.cacheSize != 0);
+        _state.cache = (unsigned char)((uint32_t)_state.low >> 24);
+    }
+    _state.cacheSize++;
+    _state.low = (uint32_t)_state.low << 8;
+}
+
+void VoxelPacketEncoder::encodeBit(uint16_t& probability, int bit) {
+    uint32_t bound = (_state.range >> VoxelPacketModel::PROBABILITY_BITS) * probability;
+    if (bit) {
+        _state.low += bound;
+        _state.range -= bound;
+        probability -= probability >> ADAPT_SHIFT;
+    } else {
+        _state.range = bound;
+        probability += (PROBABILITY_ONE - probability) >> ADAPT_SHIFT;
+    }
+    while (_state.range < TOP) {
+        _state.range <<= 8;
+        shiftLow();
+    }
+}
+
+void VoxelPacketEncoder::encodeDirectBits(uint32_t value, int bitCount) {
+    for (int i = bitCount - 1; i >= 0; i--) {
+        _state.range >>= 1;
+        if ((value >> i) & 1) {
+            _state.low += _state.range;
+        }
+        while (_state.range < TOP) {
+            _state.range <<= 8;
+            shiftLow();
+        }
+    }
+}
+
+void VoxelPacketEncoder::encodeTree(uint16_t* probabilities, int symbol) {
+    int node = 1;
+    for (int i = 7; i >= 0; i--) {
+        int bit = (symbol >> i) & 1;
+        encodeBit(probabilities[node], bit);
+        node = (node << 1) | bit;
+    }
+}
+
+bool VoxelPacketEncoder::encodeSubtree(const unsigned char*& at, const unsigned char* end) {
+    int octalCodeBytes = bytesRequiredForCodeLength(*at);
+    if (end - at < octalCodeBytes) {
+        return false;
+    }
+    for (int i = 0; i < octalCodeBytes; i++) {
+        encodeDirectBits(*at++, 8);
+    }
+    return encodeNode(at, end, 0);
+}
+
+// the same layout VoxelTree::readNodeData() reads
+bool VoxelPacketEncoder::encodeNode(const unsigned char*& at, const unsigned char* end, int depth) {
+    if (depth > VoxelPacketModel::MAX_SUBTREE_DEPTH || at >= end) {
+        return false;
+    }
+    VoxelPacketModel& model = _state.model;
+    unsigned char colorMask = *at++;
+    encodeTree(model.colorMasks, colorMask);
+    if (_includeColor) {
+        if (end - at < numberOfOnes(colorMask) * COLOR_BYTES) {
+            return false;
+        }
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            if (oneAtBit(colorMask, i)) {
+                encodeColor(at);
+                at += COLOR_BYTES;
+            }
+        }
+    }
+
+    if (end - at < (_includeExistsBits ? 2 : 1)) {
+        return false;
+    }
+    unsigned char existsMask = _includeExistsBits ? *at++ : 0xFF;
+    unsigned char inPacketMask = *at++;
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        int colored = oneAtBit(colorMask, i);
+        if (_includeExistsBits) {
+            encodeBit(model.existsBits[i * 2 + colored], oneAtBit(existsMask, i));
+        }
+        encodeBit(model.inPacketBits[i * 4 + colored * 2 + oneAtBit(existsMask, i)], oneAtBit(inPacketMask, i));
+    }
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (oneAtBit(inPacketMask, i) && !encodeNode(at, end, depth + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void VoxelPacketEncoder::encodeColor(const unsigned char* color) {
+    int index = _state.model.findColor(color);
+    encodeTree(_state.model.paletteIndexes, index);
+    if (!index) {
+        encodeDirectBits((color[0] << 16) | (color[1] << 8) | color[2], 24);
+        _state.model.addColor(color);
+    }
+}
+
+int VoxelPacketDecoder::decode(const unsigned char* packetData, int bytes, bool includeColor, bool includeExistsBits,
+                               unsigned char* destination, int capacity) {
+    _at = packetData;
+    _end = packetData + bytes;
+    _output = destination;
+    _outputEnd = destination + capacity;
+    _includeColor = includeColor;
+    _includeExistsBits = includeExistsBits;
+    _model.reset();
+
+    // the encoder leaves off its first byte, which is always zero
+    _range = 0xFFFFFFFF;
+    _code = 0;
+    for (int i = 0; i < 4; i++) {
+        _code = (_code << 8) | nextByte();
+    }
+
+    while (decodeBit(_model.more)) {
+        unsigned char octalCode[256];
+        octalCode[0] = decodeDirectBits(8);
+        int octalCodeBytes = bytesRequiredForCodeLength(octalCode[0]);
+        for (int i = 1; i < octalCodeBytes; i++) {
+            octalCode[i] = decodeDirectBits(8);
+        }
+        if (!write(octalCode, octalCodeBytes) || !decodeNode(0)) {
+            return -1;
+        }
+    }
+    return _output - destination;
+}
+
+int VoxelPacketDecoder::decodeBit(uint16_t& probability) {
+    uint32_t bound = (_range >> VoxelPacketModel::PROBABILITY_BITS) * probability;
+    int bit;
+    if (_code < bound) {
+        _range = bound;
+        probability += (PROBABILITY_ONE - probability) >> ADAPT_SHIFT;
+        bit = 0;
+    } else {
+        _code -= bound;
+        _range -= bound;
+        probability -= probability >> ADAPT_SHIFT;
+        bit = 1;
+    }
+    while (_range < TOP) {
+        _range <<= 8;
+        _code = (_code << 8) | nextByte();
+    }
+    return bit;
+}
+
+uint32_t VoxelPacketDecoder::decodeDirectBits(int bitCount) {
+    uint32_t value = 0;
+    for (int i = 0; i < bitCount; i++) {
+        _range >>= 1;
+        int bit = 0;
+        if (_code >= _range) {
+            _code -= _range;
+            bit = 1;
+        }
+        value = (value << 1) | bit;
+        while (_range < TOP) {
+            _range <<= 8;
+            _code = (_code << 8) | nextByte();
+        }
+    }
+    return value;
+}
+
+int VoxelPacketDecoder::decodeTree(uint16_t* probabilities) {
+    int node = 1;
+    for (int i = 0; i < 8; i++) {
+        node = (node << 1) | decodeBit(probabilities[node]);
+    }
+    return node - 256;
+}
+
+bool VoxelPacketDecoder::write(const unsigned char* bytes, int count) {
+    if (_outputEnd - _output < count) {
+        return false;
+    }
+    memcpy(_output, bytes, count);
+    _output += count;
+    return true;
+}
+
+bool VoxelPacketDecoder::decodeNode(int depth) {
+    if (depth > VoxelPacketModel::MAX_SUBTREE_DEPTH) {
+        return false;
+    }
+    unsigned char colorMask = decodeTree(_model.colorMasks);
+    if (!write(&colorMask, sizeof(colorMask))) {
+        return false;
+    }
+    if (_includeColor) {
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            if (!oneAtBit(colorMask, i)) {
+                continue;
+            }
+            int index = decodeTree(_model.paletteIndexes);
+            unsigned char color[COLOR_BYTES];
+            if (index) {
+                if (index > _model.paletteCount) {
+                    return false;
+                }
+                memcpy(color, _model.palette[index - 1], COLOR_BYTES);
+            } else {
+                uint32_t value = decodeDirectBits(24);
+                color[0] = value >> 16;
+                color[1] = value >> 8;
+                color[2] = value;
+                _model.addColor(color);
+            }
+            if (!write(color, COLOR_BYTES)) {
+                return false;
+            }
+        }
+    }
+
+    unsigned char existsMask = 0xFF;
+    unsigned char inPacketMask = 0;
+    if (_includeExistsBits) {
+        existsMask = 0;
+    }
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        int colored = oneAtBit(colorMask, i);
+        if (_includeExistsBits && decodeBit(_model.existsBits[i * 2 + colored])) {
+            existsMask |= 1 << (7 - i);
+        }
+        if (decodeBit(_model.inPacketBits[i * 4 + colored * 2 + oneAtBit(existsMask, i)])) {
+            inPacketMask |= 1 << (7 - i);
+        }
+    }
+    if ((_includeExistsBits && !write(&existsMask, sizeof(existsMask))) ||
+        !write(&inPacketMask, sizeof(inPacketMask))) {
+        return false;
+    }
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (oneAtBit(inPacketMask, i) && !decodeNode(depth + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,135 @@
+//
+//  VoxelPacketCoder.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Compressed voxel data packets, for agents that ask for them with AvatarData::setWantCompression(). The encoder takes
+//  the bitstreams VoxelTree::encodeTreeBitstream() writes, one at a time, and range codes their child masks against
+//  adaptive models, and their colors as indexes into a palette of the colors already in the packet. The decoder turns
+//  the packet back into the bitstreams, for VoxelTree::readBitstreamToTree().
+//
+//  Both ends start every packet with fresh models and an empty palette, so a packet can be decoded without the ones
+//  before it, and a lost packet costs nothing more than its own voxels.
+//
+
+#ifndef __hifi__VoxelPacketCoder__
+#define __hifi__VoxelPacketCoder__
+
+#include <stdint.h>
+#include <glm/glm.hpp>
+#include "VoxelConstants.h"
+
+// the most bitstream a compressed packet may decode to, so the receiver knows how much room to make
+const int MAX_DECOMPRESSED_VOXEL_PACKET_BYTES = 16 * MAX_VOXEL_PACKET_DATA_BYTES;
+
+// the adaptive models and the palette, which the encoder and the decoder keep in step
+class VoxelPacketModel {
+public:
+    static const int PROBABILITY_BITS = 11;
+    static const int PALETTE_SIZE = 255;            // colors, index 0 is for a color that isn't in the palette
+    static const int MAX_SUBTREE_DEPTH = 32;        // levels below the octal code, anything deeper is garbage
+
+    void reset();
+
+    uint16_t more;                                  // whether another bitstream follows
+    uint16_t colorMasks[256];                       // a binary tree over the bits of the mask
+    uint16_t existsBits[NUMBER_OF_CHILDREN * 2];    // by child and whether it's colored
+    uint16_t inPacketBits[NUMBER_OF_CHILDREN * 4];  // by child, whether it's colored and whether it exists
+    uint16_t paletteIndexes[256];                   // a binary tree over the bits of the index
+
+    unsigned char palette[PALETTE_SIZE][3];
+    int paletteCount;
+    int nextReplaced;   // once the palette is full, new colors replace the old ones in turn
+
+    // the palette index for color, 0 if it isn't there
+    int findColor(const unsigned char* color) const;
+    void addColor(const unsigned char* color);
+
+private:
+    static const int LOOKUP_SIZE = 512;
+    static int hashColor(const unsigned char* color);
+
+    unsigned char _lookup[LOOKUP_SIZE];             // palette index by hash of the color, 0 for none
+};
+
+class VoxelPacketEncoder {
+public:
+    // writes to destination, which has room for capacity bytes
+    VoxelPacketEncoder(unsigned char* destination, int capacity);
+
+    void reset(bool includeColor, bool includeExistsBits); // starts a new packet
+
+    // adds a bitstream from VoxelTree::encodeTreeBitstream() to the packet, false if it won't fit, in which case the
+    // packet is as it was
+    bool append(const unsigned char* bitstream, int bytes);
+
+    bool isEmpty() const { return _state.bitstreamBytes == 0; };
+    int getBitstreamBytes() const { return _state.bitstreamBytes; }; // how much bitstream is in the packet
+
+    // ends the packet and returns its length, the encoder needs a reset() after this
+    int finish();
+
+private:
+    // disallow copying of VoxelPacketEncoder objects
+    VoxelPacketEncoder(const VoxelPacketEncoder&);
+    VoxelPacketEncoder& operator= (const VoxelPacketEncoder&);
+
+    // everything that changes as the packet is written, so it can be put back if a bitstream doesn't fit
+    class State {
+    public:
+        uint64_t low;
+        uint32_t range;
+        unsigned char cache;
+        int cacheSize;
+        int written;
+        int bitstreamBytes;
+        VoxelPacketModel model;
+    };
+
+    void encodeBit(uint16_t& probability, int bit);
+    void encodeDirectBits(uint32_t value, int bitCount);
+    void encodeTree(uint16_t* probabilities, int symbol);
+    void shiftLow();
+    int bytesAfterFinish() const;
+
+    bool encodeSubtree(const unsigned char*& at, const unsigned char* end);
+    bool encodeNode(const unsigned char*& at, const unsigned char* end, int depth);
+    void encodeColor(const unsigned char* color);
+
+    unsigned char* _destination;
+    int _capacity;
+    bool _includeColor;
+    bool _includeExistsBits;
+    State _state;
+    State _saved;
+};
+
+class VoxelPacketDecoder {
+public:
+    // decodes a packet from VoxelPacketEncoder to destination, which has room for capacity bytes, and returns the bytes
+    // of bitstream, or -1 if the packet is garbage
+    int decode(const unsigned char* packetData, int bytes, bool includeColor, bool includeExistsBits,
+               unsigned char* destination, int capacity);
+
+private:
+    int decodeBit(uint16_t& probability);
+    uint32_t decodeDirectBits(int bitCount);
+    int decodeTree(uint16_t* probabilities);
+    unsigned char nextByte() { return _at < _end ? *_at++ : 0; };
+
+    bool write(const unsigned char* bytes, int count);
+    bool decodeNode(int depth);
+
+    const unsigned char* _at;
+    const unsigned char* _end;
+    uint32_t _range;
+    uint32_t _code;
+    unsigned char* _output;
+    unsigned char* _outputEnd;
+    bool _includeColor;
+    bool _includeExistsBits;
+    VoxelPacketModel _model;
+};
+
+#endif /* defined(__hifi__VoxelPacketCoder__) */
@@ -0,0 +1,39 @@
+//
+//  VoxelSendStats.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstring>
+#include <PacketHeaders.h>
+#include "VoxelSendStats.h"
+
+int VoxelSendStats::pack(unsigned char* destination) const {
+    unsigned char* at = destination;
+    *at++ = PACKET_HEADER_VOXEL_SEND_STATS;
+    memcpy(at, &intervals, sizeof(intervals));
+    at += sizeof(intervals);
+    memcpy(at, &overruns, sizeof(overruns));
+    at += sizeof(overruns);
+    memcpy(at, &maxIntervalUsecs, sizeof(maxIntervalUsecs));
+    at += sizeof(maxIntervalUsecs);
+    memcpy(at, &agents, sizeof(agents));
+    at += sizeof(agents);
+    return at - destination;
+}
+
+bool VoxelSendStats::unpack(const unsigned char* source, int bytes) {
+    if (bytes < PACKED_BYTES || source[0] != PACKET_HEADER_VOXEL_SEND_STATS) {
+        return false;
+    }
+    const unsigned char* at = source + 1;
+    memcpy(&intervals, at, sizeof(intervals));
+    at += sizeof(intervals);
+    memcpy(&overruns, at, sizeof(overruns));
+    at += sizeof(overruns);
+    memcpy(&maxIntervalUsecs, at, sizeof(maxIntervalUsecs));
+    at += sizeof(maxIntervalUsecs);
+    memcpy(&agents, at, sizeof(agents));
+    return true;
+}
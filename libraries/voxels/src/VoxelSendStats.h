@@ -0,0 +1,32 @@
+//
+//  VoxelSendStats.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  How well a voxel server is keeping up with its send intervals. Every second or so the server sends each of its
+//  agents a PACKET_HEADER_VOXEL_SEND_STATS with these, so a load test can see the server falling behind from outside.
+//  The counts are since the server started, so a receiver that missed some packets loses nothing from them.
+//
+
+#ifndef __hifi__VoxelSendStats__
+#define __hifi__VoxelSendStats__
+
+#include <stdint.h>
+
+class VoxelSendStats {
+public:
+    static const int PACKED_BYTES = 1 + 4 * sizeof(uint32_t); // including the packet header
+
+    VoxelSendStats() : intervals(0), overruns(0), maxIntervalUsecs(0), agents(0) { };
+
+    uint32_t intervals;         // send intervals run
+    uint32_t overruns;          // intervals that took longer than the time between them, so the next one started late
+    uint32_t maxIntervalUsecs;  // the longest an interval took since the last of these was sent
+    uint32_t agents;            // served in the last interval
+
+    int pack(unsigned char* destination) const;
+    bool unpack(const unsigned char* source, int bytes);
+};
+
+#endif /* defined(__hifi__VoxelSendStats__) */
@@ -12,17 +12,22 @@
 #include <cstring>
 #include <cstdio>
 #include <cmath>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
 #include "SharedUtil.h"
 #include "Log.h"
 #include "PacketHeaders.h"
 #include "OctalCode.h"
 #include "GeometryUtil.h"
 #include "VoxelTree.h"
+#include "VoxelCollider.h"
 #include "VoxelNodeBag.h"
 #include "ViewFrustum.h"
 #include <fstream> // to load voxels from file
 #include "VoxelConstants.h"
 #include "CoverageMap.h"
+#include "Radix2InplaceSort.h"
 
 #include <glm/gtc/noise.hpp>
 
@@ -40,15 +45,12 @@ VoxelTree::VoxelTree(bool shouldReaverage) :
     voxelsBytesReadStats(100),
     _isDirty(true),
     _shouldReaverage(shouldReaverage) {
-    rootNode = new VoxelNode();
+    rootNode = new (_nodePool) VoxelNode();
 }
 
 VoxelTree::~VoxelTree() {
-    // delete the children of the root node
-    // this recursively deletes the tree
-    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-        delete rootNode->getChildAtIndex(i);
-    }
+    // all of our nodes live in our pool, so there's no need to recursively delete them, the
+    // pool frees the whole tree when it's destroyed
 }
 
 // Recurses voxel tree calling the RecurseVoxelTreeOperation function for each node.
@@ -112,148 +114,200 @@ void VoxelTree::recurseNodeWithOperationDistanceSorted(VoxelNode* node, RecurseV
 }
 
 
-VoxelNode* VoxelTree::nodeForOctalCode(VoxelNode* ancestorNode, 
-                                       unsigned char* needleCode, VoxelNode** parentOfFoundNode) const {
-    // find the appropriate branch index based on this ancestorNode
-    if (*needleCode > 0) {
-        int branchForNeedle = branchIndexWithDescendant(ancestorNode->getOctalCode(), needleCode);
-        VoxelNode* childNode = ancestorNode->getChildAtIndex(branchForNeedle);
-        
-        if (childNode) {
-            if (*childNode->getOctalCode() == *needleCode) {
-            
-            	// If the caller asked for the parent, then give them that too...
-            	if (parentOfFoundNode) {
-					*parentOfFoundNode = ancestorNode;
-				}
-                // the fact that the number of sections is equivalent does not always guarantee
-                // that this is the same node, however due to the recursive traversal
-                // we know that this is our node
-                return childNode;
-            } else {
-                // we need to go deeper
-                return nodeForOctalCode(childNode, needleCode,parentOfFoundNode);
-            }
+VoxelNode* VoxelTree::nodeForKey(VoxelNode* ancestorNode, const MortonKey& needleKey,
+                                 VoxelNode** parentOfFoundNode) const {
+    // walk down the branches the key takes until we get to its level, or there's no branch to take
+    VoxelNode* node = ancestorNode;
+    while (*node->getOctalCode() < needleKey.getLevel()) {
+        VoxelNode* childNode = node->getChildAtIndex(needleKey.getSection(*node->getOctalCode()));
+        if (!childNode) {
+            // we've been given a code we don't have a node for
+            // return this node as the last created parent
+            return node;
+        }
+        // If the caller asked for the parent, then give them that too...
+        if (parentOfFoundNode && *childNode->getOctalCode() == needleKey.getLevel()) {
+            *parentOfFoundNode = node;
         }
+        node = childNode;
     }
-    
-    // we've been given a code we don't have a node for
-    // return this node as the last created parent
-    return ancestorNode;
+    return node;
 }
 
 // returns the node created!
-VoxelNode* VoxelTree::createMissingNode(VoxelNode* lastParentNode, unsigned char* codeToReach) {
-    int indexOfNewChild = branchIndexWithDescendant(lastParentNode->getOctalCode(), codeToReach);
-    // If this parent node is a leaf, then you know the child path doesn't exist, so deal with
-    // breaking up the leaf first, which will also create a child path
-    if (lastParentNode->isLeaf() && lastParentNode->isColored()) {
-        // for colored leaves, we must add *all* the children
-        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-            lastParentNode->addChildAtIndex(i);
-            lastParentNode->getChildAtIndex(i)->setColor(lastParentNode->getColor());
+VoxelNode* VoxelTree::createMissingNode(VoxelNode* lastParentNode, const MortonKey& keyToReach) {
+    VoxelNode* node = lastParentNode;
+    while (true) {
+        int indexOfNewChild = keyToReach.getSection(*node->getOctalCode());
+        // If this parent node is a leaf, then you know the child path doesn't exist, so deal with
+        // breaking up the leaf first, which will also create a child path
+        if (node->isLeaf() && node->isColored()) {
+            // for colored leaves, we must add *all* the children
+            for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+                node->addChildAtIndex(i);
+                node->getChildAtIndex(i)->setColor(node->getColor());
+            }
+        } else if (!node->getChildAtIndex(indexOfNewChild)) {
+            // we could be coming down a branch that was already created, so don't stomp on it.
+            node->addChildAtIndex(indexOfNewChild);
         }
-    } else if (!lastParentNode->getChildAtIndex(indexOfNewChild)) {
-        // we could be coming down a branch that was already created, so don't stomp on it.
-        lastParentNode->addChildAtIndex(indexOfNewChild);
-    }
+        node = node->getChildAtIndex(indexOfNewChild);
 
-    // This works because we know we traversed down the same tree so if the length is the same, then the whole code is the same
-    if (*lastParentNode->getChildAtIndex(indexOfNewChild)->getOctalCode() == *codeToReach) {
-        return lastParentNode->getChildAtIndex(indexOfNewChild);
-    } else {
-        return createMissingNode(lastParentNode->getChildAtIndex(indexOfNewChild), codeToReach);
+        // This works because we know we traversed down the same tree so if the length is the same, then the whole
+        // code is the same
+        if (*node->getOctalCode() == keyToReach.getLevel()) {
+            return node;
+        }
     }
 }
 
+// the masks in a bitstream have child 0 in their top bit, VoxelNode has it in the bottom one
+static unsigned char childBitsFromMask(unsigned char mask) {
+    mask = (mask & 0xF0) >> 4 | (mask & 0x0F) << 4;
+    mask = (mask & 0xCC) >> 2 | (mask & 0x33) << 2;
+    return (mask & 0xAA) >> 1 | (mask & 0x55) << 1;
+}
+
+// a node whose children's data is still being read, see readNodeData()
+class ReadNodeFrame {
+public:
+    VoxelNode*      node;
+    unsigned char   childBits;          // the children whose data follows, one bit per child index
+    unsigned char   childrenInTreeBits; // the children that should be left once it's been read
+    unsigned char   unreadBits;         // the children we added for data that hasn't been read yet
+    int             nextChildIndex;
+};
+
+// levels below the node we're given, anything deeper is garbage
+const int MAX_READ_NODE_DEPTH = MortonKey::MAX_LEVELS;
+
+// Reads the data for a node and, depth first, for all the children it says follow, the same way the recursion that
+// used to be here did. A node's children are all added at once, from the masks, before any of them are read. If the
+// packet is cut short, the ones we added whose data didn't make it, or that end up with nothing in them because of it,
+// are taken out again, so a truncated packet doesn't leave empty voxels behind. This counts voxelsCreated and voxelsColored,
+// readBitstreamToTree() updates their averages once for the whole packet.
 int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData, int bytesLeftToRead, 
                             bool includeColor, bool includeExistsBits) {
-    // give this destination node the child mask from the packet
     const unsigned char ALL_CHILDREN_ASSUMED_TO_EXIST = 0xFF;
-    unsigned char colorInPacketMask = *nodeData;
-
-    // instantiate variable for bytes already read
-    int bytesRead = sizeof(colorInPacketMask);
-    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-        // check the colors mask to see if we have a child to color in
-        if (oneAtBit(colorInPacketMask, i)) {
-            // create the child if it doesn't exist
-            if (!destinationNode->getChildAtIndex(i)) {
-                destinationNode->addChildAtIndex(i);
-                if (destinationNode->isDirty()) {
-                    _isDirty = true;
-                    _nodesChangedFromBitstream++;
+    ReadNodeFrame stack[MAX_READ_NODE_DEPTH];
+    int depth = 0;
+    int bytesRead = 0;
+    bool cutShort = false;
+    VoxelNode* node = destinationNode;
+    while (true) {
+        if (node) {
+            // the colors of the colored children come first, then the masks
+            unsigned char colorBits = (bytesLeftToRead - bytesRead > 0) ? childBitsFromMask(nodeData[bytesRead]) : 0;
+            int colorBytes = 0;
+            if (includeColor) {
+                for (unsigned char bits = colorBits; bits; bits &= bits - 1) {
+                    colorBytes += 3;
                 }
-                voxelsCreated++;
-                voxelsCreatedStats.updateAverage(1);
             }
-
-            // pull the color for this child
-            nodeColor newColor = { 128, 128, 128, 1};
-            if (includeColor) {
-                memcpy(newColor, nodeData + bytesRead, 3);
-                bytesRead += 3;
+            int nodeBytes = sizeof(colorBits) + colorBytes + (includeExistsBits ? 2 : 1);
+            if (nodeBytes > bytesLeftToRead - bytesRead) {
+                // cut short, so neither this node's data nor anything after it can be used, and the stack unwinds
+                if (depth == 0) {
+                    return bytesLeftToRead;
+                }
+                bytesRead = bytesLeftToRead;
+                cutShort = true;
+                node = NULL;
+                continue;
             }
-            bool nodeWasDirty = destinationNode->getChildAtIndex(i)->isDirty();
-            destinationNode->getChildAtIndex(i)->setColor(newColor);
-            bool nodeIsDirty = destinationNode->getChildAtIndex(i)->isDirty();
-            if (nodeIsDirty) {
+            const unsigned char* colorData = nodeData + bytesRead + sizeof(colorBits);
+            bytesRead += sizeof(colorBits) + colorBytes;
+            ReadNodeFrame& frame = stack[depth++];
+            frame.node = node;
+            frame.childrenInTreeBits = includeExistsBits ? childBitsFromMask(nodeData[bytesRead++])
+                                                         : ALL_CHILDREN_ASSUMED_TO_EXIST;
+            frame.childBits = childBitsFromMask(nodeData[bytesRead++]);
+            frame.nextChildIndex = 0;
+
+            // children whose data follows are only made if some data does
+            unsigned char childBits = (bytesLeftToRead - bytesRead > 0) ? frame.childBits : 0;
+            bool nodeWasDirty = node->isDirty();
+            unsigned char addedBits = node->addChildrenAtIndexes(colorBits | childBits);
+            frame.unreadBits = addedBits & ~colorBits;
+            if (addedBits) {
                 _isDirty = true;
+                for (unsigned char bits = addedBits; bits; bits &= bits - 1) {
+                    voxelsCreated++;
+                    if (bits & colorBits & -bits) {
+                        _nodesChangedFromBitstream++; // each new colored child counts as a change to this node
+                    }
+                }
+                if (!nodeWasDirty && !(addedBits & colorBits)) {
+                    _nodesChangedFromBitstream++;
+                }
             }
-            if (!nodeWasDirty && nodeIsDirty) {
-                _nodesChangedFromBitstream++;
+            for (int i = 0; colorBits; i++, colorBits >>= 1) {
+                if (colorBits & 1) {
+                    nodeColor newColor = { 128, 128, 128, 1};
+                    if (includeColor) {
+                        memcpy(newColor, colorData, 3);
+                        colorData += 3;
+                    }
+                    VoxelNode* child = node->getChildAtIndex(i);
+                    bool childWasDirty = child->isDirty();
+                    child->setColor(newColor);
+                    if (child->isDirty()) {
+                        _isDirty = true;
+                        if (!childWasDirty) {
+                            _nodesChangedFromBitstream++;
+                        }
+                    }
+                    voxelsColored++;
+                }
             }
-			this->voxelsColored++;
-			this->voxelsColoredStats.updateAverage(1);
+            node = NULL;
         }
-    }
 
-    // give this destination node the child mask from the packet
-    unsigned char childrenInTreeMask = includeExistsBits ? *(nodeData + bytesRead) : ALL_CHILDREN_ASSUMED_TO_EXIST; 
-    unsigned char childMask = *(nodeData + bytesRead + (includeExistsBits ? sizeof(childrenInTreeMask) : 0));
+        // on to the next child whose data follows, if there's data left and room on the stack
+        ReadNodeFrame& frame = stack[depth - 1];
+        while (frame.nextChildIndex < NUMBER_OF_CHILDREN && !(frame.childBits & (1 << frame.nextChildIndex))) {
+            frame.nextChildIndex++;
+        }
+        if (frame.nextChildIndex < NUMBER_OF_CHILDREN) {
+            if (bytesLeftToRead - bytesRead > 0 && depth < MAX_READ_NODE_DEPTH) {
+                node = frame.node->getChildAtIndex(frame.nextChildIndex++);
+                continue;
+            }
+            // the packet ends before the rest of the children's data, or goes deeper than a tree, and is garbage
+            bytesRead = bytesLeftToRead;
+            cutShort = true;
+        }
 
-    int childIndex = 0;
-    bytesRead += includeExistsBits ? sizeof(childrenInTreeMask) + sizeof(childMask) : sizeof(childMask);
-    
-    while (bytesLeftToRead - bytesRead > 0 && childIndex < NUMBER_OF_CHILDREN) {
-        // check the exists mask to see if we have a child to traverse into
-        
-        if (oneAtBit(childMask, childIndex)) {            
-            if (!destinationNode->getChildAtIndex(childIndex)) {
-                // add a child at that index, if it doesn't exist
-                bool nodeWasDirty = destinationNode->isDirty();
-                destinationNode->addChildAtIndex(childIndex);
-                bool nodeIsDirty = destinationNode->isDirty();
-                if (nodeIsDirty) {
-                    _isDirty = true;
-                }
-                if (!nodeWasDirty && nodeIsDirty) {
-                    _nodesChangedFromBitstream++;
-                }
-                this->voxelsCreated++;
-                this->voxelsCreatedStats.updateAverage(this->voxelsCreated);
+        // this node is done, take out the children we added for data that never came
+        for (int i = 0; frame.unreadBits; i++, frame.unreadBits >>= 1) {
+            if (frame.unreadBits & 1) {
+                frame.node->deleteChildAtIndex(i);
+                voxelsCreated--;
             }
-            
-            // tell the child to read the subsequent data
-            bytesRead += readNodeData(destinationNode->getChildAtIndex(childIndex),
-                                      nodeData + bytesRead, bytesLeftToRead - bytesRead, includeColor, includeExistsBits);
         }
-        childIndex++;
-    }
-    
 
-    if (includeExistsBits) {
-        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-            // now also check the childrenInTreeMask, if the mask is missing the bit, then it means we need to delete this child
-            // subtree/node, because it shouldn't actually exist in the tree.
-            if (!oneAtBit(childrenInTreeMask, i) && destinationNode->getChildAtIndex(i)) {
-                bool stagedForDeletion = false; // assume staging is not needed
-                destinationNode->safeDeepDeleteChildAtIndex(i, stagedForDeletion);
-                _isDirty = true; // by definition!
+        // then delete the children the exists mask says shouldn't be in the tree
+        if (includeExistsBits) {
+            unsigned char deletedBits = frame.node->getChildBitmask() & ~frame.childrenInTreeBits;
+            for (int i = 0; deletedBits; i++, deletedBits >>= 1) {
+                if (deletedBits & 1) {
+                    bool stagedForDeletion = false; // assume staging is not needed
+                    frame.node->safeDeepDeleteChildAtIndex(i, stagedForDeletion);
+                    _isDirty = true; // by definition!
+                }
             }
-        }        
+        }
+
+        // if the packet was cut short and that leaves nothing of this node, then if it was added for its data too, our
+        // parent takes it out as well
+        if (depth > 1 && !(cutShort && frame.node->getChildCount() == 0 && !frame.node->isColored())) {
+            ReadNodeFrame& parentFrame = stack[depth - 2];
+            parentFrame.unreadBits &= ~(1 << (parentFrame.nextChildIndex - 1));
+        }
+        if (--depth == 0) {
+            return bytesRead;
+        }
     }
-    return bytesRead;
 }
 
 void VoxelTree::readBitstreamToTree(unsigned char * bitstream, unsigned long int bufferSizeBytes, 
@@ -267,20 +321,28 @@ void VoxelTree::readBitstreamToTree(unsigned char * bitstream, unsigned long int
     }
     
     _nodesChangedFromBitstream = 0;
+    long voxelsCreatedBefore = voxelsCreated;
+    long voxelsColoredBefore = voxelsColored;
 
     // Keep looping through the buffer calling readNodeData() this allows us to pack multiple root-relative Octal codes
     // into a single network packet. readNodeData() basically goes down a tree from the root, and fills things in from there
     // if there are more bytes after that, it's assumed to be another root relative tree
 
     while (bitstreamAt < bitstream + bufferSizeBytes) {
-        VoxelNode* bitstreamRootNode = nodeForOctalCode(destinationNode, (unsigned char *)bitstreamAt, NULL);
-        if (*bitstreamAt != *bitstreamRootNode->getOctalCode()) {
+        MortonKey bitstreamRootKey = MortonKey::fromOctalCode(bitstreamAt);
+        if (!bitstreamRootKey.isValid()) {
+            // deeper than any tree goes, and we can't tell where its data ends, so the rest of the packet is lost too
+            printLog("WARNING! bitstream octal code too deep, %ld bytes ignored\n", (long)(bufferSizeBytes - bytesRead));
+            break;
+        }
+        VoxelNode* bitstreamRootNode = nodeForKey(destinationNode, bitstreamRootKey, NULL);
+        if (bitstreamRootKey.getLevel() != *bitstreamRootNode->getOctalCode()) {
             // if the octal code returned is not on the same level as
             // the code being searched for, we have VoxelNodes to create
 
             // Note: we need to create this node relative to root, because we're assuming that the bitstream for the initial
             // octal code is always relative to root!
-            bitstreamRootNode = createMissingNode(destinationNode, (unsigned char*) bitstreamAt);
+            bitstreamRootNode = createMissingNode(destinationNode, bitstreamRootKey);
             if (bitstreamRootNode->isDirty()) {
                 _isDirty = true;
                 _nodesChangedFromBitstream++;
@@ -298,14 +360,16 @@ void VoxelTree::readBitstreamToTree(unsigned char * bitstream, unsigned long int
         bytesRead +=  theseBytesRead;
     }
 
+    voxelsCreatedStats.updateAverage(voxelsCreated - voxelsCreatedBefore);
+    voxelsColoredStats.updateAverage(voxelsColored - voxelsColoredBefore);
     this->voxelsBytesRead += bufferSizeBytes;
     this->voxelsBytesReadStats.updateAverage(bufferSizeBytes);
 }
 
 void VoxelTree::deleteVoxelAt(float x, float y, float z, float s, bool stage) {
-    unsigned char* octalCode = pointToVoxel(x,y,z,s,0,0,0);
+    unsigned char octalCode[MortonKey::MAX_OCTAL_CODE_BYTES];
+    MortonKey::fromPoint(x, y, z, s).toOctalCode(octalCode);
     deleteVoxelCodeFromTree(octalCode, stage);
-    delete[] octalCode; // cleanup memory
 }
 
 
@@ -313,7 +377,7 @@ class DeleteVoxelCodeFromTreeArgs {
 public:
     bool            stage;
     bool            collapseEmptyTrees;
-    unsigned char*  codeBuffer;
+    MortonKey       key;
     int             lengthOfCode;
     bool            deleteLastChild;
     bool            pathChanged;
@@ -327,8 +391,11 @@ void VoxelTree::deleteVoxelCodeFromTree(unsigned char* codeBuffer, bool stage, b
     DeleteVoxelCodeFromTreeArgs args;
     args.stage              = stage;
     args.collapseEmptyTrees = collapseEmptyTrees;
-    args.codeBuffer         = codeBuffer;
-    args.lengthOfCode       = numberOfThreeBitSectionsInCode(codeBuffer);
+    args.key                = MortonKey::fromOctalCode(codeBuffer);
+    if (!args.key.isValid()) {
+        return; // deeper than any tree goes, so there's nothing there to delete
+    }
+    args.lengthOfCode       = args.key.getLevel();
     args.deleteLastChild    = false;
     args.pathChanged        = false;
     
@@ -339,7 +406,7 @@ void VoxelTree::deleteVoxelCodeFromTree(unsigned char* codeBuffer, bool stage, b
 void VoxelTree::deleteVoxelCodeFromTreeRecursion(VoxelNode* node, void* extraData) {
     DeleteVoxelCodeFromTreeArgs* args = (DeleteVoxelCodeFromTreeArgs*)extraData;
 
-    int lengthOfNodeCode = numberOfThreeBitSectionsInCode(node->getOctalCode());
+    int lengthOfNodeCode = *node->getOctalCode();
 
     // Since we traverse the tree in code order, we know that if our code 
     // matches, then we've reached  our target node.
@@ -352,8 +419,14 @@ void VoxelTree::deleteVoxelCodeFromTreeRecursion(VoxelNode* node, void* extraDat
         return;
     }
 
+    // if our children haven't been loaded yet, then we need them before we can look for our target
+    if (node->hasChildrenOnDisk()) {
+        materializeChildrenForEdit(node);
+        args->pathChanged = true;
+    }
+
     // Ok, we know we haven't reached our target node yet, so keep looking
-    int childIndex = branchIndexWithDescendant(node->getOctalCode(), args->codeBuffer);
+    int childIndex = args->key.getSection(lengthOfNodeCode);
     VoxelNode* childNode = node->getChildAtIndex(childIndex);
     
     // If there is no child at the target location, and the current parent node is a colored leaf,
@@ -363,7 +436,8 @@ void VoxelTree::deleteVoxelCodeFromTreeRecursion(VoxelNode* node, void* extraDat
         // we need to break up ancestors until we get to the right level
         VoxelNode* ancestorNode = node;
         while (true) {
-            int index = branchIndexWithDescendant(ancestorNode->getOctalCode(), args->codeBuffer);
+            int lengthOfancestorNode = *ancestorNode->getOctalCode();
+            int index = args->key.getSection(lengthOfancestorNode);
             for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
                 if (i != index) {
                     ancestorNode->addChildAtIndex(i);
@@ -372,8 +446,7 @@ void VoxelTree::deleteVoxelCodeFromTreeRecursion(VoxelNode* node, void* extraDat
                     }
                 }
             }
-            int lengthOfancestorNode = numberOfThreeBitSectionsInCode(ancestorNode->getOctalCode());
-            
+
             // If we've reached the parent of the target, then stop breaking up children
             if (lengthOfancestorNode == (args->lengthOfCode - 1)) {
                 break;
@@ -437,15 +510,18 @@ void VoxelTree::deleteVoxelCodeFromTreeRecursion(VoxelNode* node, void* extraDat
 }
 
 void VoxelTree::eraseAllVoxels() {
-    // XXXBHG Hack attack - is there a better way to erase the voxel tree?
-    delete rootNode; // this will recurse and delete all children
-    rootNode = new VoxelNode();
+    // every node and octal code lives in our pool, so rather than recursively deleting the tree we just
+    // release the pool's blocks. Note: this means any nodes removed from the tree but not yet deleted are gone too
+    _nodePool.releaseAll();
+    _mappedFile.close();
+    rootNode = new (_nodePool) VoxelNode();
     _isDirty = true;
 }
 
 class ReadCodeColorBufferToTreeArgs {
 public:
     unsigned char*  codeColorBuffer;
+    MortonKey       key;
     int             lengthOfCode;
     bool            destructive;
     bool            pathChanged;
@@ -454,7 +530,11 @@ public:
 void VoxelTree::readCodeColorBufferToTree(unsigned char* codeColorBuffer, bool destructive) {
     ReadCodeColorBufferToTreeArgs args;
     args.codeColorBuffer = codeColorBuffer;
-    args.lengthOfCode    = numberOfThreeBitSectionsInCode(codeColorBuffer);
+    args.key             = MortonKey::fromOctalCode(codeColorBuffer);
+    if (!args.key.isValid()) {
+        return; // deeper than any tree goes
+    }
+    args.lengthOfCode    = args.key.getLevel();
     args.destructive     = destructive;
     args.pathChanged     = false;
 
@@ -468,50 +548,26 @@ void VoxelTree::readCodeColorBufferToTree(unsigned char* codeColorBuffer, bool d
 void VoxelTree::readCodeColorBufferToTreeRecursion(VoxelNode* node, void* extraData) {
     ReadCodeColorBufferToTreeArgs* args = (ReadCodeColorBufferToTreeArgs*)extraData;
 
-    int lengthOfNodeCode = numberOfThreeBitSectionsInCode(node->getOctalCode());
+    // if our children haven't been loaded yet, then load them, whether we're the target or on the way to it
+    if (node->hasChildrenOnDisk()) {
+        materializeChildrenForEdit(node);
+        args->pathChanged = true;
+    }
+
+    int lengthOfNodeCode = *node->getOctalCode();
 
     // Since we traverse the tree in code order, we know that if our code 
     // matches, then we've reached  our target node.
     if (lengthOfNodeCode == args->lengthOfCode) {
-        // we've reached our target -- we might have found our node, but that node might have children.
-        // in this case, we only allow you to set the color if you explicitly asked for a destructive
-        // write.
-        if (!node->isLeaf() && args->destructive) {
-            // if it does exist, make sure it has no children
-            for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-                node->deleteChildAtIndex(i);
-            }
-        } else {
-            if (!node->isLeaf()) {
-                printLog("WARNING! operation would require deleting children, add Voxel ignored!\n ");
-            }
-        }
-        
-        // If we get here, then it means, we either had a true leaf to begin with, or we were in
-        // destructive mode and we deleted all the child trees. So we can color.
-        if (node->isLeaf()) {
-            // give this node its color
-            int octalCodeBytes = bytesRequiredForCodeLength(args->lengthOfCode);
-
-            nodeColor newColor;
-            memcpy(newColor, args->codeColorBuffer + octalCodeBytes, SIZE_OF_COLOR_DATA);
-            newColor[SIZE_OF_COLOR_DATA] = 1;
-            node->setColor(newColor);
-            
-            // It's possible we just reset the node to it's exact same color, in
-            // which case we don't consider this to be dirty...
-            if (node->isDirty()) {
-                // track our tree dirtiness
-                _isDirty = true;
-                // track that path has changed
-                args->pathChanged = true;
-            }
+        if (setColorFromCodeColorBuffer(node, args->codeColorBuffer, args->destructive)) {
+            // track that path has changed
+            args->pathChanged = true;
         }
         return;
     }
 
     // Ok, we know we haven't reached our target node yet, so keep looking
-    int childIndex = branchIndexWithDescendant(node->getOctalCode(), args->codeColorBuffer);
+    int childIndex = args->key.getSection(lengthOfNodeCode);
     VoxelNode* childNode = node->getChildAtIndex(childIndex);
     
     // If the branch we need to traverse does not exist, then create it on the way down...
@@ -531,6 +587,179 @@ void VoxelTree::readCodeColorBufferToTreeRecursion(VoxelNode* node, void* extraD
     }
 }
 
+// sets the color of the node an edit is aimed at, returns true if that changed anything
+bool VoxelTree::setColorFromCodeColorBuffer(VoxelNode* node, unsigned char* codeColorBuffer, bool destructive) {
+    // we've reached our target -- we might have found our node, but that node might have children.
+    // in this case, we only allow you to set the color if you explicitly asked for a destructive
+    // write.
+    if (!node->isLeaf() && destructive) {
+        // if it does exist, make sure it has no children
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            node->deleteChildAtIndex(i);
+        }
+    } else {
+        if (!node->isLeaf()) {
+            printLog("WARNING! operation would require deleting children, add Voxel ignored!\n ");
+        }
+    }
+    
+    // If we get here, then it means, we either had a true leaf to begin with, or we were in
+    // destructive mode and we deleted all the child trees. So we can color.
+    if (node->isLeaf()) {
+        // give this node its color
+        int octalCodeBytes = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(codeColorBuffer));
+
+        nodeColor newColor;
+        memcpy(newColor, codeColorBuffer + octalCodeBytes, SIZE_OF_COLOR_DATA);
+        newColor[SIZE_OF_COLOR_DATA] = 1;
+        node->setColor(newColor);
+        
+        // It's possible we just reset the node to it's exact same color, in
+        // which case we don't consider this to be dirty...
+        if (node->isDirty()) {
+            // track our tree dirtiness
+            _isDirty = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sorts edits into tree order: sibling subtrees in child index order, an edit to a node ahead of the edits to its
+// descendants, and edits to the same node in the order they came in. Each three bit section of an octal code is
+// scanned as four bits, the first set only if the code is that long, so that shorter codes sort first
+class VoxelEditScanner {
+public:
+    static const int BITS_PER_SECTION = 4;
+
+    VoxelEditScanner(int maxSections, int orderBits) :
+        _codeBits(maxSections * BITS_PER_SECTION),
+        _totalBits(_codeBits + orderBits) {};
+
+    typedef int state_type;
+    state_type initial_state() const { return 0; };
+    bool advance(state_type& position) const { return ++position < _totalBits; };
+
+    bool bit(const VoxelEdit& edit, state_type position) const {
+        if (position >= _codeBits) {
+            return (edit.order >> (_totalBits - 1 - position)) & 1;
+        }
+        int section = position / BITS_PER_SECTION;
+        int bitInSection = position % BITS_PER_SECTION;
+        if (section >= edit.key.getLevel()) {
+            return false;
+        }
+        if (bitInSection == 0) {
+            return true;
+        }
+        return (edit.key.getSection(section) >> (BITS_PER_SECTION - 1 - bitInSection)) & 1;
+    };
+
+private:
+    int _codeBits;
+    int _totalBits;
+};
+
+void VoxelTree::readCodeColorBuffersToTree(VoxelEdit* edits, int editCount) {
+    if (editCount <= 0) {
+        return;
+    }
+    // edits deeper than any tree goes are dropped, the rest keep their order
+    int maxSections = 0;
+    int validCount = 0;
+    for (int i = 0; i < editCount; i++) {
+        MortonKey key = MortonKey::fromOctalCode(edits[i].codeColorBuffer);
+        if (key.isValid()) {
+            edits[validCount] = edits[i];
+            edits[validCount].order = validCount;
+            edits[validCount].key = key;
+            maxSections = std::max(maxSections, key.getLevel());
+            validCount++;
+        }
+    }
+    editCount = validCount;
+    if (editCount == 0) {
+        return;
+    }
+    int orderBits = 1;
+    while ((editCount - 1) >> orderBits) {
+        orderBits++;
+    }
+    radix2InplaceSort(edits, edits + editCount, VoxelEditScanner(maxSections, orderBits));
+    readCodeColorBuffersToTreeRecursion(rootNode, 0, edits, editCount, 0, editCount);
+}
+
+// Applies the edits with orders in [firstOrder, endOrder) to node and its descendants. The edits are all for node or
+// below it, in tree order, so the ones for node itself come first. Returns true if anything changed, so our parent
+// knows to reaverage.
+bool VoxelTree::readCodeColorBuffersToTreeRecursion(VoxelNode* node, int level, VoxelEdit* edits, int editCount,
+                                                    int firstOrder, int endOrder) {
+    bool pathChanged = false;
+
+    // if our children haven't been loaded yet, then load them, whether we're the target or on the way to it
+    if (node->hasChildrenOnDisk()) {
+        materializeChildrenForEdit(node);
+        pathChanged = true;
+    }
+
+    int nodeEdits = 0;
+    while (nodeEdits < editCount && edits[nodeEdits].key.getLevel() == level) {
+        nodeEdits++;
+    }
+
+    // Edits below us that came in before an edit to us need to be applied before it, and the ones that came after,
+    // after it. So each edit to us splits the edits below us into another pass, usually there's just the one
+    int passFirstOrder = firstOrder;
+    for (int nodeEdit = 0; nodeEdit <= nodeEdits; nodeEdit++) {
+        int passEndOrder = endOrder;
+        if (nodeEdit < nodeEdits) {
+            if (edits[nodeEdit].order < firstOrder || edits[nodeEdit].order >= endOrder) {
+                continue; // this one belongs to a different pass of our parent's
+            }
+            passEndOrder = edits[nodeEdit].order;
+        }
+
+        bool descendantsChanged = false;
+        int childEdits = nodeEdits;
+        while (childEdits < editCount) {
+            int childIndex = edits[childEdits].key.getSection(level);
+            int childEditsEnd = childEdits;
+            bool inThisPass = false;
+            while (childEditsEnd < editCount && edits[childEditsEnd].key.getSection(level) == childIndex) {
+                int order = edits[childEditsEnd].order;
+                inThisPass = inThisPass || (order >= passFirstOrder && order < passEndOrder);
+                childEditsEnd++;
+            }
+            if (inThisPass) {
+                // If the branch we need to traverse does not exist, then create it on the way down...
+                VoxelNode* childNode = node->getChildAtIndex(childIndex);
+                if (!childNode) {
+                    childNode = node->addChildAtIndex(childIndex);
+                }
+                if (readCodeColorBuffersToTreeRecursion(childNode, level + 1, edits + childEdits,
+                                                        childEditsEnd - childEdits, passFirstOrder, passEndOrder)) {
+                    descendantsChanged = true;
+                }
+            }
+            childEdits = childEditsEnd;
+        }
+
+        // once for all of the edits below us in this pass
+        if (descendantsChanged) {
+            node->handleSubtreeChanged(this);
+            pathChanged = true;
+        }
+
+        if (nodeEdit < nodeEdits) {
+            if (setColorFromCodeColorBuffer(node, edits[nodeEdit].codeColorBuffer, edits[nodeEdit].destructive)) {
+                pathChanged = true;
+            }
+            passFirstOrder = passEndOrder + 1;
+        }
+    }
+    return pathChanged;
+}
+
 void VoxelTree::processRemoveVoxelBitstream(unsigned char * bitstream, int bufferSizeBytes) {
 	//unsigned short int itemNumber = (*((unsigned short int*)&bitstream[sizeof(PACKET_HEADER)]));
 	int atByte = sizeof(short int) + sizeof(PACKET_HEADER);
@@ -613,6 +842,207 @@ void VoxelTree::reaverageVoxelColors(VoxelNode *startNode) {
     }
 }
 
+void VoxelTreeStats::add(const VoxelTreeStats& other) {
+    nodeCount += other.nodeCount;
+    leafCount += other.leafCount;
+    coloredCount += other.coloredCount;
+    collapsedCount += other.collapsedCount;
+    maxLevel = std::max(maxLevel, other.maxLevel);
+    problemCount += other.problemCount;
+}
+
+// one subtree below the top levels, for reaverageAndValidate()'s threads, and what was found in it
+class ReaverageTask {
+public:
+    VoxelNode*                  node;
+    MortonKey                   key;
+    bool                        collapsible;
+    VoxelTreeStats              stats;
+    std::vector<VoxelNode*>     collapseRoots;
+};
+
+class ReaveragePass {
+public:
+    bool                        reaverage;
+    std::vector<ReaverageTask>  tasks;
+    int                         taskLevel;  // the level the tasks' nodes are at, the pass over the top levels stops there
+    int                         nextTask;
+    pthread_mutex_t             nextTaskLock;
+};
+
+static const int MAX_PROBLEMS_PRINTED = 10;   // by each thread
+static const int TASKS_PER_THREAD = 8;        // so a thread that gets the big subtrees doesn't hold up the rest
+static const int MAX_TASK_LEVEL = 4;
+
+static void validateNode(VoxelNode* node, const MortonKey& key, VoxelTreeStats& stats) {
+    const char* problem = NULL;
+    if (MortonKey::fromOctalCode(node->getOctalCode()) != key) {
+        problem = "octal code doesn't match its place in the tree";
+    } else if (!(node->getDensity() >= 0.0f && node->getDensity() <= 1.0f)) {
+        problem = "density is out of range";
+    }
+    if (problem && stats.problemCount++ < MAX_PROBLEMS_PRINTED) {
+        printLog("reaverageAndValidate() node at level %d: %s\n", key.getLevel(), problem);
+    }
+}
+
+// Reaverages and validates the subtree below node, adding what's in it to stats, and returns whether the node could
+// collapse into a colored leaf. Whether it does is up to its parent, which may collapse too, so the nodes a parent
+// decides to collapse are put on collapseRoots rather than collapsed right away. Below the pass's taskLevel, if it has
+// one, the results come from the tasks instead, in the same order the tasks were collected
+static bool reaverageAndValidateRecursion(ReaveragePass& pass, VoxelNode* node, const MortonKey& key,
+                                          VoxelTreeStats& stats, std::vector<VoxelNode*>& collapseRoots) {
+    if (key.getLevel() == pass.taskLevel) {
+        ReaverageTask& task = pass.tasks[pass.nextTask++];
+        stats.add(task.stats);
+        collapseRoots.insert(collapseRoots.end(), task.collapseRoots.begin(), task.collapseRoots.end());
+        return task.collapsible;
+    }
+
+    stats.nodeCount++;
+    stats.maxLevel = std::max(stats.maxLevel, key.getLevel());
+    validateNode(node, key, stats);
+    if (node->isLeaf()) {
+        stats.leafCount++;
+        if (node->isColored()) {
+            stats.coloredCount++;
+        }
+        return pass.reaverage && node->isColored() && !node->isStagedForDeletion() && !node->hasChildrenOnDisk();
+    }
+
+    // like collapseIdenticalLeaves(), all the children have to be there, collapsible and the same color
+    bool collapsible = pass.reaverage && node->getChildCount() == NUMBER_OF_CHILDREN && !node->isStagedForDeletion();
+    bool childCollapsible[NUMBER_OF_CHILDREN];
+    VoxelTreeStats childStats[NUMBER_OF_CHILDREN];
+    VoxelNode* firstChild = NULL;
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* child = node->getChildAtIndex(i);
+        childCollapsible[i] = false;
+        if (child) {
+            childCollapsible[i] = reaverageAndValidateRecursion(pass, child, key.getChild(i), childStats[i],
+                                                                collapseRoots);
+            if (!firstChild) {
+                firstChild = child;
+            }
+            if (!childCollapsible[i] || memcmp(child->getColor(), firstChild->getColor(), 3) != 0) {
+                collapsible = false;
+            }
+        }
+    }
+
+    // a node that collapses gets the color its children all have, which is also their average
+    if (pass.reaverage) {
+        node->setColorFromAverageOfChildren();
+    }
+    if (node->isColored()) {
+        stats.coloredCount++;
+    }
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (collapsible) {
+            stats.add(childStats[i]);
+        } else if (childCollapsible[i] && !node->getChildAtIndex(i)->isLeaf()) {
+            // the child's subtree becomes a single colored leaf
+            collapseRoots.push_back(node->getChildAtIndex(i));
+            stats.collapsedCount += childStats[i].collapsedCount + childStats[i].nodeCount - 1;
+            stats.nodeCount++;
+            stats.leafCount++;
+            stats.coloredCount++;
+            stats.maxLevel = std::max(stats.maxLevel, childStats[i].maxLevel);
+            stats.problemCount += childStats[i].problemCount;
+        } else {
+            stats.add(childStats[i]);
+        }
+    }
+    return collapsible;
+}
+
+static void* reaverageTaskThread(void* args) {
+    ReaveragePass* pass = (ReaveragePass*)args;
+    while (true) {
+        pthread_mutex_lock(&pass->nextTaskLock);
+        int taskIndex = pass->nextTask++;
+        pthread_mutex_unlock(&pass->nextTaskLock);
+        if (taskIndex >= (int)pass->tasks.size()) {
+            break;
+        }
+        ReaverageTask& task = pass->tasks[taskIndex];
+        ReaveragePass subtreePass;
+        subtreePass.reaverage = pass->reaverage;
+        subtreePass.taskLevel = -1;
+        task.collapsible = reaverageAndValidateRecursion(subtreePass, task.node, task.key, task.stats,
+                                                         task.collapseRoots);
+    }
+    return NULL;
+}
+
+// the nodes at level, in child index order depth first, which is the order the pass over the top levels visits them
+static void collectTasks(VoxelNode* node, const MortonKey& key, int level, std::vector<ReaverageTask>& tasks) {
+    if (key.getLevel() == level) {
+        tasks.push_back(ReaverageTask());
+        tasks.back().node = node;
+        tasks.back().key = key;
+        return;
+    }
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (node->getChildAtIndex(i)) {
+            collectTasks(node->getChildAtIndex(i), key.getChild(i), level, tasks);
+        }
+    }
+}
+
+void VoxelTree::reaverageAndValidate(int threadCount, bool reaverage, VoxelTreeStats& stats) {
+    ReaveragePass pass;
+    pass.reaverage = reaverage && _shouldReaverage;
+    pthread_mutex_init(&pass.nextTaskLock, NULL);
+
+    // go down until there are enough subtrees to keep the threads busy
+    pass.taskLevel = 1;
+    collectTasks(rootNode, MortonKey(), pass.taskLevel, pass.tasks);
+    while (pass.taskLevel < MAX_TASK_LEVEL && (int)pass.tasks.size() < threadCount * TASKS_PER_THREAD) {
+        std::vector<ReaverageTask> deeperTasks;
+        collectTasks(rootNode, MortonKey(), pass.taskLevel + 1, deeperTasks);
+        if (deeperTasks.size() <= pass.tasks.size()) {
+            break;
+        }
+        pass.tasks.swap(deeperTasks);
+        pass.taskLevel++;
+    }
+
+    pass.nextTask = 0;
+    std::vector<pthread_t> threads(std::max(threadCount - 1, 0));
+    for (int i = 0; i < (int)threads.size(); i++) {
+        pthread_create(&threads[i], NULL, reaverageTaskThread, &pass);
+    }
+    reaverageTaskThread(&pass); // this thread works too
+    for (int i = 0; i < (int)threads.size(); i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pass.nextTaskLock);
+
+    // then the levels above the tasks, which take the tasks' results in order
+    pass.nextTask = 0;
+    std::vector<VoxelNode*> collapseRoots;
+    if (reaverageAndValidateRecursion(pass, rootNode, MortonKey(), stats, collapseRoots) && !rootNode->isLeaf()) {
+        collapseRoots.push_back(rootNode);
+        stats.collapsedCount = stats.nodeCount - 1;
+        stats.nodeCount = stats.leafCount = stats.coloredCount = 1;
+    }
+
+    for (int i = 0; i < (int)collapseRoots.size(); i++) {
+        VoxelNode* node = collapseRoots[i];
+        nodeColor collapsedColor;
+        memcpy(collapsedColor, node->getColor(), 3);
+        collapsedColor[3] = 1;
+        for (int j = 0; j < NUMBER_OF_CHILDREN; j++) {
+            node->deleteChildAtIndex(j);
+        }
+        node->setColor(collapsedColor);
+    }
+    if (!collapseRoots.empty()) {
+        _isDirty = true;
+    }
+}
+
 void VoxelTree::loadVoxelsFile(const char* fileName, bool wantColorRandomizer) {
     int vCount = 0;
 
@@ -667,20 +1097,41 @@ void VoxelTree::loadVoxelsFile(const char* fileName, bool wantColorRandomizer) {
 }
 
 VoxelNode* VoxelTree::getVoxelAt(float x, float y, float z, float s) const {
-    unsigned char* octalCode = pointToVoxel(x,y,z,s,0,0,0);
-    VoxelNode* node = nodeForOctalCode(rootNode, octalCode, NULL);
-    if (*node->getOctalCode() != *octalCode) {
+    MortonKey key = MortonKey::fromPoint(x, y, z, s);
+    VoxelNode* node = nodeForKey(rootNode, key, NULL);
+    if (*node->getOctalCode() != key.getLevel()) {
         node = NULL;
     }
-    delete[] octalCode; // cleanup memory
+    return node;
+}
+
+VoxelNode* VoxelTree::getNodeAt(const MortonKey& key) const {
+    VoxelNode* node = nodeForKey(rootNode, key, NULL);
+    return (*node->getOctalCode() == key.getLevel()) ? node : NULL;
+}
+
+VoxelNode* VoxelTree::createNodeAt(const MortonKey& key) {
+    VoxelNode* node = nodeForKey(rootNode, key, NULL);
+    if (*node->getOctalCode() != key.getLevel()) {
+        node = createMissingNode(node, key);
+        // let the encoder know there's something new below the node's ancestors
+        for (VoxelNode* ancestor = rootNode; ancestor != node;
+             ancestor = ancestor->getChildAtIndex(key.getSection(*ancestor->getOctalCode()))) {
+            ancestor->markWithChangedTime();
+        }
+        _isDirty = true;
+    }
     return node;
 }
 
 void VoxelTree::createVoxel(float x, float y, float z, float s, 
                             unsigned char red, unsigned char green, unsigned char blue, bool destructive) {
-    unsigned char* voxelData = pointToVoxel(x,y,z,s,red,green,blue);
+    unsigned char voxelData[MortonKey::MAX_OCTAL_CODE_BYTES + SIZE_OF_COLOR_DATA];
+    int octalCodeBytes = MortonKey::fromPoint(x, y, z, s).toOctalCode(voxelData);
+    voxelData[octalCodeBytes + RED_INDEX] = red;
+    voxelData[octalCodeBytes + GREEN_INDEX] = green;
+    voxelData[octalCodeBytes + BLUE_INDEX] = blue;
     this->readCodeColorBufferToTree(voxelData, destructive);
-    delete[] voxelData;
 }
 
 
@@ -834,121 +1285,218 @@ int VoxelTree::searchForColoredNodes(int maxSearchLevel, VoxelNode* node, const
     // call the recursive version, this will add all found colored node roots to the bag
     int currentSearchLevel = 0;
     
-    int levelReached = searchForColoredNodesRecursion(maxSearchLevel, currentSearchLevel, rootNode, 
+    int levelReached = searchForColoredNodesRecursion(maxSearchLevel, currentSearchLevel, node, 
                                                       viewFrustum, bag, deltaViewFrustum, lastViewFrustum);
     return levelReached;
 }
 
 // combines the ray cast arguments into a single object
-class RayArgs {
+// A ray on its way down the tree, for findRayIntersection(). This is the parametric traversal from Revelles et al.,
+// "An Efficient Parametric Algorithm for Octree Traversal". The ray is mirrored so that it goes the positive way on
+// every axis, which lets the order it passes through a node's children come from where it enters the node and a
+// table of which child it goes to when it leaves each one. mirrorMask turns a mirrored child index back into a real
+// one, the t values are where the ray crosses the planes of a node's box in units of its direction
+class RayTraversal {
 public:
-    glm::vec3 origin;
-    glm::vec3 direction;
-    VoxelNode*& node;
-    float& distance;
-    BoxFace& face;
-    bool found;
+    unsigned char   mirrorMask;
+    glm::vec3       direction;
+    VoxelNode*      node;
+    float           distance;
+    BoxFace         face;
 };
 
-bool findRayIntersectionOp(VoxelNode* node, void* extraData) {
-    RayArgs* args = static_cast<RayArgs*>(extraData);
-    AABox box = node->getAABox();
-    float distance;
-    BoxFace face;
-    if (!box.findRayIntersection(args->origin, args->direction, distance, face)) {
-        return false;
+// the child the ray goes to when it leaves the current one through the nearest of the three planes, 8 for none
+static int nextChild(float tx, int xChild, float ty, int yChild, float tz, int zChild) {
+    if (tx < ty) {
+        return tx < tz ? xChild : zChild;
     }
-    if (!node->isLeaf()) {
-        return true; // recurse on children
+    return ty < tz ? yChild : zChild;
+}
+
+static bool findRayIntersectionInNode(RayTraversal& ray, VoxelNode* node, float tx0, float ty0, float tz0,
+                                      float tx1, float ty1, float tz1) {
+    if (tx1 < 0.0f || ty1 < 0.0f || tz1 < 0.0f) {
+        return false; // behind the origin
     }
-    distance *= TREE_SCALE;
-    if (node->isColored() && (!args->found || distance < args->distance)) {
-        args->node = node;
-        args->distance = distance;
-        args->face = face;
-        args->found = true;
+    if (node->isLeaf()) {
+        if (!node->isColored()) {
+            return false;
+        }
+        float entry = std::max(tx0, std::max(ty0, tz0));
+        ray.node = node;
+        ray.distance = std::max(entry, 0.0f); // zero if the origin is inside
+        if (entry == tx0) {
+            ray.face = ray.direction.x > 0 ? MIN_X_FACE : MAX_X_FACE;
+        } else if (entry == ty0) {
+            ray.face = ray.direction.y > 0 ? MIN_Y_FACE : MAX_Y_FACE;
+        } else {
+            ray.face = ray.direction.z > 0 ? MIN_Z_FACE : MAX_Z_FACE;
+        }
+        return true;
+    }
+
+    float txm = 0.5f * (tx0 + tx1);
+    float tym = 0.5f * (ty0 + ty1);
+    float tzm = 0.5f * (tz0 + tz1);
+
+    // the first child is on the far side of any middle plane the ray crosses before it enters the node
+    int child = 0;
+    if (tx0 > ty0 && tx0 > tz0) {
+        child |= (tym < tx0 ? 2 : 0) | (tzm < tx0 ? 1 : 0);
+    } else if (ty0 > tz0) {
+        child |= (txm < ty0 ? 4 : 0) | (tzm < ty0 ? 1 : 0);
+    } else {
+        child |= (txm < tz0 ? 4 : 0) | (tym < tz0 ? 2 : 0);
+    }
+
+    const int NO_CHILD = NUMBER_OF_CHILDREN;
+    while (child < NO_CHILD) {
+        VoxelNode* childNode = node->getChildAtIndex(child ^ ray.mirrorMask);
+        switch (child) {
+            case 0:
+                if (childNode && findRayIntersectionInNode(ray, childNode, tx0, ty0, tz0, txm, tym, tzm)) {
+                    return true;
+                }
+                child = nextChild(txm, 4, tym, 2, tzm, 1);
+                break;
+            case 1:
+                if (childNode && findRayIntersectionInNode(ray, childNode, tx0, ty0, tzm, txm, tym, tz1)) {
+                    return true;
+                }
+                child = nextChild(txm, 5, tym, 3, tz1, NO_CHILD);
+                break;
+            case 2:
+                if (childNode && findRayIntersectionInNode(ray, childNode, tx0, tym, tz0, txm, ty1, tzm)) {
+                    return true;
+                }
+                child = nextChild(txm, 6, ty1, NO_CHILD, tzm, 3);
+                break;
+            case 3:
+                if (childNode && findRayIntersectionInNode(ray, childNode, tx0, tym, tzm, txm, ty1, tz1)) {
+                    return true;
+                }
+                child = nextChild(txm, 7, ty1, NO_CHILD, tz1, NO_CHILD);
+                break;
+            case 4:
+                if (childNode && findRayIntersectionInNode(ray, childNode, txm, ty0, tz0, tx1, tym, tzm)) {
+                    return true;
+                }
+                child = nextChild(tx1, NO_CHILD, tym, 6, tzm, 5);
+                break;
+            case 5:
+                if (childNode && findRayIntersectionInNode(ray, childNode, txm, ty0, tzm, tx1, tym, tz1)) {
+                    return true;
+                }
+                child = nextChild(tx1, NO_CHILD, tym, 7, tz1, NO_CHILD);
+                break;
+            case 6:
+                if (childNode && findRayIntersectionInNode(ray, childNode, txm, tym, tz0, tx1, ty1, tzm)) {
+                    return true;
+                }
+                child = nextChild(tx1, NO_CHILD, ty1, NO_CHILD, tzm, 7);
+                break;
+            default:
+                if (childNode && findRayIntersectionInNode(ray, childNode, txm, tym, tzm, tx1, ty1, tz1)) {
+                    return true;
+                }
+                child = NO_CHILD;
+                break;
+        }
     }
     return false;
 }
 
 bool VoxelTree::findRayIntersection(const glm::vec3& origin, const glm::vec3& direction,
-                                    VoxelNode*& node, float& distance, BoxFace& face) {
-    RayArgs args = { origin / (float)TREE_SCALE, direction, node, distance, face };
-    recurseTreeWithOperation(findRayIntersectionOp, &args);
-    return args.found;
+                                    VoxelNode*& node, float& distance, BoxFace& face) const {
+    RayTraversal ray;
+    ray.mirrorMask = 0;
+    ray.direction = direction;
+
+    // the root is the unit cube, mirror the ray on each axis it goes the negative way along
+    glm::vec3 mirroredOrigin = origin / (float)TREE_SCALE;
+    glm::vec3 mirroredDirection = direction;
+    for (int axis = 0; axis < 3; axis++) {
+        if (mirroredDirection[axis] < 0.0f) {
+            mirroredOrigin[axis] = 1.0f - mirroredOrigin[axis];
+            mirroredDirection[axis] = -mirroredDirection[axis];
+            ray.mirrorMask |= 4 >> axis;
+        }
+        // a ray along a plane never crosses it, a tiny step keeps the t values finite and on the right side
+        const float PARALLEL_DIRECTION = 1.0e-20f;
+        if (mirroredDirection[axis] < PARALLEL_DIRECTION) {
+            mirroredDirection[axis] = PARALLEL_DIRECTION;
+        }
+    }
+    glm::vec3 t0 = -mirroredOrigin / mirroredDirection;
+    glm::vec3 t1 = (glm::vec3(1.0f, 1.0f, 1.0f) - mirroredOrigin) / mirroredDirection;
+    if (std::max(t0.x, std::max(t0.y, t0.z)) >= std::min(t1.x, std::min(t1.y, t1.z)) ||
+        !findRayIntersectionInNode(ray, rootNode, t0.x, t0.y, t0.z, t1.x, t1.y, t1.z)) {
+        return false;
+    }
+    node = ray.node;
+    distance = ray.distance * TREE_SCALE;
+    face = ray.face;
+    return true;
 }
 
-class SphereArgs {
+// a share of a batch of rays, for findRayIntersections()
+class RayBatch {
 public:
-    glm::vec3 center;
-    float radius;
-    glm::vec3& penetration;
-    bool found;
+    const VoxelTree*    tree;
+    VoxelRayQuery*      rays;
+    int                 rayCount;
 };
 
-bool findSpherePenetrationOp(VoxelNode* node, void* extraData) {
-    SphereArgs* args = static_cast<SphereArgs*>(extraData);
-    
-    // coarse check against bounds
-    const AABox& box = node->getAABox();
-    if (!box.expandedContains(args->center, args->radius)) {
-        return false;
+static void* findRayIntersectionsThread(void* args) {
+    RayBatch* batch = (RayBatch*)args;
+    for (int i = 0; i < batch->rayCount; i++) {
+        VoxelRayQuery& ray = batch->rays[i];
+        ray.found = batch->tree->findRayIntersection(ray.origin, ray.direction, ray.node, ray.distance, ray.face);
     }
-    if (!node->isLeaf()) {
-        return true; // recurse on children
+    return NULL;
+}
+
+void VoxelTree::findRayIntersections(VoxelRayQuery* rays, int rayCount, int threadCount) const {
+    // a thread isn't worth starting for fewer rays than this
+    const int MIN_RAYS_PER_THREAD = 64;
+    threadCount = std::max(1, std::min(threadCount, rayCount / MIN_RAYS_PER_THREAD));
+
+    std::vector<RayBatch> batches(threadCount);
+    std::vector<pthread_t> threads(threadCount);
+    int firstRay = 0;
+    for (int i = 0; i < threadCount; i++) {
+        int batchRays = (rayCount - firstRay) / (threadCount - i);
+        batches[i].tree = this;
+        batches[i].rays = rays + firstRay;
+        batches[i].rayCount = batchRays;
+        firstRay += batchRays;
+        if (i > 0) {
+            pthread_create(&threads[i], NULL, findRayIntersectionsThread, &batches[i]);
+        }
     }
-    if (node->isColored()) {
-        glm::vec3 nodePenetration;
-        if (box.findSpherePenetration(args->center, args->radius, nodePenetration)) {
-            args->penetration = addPenetrations(args->penetration, nodePenetration * (float)TREE_SCALE);
-            args->found = true;
-        }        
+    findRayIntersectionsThread(&batches[0]); // this thread takes the first share
+    for (int i = 1; i < threadCount; i++) {
+        pthread_join(threads[i], NULL);
     }
-    return false;
 }
 
-bool VoxelTree::findSpherePenetration(const glm::vec3& center, float radius, glm::vec3& penetration) {
-    SphereArgs args = { center / (float)TREE_SCALE, radius / TREE_SCALE, penetration };
-    penetration = glm::vec3(0.0f, 0.0f, 0.0f);
-    recurseTreeWithOperation(findSpherePenetrationOp, &args);
-    return args.found;
+// a one query batch, so these find exactly what a VoxelCollider would
+static bool findPenetration(VoxelTree* tree, const glm::vec3& start, const glm::vec3& end, float radius,
+                            glm::vec3& penetration) {
+    VoxelCollider collider(tree);
+    VoxelCollisionQuery query = { start, end, radius, NULL };
+    std::vector<VoxelContact> contacts;
+    collider.findContacts(&query, 1, contacts);
+    VoxelCollider::combinePenetrations(contacts, 1, &penetration);
+    return !contacts.empty();
 }
 
-class CapsuleArgs {
-public:
-    glm::vec3 start;
-    glm::vec3 end;
-    float radius;
-    glm::vec3& penetration;
-    bool found;
-};
-
-bool findCapsulePenetrationOp(VoxelNode* node, void* extraData) {
-    CapsuleArgs* args = static_cast<CapsuleArgs*>(extraData);
-    
-    // coarse check against bounds
-    const AABox& box = node->getAABox();
-    if (!box.expandedIntersectsSegment(args->start, args->end, args->radius)) {
-        return false;
-    }
-    if (!node->isLeaf()) {
-        return true; // recurse on children
-    }
-    if (node->isColored()) {
-        glm::vec3 nodePenetration;
-        if (box.findCapsulePenetration(args->start, args->end, args->radius, nodePenetration)) {
-            args->penetration = addPenetrations(args->penetration, nodePenetration * (float)TREE_SCALE);
-            args->found = true;
-        }        
-    }
-    return false;
+bool VoxelTree::findSpherePenetration(const glm::vec3& center, float radius, glm::vec3& penetration) {
+    return findPenetration(this, center, center, radius, penetration);
 }
 
 bool VoxelTree::findCapsulePenetration(const glm::vec3& start, const glm::vec3& end, float radius, glm::vec3& penetration) {
-    CapsuleArgs args = { start / (float)TREE_SCALE, end / (float)TREE_SCALE, radius / TREE_SCALE, penetration };
-    penetration = glm::vec3(0.0f, 0.0f, 0.0f);
-    recurseTreeWithOperation(findCapsulePenetrationOp, &args);
-    return args.found;
+    return findPenetration(this, start, end, radius, penetration);
 }
 
 int VoxelTree::searchForColoredNodesRecursion(int maxSearchLevel, int& currentSearchLevel, 
@@ -981,12 +1529,17 @@ int VoxelTree::searchForColoredNodesRecursion(int maxSearchLevel, int& currentSe
     int        inViewNotLeafCount = 0;
     int        inViewWithColorCount = 0;
     
+    ViewFrustum::ChildLocations childLocations;
+    AABox box = node->getAABox();
+    box.scale(TREE_SCALE);
+    viewFrustum.classifyChildren(box, boundaryDistanceForRenderLevel(*node->getOctalCode() + 2), childLocations);
+
     // for each child node, check to see if they exist, are colored, and in view, and if so
     // add them to our distance ordered array of children
     for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
         VoxelNode* childNode = node->getChildAtIndex(i);
         bool childIsColored = (childNode && childNode->isColored());
-        bool childIsInView  = (childNode && childNode->isInView(viewFrustum));
+        bool childIsInView  = (childNode && (childLocations.inView() & (1 << i)));
         bool childIsLeaf    = (childNode && childNode->isLeaf());
 
         if (childIsInView) {
@@ -1001,9 +1554,9 @@ int VoxelTree::searchForColoredNodesRecursion(int maxSearchLevel, int& currentSe
                 inViewWithColorCount++;
             }
         
-            float distance = childNode->distanceToCamera(viewFrustum);
+            float distance = sqrtf(childLocations.distanceSquared[i]);
             
-            if (distance < boundaryDistanceForRenderLevel(*childNode->getOctalCode() + 1)) {
+            if (childLocations.inLOD & (1 << i)) {
                 inViewCount = insertIntoSortedArrays((void*)childNode, distance, i, 
                                                      (void**)&inViewChildren, (float*)&distancesToChildren, 
                                                      (int*)&positionOfChildren, inViewCount, NUMBER_OF_CHILDREN);
@@ -1047,15 +1600,8 @@ int VoxelTree::encodeTreeBitstream(VoxelNode* node, unsigned char* outputBuffer,
     // write the octal code
     int codeLength;
     if (params.chopLevels) {
-        unsigned char* newCode = chopOctalCode(node->getOctalCode(), params.chopLevels);
-        if (newCode) {
-            codeLength = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(newCode));
-            memcpy(outputBuffer, newCode, codeLength);
-            delete newCode;
-        } else {
-            codeLength = 1; // chopped to root!
-            *outputBuffer = 0; // root
-        }
+        // chopped to root, if it's all chopped
+        codeLength = MortonKey::fromOctalCode(node->getOctalCode()).chop(params.chopLevels).toOctalCode(outputBuffer);
     } else {
         codeLength = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(node->getOctalCode()));
         memcpy(outputBuffer, node->getOctalCode(), codeLength);
@@ -1101,6 +1647,9 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
         return bytesAtThisLevel;
     }
 
+    ViewFrustum::ChildLocations childLocations;
+    int childBoundaryDistance = 0;
+
     // caller can pass NULL as viewFrustum if they want everything
     if (params.viewFrustum) {
         float distance = node->distanceToCamera(*params.viewFrustum);
@@ -1114,14 +1663,26 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
         // If we're at a node that is out of view, then we can return, because no nodes below us will be in view!
         // although technically, we really shouldn't ever be here, because our callers shouldn't be calling us if
         // we're out of view
-        if (!node->isInView(*params.viewFrustum)) {
+        AABox box = node->getAABox();
+        box.scale(TREE_SCALE);
+        if (params.viewFrustum->boxInFrustum(box) == ViewFrustum::OUTSIDE) {
             return bytesAtThisLevel;
         }
+
+        // and while we have our box, find out where all our children are in one go
+        childBoundaryDistance = boundaryDistanceForRenderLevel(*node->getOctalCode() + 2);
+        params.viewFrustum->classifyChildren(box, childBoundaryDistance, childLocations);
         
         
         // If the user also asked for occlusion culling, check if this node is occluded, but only if it's not a leaf.
         // leaf occlusion is handled down below when we check child nodes
-        if (params.wantOcclusionCulling && !node->isLeaf()) {
+        if (params.wantOcclusionCulling && params.occlusionBuffer && !node->isLeaf()) {
+            VoxelProjectedPolygon voxelShadow = params.viewFrustum->getProjectedShadow(box);
+            if (voxelShadow.getAllInView() && params.occlusionBuffer->isOccluded(voxelShadow,
+                    OcclusionBuffer::nearDistance(box, params.viewFrustum->getPosition()))) {
+                return bytesAtThisLevel;
+            }
+        } else if (params.wantOcclusionCulling && !node->isLeaf()) {
             //node->printDebugDetails("upper section, params.wantOcclusionCulling...  node=");
             AABox voxelBox = node->getAABox();
             voxelBox.scale(TREE_SCALE);
@@ -1195,7 +1756,7 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
                 //printLog("recurseNodeWithOperationDistanceSorted() CHECKING child[%d] point=%f,%f center=%f,%f distance=%f...\n", i, point.x, point.y, center.x, center.y, distance);
                 //childNode->printDebugDetails("");
 
-                float distance = params.viewFrustum ? childNode->distanceToCamera(*params.viewFrustum) : 0;
+                float distance = params.viewFrustum ? sqrtf(childLocations.distanceSquared[i]) : 0;
 
                 currentCount = insertIntoSortedArrays((void*)childNode, distance, i,
                                                       (void**)&sortedChildren, (float*)&distancesToChildren, 
@@ -1215,20 +1776,29 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
         VoxelNode* childNode = sortedChildren[i];
         int originalIndex = indexOfChildren[i];
 
-        bool childIsInView  = (childNode && (!params.viewFrustum || childNode->isInView(*params.viewFrustum)));
+        bool childIsInView  = (childNode && (!params.viewFrustum || (childLocations.inView() & (1 << originalIndex))));
         
         if (childIsInView) {
-            // Before we determine consider this further, let's see if it's in our LOD scope...
-            float distance = distancesToChildren[i]; // params.viewFrustum ? childNode->distanceToCamera(*params.viewFrustum) : 0;
-            float boundaryDistance = params.viewFrustum ? boundaryDistanceForRenderLevel(*childNode->getOctalCode() + 1) : 1;
-
-            if (distance < boundaryDistance) {
+            // Before we determine consider this further, let's see if it's in our LOD scope... Without occlusion
+            // culling we haven't looked at the distances, and it's left to the child to check its LOD when we recurse,
+            // unless we're past the deepest level that has any LOD scope at all
+            bool childIsInLOD = !params.viewFrustum ||
+                                (params.wantOcclusionCulling ? (childLocations.inLOD & (1 << originalIndex)) :
+                                                               (childBoundaryDistance > 0));
+
+            if (childIsInLOD) {
                 inViewCount++;
+
+                // If the caller already sent this child's subtree, and nothing in it has changed since then, then the
+                // receiver already has it, so leave it out of the packet. We still include it in the exists bits, so the
+                // receiver knows to keep it.
+                bool childWasSent = (params.lastSentTime != IGNORE_LAST_SENT_TIME && 
+                                     !childNode->hasChangedSince(params.lastSentTime));
             
                 // track children in view as existing and not a leaf, if they're a leaf,
                 // we don't care about recursing deeper on them, and we don't consider their
                 // subtree to exist
-                if (!(childNode && childNode->isLeaf())) {
+                if (!(childNode && childNode->isLeaf()) && !childWasSent) {
                     childrenExistInPacketBits += (1 << (7 - originalIndex));
                     inViewNotLeafCount++;
                 }
@@ -1236,7 +1806,22 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
                 bool childIsOccluded = false; // assume it's not occluded
 
                 // If the user also asked for occlusion culling, check if this node is occluded
-                if (params.wantOcclusionCulling && childNode->isLeaf()) {
+                if (params.wantOcclusionCulling && params.occlusionBuffer && childNode->isLeaf()) {
+                    // leaves that aren't hidden hide whatever is behind them
+                    AABox voxelBox = childNode->getAABox();
+                    voxelBox.scale(TREE_SCALE);
+                    VoxelProjectedPolygon voxelShadow = params.viewFrustum->getProjectedShadow(voxelBox);
+                    if (voxelShadow.getAllInView()) {
+                        const glm::vec3& position = params.viewFrustum->getPosition();
+                        if (params.occlusionBuffer->isOccluded(voxelShadow,
+                                                               OcclusionBuffer::nearDistance(voxelBox, position))) {
+                            childIsOccluded = true;
+                        } else {
+                            params.occlusionBuffer->storeOccluder(voxelShadow,
+                                                                  OcclusionBuffer::farDistance(voxelBox, position));
+                        }
+                    }
+                } else if (params.wantOcclusionCulling && childNode->isLeaf()) {
                     // Don't check occlusion here, just add them to our distance ordered array...
 
                     AABox voxelBox = childNode->getAABox();
@@ -1269,7 +1854,7 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
                                       (params.lastViewFrustum && ViewFrustum::INSIDE == childNode->inFrustum(*params.lastViewFrustum)));
             
                 // track children with actual color, only if the child wasn't previously in view!
-                if (childNode && childNode->isColored() && !childWasInView && !childIsOccluded) {
+                if (childNode && childNode->isColored() && !childWasInView && !childIsOccluded && !childWasSent) {
                     childrenColoredBits += (1 << (7 - originalIndex));
                     inViewWithColorCount++;
                 }
@@ -1476,6 +2061,123 @@ void VoxelTree::writeToSVOFile(const char* fileName, VoxelNode* node) const {
     file.close();
 }
 
+bool VoxelTree::readFromMappedSVOFile(const char* fileName, int eagerLevels) {
+    eraseAllVoxels();
+    if (!_mappedFile.open(fileName)) {
+        return false;
+    }
+    printLog("loading mapped file %s, %d nodes in %d levels...\n", fileName,
+             _mappedFile.getNodeCount(), _mappedFile.getLevelCount());
+
+    const VoxelMappedFile::Record& rootRecord = _mappedFile.getRecord(0);
+    if (rootRecord.isColored()) {
+        nodeColor rootColor = { rootRecord.color[0], rootRecord.color[1], rootRecord.color[2], 1 };
+        rootNode->setColor(rootColor);
+    }
+    rootNode->setDensity(rootRecord.density);
+    materializeChildren(rootNode, 0, eagerLevels < 1 ? 1 : eagerLevels);
+
+    // if we loaded everything, we're done with the file
+    if (!hasNodesOnDisk()) {
+        _mappedFile.close();
+    }
+    _isDirty = true;
+    return true;
+}
+
+bool VoxelTree::writeToMappedSVOFile(const char* fileName) const {
+    if (hasNodesOnDisk()) {
+        printLog("WARNING! can't save %s while some of the tree is still on disk\n", fileName);
+        return false;
+    }
+    printLog("saving to mapped file %s...\n", fileName);
+    return VoxelMappedFile::write(fileName, rootNode);
+}
+
+// creates node's children from the records in our mapped file, and their children, down to the given number of levels.
+// Children who have children of their own below that are left on disk.
+int VoxelTree::materializeChildren(VoxelNode* node, uint32_t record, int levels) {
+    const VoxelMappedFile::Record& nodeRecord = _mappedFile.getRecord(record);
+    uint32_t childRecord = nodeRecord.getFirstChild();
+    int nodesCreated = 0;
+
+    node->setChildrenOnDisk(false);
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        if (nodeRecord.childBitmask & (1 << i)) {
+            const VoxelMappedFile::Record& childData = _mappedFile.getRecord(childRecord);
+            VoxelNode* child = node->addChildAtIndex(i);
+            if (childData.isColored()) {
+                nodeColor childColor = { childData.color[0], childData.color[1], childData.color[2], 1 };
+                child->setColor(childColor);
+            }
+            child->setDensity(childData.density);
+            nodesCreated++;
+
+            if (childData.childBitmask) {
+                if (levels > 1) {
+                    nodesCreated += materializeChildren(child, childRecord, levels - 1);
+                } else {
+                    child->setChildrenOnDisk(true);
+                    child->setDescendantsOnDisk(true);
+                }
+                if (child->hasDescendantsOnDisk()) {
+                    node->setDescendantsOnDisk(true);
+                }
+            }
+            childRecord++;
+        }
+    }
+    return nodesCreated;
+}
+
+int VoxelTree::materializeNodesFromDisk(int maxNodes) {
+    if (!hasNodesOnDisk()) {
+        return 0;
+    }
+    int nodesCreated = materializeNodesFromDiskRecursion(rootNode, 0, maxNodes);
+    if (!hasNodesOnDisk()) {
+        _mappedFile.close();
+    }
+    return nodesCreated;
+}
+
+// loads a level at a time below each node with children on disk until we've created maxNodes, the nodes on the way
+// down are marked as changed, so anyone sending changes knows to look here again
+int VoxelTree::materializeNodesFromDiskRecursion(VoxelNode* node, uint32_t record, int maxNodes) {
+    int nodesCreated = 0;
+    if (node->hasChildrenOnDisk()) {
+        nodesCreated += materializeChildren(node, record, 1);
+    }
+
+    bool descendantsOnDisk = false;
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* child = node->getChildAtIndex(i);
+        // only children that came from the file can have descendants on disk, so the file always has their record
+        if (child && child->hasDescendantsOnDisk()) {
+            if (nodesCreated < maxNodes) {
+                nodesCreated += materializeNodesFromDiskRecursion(child, _mappedFile.getChildRecord(record, i),
+                                                                  maxNodes - nodesCreated);
+            }
+            descendantsOnDisk = descendantsOnDisk || child->hasDescendantsOnDisk();
+        }
+    }
+    node->setDescendantsOnDisk(descendantsOnDisk);
+    if (nodesCreated) {
+        node->markWithChangedTime();
+    }
+    return nodesCreated;
+}
+
+// an edit reached a node whose children are still on disk, the rest of the subtree can stay there
+void VoxelTree::materializeChildrenForEdit(VoxelNode* node) {
+    uint32_t record = _mappedFile.findRecord(node->getOctalCode());
+    if (record != VoxelMappedFile::NO_RECORD) {
+        materializeChildren(node, record, 1);
+    } else {
+        node->setChildrenOnDisk(false);
+    }
+}
+
 unsigned long VoxelTree::getVoxelCount() {
     unsigned long nodeCount = 0;
     recurseTreeWithOperation(countVoxelsOperation, &nodeCount);
@@ -10,10 +10,14 @@
 #define __hifi__VoxelTree__
 
 #include "SimpleMovingAverage.h"
+#include "MortonKey.h"
 #include "ViewFrustum.h"
 #include "VoxelNode.h"
 #include "VoxelNodeBag.h"
+#include "VoxelNodePool.h"
+#include "VoxelMappedFile.h"
 #include "CoverageMap.h"
+#include "OcclusionBuffer.h"
 
 // Callback function, for recuseTreeWithOperation
 typedef bool (*RecurseVoxelTreeOperation)(VoxelNode* node, void* extraData);
@@ -31,7 +35,9 @@ typedef enum {GRADIENT, RANDOM, NATURAL} creationMode;
 #define NO_OCCLUSION_CULLING   false
 #define WANT_OCCLUSION_CULLING true
 #define IGNORE_COVERAGE_MAP    NULL
+#define IGNORE_OCCLUSION_BUFFER NULL
 #define DONT_CHOP              0
+#define IGNORE_LAST_SENT_TIME  0
 
 class EncodeBitstreamParams {
 public:
@@ -44,6 +50,8 @@ public:
     const ViewFrustum*  lastViewFrustum;
     bool                wantOcclusionCulling;
     CoverageMap*        map;
+    long long           lastSentTime;
+    OcclusionBuffer*    occlusionBuffer;    // if set, occlusion culling uses it instead of the map
     
     EncodeBitstreamParams(
         int                 maxEncodeLevel      = INT_MAX, 
@@ -54,7 +62,9 @@ public:
         bool                deltaViewFrustum    = false, 
         const ViewFrustum*  lastViewFrustum     = IGNORE_VIEW_FRUSTUM,
         bool                wantOcclusionCulling= NO_OCCLUSION_CULLING,
-        CoverageMap*        map                 = IGNORE_COVERAGE_MAP) :
+        CoverageMap*        map                 = IGNORE_COVERAGE_MAP,
+        long long           lastSentTime        = IGNORE_LAST_SENT_TIME,
+        OcclusionBuffer*    occlusionBuffer     = IGNORE_OCCLUSION_BUFFER) :
         
             maxEncodeLevel      (maxEncodeLevel),
             viewFrustum         (viewFrustum),
@@ -64,10 +74,47 @@ public:
             deltaViewFrustum    (deltaViewFrustum),
             lastViewFrustum     (lastViewFrustum),
             wantOcclusionCulling(wantOcclusionCulling),
-            map                 (map)
+            map                 (map),
+            lastSentTime        (lastSentTime),
+            occlusionBuffer     (occlusionBuffer)
     {}
 };
 
+// one voxel of a batch of edits, see VoxelTree::readCodeColorBuffersToTree()
+class VoxelEdit {
+public:
+    unsigned char*  codeColorBuffer;
+    bool            destructive;
+    int             order;  // filled in by readCodeColorBuffersToTree(), its index among the batch's valid edits
+    MortonKey       key;    // filled in by readCodeColorBuffersToTree(), the key for codeColorBuffer's octal code
+};
+
+// one of a batch of rays for VoxelTree::findRayIntersections(), the origin and direction go in and the rest comes out
+class VoxelRayQuery {
+public:
+    glm::vec3   origin;
+    glm::vec3   direction;
+    bool        found;
+    VoxelNode*  node;
+    float       distance;
+    BoxFace     face;
+};
+
+// what VoxelTree::reaverageAndValidate() found, the counts are of the tree as it is afterwards
+class VoxelTreeStats {
+public:
+    VoxelTreeStats() : nodeCount(0), leafCount(0), coloredCount(0), collapsedCount(0), maxLevel(0), problemCount(0) { };
+
+    unsigned long   nodeCount;
+    unsigned long   leafCount;
+    unsigned long   coloredCount;
+    unsigned long   collapsedCount;     // nodes deleted because they were collapsed into an identical colored leaf
+    int             maxLevel;           // of the deepest node before collapsing
+    unsigned long   problemCount;       // nodes that failed validation
+
+    void add(const VoxelTreeStats& other);
+};
+
 class VoxelTree {
 public:
     // when a voxel is created in the tree (object new'd)
@@ -76,6 +123,7 @@ public:
     long voxelsColored;
     long voxelsBytesRead;
 
+    // each sample is what one readBitstreamToTree() call created, colored and read
     SimpleMovingAverage voxelsCreatedStats;
     SimpleMovingAverage voxelsColoredStats;
     SimpleMovingAverage voxelsBytesReadStats;
@@ -93,13 +141,28 @@ public:
                              bool includeColor = WANT_COLOR, bool includeExistsBits = WANT_EXISTS_BITS, 
                              VoxelNode* destinationNode = NULL);
     void readCodeColorBufferToTree(unsigned char* codeColorBuffer, bool destructive = false);
+
+    // Applies a batch of edits in one walk down the tree, with each changed ancestor reaveraged once rather than once
+    // per edit below it. The result is the same as calling readCodeColorBufferToTree() for each of them in order, which
+    // includes skipping codes deeper than MortonKey::MAX_LEVELS. The rest of the edits are sorted into tree order in
+    // place, at the front of the array
+    void readCodeColorBuffersToTree(VoxelEdit* edits, int editCount);
     void deleteVoxelCodeFromTree(unsigned char* codeBuffer, bool stage = ACTUALLY_DELETE, 
                                  bool collapseEmptyTrees = DONT_COLLAPSE);
     void printTreeForDebugging(VoxelNode* startNode);
     void reaverageVoxelColors(VoxelNode* startNode);
 
+    // One pass over the whole tree that does what reaverageVoxelColors(rootNode) and getVoxelCount() do, with the
+    // subtrees below the top few levels split between threadCount threads. Reaverages only if asked to and this is a
+    // reaveraging tree. Identical leaves are collapsed as reaverageVoxelColors() would, but the collapsed nodes are
+    // deleted once the threads are done, since the pool isn't thread safe. Every node is also checked against its
+    // place in the tree, and the first few that don't match are printed
+    void reaverageAndValidate(int threadCount, bool reaverage, VoxelTreeStats& stats);
+
     void deleteVoxelAt(float x, float y, float z, float s, bool stage = false);
     VoxelNode* getVoxelAt(float x, float y, float z, float s) const;
+    VoxelNode* getNodeAt(const MortonKey& key) const; // NULL if there isn't one
+    VoxelNode* createNodeAt(const MortonKey& key);    // the node, created uncolored if it isn't there
     void createVoxel(float x, float y, float z, float s, 
                      unsigned char red, unsigned char green, unsigned char blue, bool destructive = false);
     void createLine(glm::vec3 point1, glm::vec3 point2, float unitSize, rgbColor color, bool destructive = false);
@@ -121,8 +184,15 @@ public:
     void setDirtyBit() { _isDirty = true; };
     unsigned long int getNodesChangedFromBitstream() const { return _nodesChangedFromBitstream; };
 
+    // the nearest colored leaf along the ray, its distance in TREE_SCALE units of direction and the face the ray enters
+    // it by. The origin is in TREE_SCALE units too. The children of each node are visited in the order the ray passes
+    // through them, so the first colored leaf reached is the nearest and the search stops there
     bool findRayIntersection(const glm::vec3& origin, const glm::vec3& direction,
-                             VoxelNode*& node, float& distance, BoxFace& face);
+                             VoxelNode*& node, float& distance, BoxFace& face) const;
+
+    // findRayIntersection() for each of the rays, spread over up to threadCount threads. The tree mustn't change
+    // until it returns
+    void findRayIntersections(VoxelRayQuery* rays, int rayCount, int threadCount = 1) const;
 
     bool findSpherePenetration(const glm::vec3& center, float radius, glm::vec3& penetration);
     bool findCapsulePenetration(const glm::vec3& start, const glm::vec3& end, float radius, glm::vec3& penetration);
@@ -134,6 +204,14 @@ public:
     void writeToSVOFile(const char* filename, VoxelNode* node = NULL) const;
     bool readFromSVOFile(const char* filename);
 
+    // these read/write the mapped SVO format, see VoxelMappedFile. Reading replaces whatever is in the tree, but only
+    // the top eagerLevels below the root are created right away. The rest stays on disk until an edit reaches it or
+    // materializeNodesFromDisk() gets to it, until then those nodes look like leaves.
+    bool readFromMappedSVOFile(const char* fileName, int eagerLevels = INT_MAX);
+    bool writeToMappedSVOFile(const char* fileName) const;
+    int materializeNodesFromDisk(int maxNodes); // returns the number of nodes created
+    bool hasNodesOnDisk() const { return rootNode->hasDescendantsOnDisk(); };
+
     unsigned long getVoxelCount();
 
     void copySubTreeIntoNewTree(VoxelNode* startNode, VoxelTree* destinationTree, bool rebaseToRoot);
@@ -141,6 +219,9 @@ public:
     
     bool getShouldReaverage() const { return _shouldReaverage; }
 
+    // storage for all the nodes and octal codes in this tree
+    const VoxelNodePool& getNodePool() const { return _nodePool; }
+
     void recurseNodeWithOperation(VoxelNode* node, RecurseVoxelTreeOperation operation, void* extraData);
     void recurseNodeWithOperationDistanceSorted(VoxelNode* node, RecurseVoxelTreeOperation operation, 
                 const glm::vec3& point, void* extraData);
@@ -148,6 +229,9 @@ public:
 private:
     void deleteVoxelCodeFromTreeRecursion(VoxelNode* node, void* extraData);
     void readCodeColorBufferToTreeRecursion(VoxelNode* node, void* extraData);
+    bool setColorFromCodeColorBuffer(VoxelNode* node, unsigned char* codeColorBuffer, bool destructive);
+    bool readCodeColorBuffersToTreeRecursion(VoxelNode* node, int level, VoxelEdit* edits, int editCount,
+                                             int firstOrder, int endOrder);
 
     int encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outputBuffer, int availableBytes, VoxelNodeBag& bag, 
                                      EncodeBitstreamParams& params, int& currentEncodeLevel) const;
@@ -158,11 +242,17 @@ private:
 
     static bool countVoxelsOperation(VoxelNode* node, void* extraData);
 
-    VoxelNode* nodeForOctalCode(VoxelNode* ancestorNode, unsigned char* needleCode, VoxelNode** parentOfFoundNode) const;
-    VoxelNode* createMissingNode(VoxelNode* lastParentNode, unsigned char* deepestCodeToCreate);
+    VoxelNode* nodeForKey(VoxelNode* ancestorNode, const MortonKey& needleKey, VoxelNode** parentOfFoundNode) const;
+    VoxelNode* createMissingNode(VoxelNode* lastParentNode, const MortonKey& deepestKeyToCreate);
     int readNodeData(VoxelNode *destinationNode, unsigned char* nodeData, int bufferSizeBytes, 
                      bool includeColor = WANT_COLOR, bool includeExistsBits = WANT_EXISTS_BITS);
+
+    int materializeChildren(VoxelNode* node, uint32_t record, int levels);
+    int materializeNodesFromDiskRecursion(VoxelNode* node, uint32_t record, int maxNodes);
+    void materializeChildrenForEdit(VoxelNode* node);
     
+    VoxelNodePool _nodePool;
+    VoxelMappedFile _mappedFile; // open while any of the tree is still on disk
     bool _isDirty;
     unsigned long int _nodesChangedFromBitstream;
     bool _shouldReaverage;
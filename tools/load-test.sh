@@ -0,0 +1,54 @@
+#!/bin/bash
+#
+# load-test.sh
+#
+# Runs a local domain server and voxel server, and puts voxel-load-tester load on them, so every voxel server change
+# can be measured the same way without leaving this machine.
+#
+#   USAGE: tools/load-test.sh -b <build dir> -i <svo file> [-c clients] [-t seconds] [-s "server options"]
+#                             [-- load tester options]
+#
+# Anything after -- goes to voxel-load-tester, like --path flyby or --wantDelta.
+
+BUILD_DIR=build
+CLIENTS=8
+SECONDS_PER_RUN=30
+INPUT_FILE=
+SERVER_OPTIONS=
+
+while getopts "b:i:c:t:s:" option; do
+    case $option in
+        b) BUILD_DIR=$OPTARG ;;
+        i) INPUT_FILE=$OPTARG ;;
+        c) CLIENTS=$OPTARG ;;
+        t) SECONDS_PER_RUN=$OPTARG ;;
+        s) SERVER_OPTIONS=$OPTARG ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ -z "$INPUT_FILE" ]; then
+    echo "USAGE: $0 -b <build dir> -i <svo file> [-c clients] [-t seconds] [-s \"server options\"] [-- options]"
+    exit 1
+fi
+
+VOXEL_SERVER_PORT=40120
+SERVER_STARTUP_SECONDS=15
+PIDS=()
+
+stop_servers() {
+    kill ${PIDS[@]} 2> /dev/null
+    wait ${PIDS[@]} 2> /dev/null
+}
+trap stop_servers EXIT
+
+$BUILD_DIR/domain-server/domain-server --local > domain-server.log 2>&1 &
+PIDS+=($!)
+sleep 1
+
+$BUILD_DIR/voxel-server/voxel-server --local --NoVoxelPersist --NoAddScene --port $VOXEL_SERVER_PORT -i "$INPUT_FILE" \
+    $SERVER_OPTIONS > voxel-server-$VOXEL_SERVER_PORT.log 2>&1 &
+PIDS+=($!)
+
+sleep $SERVER_STARTUP_SECONDS
+$BUILD_DIR/voxel-load-tester/voxel-load-tester --local --clients $CLIENTS --seconds $SECONDS_PER_RUN "$@"
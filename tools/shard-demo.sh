@@ -0,0 +1,83 @@
+#!/bin/bash
+#
+# shard-demo.sh
+#
+# Runs a local domain with the voxel world split between several voxel servers, and puts the same load on it that it
+# puts on a single voxel server holding the whole world, so the two can be compared.
+#
+#   USAGE: tools/shard-demo.sh -b <build dir> -i <svo file> [-c clients] [-t seconds] [prefixes ...]
+#
+# Each prefixes argument is one voxel server's --shard, the default being four shards that each get one of the lower
+# and one of the upper children of the root.
+
+BUILD_DIR=build
+CLIENTS=8
+SECONDS_PER_RUN=30
+INPUT_FILE=
+
+while getopts "b:i:c:t:" option; do
+    case $option in
+        b) BUILD_DIR=$OPTARG ;;
+        i) INPUT_FILE=$OPTARG ;;
+        c) CLIENTS=$OPTARG ;;
+        t) SECONDS_PER_RUN=$OPTARG ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+SHARDS=("$@")
+if [ ${#SHARDS[@]} -eq 0 ]; then
+    SHARDS=(0,2 1,3 4,6 5,7)
+fi
+
+if [ -z "$INPUT_FILE" ]; then
+    echo "USAGE: $0 -b <build dir> -i <svo file> [-c clients] [-t seconds] [prefixes ...]"
+    exit 1
+fi
+
+FIRST_SHARD_PORT=40120
+SERVER_STARTUP_SECONDS=15
+PIDS=()
+
+stop_servers() {
+    kill ${PIDS[@]} 2> /dev/null
+    wait ${PIDS[@]} 2> /dev/null
+    PIDS=()
+}
+trap stop_servers EXIT
+
+# start_voxel_server <port> [--shard <prefixes>]
+start_voxel_server() {
+    local port=$1
+    shift
+    $BUILD_DIR/voxel-server/voxel-server --local --NoVoxelPersist --NoAddScene --port $port -i "$INPUT_FILE" "$@" \
+        > voxel-server-$port.log 2>&1 &
+    PIDS+=($!)
+}
+
+run_load() {
+    sleep $SERVER_STARTUP_SECONDS
+    $BUILD_DIR/voxel-load-tester/voxel-load-tester --local --clients $CLIENTS --seconds $SECONDS_PER_RUN | grep "^total"
+}
+
+start_domain_server() {
+    $BUILD_DIR/domain-server/domain-server --local > domain-server.log 2>&1 &
+    PIDS+=($!)
+    sleep 1
+}
+
+echo "one voxel server with the whole world:"
+start_domain_server
+start_voxel_server $FIRST_SHARD_PORT
+run_load
+stop_servers
+
+echo "${#SHARDS[@]} voxel servers sharing the world (${SHARDS[*]}):"
+start_domain_server
+port=$FIRST_SHARD_PORT
+for shard in "${SHARDS[@]}"; do
+    start_voxel_server $port --shard $shard
+    port=$((port + 1))
+done
+run_load
+stop_servers
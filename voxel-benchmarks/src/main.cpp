@@ -0,0 +1,1822 @@
+//
+//  main.cpp
+//  Voxel Benchmarks
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Times the VoxelTree operations the servers and the interface lean on, against worlds generated from a seed so two
+//  runs see the same voxels: the sphere and surface scenes from SceneUtils, a dense random fill of one block of the
+//  world, a sparse random fill of all of it and a small solid sphere, or against an SVO file given with --svo. The
+//  benchmarks come in groups, encoding, rays, collisions, loading and recovering a voxel server's files and so on, see
+//  BENCHMARK_GROUPS, and --benchmarks picks which of them run. Each benchmark reports the nanoseconds and the
+//  heap allocations per operation, and the peak resident set size of the process once it's done, both as a table and to
+//  a JSON or CSV file, so runs before and after a change can be diffed. The benchmarks that build a client's render
+//  arrays also report the bytes those arrays take per voxel they have room for, and the ones that mesh them the bytes
+//  of mesh per voxel, and some report figures of their own, like the packets per second a decoder reads. The sphere
+//  scene is over 30 million voxels and needs about 4GB, so it's only run when asked for with --worlds.
+//
+//  A few groups don't use a world, like the simulation of a voxel server pacing what it sends over lossy links, see
+//  SIMULATION_GROUPS. They're run once, before the worlds are built, and report what they simulate as the world.
+//
+//  Peak RSS is the high water mark of the whole process, so it only goes up from one benchmark to the next.
+//
+//  Allocations are counted by replacing the global operator new, so they're the C++ heap allocations, including the
+//  ones the libraries make. VoxelNodes come from their tree's VoxelNodePool, which only shows up when it adds a block.
+//
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <new>
+#include <string>
+#include <vector>
+#include <VoxelTree.h>
+#include <VoxelNodeBag.h>
+#include <VoxelInstanceArrays.h>
+#include <VoxelMesher.h>
+#include <VoxelCollider.h>
+#include <VoxelMappedFile.h>
+#include <VoxelEditLog.h>
+#include <VoxelPacketCoder.h>
+#include <ViewFrustum.h>
+#include <CoverageMap.h>
+#include <SceneUtils.h>
+#include <SharedUtil.h>
+#include <PacketHeaders.h>
+#include <GeometryUtil.h>
+#include <OctalCode.h>
+#include <MortonKey.h>
+#include <BandwidthPacer.h>
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// every operator new in the process goes through these, so we can count them. Some benchmarks allocate from several
+// threads at once, so the count is only ever changed and read atomically
+long allocations = 0;
+
+static inline long addAllocations(long added) {
+#ifdef _WIN32
+    return _InterlockedExchangeAdd(&::allocations, added) + added;
+#else
+    return __sync_add_and_fetch(&::allocations, added);
+#endif
+}
+
+void* operator new(size_t size) {
+    addAllocations(1);
+    void* storage = malloc(size ? size : 1);
+    if (!storage) {
+        throw std::bad_alloc();
+    }
+    return storage;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* storage) {
+    free(storage);
+}
+
+void operator delete[](void* storage) {
+    free(storage);
+}
+
+const int DEFAULT_SEED = 1;
+const int DEFAULT_MAX_THREADS = 8;
+const char* DEFAULT_OUTPUT_FILE = "voxel-benchmarks.json";
+const char* TEMPORARY_SVO_FILE = "voxel-benchmarks.svo";
+
+const int DENSE_FILL_VOXELS_PER_SIDE = 64;
+const float DENSE_FILL_VOXEL_SIZE = 1.0f / 512.0f;
+const float DENSE_FILL_CHANCE = 0.5f;
+const float SOLID_SPHERE_RADIUS = 0.125f;
+const float SOLID_SPHERE_VOXEL_SIZE = 1.0f / 256.0f;
+const int SPARSE_FILL_VOXELS = 100000;
+const float SPARSE_FILL_VOXEL_SIZE = 1.0f / 1024.0f;
+
+const int EDITS = 100000;
+const float EDIT_VOXEL_SIZE = 1.0f / 1024.0f;
+const int VIEWS = 8;
+const int RAYS = 100000;
+const int ARRAY_BUILDS = 4;
+const int MAX_MESH_VOXELS = 2000000;
+const int DECODE_PASSES = 4;
+const long long SIMULATED_USECS = 60 * 1000 * 1000;
+const int SIMULATED_STEP_USECS = 1000;
+
+class BenchmarkResult {
+public:
+    std::string benchmark;
+    std::string world;
+    long ops;
+    double nsPerOp;
+    double allocationsPerOp;
+    long peakRSSKilobytes;
+    long bytesPerVoxel;
+    std::vector<std::pair<std::string, double> > metrics;
+};
+
+std::vector<BenchmarkResult> results;
+
+long getPeakRSSKilobytes() {
+#ifdef _WIN32
+    return 0;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes there, kilobytes everywhere else
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// the most threads the benchmarks that take a thread count go up to, doubling from one
+int maxThreads = DEFAULT_MAX_THREADS;
+
+// the SVO file the file world is read from
+const char* svoFile = NULL;
+
+// times one benchmark, from when it's made to finish(). A benchmark whose work is spread over a loop with other things
+// going on in it can time just its part with start() and stop(), which add up until finish()
+class Measurement {
+public:
+    Measurement(const std::string& benchmark, const std::string& world) :
+        _benchmark(benchmark),
+        _world(world),
+        _running(false),
+        _usecs(0),
+        _allocations(0) { start(); };
+
+    // starts timing again, dropping anything since the last stop()
+    void start() {
+        _running = true;
+        _startAllocations = addAllocations(0);
+        _start = usecTimestampNow();
+    };
+    void stop() {
+        if (_running) {
+            _usecs += usecTimestampNow() - _start;
+            _allocations += addAllocations(0) - _startAllocations;
+            _running = false;
+        }
+    };
+    long long getElapsedUsecs() const { return _usecs + (_running ? usecTimestampNow() - _start : 0); };
+
+    // reported along with the timing, once the benchmark is finished
+    void addMetric(const char* name, double value) { _metrics.push_back(std::make_pair(std::string(name), value)); };
+
+    void finish(long ops, long bytesPerVoxel = 0) {
+        stop();
+        long long usecs = _usecs;
+        long allocations = _allocations;
+        BenchmarkResult result;
+        result.benchmark = _benchmark;
+        result.world = _world;
+        result.ops = ops;
+        result.nsPerOp = ops ? usecs * 1000.0 / ops : 0.0;
+        result.allocationsPerOp = ops ? (double)allocations / ops : 0.0;
+        result.peakRSSKilobytes = getPeakRSSKilobytes();
+        result.bytesPerVoxel = bytesPerVoxel;
+        result.metrics = _metrics;
+        ::results.push_back(result);
+        printf("%-26s %-8s %10ld ops %14.1f ns/op %10.3f allocs/op %8ld KB peak RSS", _benchmark.c_str(),
+               _world.c_str(), ops, result.nsPerOp, result.allocationsPerOp, result.peakRSSKilobytes);
+        if (bytesPerVoxel) {
+            printf(" %6ld bytes/voxel", bytesPerVoxel);
+        }
+        for (int i = 0; i < (int)_metrics.size(); i++) {
+            printf(" %s %.3f", _metrics[i].first.c_str(), _metrics[i].second);
+        }
+        printf("\n");
+    }
+
+private:
+    std::string _benchmark;
+    std::string _world;
+    bool _running;
+    long long _start;
+    long long _usecs;
+    long _startAllocations;
+    long _allocations;
+    std::vector<std::pair<std::string, double> > _metrics;
+};
+
+// a voxel of size s with its lowest corner at x, y, z, as an octal code followed by a color
+void addCodeColorBuffer(std::vector<unsigned char*>& buffers, float x, float y, float z, float s) {
+    buffers.push_back(pointToVoxel(x, y, z, s, randIntInRange(0, 255), randIntInRange(0, 255),
+                                   randIntInRange(0, 255)));
+}
+
+void deleteCodeColorBuffers(std::vector<unsigned char*>& buffers) {
+    for (int i = 0; i < (int)buffers.size(); i++) {
+        delete[] buffers[i];
+    }
+    buffers.clear();
+}
+
+long insertCodeColorBuffers(VoxelTree* tree, std::vector<unsigned char*>& buffers) {
+    for (int i = 0; i < (int)buffers.size(); i++) {
+        tree->readCodeColorBufferToTree(buffers[i]);
+    }
+    return buffers.size();
+}
+
+// about half of the voxels in a block of the world, the block being a cube of DENSE_FILL_VOXELS_PER_SIDE voxels
+void makeDenseFill(std::vector<unsigned char*>& buffers) {
+    float corner = 0.5f - DENSE_FILL_VOXELS_PER_SIDE * DENSE_FILL_VOXEL_SIZE / 2.0f;
+    for (int x = 0; x < DENSE_FILL_VOXELS_PER_SIDE; x++) {
+        for (int y = 0; y < DENSE_FILL_VOXELS_PER_SIDE; y++) {
+            for (int z = 0; z < DENSE_FILL_VOXELS_PER_SIDE; z++) {
+                if (randFloat() < DENSE_FILL_CHANCE) {
+                    addCodeColorBuffer(buffers, corner + x * DENSE_FILL_VOXEL_SIZE, corner + y * DENSE_FILL_VOXEL_SIZE,
+                                       corner + z * DENSE_FILL_VOXEL_SIZE, DENSE_FILL_VOXEL_SIZE);
+                }
+            }
+        }
+    }
+}
+
+void makeRandomVoxels(std::vector<unsigned char*>& buffers, int count, float size) {
+    for (int i = 0; i < count; i++) {
+        addCodeColorBuffer(buffers, randFloat() * (1.0f - size), randFloat() * (1.0f - size),
+                           randFloat() * (1.0f - size), size);
+    }
+}
+
+// the scene functions print as they go, but that's fine, the results are the lines after
+VoxelTree* buildWorld(const char* world) {
+    VoxelTree* tree = new VoxelTree(true);
+    std::vector<unsigned char*> buffers;
+    if (strcmp(world, "dense") == 0) {
+        makeDenseFill(buffers);
+    } else if (strcmp(world, "sparse") == 0) {
+        makeRandomVoxels(buffers, SPARSE_FILL_VOXELS, SPARSE_FILL_VOXEL_SIZE);
+    }
+
+    Measurement measurement("build", world);
+    if (strcmp(world, "sphere") == 0) {
+        addSphereScene(tree);
+    } else if (strcmp(world, "surface") == 0) {
+        addSurfaceScene(tree);
+    } else if (strcmp(world, "solid") == 0) {
+        tree->createSphere(SOLID_SPHERE_RADIUS, 0.5f, 0.5f, 0.5f, SOLID_SPHERE_VOXEL_SIZE, true, GRADIENT);
+    } else if (strcmp(world, "file") == 0) {
+        if (!::svoFile || !tree->readFromSVOFile(::svoFile)) {
+            printf("Unable to read SVO file %s\n", ::svoFile ? ::svoFile : "(none given, see --svo)");
+            delete tree;
+            return NULL;
+        }
+    } else {
+        insertCodeColorBuffers(tree, buffers);
+    }
+    measurement.finish(tree->getVoxelCount());
+
+    deleteCodeColorBuffers(buffers);
+    return tree;
+}
+
+void setRandomView(ViewFrustum& viewFrustum) {
+    viewFrustum.setFieldOfView(45.0f);
+    viewFrustum.setAspectRatio(4.0f / 3.0f);
+    viewFrustum.setNearClip(0.1f);
+    viewFrustum.setFarClip(500.0f);
+    viewFrustum.setPosition(glm::vec3(randFloat(), randFloat() * 0.25f, randFloat()) * (float)TREE_SCALE);
+    viewFrustum.setOrientation(glm::quat(glm::radians(glm::vec3(-randFloatInRange(0.0f, 45.0f),
+                                                                randFloatInRange(0.0f, 360.0f), 0.0f))));
+    viewFrustum.calculate();
+}
+
+// from the same sort of place as setRandomView(), but looking at the middle of the world
+void setViewTowardMiddle(ViewFrustum& viewFrustum) {
+    setRandomView(viewFrustum);
+    glm::vec3 direction = glm::normalize(glm::vec3(0.5f, 0.5f, 0.5f) * (float)TREE_SCALE - viewFrustum.getPosition());
+    float pitch = asinf(direction.y);
+    float yaw = atan2f(-direction.x, -direction.z);
+    viewFrustum.setOrientation(glm::quat(glm::vec3(0.0f, yaw, 0.0f)) * glm::quat(glm::vec3(pitch, 0.0f, 0.0f)));
+    viewFrustum.calculate();
+}
+
+// encodes everything the params let through, the way the voxel server does, returning the bitstreams written. If
+// bitstreams is given, they're appended to it, and if bytes is, their bytes are added to it
+long encodeTree(VoxelTree* tree, EncodeBitstreamParams& params, std::vector<std::vector<unsigned char> >* bitstreams,
+                long* bytesWritten = NULL) {
+    static unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE];
+    VoxelNodeBag bag;
+    bag.insert(tree->rootNode);
+    long bitstreamCount = 0;
+    while (!bag.isEmpty()) {
+        int bytes = tree->encodeTreeBitstream(bag.extract(), outputBuffer, MAX_VOXEL_PACKET_SIZE - 1, bag, params);
+        if (bytes > 0) {
+            bitstreamCount++;
+            if (bytesWritten) {
+                *bytesWritten += bytes;
+            }
+            if (bitstreams) {
+                bitstreams->push_back(std::vector<unsigned char>(outputBuffer, outputBuffer + bytes));
+            }
+        }
+    }
+    return bitstreamCount;
+}
+
+// encodes what a client would get for a view, the way the voxel server does, as many bitstreams to a packet as fit
+void encodeViewPackets(VoxelTree* tree, ViewFrustum& viewFrustum, std::vector<std::vector<unsigned char> >& packets) {
+    static unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE];
+    EncodeBitstreamParams params(INT_MAX, &viewFrustum, WANT_COLOR, WANT_EXISTS_BITS);
+    VoxelNodeBag bag;
+    bag.insert(tree->rootNode);
+    std::vector<unsigned char> packet;
+    while (!bag.isEmpty()) {
+        int bytes = tree->encodeTreeBitstream(bag.extract(), outputBuffer, MAX_VOXEL_PACKET_DATA_BYTES, bag, params);
+        if (packet.size() + bytes > (size_t)MAX_VOXEL_PACKET_DATA_BYTES) {
+            packets.push_back(packet);
+            packet.clear();
+        }
+        packet.insert(packet.end(), outputBuffer, outputBuffer + bytes);
+    }
+    if (!packet.empty()) {
+        packets.push_back(packet);
+    }
+}
+
+// a hash of every node's octal code and color, in tree order, so two trees can be compared
+bool hashNodesOperation(VoxelNode* node, void* extraData) {
+    uint32_t& hash = *(uint32_t*)extraData;
+    const unsigned char* code = node->getOctalCode();
+    for (int i = 0; i < bytesRequiredForCodeLength(*code); i++) {
+        hash = (hash ^ code[i]) * 16777619;
+    }
+    for (int i = 0; i < 4; i++) {
+        hash = (hash ^ node->getColor()[i]) * 16777619;
+    }
+    return true; // keep going
+}
+
+uint32_t hashTree(VoxelTree* tree) {
+    uint32_t hash = 2166136261u;
+    tree->recurseTreeWithOperation(hashNodesOperation, &hash);
+    return hash;
+}
+
+// packets read per second, and how often the tree's node pool was asked for or given back storage per packet
+void finishReadingPackets(Measurement& measurement, long packets, unsigned long poolOperations) {
+    measurement.stop();
+    measurement.addMetric("packets_per_sec", packets * 1000000.0 / std::max(measurement.getElapsedUsecs(), 1LL));
+    measurement.addMetric("pool_ops_per_packet", (double)poolOperations / std::max(packets, 1L));
+    measurement.finish(packets);
+}
+
+// the render arrays the way VoxelSystem writes them, all VERTEX_POINTS_PER_VOXEL vertex points and colors of each voxel
+// it draws, so build_vertex_arrays has something to compare VoxelInstanceArrays against. Just full rebuilds, which
+// are what it does after voxels have been removed
+class VertexArrays {
+public:
+    static const float IDENTITY_VERTICES[VERTEX_POINTS_PER_VOXEL];
+
+    VertexArrays(int maxVoxels) : _maxVoxels(maxVoxels), _voxelsInWriteArrays(0), _voxelsInReadArrays(0) {
+        _writeVertices = new float[VERTEX_POINTS_PER_VOXEL * _maxVoxels];
+        _readVertices = new float[VERTEX_POINTS_PER_VOXEL * _maxVoxels];
+        _writeColors = new unsigned char[VERTEX_POINTS_PER_VOXEL * _maxVoxels];
+        _readColors = new unsigned char[VERTEX_POINTS_PER_VOXEL * _maxVoxels];
+        _writeVoxelDirtyArray = new bool[_maxVoxels];
+        _readVoxelDirtyArray = new bool[_maxVoxels];
+    };
+    ~VertexArrays() {
+        delete[] _writeVertices;
+        delete[] _readVertices;
+        delete[] _writeColors;
+        delete[] _readColors;
+        delete[] _writeVoxelDirtyArray;
+        delete[] _readVoxelDirtyArray;
+    };
+
+    int treeToArrays(VoxelNode* node, const ViewFrustum& viewFrustum);
+    void copyWrittenDataToReadArrays();
+    void reset() { _voxelsInWriteArrays = 0; };
+    const float* getReadVertices() const { return _readVertices; };
+    const unsigned char* getReadColors() const { return _readColors; };
+    unsigned long getVoxelsInReadArrays() const { return _voxelsInReadArrays; };
+    long getMemoryUsage() const {
+        int bytesPerVoxel = VERTEX_POINTS_PER_VOXEL * (sizeof(float) + sizeof(unsigned char)) + sizeof(bool);
+        return (long)_maxVoxels * 2 * bytesPerVoxel;
+    };
+
+private:
+    int _maxVoxels;
+    float* _writeVertices;
+    float* _readVertices;
+    unsigned char* _writeColors;
+    unsigned char* _readColors;
+    bool* _writeVoxelDirtyArray;
+    bool* _readVoxelDirtyArray;
+    unsigned long _voxelsInWriteArrays;
+    unsigned long _voxelsInReadArrays;
+};
+
+const float VertexArrays::IDENTITY_VERTICES[VERTEX_POINTS_PER_VOXEL] = {
+    0,0,0, 1,0,0, 1,1,0, 0,1,0, 0,0,1, 1,0,1, 1,1,1, 0,1,1,
+    0,0,0, 1,0,0, 1,1,0, 0,1,0, 0,0,1, 1,0,1, 1,1,1, 0,1,1,
+    0,0,0, 1,0,0, 1,1,0, 0,1,0, 0,0,1, 1,0,1, 1,1,1, 0,1,1 };
+
+int VertexArrays::treeToArrays(VoxelNode* node, const ViewFrustum& viewFrustum) {
+    int voxelsUpdated = 0;
+    bool shouldRender = false;
+    if (node->isColored()) {
+        float distanceToNode = node->distanceToCamera(viewFrustum);
+        float boundary = boundaryDistanceForRenderLevel(node->getLevel());
+        float childBoundary = boundaryDistanceForRenderLevel(node->getLevel() + 1);
+        bool inBoundary = (distanceToNode <= boundary);
+        bool inChildBoundary = (distanceToNode <= childBoundary);
+        shouldRender = (node->isLeaf() && inChildBoundary) || (inBoundary && !inChildBoundary);
+    }
+    node->setShouldRender(shouldRender && !node->isStagedForDeletion());
+    if (!node->isLeaf()) {
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            if (node->getChildAtIndex(i)) {
+                voxelsUpdated += treeToArrays(node->getChildAtIndex(i), viewFrustum);
+            }
+        }
+    }
+    if (_voxelsInWriteArrays < (unsigned long)_maxVoxels) {
+        if (node->getShouldRender()) {
+            glm::vec3 startVertex = node->getCorner();
+            float voxelScale = node->getScale();
+            glBufferIndex nodeIndex = _voxelsInWriteArrays++;
+            float* writeVerticesAt = _writeVertices + (nodeIndex * VERTEX_POINTS_PER_VOXEL);
+            unsigned char* writeColorsAt = _writeColors + (nodeIndex * VERTEX_POINTS_PER_VOXEL);
+            for (int j = 0; j < VERTEX_POINTS_PER_VOXEL; j++) {
+                writeVerticesAt[j] = startVertex[j % 3] + (IDENTITY_VERTICES[j] * voxelScale);
+                writeColorsAt[j] = node->getColor()[j % 3];
+            }
+            node->setBufferIndex(nodeIndex);
+            _writeVoxelDirtyArray[nodeIndex] = true;
+            voxelsUpdated++;
+        } else {
+            node->setBufferIndex(GLBUFFER_INDEX_UNKNOWN);
+        }
+    }
+    node->clearDirtyBit();
+    return voxelsUpdated;
+}
+
+void VertexArrays::copyWrittenDataToReadArrays() {
+    memcpy(_readVertices, _writeVertices, _voxelsInWriteArrays * VERTEX_POINTS_PER_VOXEL * sizeof(float));
+    memcpy(_readColors, _writeColors, _voxelsInWriteArrays * VERTEX_POINTS_PER_VOXEL * sizeof(unsigned char));
+    memset(_writeVoxelDirtyArray, false, _voxelsInWriteArrays * sizeof(bool));
+    _voxelsInReadArrays = _voxelsInWriteArrays;
+}
+
+// the total area of a mesh's quads, which merging them shouldn't change
+float meshArea(const VoxelMesh& mesh) {
+    double area = 0.0;
+    for (int i = 0; i < (int)mesh.vertices.size(); i += VoxelMesh::VERTICES_PER_QUAD * 3) {
+        glm::vec3 first(mesh.vertices[i], mesh.vertices[i + 1], mesh.vertices[i + 2]);
+        glm::vec3 second(mesh.vertices[i + 3], mesh.vertices[i + 4], mesh.vertices[i + 5]);
+        glm::vec3 fourth(mesh.vertices[i + 9], mesh.vertices[i + 10], mesh.vertices[i + 11]);
+        area += glm::length(glm::cross(second - first, fourth - first));
+    }
+    return area;
+}
+
+// a benchmark's name with the number of threads it ran on, like find_ray_intersections_4t
+std::string withThreads(const char* benchmark, int threads) {
+    char name[64];
+    sprintf(name, "%s_%dt", benchmark, threads);
+    return name;
+}
+
+// a world and the views the benchmarks look at it from
+class World {
+public:
+    const char* name;
+    VoxelTree* tree;
+    std::vector<ViewFrustum> views;
+};
+
+void benchmarkEncode(World& world) {
+    // the whole tree, the way the voxel server writes its persist file and agents without a view get it
+    EncodeBitstreamParams fullParams;
+    Measurement encodeFull("encode_full", world.name);
+    encodeFull.finish(encodeTree(world.tree, fullParams, NULL));
+
+    // the same views without occlusion culling, with the voxel server's CoverageMap and with the OcclusionBuffer, and
+    // the bytes each of them saves
+    const int MODES = 3;
+    const char* MODE_BENCHMARKS[MODES] = { "encode_frustum", "encode_occlusion", "encode_occlusion_buffer" };
+    CoverageMap map;
+    OcclusionBuffer* occlusionBuffer = new OcclusionBuffer();
+    long frustumBytes = 0;
+    for (int mode = 0; mode < MODES; mode++) {
+        long bitstreams = 0;
+        long bytes = 0;
+        Measurement encodeViews(MODE_BENCHMARKS[mode], world.name);
+        for (int i = 0; i < VIEWS; i++) {
+            EncodeBitstreamParams params(INT_MAX, &world.views[i], WANT_COLOR, WANT_EXISTS_BITS, DONT_CHOP, false,
+                                         IGNORE_VIEW_FRUSTUM, mode != 0, mode == 1 ? &map : IGNORE_COVERAGE_MAP,
+                                         IGNORE_LAST_SENT_TIME, mode == 2 ? occlusionBuffer : IGNORE_OCCLUSION_BUFFER);
+            bitstreams += encodeTree(world.tree, params, NULL, &bytes);
+            if (mode == 1) {
+                map.erase();
+            } else if (mode == 2) {
+                occlusionBuffer->erase();
+            }
+        }
+        if (mode == 0) {
+            frustumBytes = bytes;
+        }
+        encodeViews.addMetric("bytes_per_view", (double)bytes / VIEWS);
+        encodeViews.addMetric("saved_percent", frustumBytes ? 100.0 * (frustumBytes - bytes) / frustumBytes : 0.0);
+        encodeViews.finish(bitstreams);
+    }
+    delete occlusionBuffer;
+}
+
+// the arrays a client renders from, for the first of the views, built from scratch and copied for the renderer the
+// way VoxelSystem does it and as compact records, then the vertices made from the records
+void benchmarkArrays(World& world) {
+    VoxelInstanceArrays instanceArrays;
+    instanceArrays.treeToArrays(world.tree, world.views[0]); // so every node that's drawn already has its client data
+    instanceArrays.copyWrittenDataToReadArrays();
+    VertexArrays vertexArrays(MAX_VOXELS_PER_SYSTEM);
+    Measurement buildVertexArrays("build_vertex_arrays", world.name);
+    long voxels = 0;
+    for (int i = 0; i < ARRAY_BUILDS; i++) {
+        vertexArrays.reset();
+        voxels += vertexArrays.treeToArrays(world.tree->rootNode, world.views[0]);
+        vertexArrays.copyWrittenDataToReadArrays();
+    }
+    buildVertexArrays.finish(voxels, vertexArrays.getMemoryUsage() / MAX_VOXELS_PER_SYSTEM);
+
+    Measurement buildInstanceArrays("build_instance_arrays", world.name);
+    voxels = 0;
+    for (int i = 0; i < ARRAY_BUILDS; i++) {
+        instanceArrays.setWantFullRebuild();
+        voxels += instanceArrays.treeToArrays(world.tree, world.views[0]);
+        instanceArrays.copyWrittenDataToReadArrays();
+    }
+    buildInstanceArrays.finish(voxels, instanceArrays.getMemoryUsage() / MAX_VOXELS_PER_SYSTEM);
+
+    std::vector<float> vertices(instanceArrays.getVoxelsInReadArrays() * VERTEX_POINTS_PER_VOXEL + 1);
+    std::vector<unsigned char> colors(vertices.size());
+    Measurement expandInstanceVertices("expand_instance_vertices", world.name);
+    for (int i = 0; i < ARRAY_BUILDS; i++) {
+        VoxelInstanceArrays::expandVertices(instanceArrays.getReadInstances(), instanceArrays.getVoxelsInReadArrays(),
+                                            &vertices[0], &colors[0]);
+    }
+    expandInstanceVertices.finish(instanceArrays.getVoxelsInReadArrays() * ARRAY_BUILDS);
+    int points = instanceArrays.getVoxelsInReadArrays() * VERTEX_POINTS_PER_VOXEL;
+    if (instanceArrays.getVoxelsInReadArrays() != vertexArrays.getVoxelsInReadArrays() ||
+            memcmp(&vertices[0], vertexArrays.getReadVertices(), points * sizeof(float)) != 0 ||
+            memcmp(&colors[0], vertexArrays.getReadColors(), points) != 0) {
+        printf("WARNING! the vertices made from the instance arrays don't match the vertex arrays\n");
+    }
+}
+
+// the faces of the voxels drawn from the first view: all of them, the ones that can be seen, and those merged
+void benchmarkMesh(World& world) {
+    VoxelInstanceArrays meshArrays(MAX_MESH_VOXELS);
+    meshArrays.treeToArrays(world.tree, world.views[0]);
+    meshArrays.copyWrittenDataToReadArrays();
+    VoxelMesher mesher(world.tree);
+    VoxelMesh mesh;
+    const char* meshBenchmarks[] = { "mesh_all_faces", "mesh_cull_hidden", "mesh_cull_and_merge" };
+    float meshAreas[3];
+    for (int i = 0; i < 3; i++) {
+        mesher.setCullHiddenFaces(i > 0);
+        mesher.setMergeFaces(i > 1);
+        mesher.resetStats();
+        Measurement buildMesh(meshBenchmarks[i], world.name);
+        mesher.build(meshArrays.getReadInstances(), meshArrays.getVoxelsInReadArrays(), mesh);
+        buildMesh.addMetric("quads_per_voxel", (double)mesher.getQuadsEmitted() / std::max(mesher.getVoxels(), 1L));
+        buildMesh.finish(mesher.getVoxels(), mesh.getMemoryUsage() / std::max(mesher.getVoxels(), 1L));
+        printf("    %ld voxels, %ld faces culled, %ld faces, %ld quads\n", mesher.getVoxels(),
+               mesher.getFacesCulled(), mesher.getFacesEmitted(), mesher.getQuadsEmitted());
+        meshAreas[i] = meshArea(mesh);
+    }
+    if (fabsf(meshAreas[2] - meshAreas[1]) > meshAreas[1] * 0.0001f) {
+        printf("WARNING! the merged quads cover %f, the faces they were merged from %f\n", meshAreas[2], meshAreas[1]);
+    }
+}
+
+void benchmarkReadBitstream(World& world) {
+    // what the whole tree encoded to, read into a new tree the way an agent reads voxel packets
+    EncodeBitstreamParams fullParams;
+    std::vector<std::vector<unsigned char> > fullBitstreams;
+    encodeTree(world.tree, fullParams, &fullBitstreams);
+    VoxelTree* readTree = new VoxelTree(true);
+    Measurement readBitstream("read_bitstream", world.name);
+    for (int i = 0; i < (int)fullBitstreams.size(); i++) {
+        readTree->readBitstreamToTree(&fullBitstreams[i][0], fullBitstreams[i].size(), WANT_COLOR, WANT_EXISTS_BITS);
+    }
+    readBitstream.finish(fullBitstreams.size());
+    delete readTree;
+    fullBitstreams.clear();
+
+    // voxel packets the way a client gets them while looking around, from the random views and from views looking at
+    // the middle of the world, where the smaller worlds are. They're read into a new tree and then again into the tree
+    // they built, which mostly finds that nothing has changed, so reading them again mustn't change the tree
+    std::vector<std::vector<unsigned char> > viewPackets;
+    for (int i = 0; i < VIEWS; i++) {
+        ViewFrustum towardMiddle;
+        setViewTowardMiddle(towardMiddle);
+        encodeViewPackets(world.tree, world.views[i], viewPackets);
+        encodeViewPackets(world.tree, towardMiddle, viewPackets);
+    }
+    readTree = new VoxelTree(true);
+    unsigned long generation = readTree->getNodePool().getGeneration();
+    Measurement readViewPackets("read_bitstream_views", world.name);
+    for (int i = 0; i < (int)viewPackets.size(); i++) {
+        readTree->readBitstreamToTree(&viewPackets[i][0], viewPackets[i].size(), WANT_COLOR, WANT_EXISTS_BITS);
+    }
+    finishReadingPackets(readViewPackets, viewPackets.size(), readTree->getNodePool().getGeneration() - generation);
+
+    uint32_t readHash = hashTree(readTree);
+    long voxelsCreated = readTree->voxelsCreated;
+    generation = readTree->getNodePool().getGeneration();
+    Measurement readViewPacketsAgain("read_bitstream_views_again", world.name);
+    for (int pass = 0; pass < DECODE_PASSES; pass++) {
+        for (int i = 0; i < (int)viewPackets.size(); i++) {
+            readTree->readBitstreamToTree(&viewPackets[i][0], viewPackets[i].size(), WANT_COLOR, WANT_EXISTS_BITS);
+        }
+    }
+    finishReadingPackets(readViewPacketsAgain, viewPackets.size() * DECODE_PASSES,
+                         readTree->getNodePool().getGeneration() - generation);
+    if (hashTree(readTree) != readHash || readTree->voxelsCreated != voxelsCreated) {
+        printf("WARNING! reading the view packets into the tree they built changed it\n");
+    }
+    delete readTree;
+}
+
+// the bitstreams the voxel server would put in its packets for the views, packed into packets the way it does, raw and
+// compressed, then the compressed ones decoded again and checked against the raw ones
+void benchmarkCompression(World& world) {
+    // what the server's encoder writes for each view, one bitstream at a time
+    std::vector<unsigned char> bitstreams;
+    std::vector<int> bitstreamSizes;
+    unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE];
+    for (int i = 0; i < VIEWS; i++) {
+        EncodeBitstreamParams params(INT_MAX, &world.views[i], WANT_COLOR, WANT_EXISTS_BITS);
+        VoxelNodeBag bag;
+        bag.insert(world.tree->rootNode);
+        while (!bag.isEmpty()) {
+            int bytes = world.tree->encodeTreeBitstream(bag.extract(), outputBuffer, MAX_VOXEL_PACKET_DATA_BYTES, bag,
+                                                        params);
+            if (bytes) {
+                bitstreams.insert(bitstreams.end(), outputBuffer, outputBuffer + bytes);
+                bitstreamSizes.push_back(bytes);
+            }
+        }
+    }
+    if (bitstreams.empty()) {
+        return; // none of the views sees anything
+    }
+    long rawBytes = 0;
+    int available = 0;
+    for (int i = 0; i < (int)bitstreamSizes.size(); i++) {
+        if (bitstreamSizes[i] > available) {
+            rawBytes += VOXEL_PACKET_HEADER_BYTES;
+            available = MAX_VOXEL_PACKET_DATA_BYTES;
+        }
+        rawBytes += bitstreamSizes[i];
+        available -= bitstreamSizes[i];
+    }
+
+    // packets are either compressed or, when a bitstream won't fit in a compressed packet by itself, raw
+    std::vector<std::vector<unsigned char> > packets;
+    std::vector<bool> packetCompressed;
+    unsigned char packetData[MAX_VOXEL_PACKET_DATA_BYTES];
+    VoxelPacketEncoder encoder(packetData, MAX_VOXEL_PACKET_DATA_BYTES);
+    Measurement compressPackets("compress_packets", world.name);
+    const unsigned char* bitstream = &bitstreams[0];
+    for (int i = 0; i < (int)bitstreamSizes.size(); i++) {
+        if (!encoder.append(bitstream, bitstreamSizes[i])) {
+            if (!encoder.isEmpty()) {
+                int bytes = encoder.finish();
+                packets.push_back(std::vector<unsigned char>(packetData, packetData + bytes));
+                packetCompressed.push_back(true);
+                encoder.reset(WANT_COLOR, WANT_EXISTS_BITS);
+            }
+            if (!encoder.append(bitstream, bitstreamSizes[i])) {
+                packets.push_back(std::vector<unsigned char>(bitstream, bitstream + bitstreamSizes[i]));
+                packetCompressed.push_back(false);
+            }
+        }
+        bitstream += bitstreamSizes[i];
+    }
+    if (!encoder.isEmpty()) {
+        int bytes = encoder.finish();
+        packets.push_back(std::vector<unsigned char>(packetData, packetData + bytes));
+        packetCompressed.push_back(true);
+    }
+    compressPackets.stop();
+    long compressedBytes = 0;
+    int uncompressedPackets = 0;
+    for (int i = 0; i < (int)packets.size(); i++) {
+        compressedBytes += VOXEL_PACKET_HEADER_BYTES + packets[i].size();
+        uncompressedPackets += packetCompressed[i] ? 0 : 1;
+    }
+    compressPackets.addMetric("bitstream_mb_per_sec", bitstreams.size() / (1024.0 * 1024.0) * 1000000.0 /
+                              std::max(compressPackets.getElapsedUsecs(), 1LL));
+    compressPackets.addMetric("raw_over_compressed_bytes", compressedBytes ? (double)rawBytes / compressedBytes : 0.0);
+    compressPackets.addMetric("raw_packets", uncompressedPackets);
+    compressPackets.finish(bitstreamSizes.size());
+
+    std::vector<unsigned char> decoded(bitstreams.size());
+    static unsigned char decodeBuffer[MAX_DECOMPRESSED_VOXEL_PACKET_BYTES];
+    VoxelPacketDecoder decoder;
+    bool matches = true;
+    Measurement decompressPackets("decompress_packets", world.name);
+    for (int pass = 0; pass < DECODE_PASSES; pass++) {
+        long decodedBytes = 0;
+        for (int i = 0; i < (int)packets.size(); i++) {
+            int bytes = packets[i].size();
+            const unsigned char* data = &packets[i][0];
+            if (packetCompressed[i]) {
+                bytes = decoder.decode(data, bytes, WANT_COLOR, WANT_EXISTS_BITS, decodeBuffer, sizeof(decodeBuffer));
+                data = decodeBuffer;
+            }
+            if (bytes < 0 || decodedBytes + bytes > (long)decoded.size()) {
+                matches = false;
+                break;
+            }
+            memcpy(&decoded[decodedBytes], data, bytes);
+            decodedBytes += bytes;
+        }
+        matches = matches && decodedBytes == (long)decoded.size();
+    }
+    decompressPackets.stop();
+    decompressPackets.addMetric("bitstream_mb_per_sec", bitstreams.size() * DECODE_PASSES / (1024.0 * 1024.0) *
+                                1000000.0 / std::max(decompressPackets.getElapsedUsecs(), 1LL));
+    decompressPackets.finish(packets.size() * DECODE_PASSES);
+    if (!matches || decoded != bitstreams) {
+        printf("WARNING! the decompressed bitstreams don't match\n");
+    }
+}
+
+bool collectParentsOperation(VoxelNode* node, void* extraData) {
+    if (!node->isLeaf()) {
+        ((std::vector<VoxelNode*>*)extraData)->push_back(node);
+    }
+    return true;
+}
+
+// how long it takes to find out where the children of a node are relative to the view frustum, the way the encoder
+// used to do it, one child at a time, and all eight at once
+void benchmarkFrustum(World& world) {
+    std::vector<VoxelNode*> parents;
+    world.tree->recurseTreeWithOperation(collectParentsOperation, &parents);
+    std::vector<std::vector<unsigned char> > inView(VIEWS, std::vector<unsigned char>(parents.size()));
+
+    Measurement oneAtATime("classify_one_at_a_time", world.name);
+    for (int view = 0; view < VIEWS; view++) {
+        const ViewFrustum& viewFrustum = world.views[view];
+        for (int i = 0; i < (int)parents.size(); i++) {
+            VoxelNode* node = parents[i];
+            float boundaryDistance = boundaryDistanceForRenderLevel(*node->getOctalCode() + 2);
+            unsigned char childrenInViewAndLOD = 0;
+            for (int child = 0; child < NUMBER_OF_CHILDREN; child++) {
+                VoxelNode* childNode = node->getChildAtIndex(child);
+                if (childNode && childNode->isInView(viewFrustum) &&
+                    childNode->distanceToCamera(viewFrustum) < boundaryDistance) {
+                    childrenInViewAndLOD |= (1 << child);
+                }
+            }
+            inView[view][i] = childrenInViewAndLOD;
+        }
+    }
+    oneAtATime.finish(parents.size() * VIEWS);
+
+    long mismatches = 0;
+    Measurement allAtOnce("classify_all_at_once", world.name);
+    for (int view = 0; view < VIEWS; view++) {
+        const ViewFrustum& viewFrustum = world.views[view];
+        for (int i = 0; i < (int)parents.size(); i++) {
+            VoxelNode* node = parents[i];
+            AABox box = node->getAABox();
+            box.scale(TREE_SCALE);
+            ViewFrustum::ChildLocations childLocations;
+            viewFrustum.classifyChildren(box, boundaryDistanceForRenderLevel(*node->getOctalCode() + 2), childLocations);
+            unsigned char childrenInViewAndLOD = node->getChildBitmask() & childLocations.inView() & childLocations.inLOD;
+            if (childrenInViewAndLOD != inView[view][i]) {
+                mismatches++;
+            }
+        }
+    }
+    allAtOnce.finish(parents.size() * VIEWS);
+    if (mismatches) {
+        printf("WARNING! classifying the children all at once doesn't match classifying them one at a time\n");
+    }
+}
+
+// how VoxelTree::findRayIntersection() used to find the nearest colored leaf, by testing the box of every node the ray
+// passes through, for benchmarkRays() to compare against
+class RecursionRayArgs {
+public:
+    glm::vec3 origin;
+    glm::vec3 direction;
+    VoxelNode* node;
+    float distance;
+    BoxFace face;
+    bool found;
+};
+
+bool findRayIntersectionByRecursionOperation(VoxelNode* node, void* extraData) {
+    RecursionRayArgs* args = (RecursionRayArgs*)extraData;
+    AABox box = node->getAABox();
+    float distance;
+    BoxFace face;
+    if (!box.findRayIntersection(args->origin, args->direction, distance, face)) {
+        return false;
+    }
+    if (!node->isLeaf()) {
+        return true; // recurse on children
+    }
+    distance *= TREE_SCALE;
+    if (node->isColored() && (!args->found || distance < args->distance)) {
+        args->node = node;
+        args->distance = distance;
+        args->face = face;
+        args->found = true;
+    }
+    return false;
+}
+
+// rays from random points around the outside of the world toward random points near the middle of it, many will miss
+void makeRandomRays(std::vector<VoxelRayQuery>& rays) {
+    for (int i = 0; i < (int)rays.size(); i++) {
+        glm::vec3 from = glm::normalize(glm::vec3(randFloat() - 0.5f, randFloat() - 0.5f, randFloat() - 0.5f));
+        glm::vec3 to(randFloat() * 0.5f + 0.25f, randFloat() * 0.5f + 0.25f, randFloat() * 0.5f + 0.25f);
+        rays[i].origin = (glm::vec3(0.5f, 0.5f, 0.5f) + from) * (float)TREE_SCALE;
+        rays[i].direction = glm::normalize(to * (float)TREE_SCALE - rays[i].origin);
+    }
+}
+
+// the rays one at a time, the first of them the old way too, and all of them as a batch with more and more threads
+void benchmarkRays(World& world) {
+    const int RECURSION_RAYS = 2000; // the old way is too slow for all of them
+    const float DISTANCE_TOLERANCE = 0.001f;
+
+    std::vector<VoxelRayQuery> rays(RAYS);
+    makeRandomRays(rays);
+
+    std::vector<VoxelRayQuery> expected(rays.begin(), rays.begin() + RECURSION_RAYS);
+    Measurement findByRecursion("find_ray_recursion", world.name);
+    for (int i = 0; i < RECURSION_RAYS; i++) {
+        RecursionRayArgs args;
+        args.origin = expected[i].origin / (float)TREE_SCALE;
+        args.direction = expected[i].direction;
+        args.found = false;
+        world.tree->recurseTreeWithOperation(findRayIntersectionByRecursionOperation, &args);
+        expected[i].found = args.found;
+        expected[i].distance = args.distance;
+    }
+    findByRecursion.finish(RECURSION_RAYS);
+
+    Measurement findRayIntersection("find_ray_intersection", world.name);
+    for (int i = 0; i < RAYS; i++) {
+        VoxelRayQuery& ray = rays[i];
+        ray.found = world.tree->findRayIntersection(ray.origin, ray.direction, ray.node, ray.distance, ray.face);
+    }
+    int hits = 0;
+    int mismatches = 0;
+    for (int i = 0; i < RAYS; i++) {
+        hits += rays[i].found ? 1 : 0;
+        if (i < RECURSION_RAYS && (rays[i].found != expected[i].found ||
+                (rays[i].found && fabsf(rays[i].distance - expected[i].distance) > DISTANCE_TOLERANCE))) {
+            mismatches++;
+        }
+    }
+    findRayIntersection.addMetric("hit_percent", hits * 100.0 / RAYS);
+    findRayIntersection.finish(RAYS);
+    if (mismatches) {
+        printf("WARNING! the hits don't match the ones found by recursion\n");
+    }
+
+    for (int threads = 1; threads <= ::maxThreads; threads *= 2) {
+        Measurement findRayIntersections(withThreads("find_ray_intersections", threads), world.name);
+        world.tree->findRayIntersections(&rays[0], RAYS, threads);
+        findRayIntersections.finish(RAYS);
+    }
+}
+
+// how VoxelTree::findCapsulePenetration() used to find a capsule's penetration, one recursion through the tree per
+// capsule, for benchmarkCollisions() to compare against
+class RecursionCapsuleArgs {
+public:
+    glm::vec3 start;
+    glm::vec3 end;
+    float radius;
+    glm::vec3 penetration;
+};
+
+bool findCapsulePenetrationByRecursionOperation(VoxelNode* node, void* extraData) {
+    RecursionCapsuleArgs* args = (RecursionCapsuleArgs*)extraData;
+    const AABox& box = node->getAABox();
+    if (!box.expandedIntersectsSegment(args->start, args->end, args->radius)) {
+        return false;
+    }
+    if (!node->isLeaf()) {
+        return true; // recurse on children
+    }
+    glm::vec3 nodePenetration;
+    if (node->isColored() && box.findCapsulePenetration(args->start, args->end, args->radius, nodePenetration)) {
+        args->penetration = addPenetrations(args->penetration, nodePenetration * (float)TREE_SCALE);
+    }
+    return false;
+}
+
+int countMismatches(const std::vector<glm::vec3>& penetrations, const std::vector<glm::vec3>& expected) {
+    int mismatches = 0;
+    for (int i = 0; i < (int)penetrations.size(); i++) {
+        mismatches += (penetrations[i] != expected[i]) ? 1 : 0;
+    }
+    return mismatches;
+}
+
+// avatar sized capsules standing where random rays hit the world, each wandering a little every frame, found the old
+// way, one query at a time through the collider, as one batch, and as one batch with each capsule as its own owner
+void benchmarkCollisions(World& world) {
+    const int CAPSULES = 1000;
+    const int FRAMES = 60;
+    const int RAY_BATCHES = 100; // to find places for the capsules before giving up on a world that's mostly empty
+    const float CAPSULE_RADIUS = 0.25f;
+    const float CAPSULE_HALF_HEIGHT = 0.65f;
+    const float STEP_PER_FRAME = 0.02f; // a brisk walk at 60 frames per second
+
+    std::vector<VoxelCollisionQuery> queries;
+    std::vector<VoxelRayQuery> rays(CAPSULES);
+    for (int batch = 0; batch < RAY_BATCHES && (int)queries.size() < CAPSULES; batch++) {
+        makeRandomRays(rays);
+        world.tree->findRayIntersections(&rays[0], CAPSULES);
+        for (int i = 0; i < CAPSULES && (int)queries.size() < CAPSULES; i++) {
+            if (rays[i].found) {
+                glm::vec3 center = rays[i].origin + rays[i].direction * rays[i].distance;
+                VoxelCollisionQuery query = { center - glm::vec3(0.0f, CAPSULE_HALF_HEIGHT, 0.0f),
+                    center + glm::vec3(0.0f, CAPSULE_HALF_HEIGHT, 0.0f), CAPSULE_RADIUS, NULL };
+                queries.push_back(query);
+            }
+        }
+    }
+    if ((int)queries.size() < CAPSULES) {
+        printf("    not enough of the world to stand capsules on, skipping the collisions\n");
+        return;
+    }
+    std::vector<glm::vec3> headings(CAPSULES);
+    for (int i = 0; i < CAPSULES; i++) {
+        headings[i] = glm::normalize(glm::vec3(randFloat() - 0.5f, randFloat() - 0.5f, randFloat() - 0.5f));
+    }
+
+    std::vector<glm::vec3> expected(CAPSULES);
+    std::vector<glm::vec3> penetrations(CAPSULES);
+    std::vector<VoxelContact> contacts;
+    VoxelCollider batchCollider(world.tree);
+    VoxelCollider ownerCollider(world.tree);
+    Measurement recursion("capsule_recursion", world.name);
+    Measurement oneAtATime("capsule_one_at_a_time", world.name);
+    Measurement batch("capsule_batch", world.name);
+    Measurement ownerBatch("capsule_batch_owners", world.name);
+    long batchNodes = 0, contactCount = 0;
+    int mismatches = 0;
+    for (int frame = 0; frame < FRAMES; frame++) {
+        for (int i = 0; i < CAPSULES; i++) {
+            glm::vec3 step = headings[i] * STEP_PER_FRAME;
+            queries[i].start += step;
+            queries[i].end += step;
+        }
+
+        recursion.start();
+        for (int i = 0; i < CAPSULES; i++) {
+            RecursionCapsuleArgs args = { queries[i].start / (float)TREE_SCALE, queries[i].end / (float)TREE_SCALE,
+                queries[i].radius / TREE_SCALE, glm::vec3(0.0f, 0.0f, 0.0f) };
+            world.tree->recurseTreeWithOperation(findCapsulePenetrationByRecursionOperation, &args);
+            expected[i] = args.penetration;
+        }
+        recursion.stop();
+
+        oneAtATime.start();
+        for (int i = 0; i < CAPSULES; i++) {
+            world.tree->findCapsulePenetration(queries[i].start, queries[i].end, queries[i].radius, penetrations[i]);
+        }
+        oneAtATime.stop();
+        mismatches += countMismatches(penetrations, expected);
+
+        batchCollider.resetStats();
+        batch.start();
+        batchCollider.findContacts(&queries[0], CAPSULES, contacts);
+        VoxelCollider::combinePenetrations(contacts, CAPSULES, &penetrations[0]);
+        batch.stop();
+        batchNodes += batchCollider.getNodesVisited();
+        contactCount += contacts.size();
+        mismatches += countMismatches(penetrations, expected);
+
+        for (int i = 0; i < CAPSULES; i++) {
+            queries[i].owner = &headings[i];
+        }
+        ownerBatch.start();
+        ownerCollider.findContacts(&queries[0], CAPSULES, contacts);
+        VoxelCollider::combinePenetrations(contacts, CAPSULES, &penetrations[0]);
+        ownerBatch.stop();
+        for (int i = 0; i < CAPSULES; i++) {
+            queries[i].owner = NULL;
+        }
+        mismatches += countMismatches(penetrations, expected);
+    }
+
+    long queryCount = (long)CAPSULES * FRAMES;
+    recursion.finish(queryCount);
+    oneAtATime.finish(queryCount);
+    batch.addMetric("contacts_per_capsule", (double)contactCount / queryCount);
+    batch.addMetric("nodes_per_capsule", (double)batchNodes / queryCount);
+    batch.finish(queryCount);
+    ownerBatch.addMetric("coherent_percent", ownerCollider.getCoherentQueries() * 100.0 / queryCount);
+    ownerBatch.addMetric("nodes_per_capsule", (double)ownerCollider.getNodesVisited() / queryCount);
+    ownerBatch.finish(queryCount);
+    if (mismatches) {
+        printf("WARNING! the penetrations don't match the ones found by recursion\n");
+    }
+}
+
+// edits arriving at the voxel server, then deleted again
+void benchmarkEdits(World& world) {
+    std::vector<unsigned char*> edits;
+    makeRandomVoxels(edits, EDITS, EDIT_VOXEL_SIZE);
+    Measurement readCodeColorBuffer("read_code_color_buffer", world.name);
+    readCodeColorBuffer.finish(insertCodeColorBuffers(world.tree, edits));
+
+    Measurement deleteVoxelCode("delete_voxel_code", world.name);
+    for (int i = 0; i < (int)edits.size(); i++) {
+        world.tree->deleteVoxelCodeFromTree(edits[i]);
+    }
+    deleteVoxelCode.finish(edits.size());
+    deleteCodeColorBuffers(edits);
+}
+
+// The VoxelNodeBag we used to have, a pointer sorted array searched linearly, kept here to compare against
+class SortedArrayNodeBag {
+public:
+    SortedArrayNodeBag() : _elements(NULL), _elementsInUse(0), _sizeOfElementsArray(0) {};
+    ~SortedArrayNodeBag() { delete[] _elements; };
+
+    void insert(VoxelNode* node) {
+        int insertAt = _elementsInUse;
+        for (int i = 0; i < _elementsInUse; i++) {
+            if (_elements[i] == node) {
+                return;
+            }
+            if (_elements[i] > node) {
+                insertAt = i;
+                break;
+            }
+        }
+        if (_sizeOfElementsArray < _elementsInUse + 1) {
+            const int GROW_BAG_BY = 100;
+            VoxelNode** oldBag = _elements;
+            _elements = new VoxelNode*[_sizeOfElementsArray + GROW_BAG_BY];
+            _sizeOfElementsArray += GROW_BAG_BY;
+            memcpy(_elements, oldBag, _elementsInUse * sizeof(VoxelNode*));
+            delete[] oldBag;
+        }
+        memmove(&_elements[insertAt + 1], &_elements[insertAt], (_elementsInUse - insertAt) * sizeof(VoxelNode*));
+        _elements[insertAt] = node;
+        _elementsInUse++;
+    };
+    bool contains(VoxelNode* node) {
+        for (int i = 0; i < _elementsInUse && _elements[i] <= node; i++) {
+            if (_elements[i] == node) {
+                return true;
+            }
+        }
+        return false;
+    };
+    VoxelNode* extract() { return _elementsInUse ? _elements[--_elementsInUse] : NULL; };
+
+private:
+    VoxelNode** _elements;
+    int _elementsInUse;
+    int _sizeOfElementsArray;
+};
+
+bool collectNodesOperation(VoxelNode* node, void* extraData) {
+    ((std::vector<VoxelNode*>*)extraData)->push_back(node);
+    return true;
+}
+
+// inserts every node twice (so we exercise the de-duping), looks each one up, then extracts them all, one operation
+// being one of those
+template<class Bag>
+void benchmarkBag(const char* bagName, const char* world, VoxelNode** nodes, int nodeCount) {
+    char benchmark[64];
+    sprintf(benchmark, "%s_%d", bagName, nodeCount);
+    Bag bag;
+    int found = 0;
+    int extracted = 0;
+    Measurement measurement(benchmark, world);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < nodeCount; i++) {
+            bag.insert(nodes[i]);
+        }
+    }
+    for (int i = 0; i < nodeCount; i++) {
+        found += bag.contains(nodes[i]) ? 1 : 0;
+    }
+    while (bag.extract()) {
+        extracted++;
+    }
+    measurement.finish(nodeCount * 4L);
+    if (found != nodeCount || extracted != nodeCount) {
+        printf("WARNING! the %s found %d and extracted %d of %d nodes\n", bagName, found, extracted, nodeCount);
+    }
+}
+
+// the world's nodes in a random order, the way nodes come out of a tree is nothing like pointer order
+void benchmarkNodeBags(World& world) {
+    const int NODE_COUNTS[] = { 1000, 10000, 100000 };
+
+    std::vector<VoxelNode*> nodes;
+    world.tree->recurseTreeWithOperation(collectNodesOperation, &nodes);
+    for (int i = nodes.size() - 1; i > 0; i--) {
+        std::swap(nodes[i], nodes[randIntInRange(0, i)]);
+    }
+    for (int i = 0; i < (int)(sizeof(NODE_COUNTS) / sizeof(NODE_COUNTS[0])); i++) {
+        if (NODE_COUNTS[i] <= (int)nodes.size()) {
+            benchmarkBag<SortedArrayNodeBag>("sorted_array_bag", world.name, &nodes[0], NODE_COUNTS[i]);
+            benchmarkBag<VoxelNodeBag>("hash_set_bag", world.name, &nodes[0], NODE_COUNTS[i]);
+        }
+    }
+}
+
+int walkedNodeCount = 0;
+bool walkVoxelsOperation(VoxelNode* node, void* extraData) {
+    ::walkedNodeCount++;
+    return true; // keep going
+}
+
+long nodeMemoryUsage = 0;
+bool sumNodeMemoryOperation(VoxelNode* node, void* extraData) {
+    ::nodeMemoryUsage += node->getMemoryUsage();
+    return true; // keep going
+}
+
+// writes the world the way the voxel server persists it and reads it back, then walks what was read a few times, says
+// what its nodes cost and erases it
+void benchmarkSVO(World& world) {
+    const int WALK_PASSES = 10;
+
+    Measurement writeSVO("write_svo", world.name);
+    world.tree->writeToSVOFile(TEMPORARY_SVO_FILE);
+    writeSVO.finish(1);
+
+    VoxelTree* svoTree = new VoxelTree(true);
+    Measurement readSVO("read_svo", world.name);
+    svoTree->readFromSVOFile(TEMPORARY_SVO_FILE);
+    readSVO.finish(1);
+    remove(TEMPORARY_SVO_FILE);
+
+    ::walkedNodeCount = 0;
+    Measurement walkTree("walk_tree", world.name);
+    for (int pass = 0; pass < WALK_PASSES; pass++) {
+        svoTree->recurseTreeWithOperation(walkVoxelsOperation);
+    }
+    int nodes = ::walkedNodeCount / WALK_PASSES;
+    ::nodeMemoryUsage = 0;
+    svoTree->recurseTreeWithOperation(sumNodeMemoryOperation);
+    walkTree.addMetric("node_bytes", sizeof(VoxelNode));
+    walkTree.addMetric("bytes_per_node", (double)::nodeMemoryUsage / std::max(nodes, 1));
+    walkTree.addMetric("pool_bytes_per_node", (double)svoTree->getNodePool().getBytesInUse() / std::max(nodes, 1));
+    walkTree.finish(::walkedNodeCount);
+
+    Measurement eraseAllVoxels("erase_all_voxels", world.name);
+    svoTree->eraseAllVoxels();
+    eraseAllVoxels.finish(nodes);
+    delete svoTree;
+}
+
+// encodes the first packet a client standing at the edge of the world and looking into it would get
+int encodeFirstPacket(VoxelTree* tree) {
+    ViewFrustum viewFrustum;
+    viewFrustum.setPosition(glm::vec3(0.5f, 0.1f, 1.0f) * (float)TREE_SCALE);
+    viewFrustum.setOrientation(glm::quat());
+    viewFrustum.setFieldOfView(45.0f);
+    viewFrustum.calculate();
+
+    static unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE];
+    VoxelNodeBag bag;
+    bag.insert(tree->rootNode);
+    EncodeBitstreamParams params(INT_MAX, &viewFrustum, WANT_COLOR, WANT_EXISTS_BITS);
+    return tree->encodeTreeBitstream(bag.extract(), outputBuffer, MAX_VOXEL_PACKET_SIZE - 1, bag, params);
+}
+
+// how long it takes from a cold start to having the first packet ready, the way the voxel server loads its wire format
+// persist file, and from a mapped SVO file that only loads the top of the tree before serving, then how long the rest
+// of the mapped file takes to materialize
+void benchmarkColdStart(World& world) {
+    const int EAGER_LEVELS = 6;
+    const int NODES_PER_MATERIALIZE = 64 * 1024;
+    std::string mappedFileName = std::string(TEMPORARY_SVO_FILE) + VoxelMappedFile::FILE_EXTENSION;
+    world.tree->writeToSVOFile(TEMPORARY_SVO_FILE);
+
+    // Note: the files were just written, so they're probably in the page cache, these aren't truly cold starts
+    Measurement wireStart("cold_start_wire", world.name);
+    VoxelTree* tree = new VoxelTree(true);
+    tree->readFromSVOFile(TEMPORARY_SVO_FILE);
+    tree->reaverageVoxelColors(tree->rootNode);
+    encodeFirstPacket(tree);
+    wireStart.finish(1);
+    unsigned long wireNodes = tree->getVoxelCount();
+
+    Measurement writeMapped("write_mapped_svo", world.name);
+    tree->writeToMappedSVOFile(mappedFileName.c_str());
+    writeMapped.finish(1);
+    delete tree;
+    remove(TEMPORARY_SVO_FILE);
+
+    Measurement mappedStart("cold_start_mapped", world.name);
+    tree = new VoxelTree(true);
+    tree->readFromMappedSVOFile(mappedFileName.c_str(), EAGER_LEVELS);
+    encodeFirstPacket(tree);
+    mappedStart.finish(1);
+
+    Measurement materialize("materialize_mapped", world.name);
+    while (tree->hasNodesOnDisk()) {
+        tree->materializeNodesFromDisk(NODES_PER_MATERIALIZE);
+    }
+    materialize.stop();
+    unsigned long mappedNodes = tree->getVoxelCount();
+    materialize.finish(mappedNodes);
+    if (mappedNodes != wireNodes) {
+        printf("WARNING! the mapped file has %ld nodes, the wire format file %ld\n", mappedNodes, wireNodes);
+    }
+    delete tree;
+    remove(mappedFileName.c_str());
+}
+
+// what the voxel server does with a tree it has just loaded, reaveraging and counting it one after the other, against
+// reaverageAndValidate() with more and more threads
+void benchmarkLoadPass(World& world) {
+    world.tree->writeToSVOFile(TEMPORARY_SVO_FILE);
+    VoxelTree* tree = new VoxelTree(true);
+    tree->readFromSVOFile(TEMPORARY_SVO_FILE);
+    Measurement reaverage("reaverage_voxel_colors", world.name);
+    tree->reaverageVoxelColors(tree->rootNode);
+    reaverage.stop();
+    unsigned long nodeCount = tree->getVoxelCount();
+    reaverage.finish(nodeCount);
+    Measurement count("get_voxel_count", world.name);
+    tree->getVoxelCount();
+    count.finish(nodeCount);
+    uint32_t expectedHash = hashTree(tree);
+    delete tree;
+
+    for (int threads = 1; threads <= ::maxThreads; threads *= 2) {
+        tree = new VoxelTree(true);
+        tree->readFromSVOFile(TEMPORARY_SVO_FILE);
+        VoxelTreeStats stats;
+        Measurement reaverageAndValidate(withThreads("reaverage_and_validate", threads), world.name);
+        tree->reaverageAndValidate(threads, true, stats);
+        reaverageAndValidate.addMetric("problems", stats.problemCount);
+        reaverageAndValidate.finish(stats.nodeCount);
+        if (stats.nodeCount != nodeCount || hashTree(tree) != expectedHash) {
+            printf("WARNING! reaverageAndValidate() with %d threads left a different tree\n", threads);
+        }
+        delete tree;
+    }
+    remove(TEMPORARY_SVO_FILE);
+}
+
+// how long the voxel server takes to come back after a crash with EDITS edits in its log since the last snapshot, and
+// what logging those edits cost while they were being made
+void benchmarkRecovery(World& world) {
+    const int EDITS_PER_COMMIT = 1000;
+    const int MIN_EDIT_LEVEL = 3;
+    const int MAX_EDIT_LEVEL = 10;
+    const uint32_t SNAPSHOT_GENERATION = 1;
+
+    std::string snapshotFileName = std::string(TEMPORARY_SVO_FILE) + VoxelMappedFile::FILE_EXTENSION;
+    std::string logFileName = VoxelEditLog::fileNameFor(snapshotFileName.c_str(), SNAPSHOT_GENERATION);
+    world.tree->writeToSVOFile(TEMPORARY_SVO_FILE);
+    VoxelTree* tree = new VoxelTree(true);
+    tree->readFromSVOFile(TEMPORARY_SVO_FILE);
+    remove(TEMPORARY_SVO_FILE);
+    tree->reaverageVoxelColors(tree->rootNode);
+    VoxelMappedFile::write(snapshotFileName.c_str(), tree->rootNode, SNAPSHOT_GENERATION);
+    remove(logFileName.c_str());
+
+    // a mix of adds, destructive adds and deletes, near the ground where the scenes are
+    std::vector<unsigned char*> editCodes(EDITS);
+    for (int i = 0; i < EDITS; i++) {
+        float voxelSize = 1.0f / (1 << randIntInRange(MIN_EDIT_LEVEL, MAX_EDIT_LEVEL));
+        editCodes[i] = pointToVoxel(randFloat(), randFloat() * 0.0625f, randFloat(), voxelSize,
+                                    randIntInRange(0, 255), randIntInRange(0, 255), randIntInRange(0, 255));
+    }
+
+    VoxelEditLog log;
+    log.open(logFileName.c_str(), SNAPSHOT_GENERATION);
+    Measurement applyEdits("apply_edits", world.name);
+    Measurement logEdits("log_edits", world.name);
+    Measurement commitEdits("commit_edit_log", world.name);
+    int commits = 0;
+    for (int i = 0; i < EDITS; i++) {
+        unsigned char* code = editCodes[i];
+        int editType = i % 4;
+        applyEdits.start();
+        if (editType == 3) {
+            tree->deleteVoxelCodeFromTree(code, ACTUALLY_DELETE, COLLAPSE_EMPTY_TREE);
+        } else {
+            tree->readCodeColorBufferToTree(code, editType == 2);
+        }
+        applyEdits.stop();
+        if (editType == 3) {
+            // the way it comes in, see processRemoveVoxelBitstream()
+            unsigned char erasePacket[MAX_VOXEL_PACKET_SIZE];
+            int codeBytes = bytesRequiredForCodeLength(*code);
+            int eraseBytes = sizeof(PACKET_HEADER) + sizeof(short int) + codeBytes + SIZE_OF_COLOR_DATA;
+            erasePacket[0] = PACKET_HEADER_ERASE_VOXEL;
+            memcpy(erasePacket + sizeof(PACKET_HEADER) + sizeof(short int), code, codeBytes + SIZE_OF_COLOR_DATA);
+            logEdits.start();
+            log.logEraseVoxelBitstream(erasePacket, eraseBytes);
+        } else {
+            logEdits.start();
+            log.logSetVoxel(code, editType == 2);
+        }
+        logEdits.stop();
+
+        if ((i + 1) % EDITS_PER_COMMIT == 0 || i + 1 == EDITS) {
+            commitEdits.start();
+            log.flush();
+            commitEdits.stop();
+            commits++;
+        }
+    }
+    long logBytes = log.getFileSize();
+    log.close();
+    applyEdits.finish(EDITS);
+    logEdits.addMetric("log_bytes_per_edit", (double)logBytes / EDITS);
+    logEdits.finish(EDITS);
+    commitEdits.addMetric("edits_per_commit", EDITS_PER_COMMIT);
+    commitEdits.finish(commits);
+
+    unsigned long expectedNodes = tree->getVoxelCount();
+    delete tree;
+    deleteCodeColorBuffers(editCodes);
+
+    // Note: the files were just written, so they're probably in the page cache, this isn't truly a cold start
+    tree = new VoxelTree(true);
+    Measurement readSnapshot("read_snapshot", world.name);
+    tree->readFromMappedSVOFile(snapshotFileName.c_str());
+    readSnapshot.finish(1);
+    Measurement replayEdits("replay_edit_log", world.name);
+    long edits = VoxelEditLog::replay(logFileName.c_str(), tree);
+    replayEdits.finish(edits);
+    unsigned long recoveredNodes = tree->getVoxelCount();
+    if (recoveredNodes != expectedNodes) {
+        printf("WARNING! the recovered tree has %ld nodes, the one the edits were made to %ld\n", recoveredNodes,
+               expectedNodes);
+    }
+    delete tree;
+    remove(snapshotFileName.c_str());
+    remove(logFileName.c_str());
+}
+
+bool collectOctalCodesOperation(VoxelNode* node, void* extraData) {
+    std::vector<unsigned char>* codes = (std::vector<unsigned char>*)extraData;
+    unsigned char* code = node->getOctalCode();
+    codes->insert(codes->end(), code, code + bytesRequiredForCodeLength(*code));
+    return true;
+}
+
+// finds the node for an octal code the way the tree did before it had keys, a byte at a time from the top
+VoxelNode* descendByOctalCode(VoxelNode* node, unsigned char* code) {
+    while (numberOfThreeBitSectionsInCode(node->getOctalCode()) < numberOfThreeBitSectionsInCode(code)) {
+        VoxelNode* childNode = node->getChildAtIndex(branchIndexWithDescendant(node->getOctalCode(), code));
+        if (!childNode) {
+            break;
+        }
+        node = childNode;
+    }
+    return node;
+}
+
+VoxelNode* descendByKey(VoxelNode* node, const MortonKey& key) {
+    while (*node->getOctalCode() < key.getLevel()) {
+        VoxelNode* childNode = node->getChildAtIndex(key.getSection(*node->getOctalCode()));
+        if (!childNode) {
+            break;
+        }
+        node = childNode;
+    }
+    return node;
+}
+
+// finding nodes by octal code and by key, then edits of all sizes, from octal codes the way a voxel server gets them
+// and from points. The edits are left in the tree, so this goes last
+void benchmarkOctalCodes(World& world) {
+    const int LOOKUPS = 1000000;
+    const int MAX_EDIT_LEVEL = 10;
+
+    // the codes of random nodes in the tree
+    std::vector<unsigned char> allCodes;
+    world.tree->recurseTreeWithOperation(collectOctalCodesOperation, &allCodes);
+    std::vector<int> codeOffsets;
+    for (int offset = 0; offset < (int)allCodes.size(); offset += bytesRequiredForCodeLength(allCodes[offset])) {
+        codeOffsets.push_back(offset);
+    }
+    std::vector<unsigned char*> codes(LOOKUPS);
+    for (int i = 0; i < LOOKUPS; i++) {
+        codes[i] = &allCodes[codeOffsets[randIntInRange(0, codeOffsets.size() - 1)]];
+    }
+
+    std::vector<VoxelNode*> found(LOOKUPS);
+    Measurement byOctalCode("find_by_octal_code", world.name);
+    for (int i = 0; i < LOOKUPS; i++) {
+        found[i] = descendByOctalCode(world.tree->rootNode, codes[i]);
+    }
+    byOctalCode.finish(LOOKUPS);
+
+    int mismatches = 0;
+    Measurement byKey("find_by_key", world.name);
+    for (int i = 0; i < LOOKUPS; i++) {
+        VoxelNode* node = descendByKey(world.tree->rootNode, MortonKey::fromOctalCode(codes[i]));
+        mismatches += (node != found[i]) ? 1 : 0;
+    }
+    byKey.finish(LOOKUPS);
+    if (mismatches) {
+        printf("WARNING! the nodes found by key don't match the ones found by octal code\n");
+    }
+
+    // random edits near the ground, from big voxels down to small ones, a third of them destructive
+    std::vector<unsigned char*> edits(EDITS);
+    std::vector<bool> destructive(EDITS);
+    for (int i = 0; i < EDITS; i++) {
+        float s = 1.0f / (1 << randIntInRange(1, MAX_EDIT_LEVEL));
+        edits[i] = pointToVoxel(randFloat(), randFloat() * 0.0625f, randFloat(), s,
+                                randIntInRange(0, 255), randIntInRange(0, 255), randIntInRange(0, 255));
+        destructive[i] = randIntInRange(0, 2) == 0;
+    }
+    Measurement editFromOctalCodes("edit_from_octal_codes", world.name);
+    for (int i = 0; i < EDITS; i++) {
+        world.tree->readCodeColorBufferToTree(edits[i], destructive[i]);
+    }
+    editFromOctalCodes.finish(EDITS);
+    deleteCodeColorBuffers(edits);
+
+    Measurement editFromPoints("edit_from_points", world.name);
+    for (int i = 0; i < EDITS; i++) {
+        float s = 1.0f / (1 << randIntInRange(1, MAX_EDIT_LEVEL));
+        world.tree->createVoxel(randFloat(), randFloat() * 0.0625f, randFloat(), s,
+                                randIntInRange(0, 255), randIntInRange(0, 255), randIntInRange(0, 255), false);
+    }
+    editFromPoints.finish(EDITS);
+}
+
+// a voxel server sending full voxel packets to one client over a link that can only carry so much, queues up to
+// queueBytes, delays everything by oneWayUsecs and loses randomLoss of what it carries, in steps of a millisecond
+class SimulatedLink {
+public:
+    float bytesPerSecond;
+    int queueBytes;
+    int oneWayUsecs;
+    float randomLoss;
+};
+
+// what the voxel server has to send: as much as it can when bytesPerSend is 0, otherwise bytesPerSend every send
+// interval, the odd edit a client standing still gets, plus burstBytes every burstIntervalUsecs, a new view's worth
+// when it turns around
+class SimulatedTraffic {
+public:
+    int bytesPerSend;
+    int burstBytes;
+    int burstIntervalUsecs;
+};
+
+class SimulationResult {
+public:
+    long long bytesSent;
+    long long bytesReceived;
+    float bytesPerSecond;           // received
+    float endBytesPerSecond;        // what the pacer was sending at when the simulation ended
+    float behindUsecs;              // per burst, how long the sender had more to send than it could
+};
+
+class SimulatedPacket {
+public:
+    long long arrivesAt;
+    int bytes;
+    unsigned char stamp[PACED_PACKET_STAMP_BYTES];
+};
+
+void simulateLink(const SimulatedLink& link, const SimulatedTraffic& traffic, bool paced, SimulationResult& result) {
+    const int SEND_INTERVAL_USECS = 100 * 1000;
+    const int REPORT_INTERVAL_USECS = 100 * 1000;
+    const float STARTING_BYTES_PER_SECOND = 30.0f * MAX_VOXEL_PACKET_SIZE * 10.0f;
+
+    BandwidthPacer pacer(STARTING_BYTES_PER_SECOND, MAX_VOXEL_PACKET_SIZE * 10.0f, STARTING_BYTES_PER_SECOND * 16.0f);
+    ReceiveTracker tracker;
+    std::deque<SimulatedPacket> queue;       // waiting for the link
+    std::deque<SimulatedPacket> inFlight;    // on the link, in the order they arrive
+    std::deque<std::pair<long long, ReceiveReport> > reports;
+    int queuedBytes = 0;
+    float linkCredit = 0.0f;
+    long long& bytesSent = result.bytesSent;
+    long long& bytesReceived = result.bytesReceived;
+    bytesSent = bytesReceived = 0;
+    long long backlogBytes = 0;
+    long long behindUsecs = 0;
+    int bursts = 0;
+
+    for (long long now = 1; now <= SIMULATED_USECS; now += SIMULATED_STEP_USECS) {
+        if (now % SEND_INTERVAL_USECS == 1) {
+            backlogBytes += traffic.bytesPerSend;
+            if (traffic.burstIntervalUsecs && now % traffic.burstIntervalUsecs == 1) {
+                backlogBytes += traffic.burstBytes;
+                bursts++;
+            }
+            pacer.refill(now, FLT_MAX);
+            while (pacer.hasTokens() && (!traffic.bytesPerSend || backlogBytes > 0)) {
+                SimulatedPacket packet;
+                packet.bytes = MAX_VOXEL_PACKET_SIZE;
+                pacer.stampPacket(packet.stamp, now);
+                pacer.sent(packet.bytes);
+                bytesSent += packet.bytes;
+                backlogBytes -= packet.bytes;
+                if (queuedBytes + packet.bytes <= link.queueBytes) {
+                    queue.push_back(packet);
+                    queuedBytes += packet.bytes;
+                }
+            }
+            if (traffic.bytesPerSend) {
+                if (backlogBytes > 0) {
+                    behindUsecs += SEND_INTERVAL_USECS;
+                }
+                backlogBytes = std::max(backlogBytes, 0LL); // a packet isn't always full
+            }
+        }
+
+        // the link carries what it can this step
+        linkCredit = std::min(linkCredit + link.bytesPerSecond * SIMULATED_STEP_USECS / 1000000.0f,
+                              (float)MAX_VOXEL_PACKET_SIZE);
+        while (!queue.empty() && linkCredit >= queue.front().bytes) {
+            SimulatedPacket packet = queue.front();
+            queue.pop_front();
+            queuedBytes -= packet.bytes;
+            linkCredit -= packet.bytes;
+            if (randFloat() >= link.randomLoss) {
+                packet.arrivesAt = now + link.oneWayUsecs;
+                inFlight.push_back(packet);
+            }
+        }
+        if (queue.empty()) {
+            linkCredit = 0.0f;
+        }
+        while (!inFlight.empty() && inFlight.front().arrivesAt <= now) {
+            tracker.packetReceived(inFlight.front().stamp, inFlight.front().bytes, now);
+            bytesReceived += inFlight.front().bytes;
+            inFlight.pop_front();
+        }
+
+        // the client reports back, and without pacing the server ignores it
+        ReceiveReport report;
+        if (now % REPORT_INTERVAL_USECS == 1 && tracker.makeReport(report, now)) {
+            reports.push_back(std::make_pair(now + link.oneWayUsecs, report));
+        }
+        while (!reports.empty() && reports.front().first <= now) {
+            if (paced) {
+                pacer.processReport(reports.front().second, now);
+            }
+            reports.pop_front();
+        }
+    }
+    result.bytesPerSecond = bytesReceived * 1000000.0f / SIMULATED_USECS;
+    result.endBytesPerSecond = pacer.getBytesPerSecond();
+    result.behindUsecs = bursts ? (float)behindUsecs / bursts : 0.0f;
+}
+
+// compares sending at the fixed rate the voxel server starts agents at with pacing by the agent's reports, over
+// simulated links slower and faster than the fixed rate, with the server always having more to send and with it mostly
+// having little to send and now and then a lot. Pacing shouldn't let the quiet stretches drag its rate down, or the
+// bursts take longer to get out. Each link is reported as a world, and each simulated millisecond as an op
+void simulatePacing() {
+    const int LINKS = 3;
+    const char* LINK_NAMES[LINKS] = { "slow", "fast", "lossy" };
+    SimulatedLink links[LINKS] = {
+        { 150.0f * 1024.0f, 64 * 1024, 40 * 1000, 0.01f },
+        { 2.0f * 1024.0f * 1024.0f, 256 * 1024, 20 * 1000, 0.005f },
+        { 300.0f * 1024.0f, 64 * 1024, 60 * 1000, 0.05f }
+    };
+    const int TRAFFICS = 2;
+    const char* TRAFFIC_NAMES[TRAFFICS] = { "backlogged", "bursty" };
+    SimulatedTraffic traffics[TRAFFICS] = {
+        { 0, 0, 0 },
+        { 2 * 1024, 512 * 1024, 5 * 1000 * 1000 }
+    };
+    for (int i = 0; i < LINKS; i++) {
+        for (int j = 0; j < TRAFFICS; j++) {
+            for (int paced = 0; paced < 2; paced++) {
+                SimulationResult result;
+                Measurement measurement(std::string("pacing_") + TRAFFIC_NAMES[j] + (paced ? "_paced" : "_fixed"),
+                                        LINK_NAMES[i]);
+                simulateLink(links[i], traffics[j], paced, result);
+                measurement.addMetric("received_bytes_per_sec", result.bytesPerSecond);
+                measurement.addMetric("loss_percent", result.bytesSent ?
+                                      100.0 * (result.bytesSent - result.bytesReceived) / result.bytesSent : 0.0);
+                measurement.addMetric("end_bytes_per_sec", result.endBytesPerSecond);
+                if (traffics[j].burstBytes) {
+                    measurement.addMetric("behind_msecs_per_burst", result.behindUsecs / 1000.0f);
+                }
+                measurement.finish(SIMULATED_USECS / SIMULATED_STEP_USECS);
+            }
+        }
+    }
+}
+
+class BenchmarkGroup {
+public:
+    const char* name;
+    void (*run)(World& world);
+};
+
+// in the order they're run, the ones that change the world's tree go after the ones that would notice
+const BenchmarkGroup BENCHMARK_GROUPS[] = {
+    { "encode", benchmarkEncode },
+    { "compression", benchmarkCompression },
+    { "frustum", benchmarkFrustum },
+    { "arrays", benchmarkArrays },
+    { "mesh", benchmarkMesh },
+    { "read_bitstream", benchmarkReadBitstream },
+    { "rays", benchmarkRays },
+    { "collisions", benchmarkCollisions },
+    { "node_bag", benchmarkNodeBags },
+    { "svo", benchmarkSVO },
+    { "cold_start", benchmarkColdStart },
+    { "load_pass", benchmarkLoadPass },
+    { "recovery", benchmarkRecovery },
+    { "edits", benchmarkEdits },
+    { "octal_codes", benchmarkOctalCodes }
+};
+const int BENCHMARK_GROUP_COUNT = sizeof(BENCHMARK_GROUPS) / sizeof(BENCHMARK_GROUPS[0]);
+
+// groups that don't need a world, they're run once before the worlds are built
+class SimulationGroup {
+public:
+    const char* name;
+    void (*run)();
+};
+
+const SimulationGroup SIMULATION_GROUPS[] = {
+    { "pacing", simulatePacing }
+};
+const int SIMULATION_GROUP_COUNT = sizeof(SIMULATION_GROUPS) / sizeof(SIMULATION_GROUPS[0]);
+
+// whether name is in the comma separated list
+bool isListed(const std::string& list, const char* name) {
+    std::string separated = "," + list + ",";
+    return separated.find("," + std::string(name) + ",") != std::string::npos;
+}
+
+void runBenchmarks(const char* worldName, int seed, const std::string& groups) {
+    srand(seed);
+    World world;
+    world.name = worldName;
+    world.tree = buildWorld(worldName);
+    if (!world.tree) {
+        return;
+    }
+    world.views.resize(VIEWS);
+    for (int i = 0; i < VIEWS; i++) {
+        setRandomView(world.views[i]);
+    }
+    for (int i = 0; i < BENCHMARK_GROUP_COUNT; i++) {
+        if (groups.empty() || isListed(groups, BENCHMARK_GROUPS[i].name)) {
+            BENCHMARK_GROUPS[i].run(world);
+        }
+    }
+    delete world.tree;
+}
+
+bool writeResults(const char* fileName, int seed) {
+    FILE* file = fopen(fileName, "w");
+    if (!file) {
+        return false;
+    }
+    int length = strlen(fileName);
+    bool wantCSV = length >= 4 && strcmp(fileName + length - 4, ".csv") == 0;
+    if (wantCSV) {
+        fprintf(file, "benchmark,world,ops,ns_per_op,allocs_per_op,peak_rss_kb,bytes_per_voxel,metrics\n");
+    } else {
+        fprintf(file, "{\n  \"seed\": %d,\n  \"results\": [\n", seed);
+    }
+    for (int i = 0; i < (int)::results.size(); i++) {
+        const BenchmarkResult& result = ::results[i];
+        // a benchmark's own figures go in one column of the CSV file, as name=value pairs separated by semicolons
+        if (wantCSV) {
+            fprintf(file, "%s,%s,%ld,%.1f,%.3f,%ld,%ld,", result.benchmark.c_str(), result.world.c_str(),
+                    result.ops, result.nsPerOp, result.allocationsPerOp, result.peakRSSKilobytes,
+                    result.bytesPerVoxel);
+            for (int j = 0; j < (int)result.metrics.size(); j++) {
+                fprintf(file, "%s%s=%.3f", j ? ";" : "", result.metrics[j].first.c_str(), result.metrics[j].second);
+            }
+            fprintf(file, "\n");
+        } else {
+            fprintf(file, "    { \"benchmark\": \"%s\", \"world\": \"%s\", \"ops\": %ld, \"ns_per_op\": %.1f, "
+                    "\"allocs_per_op\": %.3f, \"peak_rss_kb\": %ld, \"bytes_per_voxel\": %ld",
+                    result.benchmark.c_str(), result.world.c_str(), result.ops, result.nsPerOp,
+                    result.allocationsPerOp, result.peakRSSKilobytes, result.bytesPerVoxel);
+            for (int j = 0; j < (int)result.metrics.size(); j++) {
+                fprintf(file, ", \"%s\": %.3f", result.metrics[j].first.c_str(), result.metrics[j].second);
+            }
+            fprintf(file, " }%s\n", i + 1 < (int)::results.size() ? "," : "");
+        }
+    }
+    if (!wantCSV) {
+        fprintf(file, "  ]\n}\n");
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, const char * argv[]) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    const char* SEED = "--seed";
+    const char* seedOption = getCmdOption(argc, argv, SEED);
+    int seed = seedOption ? atoi(seedOption) : DEFAULT_SEED;
+
+    // the results go to a JSON file, or a CSV file if its name ends with .csv
+    const char* OUTPUT = "--output";
+    const char* outputOption = getCmdOption(argc, argv, OUTPUT);
+    const char* outputFile = outputOption ? outputOption : DEFAULT_OUTPUT_FILE;
+
+    // the SVO file the file world is read from. Given on its own, it's the only world that's run
+    const char* SVO = "--svo";
+    ::svoFile = getCmdOption(argc, argv, SVO);
+
+    // a comma separated list of the worlds to run, from sphere, surface, dense, sparse, solid and file
+    const char* WORLDS = "--worlds";
+    const char* worldsOption = getCmdOption(argc, argv, WORLDS);
+    std::string worlds = worldsOption ? worldsOption : (::svoFile ? "file" : "surface,dense,sparse,solid");
+
+    // a comma separated list of the groups of benchmarks to run, all of them if it isn't given
+    const char* BENCHMARKS = "--benchmarks";
+    const char* benchmarksOption = getCmdOption(argc, argv, BENCHMARKS);
+    std::string groups = benchmarksOption ? benchmarksOption : "";
+    for (size_t start = 0; start < groups.size(); ) {
+        size_t end = std::min(groups.find(',', start), groups.size());
+        std::string group = groups.substr(start, end - start);
+        bool found = false;
+        for (int i = 0; i < BENCHMARK_GROUP_COUNT; i++) {
+            found = found || group == BENCHMARK_GROUPS[i].name;
+        }
+        for (int i = 0; i < SIMULATION_GROUP_COUNT; i++) {
+            found = found || group == SIMULATION_GROUPS[i].name;
+        }
+        if (!found) {
+            printf("WARNING! there's no group of benchmarks called %s\n", group.c_str());
+        }
+        start = end + 1;
+    }
+
+    const char* MAX_THREADS = "--maxThreads";
+    const char* maxThreadsOption = getCmdOption(argc, argv, MAX_THREADS);
+    ::maxThreads = maxThreadsOption ? std::max(atoi(maxThreadsOption), 1) : DEFAULT_MAX_THREADS;
+
+    for (int i = 0; i < SIMULATION_GROUP_COUNT; i++) {
+        if (groups.empty() || isListed(groups, SIMULATION_GROUPS[i].name)) {
+            srand(seed);
+            SIMULATION_GROUPS[i].run();
+        }
+    }
+
+    size_t start = 0;
+    while (start < worlds.size()) {
+        size_t end = worlds.find(',', start);
+        if (end == std::string::npos) {
+            end = worlds.size();
+        }
+        std::string world = worlds.substr(start, end - start);
+        if (world == "sphere" || world == "surface" || world == "dense" || world == "sparse" || world == "solid" ||
+                world == "file") {
+            runBenchmarks(world.c_str(), seed, groups);
+        } else {
+            printf("WARNING! there's no world called %s, the worlds are sphere, surface, dense, sparse, solid and "
+                   "file\n", world.c_str());
+        }
+        start = end + 1;
+    }
+
+    if (!writeResults(outputFile, seed)) {
+        printf("Unable to write results to %s\n", outputFile);
+        return 1;
+    }
+    printf("results written to %s\n", outputFile);
+    return 0;
+}
@@ -9,6 +9,7 @@
 #include <VoxelTree.h>
 #include <SharedUtil.h>
 #include <SceneUtils.h>
+#include <VoxelMappedFile.h>
 
 VoxelTree myTree;
 
@@ -54,8 +55,45 @@ void voxelTutorial(VoxelTree * tree) {
     }
 }
 
+// converts between the wire format and mapped SVO files, the output format is picked by the file's extension
+bool convertSVO(const char* inputFile, const char* outputFile) {
+    VoxelTree* tree = new VoxelTree();
+    bool inputIsMapped = VoxelMappedFile::isMappedFile(inputFile);
+    bool read = inputIsMapped ? tree->readFromMappedSVOFile(inputFile) : tree->readFromSVOFile(inputFile);
+    if (!read) {
+        printf("Unable to read SVO file %s\n", inputFile);
+        delete tree;
+        return false;
+    }
+
+    const char* extension = strrchr(outputFile, '.');
+    bool outputIsMapped = extension && strcmp(extension, VoxelMappedFile::FILE_EXTENSION) == 0;
+    bool written = true;
+    if (outputIsMapped) {
+        // wire format files don't carry densities, so reaverage like the voxel server does after loading one
+        if (!inputIsMapped) {
+            tree->reaverageVoxelColors(tree->rootNode);
+        }
+        written = tree->writeToMappedSVOFile(outputFile);
+    } else {
+        tree->writeToSVOFile(outputFile);
+    }
+    printf("converted %s to %s, %ld nodes\n", inputFile, outputFile, tree->getVoxelCount());
+    delete tree;
+    return written;
+}
+
 int main(int argc, const char * argv[])
 {
+    // converts between wire format SVO files and mapped SVO files, see VoxelMappedFile
+    const char* CONVERT_FROM = "--convertFrom";
+    const char* CONVERT_TO = "--convertTo";
+    const char* convertFrom = getCmdOption(argc, argv, CONVERT_FROM);
+    const char* convertTo = getCmdOption(argc, argv, CONVERT_TO);
+    if (convertFrom && convertTo) {
+        return convertSVO(convertFrom, convertTo) ? 0 : 1;
+    }
+
 	const char* SAY_HELLO = "--sayHello";
     if (cmdOptionExists(argc, argv, SAY_HELLO)) {
     	printf("I'm just saying hello...\n");
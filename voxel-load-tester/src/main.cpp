@@ -0,0 +1,620 @@
+//
+//  main.cpp
+//  Voxel Load Tester
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Puts voxel server load on a domain without any real avatars. Each simulated client has its own socket, sends the
+//  voxel servers the head data an interface would, with its camera following a scripted path, and reads the voxel data
+//  that comes back into its own tree, merging the packets from all of the voxel servers the domain has when the tree is
+//  split between several of them. Every few seconds it prints the throughput all the clients are seeing, and at the
+//  end what each client saw: its packets and bytes per second, and how long the voxels it could see took to stop
+//  arriving each time its camera came to rest. The voxel servers' own PACKET_HEADER_VOXEL_SEND_STATS say how often
+//  they fell behind their send intervals.
+//
+//  Paths are a list of keyframes, each a time in seconds, a position in meters and a yaw in degrees, 0 looking down
+//  -z, and the camera moves in straight lines between them, looping back to the start at the end. --path takes orbit
+//  (circling the middle of the world), flyby (across the world and back, stopping at each end), still (where the orbit
+//  starts, never moving) or a file of keyframes, one "seconds x y z yaw" per line. Each client starts at a different
+//  place along the path.
+//
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include <glm/gtx/quaternion.hpp>
+#include <AgentList.h>
+#include <AgentTypes.h>
+#include <AvatarData.h>
+#include <BandwidthPacer.h>
+#include <PacketHeaders.h>
+#include <SharedUtil.h>
+#include <UDPSocket.h>
+#include <VoxelConstants.h>
+#include <VoxelPacketCoder.h>
+#include <VoxelSendStats.h>
+#include <VoxelTree.h>
+
+#ifdef _WIN32
+#include "Syssocket.h"
+#include "Systime.h"
+#else
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#endif
+
+const int LOAD_TESTER_LISTEN_PORT = 40110;
+
+const int MAX_VOXEL_SERVERS = 16;
+const int DEFAULT_CLIENTS = 4;
+const int DEFAULT_SECONDS = 30;
+
+const float HEAD_DATA_SEND_INTERVAL_USECS = 1000000.0f / 60.0f;
+const float RECEIVE_REPORT_SEND_INTERVAL_USECS = 100000.0f;
+const float STATS_INTERVAL_USECS = 5000000.0f;
+const int IDLE_SLEEP_USECS = 1000;
+
+// a client's visible set has converged once it has been at rest this long without getting any new voxels
+const float CONVERGED_QUIET_USECS = 1000000.0f;
+
+const float ORBIT_RADIUS = TREE_SCALE * 0.75f;      // meters from the middle of the world
+const float ORBIT_PERIOD_SECONDS = 120.0f;
+const int ORBIT_KEYFRAMES = 72;
+const float CAMERA_HEIGHT = TREE_SCALE * 0.25f;
+const float FLYBY_SECONDS = 20.0f;                  // to cross the world
+const float FLYBY_PAUSE_SECONDS = 10.0f;            // at each end, and again after turning around
+
+// the same lens the interface's camera has by default
+const float CAMERA_FIELD_OF_VIEW = 60.0f;
+const float CAMERA_ASPECT_RATIO = 16.0f / 9.0f;
+const float CAMERA_NEAR_CLIP = 0.08f;
+const float CAMERA_FAR_CLIP = 50.0f * TREE_SCALE;
+
+bool wantLocalDomain = false;
+bool wantColor = true;
+bool wantDelta = false;
+bool wantOcclusionCulling = false;
+bool wantCompression = false;
+bool stillCameras = false;
+int testSeconds = DEFAULT_SECONDS;
+volatile bool stopClients = false;
+
+class CameraKeyframe {
+public:
+    float seconds;
+    glm::vec3 position;
+    float yaw;
+};
+
+class CameraPath {
+public:
+    void makeOrbit();
+    void makeFlyby();
+    bool load(const char* fileName);
+
+    float getDuration() const { return _keyframes.empty() ? 0.0f : _keyframes.back().seconds; };
+
+    // where the camera is at seconds along the path, looping back to the start after the last keyframe
+    void getCamera(float seconds, glm::vec3& position, float& yaw) const;
+
+private:
+    void addKeyframe(float seconds, const glm::vec3& position, float yaw);
+
+    std::vector<CameraKeyframe> _keyframes;
+};
+
+CameraPath cameraPath;
+
+// the voxel servers the domain server has told us about, copied out of the AgentList for the client threads
+pthread_mutex_t voxelServersLock = PTHREAD_MUTEX_INITIALIZER;
+sockaddr voxelServers[MAX_VOXEL_SERVERS];
+int voxelServerCount = 0;
+
+// the first and the latest send stats each voxel server sent any of the clients, the difference being this test's
+pthread_mutex_t sendStatsLock = PTHREAD_MUTEX_INITIALIZER;
+sockaddr sendStatsServers[MAX_VOXEL_SERVERS];
+VoxelSendStats firstSendStats[MAX_VOXEL_SERVERS];
+VoxelSendStats latestSendStats[MAX_VOXEL_SERVERS];
+uint32_t maxIntervalUsecs[MAX_VOXEL_SERVERS];
+int sendStatsServerCount = 0;
+
+void CameraPath::addKeyframe(float seconds, const glm::vec3& position, float yaw) {
+    CameraKeyframe keyframe = { seconds, position, yaw };
+    _keyframes.push_back(keyframe);
+}
+
+// around the middle of the world, looking back at it, the last keyframe being the first one again
+void CameraPath::makeOrbit() {
+    _keyframes.clear();
+    glm::vec3 middle(TREE_SCALE / 2.0f, CAMERA_HEIGHT, TREE_SCALE / 2.0f);
+    for (int i = 0; i <= ORBIT_KEYFRAMES; i++) {
+        float angle = 2.0f * PIE * i / ORBIT_KEYFRAMES;
+        addKeyframe(ORBIT_PERIOD_SECONDS * i / ORBIT_KEYFRAMES,
+                    middle + glm::vec3(sinf(angle), 0.0f, cosf(angle)) * ORBIT_RADIUS, angle / PI_OVER_180);
+    }
+}
+
+// across the world along x, stopping at the far side, turning around, coming back and stopping again
+void CameraPath::makeFlyby() {
+    _keyframes.clear();
+    const float LOOKING_UP_X = -90.0f;
+    const float LOOKING_DOWN_X = 90.0f;
+    glm::vec3 near(TREE_SCALE * 0.1f, CAMERA_HEIGHT, TREE_SCALE / 2.0f);
+    glm::vec3 far(TREE_SCALE * 0.9f, CAMERA_HEIGHT, TREE_SCALE / 2.0f);
+    float seconds = 0.0f;
+    addKeyframe(seconds, near, LOOKING_UP_X);
+    addKeyframe(seconds += FLYBY_PAUSE_SECONDS, near, LOOKING_UP_X);
+    addKeyframe(seconds += FLYBY_SECONDS, far, LOOKING_UP_X);
+    addKeyframe(seconds += FLYBY_PAUSE_SECONDS, far, LOOKING_UP_X);
+    addKeyframe(seconds, far, LOOKING_DOWN_X);
+    addKeyframe(seconds += FLYBY_PAUSE_SECONDS, far, LOOKING_DOWN_X);
+    addKeyframe(seconds += FLYBY_SECONDS, near, LOOKING_DOWN_X);
+    addKeyframe(seconds += FLYBY_PAUSE_SECONDS, near, LOOKING_DOWN_X);
+}
+
+bool CameraPath::load(const char* fileName) {
+    FILE* file = fopen(fileName, "r");
+    if (!file) {
+        return false;
+    }
+    _keyframes.clear();
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        CameraKeyframe keyframe;
+        if (line[0] != '#' && sscanf(line, "%f %f %f %f %f", &keyframe.seconds, &keyframe.position.x,
+                                     &keyframe.position.y, &keyframe.position.z, &keyframe.yaw) == 5) {
+            if (!_keyframes.empty() && keyframe.seconds < _keyframes.back().seconds) {
+                printf("WARNING! keyframe at %.2f seconds comes before the one ahead of it, ignoring it\n",
+                       keyframe.seconds);
+                continue;
+            }
+            _keyframes.push_back(keyframe);
+        }
+    }
+    fclose(file);
+    return !_keyframes.empty();
+}
+
+void CameraPath::getCamera(float seconds, glm::vec3& position, float& yaw) const {
+    float duration = getDuration();
+    if (duration > 0.0f) {
+        seconds = fmodf(seconds, duration);
+    }
+    int keyframes = _keyframes.size();
+    int next = 1;
+    while (next < keyframes && _keyframes[next].seconds <= seconds) {
+        next++;
+    }
+    if (next == keyframes) {
+        position = _keyframes.back().position;
+        yaw = _keyframes.back().yaw;
+        return;
+    }
+    const CameraKeyframe& from = _keyframes[next - 1];
+    const CameraKeyframe& to = _keyframes[next];
+    float along = (seconds - from.seconds) / (to.seconds - from.seconds);
+    position = from.position + (to.position - from.position) * along;
+    yaw = from.yaw + (to.yaw - from.yaw) * along;
+}
+
+class LoadTestClient {
+public:
+    int index;
+    int clientCount;
+    UDPSocket* socket;
+    AvatarData avatar;
+    VoxelTree tree;
+    VoxelPacketDecoder decoder;
+    unsigned char decompressedPacket[MAX_DECOMPRESSED_VOXEL_PACKET_BYTES];
+
+    // a receive tracker for each voxel server we've heard from, so each can pace itself
+    sockaddr serverAddresses[MAX_VOXEL_SERVERS];
+    ReceiveTracker receiveTrackers[MAX_VOXEL_SERVERS];
+    int serverCount;
+
+    // counted by the client's thread, read by the main thread for the stats
+    volatile long packetsReceived;
+    volatile long bytesReceived;
+    volatile long voxelsColored;
+
+    // each time the camera comes to rest, how long until the voxels it can see stop arriving
+    glm::vec3 cameraPosition;
+    float cameraYaw;
+    long long restingSince;         // when the camera was last somewhere else
+    bool atRest;                    // hasn't moved since the last head data
+    long long lastNewVoxels;        // when a packet last added voxels to the tree
+    bool converged;                 // since the camera came to rest
+    long convergedCount;
+    long unconvergedCount;          // times the camera moved again before the voxels stopped
+    long long convergeUsecs;        // all of them added up
+    long long maxConvergeUsecs;
+};
+
+ReceiveTracker* receiveTrackerFor(LoadTestClient* client, sockaddr* senderAddress) {
+    for (int i = 0; i < client->serverCount; i++) {
+        if (socketMatch(&client->serverAddresses[i], senderAddress)) {
+            return &client->receiveTrackers[i];
+        }
+    }
+    if (client->serverCount == MAX_VOXEL_SERVERS) {
+        return NULL;
+    }
+    memcpy(&client->serverAddresses[client->serverCount], senderAddress, sizeof(sockaddr));
+    return &client->receiveTrackers[client->serverCount++];
+}
+
+// the client's camera follows the path, each client starting from a different place along it
+void moveCamera(LoadTestClient* client, long long now, long long start) {
+    float seconds = (float)client->index / client->clientCount * ::cameraPath.getDuration();
+    if (!::stillCameras) {
+        seconds += (now - start) / 1000000.0f;
+    }
+    glm::vec3 position;
+    float yaw;
+    ::cameraPath.getCamera(seconds, position, yaw);
+    if (!client->restingSince || position != client->cameraPosition || yaw != client->cameraYaw) {
+        if (client->atRest && !client->converged) {
+            client->unconvergedCount++;
+        }
+        client->cameraPosition = position;
+        client->cameraYaw = yaw;
+        client->restingSince = now;
+        client->atRest = false;
+        client->converged = false;
+    } else {
+        client->atRest = true;
+    }
+
+    // the camera's front being -z
+    client->avatar.setPosition(position);
+    client->avatar.setCameraPosition(position);
+    client->avatar.setCameraOrientation(glm::angleAxis(yaw, glm::vec3(0.0f, 1.0f, 0.0f)));
+}
+
+// whether the voxels the camera can see have stopped arriving, once we've heard from a voxel server at all
+void checkConverged(LoadTestClient* client, long long now) {
+    if (!client->atRest || client->converged || client->serverCount == 0 ||
+            now - std::max(client->restingSince, client->lastNewVoxels) < CONVERGED_QUIET_USECS) {
+        return;
+    }
+    long long convergeUsecs = std::max(client->lastNewVoxels - client->restingSince, 0LL);
+    client->converged = true;
+    client->convergedCount++;
+    client->convergeUsecs += convergeUsecs;
+    client->maxConvergeUsecs = std::max(client->maxConvergeUsecs, convergeUsecs);
+}
+
+void sendHeadData(LoadTestClient* client) {
+    unsigned char packet[MAX_PACKET_SIZE];
+    unsigned char* packetEnd = packet;
+    *(packetEnd++) = PACKET_HEADER_HEAD_DATA;
+    packetEnd += packAgentId(packetEnd, client->index);
+    packetEnd += client->avatar.getBroadcastData(packetEnd);
+
+    pthread_mutex_lock(&::voxelServersLock);
+    for (int i = 0; i < ::voxelServerCount; i++) {
+        client->socket->send(&::voxelServers[i], packet, packetEnd - packet);
+    }
+    pthread_mutex_unlock(&::voxelServersLock);
+}
+
+void sendReceiveReports(LoadTestClient* client, long long now) {
+    unsigned char reportPacket[ReceiveReport::PACKED_BYTES];
+    for (int i = 0; i < client->serverCount; i++) {
+        ReceiveReport report;
+        if (client->receiveTrackers[i].makeReport(report, now)) {
+            int reportBytes = report.pack(reportPacket);
+            client->socket->send(&client->serverAddresses[i], reportPacket, reportBytes);
+        }
+    }
+}
+
+void processSendStats(sockaddr* senderAddress, unsigned char* packet, int bytes) {
+    VoxelSendStats sendStats;
+    if (!sendStats.unpack(packet, bytes)) {
+        return;
+    }
+    pthread_mutex_lock(&::sendStatsLock);
+    int server = 0;
+    while (server < ::sendStatsServerCount && !socketMatch(&::sendStatsServers[server], senderAddress)) {
+        server++;
+    }
+    if (server == ::sendStatsServerCount && server < MAX_VOXEL_SERVERS) {
+        memcpy(&::sendStatsServers[server], senderAddress, sizeof(sockaddr));
+        ::firstSendStats[server] = ::latestSendStats[server] = sendStats;
+        ::maxIntervalUsecs[server] = 0; // for intervals that may have been before the test
+        ::sendStatsServerCount++;
+    } else if (server < ::sendStatsServerCount && sendStats.intervals > ::latestSendStats[server].intervals) {
+        ::latestSendStats[server] = sendStats; // every client hears it, some of them late
+        ::maxIntervalUsecs[server] = std::max(::maxIntervalUsecs[server], sendStats.maxIntervalUsecs);
+    }
+    pthread_mutex_unlock(&::sendStatsLock);
+}
+
+void processVoxelPacket(LoadTestClient* client, sockaddr* senderAddress, unsigned char* packet, int bytes) {
+    unsigned char command = packet[0];
+    if (command == PACKET_HEADER_VOXEL_SEND_STATS) {
+        processSendStats(senderAddress, packet, bytes);
+        return;
+    }
+    if (command != PACKET_HEADER_VOXEL_DATA && command != PACKET_HEADER_VOXEL_DATA_MONOCHROME &&
+        command != PACKET_HEADER_VOXEL_DATA_COMPRESSED && command != PACKET_HEADER_VOXEL_DATA_MONOCHROME_COMPRESSED) {
+        return;
+    }
+    ReceiveTracker* receiveTracker = receiveTrackerFor(client, senderAddress);
+    if (receiveTracker) {
+        receiveTracker->packetReceived(packet + 1, bytes, usecTimestampNow());
+    }
+    client->packetsReceived++;
+    client->bytesReceived += bytes;
+
+    unsigned char* voxelData = packet + VOXEL_PACKET_HEADER_BYTES;
+    int voxelBytes = bytes - VOXEL_PACKET_HEADER_BYTES;
+    bool includeColor = (command == PACKET_HEADER_VOXEL_DATA || command == PACKET_HEADER_VOXEL_DATA_COMPRESSED);
+    if (command == PACKET_HEADER_VOXEL_DATA_COMPRESSED || command == PACKET_HEADER_VOXEL_DATA_MONOCHROME_COMPRESSED) {
+        voxelBytes = client->decoder.decode(voxelData, voxelBytes, includeColor, WANT_EXISTS_BITS,
+                                            client->decompressedPacket, sizeof(client->decompressedPacket));
+        voxelData = client->decompressedPacket;
+    }
+    if (voxelBytes > 0) {
+        long voxelsCreated = client->tree.voxelsCreated;
+        client->tree.readBitstreamToTree(voxelData, voxelBytes, includeColor, WANT_EXISTS_BITS);
+        client->voxelsColored = client->tree.voxelsColored;
+        if (client->tree.voxelsCreated != voxelsCreated) {
+            client->lastNewVoxels = usecTimestampNow();
+        }
+    }
+}
+
+void* runClient(void* args) {
+    LoadTestClient* client = (LoadTestClient*)args;
+    client->socket->setBlocking(false);
+
+    sockaddr senderAddress;
+    unsigned char packet[MAX_PACKET_SIZE];
+    ssize_t receivedBytes;
+    long long lastHeadDataSent = 0;
+    long long lastReportsSent = 0;
+    long long start = usecTimestampNow();
+
+    while (!::stopClients) {
+        long long now = usecTimestampNow();
+        if (now - lastHeadDataSent >= HEAD_DATA_SEND_INTERVAL_USECS) {
+            lastHeadDataSent = now;
+            moveCamera(client, now, start);
+            sendHeadData(client);
+        }
+        if (now - lastReportsSent >= RECEIVE_REPORT_SEND_INTERVAL_USECS) {
+            lastReportsSent = now;
+            sendReceiveReports(client, now);
+        }
+
+        bool anyReceived = false;
+        while (client->socket->receive(&senderAddress, packet, &receivedBytes)) {
+            processVoxelPacket(client, &senderAddress, packet, receivedBytes);
+            anyReceived = true;
+        }
+        checkConverged(client, usecTimestampNow());
+        if (!anyReceived) {
+            usleep(IDLE_SLEEP_USECS);
+        }
+    }
+
+    pthread_exit(0);
+    return NULL;
+}
+
+void copyVoxelServers() {
+    AgentList* agentList = AgentList::getInstance();
+    pthread_mutex_lock(&::voxelServersLock);
+    ::voxelServerCount = 0;
+    for (AgentList::iterator agent = agentList->begin(); agent != agentList->end(); agent++) {
+        if (agent->getType() == AGENT_TYPE_VOXEL_SERVER && agent->getActiveSocket() &&
+            ::voxelServerCount < MAX_VOXEL_SERVERS) {
+            memcpy(&::voxelServers[::voxelServerCount++], agent->getActiveSocket(), sizeof(sockaddr));
+        }
+    }
+    pthread_mutex_unlock(&::voxelServersLock);
+}
+
+// the send interval overruns all the voxel servers have told us about during the test
+long sendIntervalOverruns() {
+    long overruns = 0;
+    pthread_mutex_lock(&::sendStatsLock);
+    for (int i = 0; i < ::sendStatsServerCount; i++) {
+        overruns += ::latestSendStats[i].overruns - ::firstSendStats[i].overruns;
+    }
+    pthread_mutex_unlock(&::sendStatsLock);
+    return overruns;
+}
+
+void printStats(LoadTestClient* clients, int clientCount, float seconds, long totalPackets, long totalBytes) {
+    long voxels = 0;
+    for (int i = 0; i < clientCount; i++) {
+        voxels += clients[i].voxelsColored;
+    }
+    printf("%5.1fs %d voxel servers, %d clients: %8.0f packets/sec %10.0f bytes/sec, %ld voxels colored, "
+           "%ld send interval overruns\n", seconds, ::voxelServerCount, clientCount, totalPackets / seconds,
+           totalBytes / seconds, voxels, sendIntervalOverruns());
+}
+
+void printClientStats(LoadTestClient& client, float seconds) {
+    printf("client %d: %.0f packets/sec %.0f bytes/sec, %ld voxels in its tree, ", client.index,
+           client.packetsReceived / seconds, client.bytesReceived / seconds, client.tree.getVoxelCount());
+    if (client.convergedCount) {
+        printf("converged %ld of %ld times at rest in %.2f secs on average (max %.2f secs)\n", client.convergedCount,
+               client.convergedCount + client.unconvergedCount + (client.atRest && !client.converged ? 1 : 0),
+               client.convergeUsecs / 1000000.0f / client.convergedCount, client.maxConvergeUsecs / 1000000.0f);
+    } else {
+        printf("never converged\n");
+    }
+}
+
+void printSendStats() {
+    pthread_mutex_lock(&::sendStatsLock);
+    for (int i = 0; i < ::sendStatsServerCount; i++) {
+        sockaddr_in* address = (sockaddr_in*)&::sendStatsServers[i];
+        uint32_t intervals = ::latestSendStats[i].intervals - ::firstSendStats[i].intervals;
+        uint32_t overruns = ::latestSendStats[i].overruns - ::firstSendStats[i].overruns;
+        printf("voxel server %s:%d: %u send intervals, %u overran (%.1f%%), longest %u usecs, serving %u agents\n",
+               inet_ntoa(address->sin_addr), ntohs(address->sin_port), intervals, overruns,
+               intervals ? overruns * 100.0f / intervals : 0.0f, ::maxIntervalUsecs[i],
+               ::latestSendStats[i].agents);
+    }
+    pthread_mutex_unlock(&::sendStatsLock);
+}
+
+int main(int argc, const char * argv[]) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    const char* CLIENTS = "--clients";
+    const char* clientsOption = getCmdOption(argc, argv, CLIENTS);
+    int clientCount = clientsOption ? atoi(clientsOption) : DEFAULT_CLIENTS;
+
+    const char* SECONDS = "--seconds";
+    const char* secondsOption = getCmdOption(argc, argv, SECONDS);
+    ::testSeconds = secondsOption ? atoi(secondsOption) : DEFAULT_SECONDS;
+
+    const char* NO_COLOR_OPTION = "--NoColor";
+    ::wantColor = !cmdOptionExists(argc, argv, NO_COLOR_OPTION);
+
+    const char* WANT_DELTA_OPTION = "--wantDelta";
+    ::wantDelta = cmdOptionExists(argc, argv, WANT_DELTA_OPTION);
+
+    const char* WANT_OCCLUSION_CULLING_OPTION = "--wantOcclusionCulling";
+    ::wantOcclusionCulling = cmdOptionExists(argc, argv, WANT_OCCLUSION_CULLING_OPTION);
+
+    const char* WANT_COMPRESSION = "--wantCompression";
+    ::wantCompression = cmdOptionExists(argc, argv, WANT_COMPRESSION);
+
+    const char* PORT = "--port";
+    const char* portOption = getCmdOption(argc, argv, PORT);
+    int listenPort = portOption ? atoi(portOption) : LOAD_TESTER_LISTEN_PORT;
+
+    const char* PATH = "--path";
+    const char* pathOption = getCmdOption(argc, argv, PATH);
+    if (!pathOption || strcmp(pathOption, "orbit") == 0) {
+        ::cameraPath.makeOrbit();
+    } else if (strcmp(pathOption, "flyby") == 0) {
+        ::cameraPath.makeFlyby();
+    } else if (strcmp(pathOption, "still") == 0) {
+        ::cameraPath.makeOrbit();
+        ::stillCameras = true;
+    } else if (!::cameraPath.load(pathOption)) {
+        printf("Unable to read camera path %s\n", pathOption);
+        return 1;
+    }
+    printf("path=%s wantColor=%s wantDelta=%s wantOcclusionCulling=%s wantCompression=%s\n",
+           pathOption ? pathOption : "orbit", debug::valueOf(::wantColor), debug::valueOf(::wantDelta),
+           debug::valueOf(::wantOcclusionCulling), debug::valueOf(::wantCompression));
+
+    // Handle Local Domain testing with the --local command line
+    const char* local = "--local";
+    ::wantLocalDomain = cmdOptionExists(argc, argv, local);
+    if (::wantLocalDomain) {
+        printf("Local Domain MODE!\n");
+        int ip = getLocalAddress();
+        sprintf(DOMAIN_IP,"%d.%d.%d.%d", (ip & 0xFF), ((ip >> 8) & 0xFF),((ip >> 16) & 0xFF), ((ip >> 24) & 0xFF));
+    }
+
+    // the agent list is just for hearing about the voxel servers from the domain server, the clients have their own
+    AgentList* agentList = AgentList::createInstance(AGENT_TYPE_AVATAR, listenPort);
+    agentList->setAgentTypesOfInterest(&AGENT_TYPE_VOXEL_SERVER, 1);
+    agentList->startSilentAgentRemovalThread();
+    agentList->startPingUnknownAgentsThread();
+
+    LoadTestClient* clients = new LoadTestClient[clientCount];
+    for (int i = 0; i < clientCount; i++) {
+        LoadTestClient& client = clients[i];
+        client.index = i;
+        client.clientCount = clientCount;
+        client.socket = new UDPSocket(0);
+        client.serverCount = 0;
+        client.packetsReceived = client.bytesReceived = client.voxelsColored = 0;
+        client.cameraYaw = 0.0f;
+        client.restingSince = client.lastNewVoxels = 0;
+        client.atRest = client.converged = false;
+        client.convergedCount = client.unconvergedCount = 0;
+        client.convergeUsecs = client.maxConvergeUsecs = 0;
+        client.avatar.setWantColor(::wantColor);
+        client.avatar.setWantDelta(::wantDelta);
+        client.avatar.setWantOcclusionCulling(::wantOcclusionCulling);
+        client.avatar.setWantCompression(::wantCompression);
+        client.avatar.setCameraFov(CAMERA_FIELD_OF_VIEW);
+        client.avatar.setCameraAspectRatio(CAMERA_ASPECT_RATIO);
+        client.avatar.setCameraNearClip(CAMERA_NEAR_CLIP);
+        client.avatar.setCameraFarClip(CAMERA_FAR_CLIP);
+    }
+
+    pthread_t* clientThreads = new pthread_t[clientCount];
+    for (int i = 0; i < clientCount; i++) {
+        pthread_create(&clientThreads[i], NULL, runClient, &clients[i]);
+    }
+
+    sockaddr senderAddress;
+    unsigned char packetData[MAX_PACKET_SIZE];
+    ssize_t receivedBytes;
+    timeval lastDomainServerCheckIn = {};
+
+    long long start = usecTimestampNow();
+    long long lastStats = start;
+    long lastPackets = 0;
+    long lastBytes = 0;
+    while (usecTimestampNow() - start < ::testSeconds * 1000000LL) {
+        // send a check in packet to the domain server if DOMAIN_SERVER_CHECK_IN_USECS has elapsed
+        if (usecTimestampNow() - usecTimestamp(&lastDomainServerCheckIn) >= DOMAIN_SERVER_CHECK_IN_USECS) {
+            gettimeofday(&lastDomainServerCheckIn, NULL);
+            agentList->sendDomainServerCheckIn();
+        }
+        if (agentList->getAgentSocket()->receive(&senderAddress, packetData, &receivedBytes)) {
+            agentList->processAgentData(&senderAddress, packetData, receivedBytes);
+        }
+        copyVoxelServers();
+
+        long long now = usecTimestampNow();
+        if (now - lastStats >= STATS_INTERVAL_USECS) {
+            long packets = 0;
+            long bytes = 0;
+            for (int i = 0; i < clientCount; i++) {
+                packets += clients[i].packetsReceived;
+                bytes += clients[i].bytesReceived;
+            }
+            printStats(clients, clientCount, (now - lastStats) / 1000000.0f, packets - lastPackets, bytes - lastBytes);
+            lastStats = now;
+            lastPackets = packets;
+            lastBytes = bytes;
+        }
+    }
+
+    ::stopClients = true;
+    for (int i = 0; i < clientCount; i++) {
+        pthread_join(clientThreads[i], NULL);
+    }
+
+    // the whole run
+    long packets = 0;
+    long bytes = 0;
+    for (int i = 0; i < clientCount; i++) {
+        packets += clients[i].packetsReceived;
+        bytes += clients[i].bytesReceived;
+    }
+    float seconds = (usecTimestampNow() - start) / 1000000.0f;
+    printf("total: ");
+    printStats(clients, clientCount, seconds, packets, bytes);
+    for (int i = 0; i < clientCount; i++) {
+        printClientStats(clients[i], seconds);
+    }
+    printSendStats();
+
+    for (int i = 0; i < clientCount; i++) {
+        delete clients[i].socket;
+    }
+    delete[] clientThreads;
+    delete[] clients;
+    return 0;
+}
@@ -0,0 +1,236 @@
+//
+//  EncodedSubtreeCache.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <OctalCode.h>
+#include "EncodedSubtreeCache.h"
+
+// Distances are measured to the box here, but the encoder measures to each node's center, so a boundary has to be
+// a little clear of the subtree before we trust that every node in it lands on the same side
+const float LOD_BOUNDARY_MARGIN = 0.001f;
+
+const int NOT_CACHED = -1;
+
+const unsigned char COLOR_FLAG = 1;
+const unsigned char EXISTS_BITS_FLAG = 2;
+
+EncodedSubtreeCache::EncodedSubtreeCache(int slotCount, long bufferBytes) :
+    _entries(new Entry[slotCount]),
+    _slotCount(slotCount),
+    _stripeBufferBytes(std::max(bufferBytes / LOCK_STRIPES, (long)(MAX_VOXEL_PACKET_SIZE +
+                                                                   MAX_LEFTOVER_NODES * sizeof(VoxelNode*))))
+{
+    for (int i = 0; i < _slotCount; i++) {
+        _entries[i].node = NULL;
+    }
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        pthread_mutex_init(&_stripes[i].mutex, NULL);
+        _stripes[i].buffer = new unsigned char[_stripeBufferBytes];
+        _stripes[i].written = 0;
+    }
+    resetStats();
+}
+
+EncodedSubtreeCache::~EncodedSubtreeCache() {
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        pthread_mutex_destroy(&_stripes[i].mutex);
+        delete[] _stripes[i].buffer;
+    }
+    delete[] _entries;
+}
+
+unsigned char EncodedSubtreeCache::flagsFor(const EncodeBitstreamParams& params) {
+    return (params.includeColor ? COLOR_FLAG : 0) | (params.includeExistsBits ? EXISTS_BITS_FLAG : 0);
+}
+
+int EncodedSubtreeCache::slotFor(VoxelNode* node, int lodLevel, unsigned char flags) const {
+    // nodes come from pools, so the low bits of their addresses don't say much, mix them all in
+    unsigned long long key = (unsigned long long)(size_t)node ^ ((unsigned long long)lodLevel << 56) ^
+                             ((unsigned long long)flags << 48);
+    key *= 0x9E3779B97F4A7C15ULL;
+    return (int)((key >> 32) % _slotCount);
+}
+
+int EncodedSubtreeCache::countUncacheable(VoxelNode* node) {
+    Stripe& stripe = stripeFor(slotFor(node, 0, 0));
+    pthread_mutex_lock(&stripe.mutex);
+    stripe.uncacheable++;
+    pthread_mutex_unlock(&stripe.mutex);
+    return NOT_CACHEABLE;
+}
+
+int EncodedSubtreeCache::lodLevelFor(VoxelNode* node, const EncodeBitstreamParams& params) {
+    // An incremental pass leaves out the children that haven't changed since the agent's last pass, so its encoding of
+    // a subtree is only the same as a full pass's if everything in the subtree has changed since then, which we can't
+    // tell without walking it. And the subtrees it bags have all changed since then, or the encoder wouldn't have put
+    // them in the packet, so there's no unchanged case to share either. Only full passes use the cache.
+    if (!params.viewFrustum || params.wantOcclusionCulling || params.deltaViewFrustum ||
+        params.lastSentTime != IGNORE_LAST_SENT_TIME || params.chopLevels || params.maxEncodeLevel != INT_MAX) {
+        return countUncacheable(node);
+    }
+    int lodLevel = NOT_CACHEABLE;
+    AABox box = node->getAABox();
+    box.scale(TREE_SCALE);
+    if (params.viewFrustum->boxInFrustum(box) == ViewFrustum::INSIDE) {
+        // how close and how far away any part of the subtree is
+        const glm::vec3& position = params.viewFrustum->getPosition();
+        glm::vec3 boxMinimum = box.getCorner();
+        glm::vec3 boxMaximum = box.getCorner() + box.getSize();
+        glm::vec3 toClosest = glm::clamp(position, boxMinimum, boxMaximum) - position;
+        glm::vec3 toFarthest = glm::max(glm::abs(boxMinimum - position), glm::abs(boxMaximum - position));
+        float closest = glm::length(toClosest) * (1.0f - LOD_BOUNDARY_MARGIN);
+        float farthest = glm::length(toFarthest) * (1.0f + LOD_BOUNDARY_MARGIN);
+
+        // the encoder keeps a node if it's closer than the boundary for its level, and the boundaries shrink as we go
+        // down, so we're looking for the first level whose boundary is closer than all of the subtree
+        for (int level = *node->getOctalCode(); ; level++) {
+            float boundaryDistance = boundaryDistanceForRenderLevel(level + 1);
+            if (boundaryDistance <= closest) {
+                lodLevel = level;
+                break;
+            } else if (boundaryDistance < farthest) {
+                break; // the boundary goes through the subtree
+            }
+        }
+    }
+    return lodLevel == NOT_CACHEABLE ? countUncacheable(node) : lodLevel;
+}
+
+int EncodedSubtreeCache::encodeTreeBitstream(VoxelTree& tree, VoxelNode* node, int lodLevel, unsigned char* outputBuffer,
+                                             VoxelNodeBag& bag, EncodeBitstreamParams& params) {
+    unsigned char flags = flagsFor(params);
+    int bytes = find(node, lodLevel, flags, outputBuffer, bag);
+    if (bytes != NOT_CACHED) {
+        return bytes;
+    }
+
+    // the encoding is the same for everyone, but what it leaves for the next packet isn't, so the encoder gets a bag of
+    // its own. Caller holds the tree's read lock, so anything that changes node after this will be newer than encodedAt
+    long long encodedAt = usecTimestampNow();
+    VoxelNodeBag leftoverBag;
+    bytes = tree.encodeTreeBitstream(node, outputBuffer, MAX_VOXEL_PACKET_DATA_BYTES, leftoverBag, params);
+
+    // the leftover bag gives them back last in first out, so put them in ours backwards
+    int leftoverCount = leftoverBag.count();
+    VoxelNode* leftovers[MAX_LEFTOVER_NODES];
+    for (int i = leftoverCount - 1; i >= 0; i--) {
+        VoxelNode* leftover = leftoverBag.extract();
+        if (i < MAX_LEFTOVER_NODES) {
+            leftovers[i] = leftover;
+        } else {
+            bag.insert(leftover); // too many to cache, and the order doesn't matter much any more
+        }
+    }
+    for (int i = 0; i < leftoverCount && i < MAX_LEFTOVER_NODES; i++) {
+        bag.insert(leftovers[i]);
+    }
+    if (leftoverCount <= MAX_LEFTOVER_NODES) {
+        store(node, lodLevel, flags, encodedAt, outputBuffer, bytes, leftovers, leftoverCount);
+    }
+    return bytes;
+}
+
+int EncodedSubtreeCache::find(VoxelNode* node, int lodLevel, unsigned char flags, unsigned char* outputBuffer,
+                              VoxelNodeBag& bag) {
+    int slot = slotFor(node, lodLevel, flags);
+    Stripe& stripe = stripeFor(slot);
+    const Entry& entry = _entries[slot];
+    int bytes = NOT_CACHED;
+
+    pthread_mutex_lock(&stripe.mutex);
+    if (entry.node == node && entry.lodLevel == lodLevel && entry.flags == flags &&
+        stripe.written - entry.position <= _stripeBufferBytes && !node->hasChangedSince(entry.encodedAt)) {
+        const unsigned char* cached = stripe.buffer + entry.position % _stripeBufferBytes;
+        memcpy(outputBuffer, cached, entry.bytes);
+        bytes = entry.bytes;
+        for (int i = 0; i < entry.leftoverCount; i++) {
+            VoxelNode* leftover;
+            memcpy(&leftover, cached + bytes + i * sizeof(VoxelNode*), sizeof(VoxelNode*)); // may not be aligned
+            bag.insert(leftover);
+        }
+        stripe.hits++;
+        stripe.bytesFromCache += bytes;
+    } else {
+        stripe.misses++;
+    }
+    pthread_mutex_unlock(&stripe.mutex);
+    return bytes;
+}
+
+void EncodedSubtreeCache::store(VoxelNode* node, int lodLevel, unsigned char flags, long long encodedAt,
+                                const unsigned char* encoded, int bytes, VoxelNode** leftovers, int leftoverCount) {
+    int slot = slotFor(node, lodLevel, flags);
+    Stripe& stripe = stripeFor(slot);
+    Entry& entry = _entries[slot];
+    int leftoverBytes = leftoverCount * sizeof(VoxelNode*);
+
+    pthread_mutex_lock(&stripe.mutex);
+
+    // entries never wrap around the end of the ring buffer, if it doesn't fit we skip ahead to the start
+    long long position = stripe.written;
+    long offset = position % _stripeBufferBytes;
+    if (offset + bytes + leftoverBytes > _stripeBufferBytes) {
+        position += _stripeBufferBytes - offset;
+        offset = 0;
+    }
+    memcpy(stripe.buffer + offset, encoded, bytes);
+    memcpy(stripe.buffer + offset + bytes, leftovers, leftoverBytes);
+    stripe.written = position + bytes + leftoverBytes;
+
+    entry.node = node;
+    entry.lodLevel = lodLevel;
+    entry.flags = flags;
+    entry.encodedAt = encodedAt;
+    entry.position = position;
+    entry.bytes = bytes;
+    entry.leftoverCount = leftoverCount;
+    pthread_mutex_unlock(&stripe.mutex);
+}
+
+long EncodedSubtreeCache::getHits() const {
+    long hits = 0;
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        hits += _stripes[i].hits;
+    }
+    return hits;
+}
+
+long EncodedSubtreeCache::getMisses() const {
+    long misses = 0;
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        misses += _stripes[i].misses;
+    }
+    return misses;
+}
+
+long EncodedSubtreeCache::getUncacheable() const {
+    long uncacheable = 0;
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        uncacheable += _stripes[i].uncacheable;
+    }
+    return uncacheable;
+}
+
+long EncodedSubtreeCache::getBytesFromCache() const {
+    long bytes = 0;
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        bytes += _stripes[i].bytesFromCache;
+    }
+    return bytes;
+}
+
+void EncodedSubtreeCache::resetStats() {
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        _stripes[i].hits = 0;
+        _stripes[i].misses = 0;
+        _stripes[i].uncacheable = 0;
+        _stripes[i].bytesFromCache = 0;
+    }
+}
@@ -0,0 +1,100 @@
+//
+//  EncodedSubtreeCache.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Encoded subtrees shared by all the agents the server is sending to. When a subtree is entirely in an agent's view,
+//  and no LOD boundary falls inside it, the encoder writes the same bytes for every view that cuts it off at the same
+//  level, so agents standing near each other can reuse each other's encodings instead of walking the tree again.
+//
+//  Only full passes, the first in a view, use the cache: an incremental pass leaves out what each agent's client
+//  already has, so its encodings aren't anybody else's.
+//
+//  Entries are keyed by node, the level the subtree is cut off at, and the params that change the encoding (color
+//  and exists bits). An entry is only used while its node hasn't changed since it was encoded, see
+//  VoxelNode::hasChangedSince(). Everything is allocated up front: a table of slots, where a new entry replaces whatever
+//  was in its slot, and ring buffers the encodings are written into one after another, where new encodings overwrite
+//  the oldest ones. The slots and ring buffers are split into stripes with a lock each, so the distributor threads
+//  rarely wait on each other.
+//
+
+#ifndef __hifi__EncodedSubtreeCache__
+#define __hifi__EncodedSubtreeCache__
+
+#include <pthread.h>
+#include <VoxelConstants.h>
+#include <VoxelTree.h>
+
+class EncodedSubtreeCache {
+public:
+    static const int NOT_CACHEABLE = -1;
+
+    EncodedSubtreeCache(int slotCount, long bufferBytes);
+    ~EncodedSubtreeCache();
+
+    // the level at which encoding node with these params stops, which is the same for every view that has the whole
+    // subtree inside it and doesn't have an LOD boundary crossing it. NOT_CACHEABLE if that isn't the case, or the
+    // params depend on the agent in other ways (occlusion culling, deltas or incremental sending). Every NOT_CACHEABLE
+    // counts toward getUncacheable()
+    int lodLevelFor(VoxelNode* node, const EncodeBitstreamParams& params);
+
+    // encodeTreeBitstream() with a whole packet's worth of space, for a subtree lodLevelFor() said could be cached.
+    // Uses the cached encoding if there is one, otherwise encodes it and caches the result. Either way the nodes the
+    // encoder left for the next packet are put into bag, in the order the encoder would have put them there
+    int encodeTreeBitstream(VoxelTree& tree, VoxelNode* node, int lodLevel, unsigned char* outputBuffer,
+                            VoxelNodeBag& bag, EncodeBitstreamParams& params);
+
+    // stats, summed over the stripes. Uncacheable counts the subtrees lodLevelFor() turned down, the rest are either
+    // hits or misses
+    long getHits() const;
+    long getMisses() const;
+    long getUncacheable() const;
+    long getBytesFromCache() const;
+    void resetStats();
+
+private:
+    // disallow copying of EncodedSubtreeCache objects
+    EncodedSubtreeCache(const EncodedSubtreeCache&);
+    EncodedSubtreeCache& operator= (const EncodedSubtreeCache&);
+
+    static const int LOCK_STRIPES = 64;
+    static const int MAX_LEFTOVER_NODES = 64;
+
+    class Entry {
+    public:
+        VoxelNode*      node;
+        int             lodLevel;
+        unsigned char   flags;
+        long long       encodedAt;
+        long long       position;       // in the stripe's ring buffer, the encoding followed by the leftovers
+        int             bytes;
+        int             leftoverCount;  // nodes the encoding left for the next packet
+    };
+
+    class Stripe {
+    public:
+        pthread_mutex_t mutex;
+        unsigned char*  buffer;
+        long long       written;        // total bytes ever written to buffer, so positions don't repeat
+        long            hits;
+        long            misses;
+        long            uncacheable;
+        long            bytesFromCache;
+    };
+
+    static unsigned char flagsFor(const EncodeBitstreamParams& params);
+    int countUncacheable(VoxelNode* node); // returns NOT_CACHEABLE
+    int find(VoxelNode* node, int lodLevel, unsigned char flags, unsigned char* outputBuffer, VoxelNodeBag& bag);
+    void store(VoxelNode* node, int lodLevel, unsigned char flags, long long encodedAt,
+               const unsigned char* encoded, int bytes, VoxelNode** leftovers, int leftoverCount);
+    int slotFor(VoxelNode* node, int lodLevel, unsigned char flags) const;
+    Stripe& stripeFor(int slot) { return _stripes[slot % LOCK_STRIPES]; };
+
+    Entry*  _entries;
+    int     _slotCount;
+    long    _stripeBufferBytes;
+    Stripe  _stripes[LOCK_STRIPES];
+};
+
+#endif /* defined(__hifi__EncodedSubtreeCache__) */
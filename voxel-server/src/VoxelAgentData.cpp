@@ -7,40 +7,91 @@
 //
 
 #include "PacketHeaders.h"
+#include "SharedUtil.h"
 #include "VoxelAgentData.h"
+#include "VoxelTree.h"
 #include <cstring>
 #include <cstdio>
+#include <cfloat>
+#include <algorithm>
 
-VoxelAgentData::VoxelAgentData(Agent* owningAgent) :
+// the slowest we'll go is a packet per send interval, and we won't go faster than this many times the starting rate
+const float MIN_BYTES_PER_SECOND = MAX_VOXEL_PACKET_SIZE * 10.0f;
+const float MAX_RATE_MULTIPLE = 16.0f;
+
+VoxelAgentData::VoxelAgentData(Agent* owningAgent, float bytesPerSecond) :
     AvatarData(owningAgent),
     _viewSent(false),
     _voxelPacketAvailableBytes(MAX_VOXEL_PACKET_SIZE),
     _maxSearchLevel(1),
-    _maxLevelReachedInLastSearch(1)
+    _maxLevelReachedInLastSearch(1),
+    _viewChangedAt(usecTimestampNow()),
+    _usefulViewSent(false),
+    _timeToUsefulViewStats(10),
+    _passStartedAt(0),
+    _lastSentTime(0),
+    _distributeUsecs(0),
+    _pacer(bytesPerSecond, std::min(MIN_BYTES_PER_SECOND, bytesPerSecond), bytesPerSecond * MAX_RATE_MULTIPLE),
+    _egressShare(FLT_MAX)
 {
     _voxelPacket = new unsigned char[MAX_VOXEL_PACKET_SIZE];
     _voxelPacketAt = _voxelPacket;
+    _outputBuffer = new unsigned char[MAX_VOXEL_PACKET_SIZE];
+    _packetEncoder = new VoxelPacketEncoder(&_voxelPacket[VOXEL_PACKET_HEADER_BYTES], MAX_VOXEL_PACKET_DATA_BYTES);
     
     resetVoxelPacket();
 }
 
 
 void VoxelAgentData::resetVoxelPacket() {
-    _voxelPacket[0] = getWantColor() ? PACKET_HEADER_VOXEL_DATA : PACKET_HEADER_VOXEL_DATA_MONOCHROME;
-    _voxelPacketAt = &_voxelPacket[1];
-    _voxelPacketAvailableBytes = MAX_VOXEL_PACKET_SIZE - 1;
+    _voxelPacketCompressed = getWantCompression();
+    if (_voxelPacketCompressed) {
+        _voxelPacket[0] = getWantColor() ? PACKET_HEADER_VOXEL_DATA_COMPRESSED
+                                         : PACKET_HEADER_VOXEL_DATA_MONOCHROME_COMPRESSED;
+        _packetEncoder->reset(getWantColor(), WANT_EXISTS_BITS);
+    } else {
+        _voxelPacket[0] = getWantColor() ? PACKET_HEADER_VOXEL_DATA : PACKET_HEADER_VOXEL_DATA_MONOCHROME;
+    }
+    _voxelPacketAt = &_voxelPacket[VOXEL_PACKET_HEADER_BYTES];
+    _voxelPacketAvailableBytes = MAX_VOXEL_PACKET_DATA_BYTES;
     _voxelPacketWaiting = false;
 }
 
-void VoxelAgentData::writeToPacket(unsigned char* buffer, int bytes) {
+bool VoxelAgentData::writeToPacket(unsigned char* buffer, int bytes) {
+    if (_voxelPacketCompressed) {
+        if (_packetEncoder->append(buffer, bytes)) {
+            _voxelPacketWaiting = true;
+            return true;
+        }
+        if (_voxelPacketWaiting) {
+            return false;
+        }
+        // this won't fit in a compressed packet even by itself, so this packet goes out the way it is
+        _voxelPacketCompressed = false;
+        bool includeColor = (_voxelPacket[0] == PACKET_HEADER_VOXEL_DATA_COMPRESSED);
+        _voxelPacket[0] = includeColor ? PACKET_HEADER_VOXEL_DATA : PACKET_HEADER_VOXEL_DATA_MONOCHROME;
+    }
+    if (bytes > _voxelPacketAvailableBytes) {
+        return false;
+    }
     memcpy(_voxelPacketAt, buffer, bytes);
     _voxelPacketAvailableBytes -= bytes;
     _voxelPacketAt += bytes;
     _voxelPacketWaiting = true;
+    return true;
+}
+
+int VoxelAgentData::finishPacket() {
+    if (_voxelPacketCompressed) {
+        return VOXEL_PACKET_HEADER_BYTES + _packetEncoder->finish();
+    }
+    return MAX_VOXEL_PACKET_SIZE - _voxelPacketAvailableBytes;
 }
 
 VoxelAgentData::~VoxelAgentData() {
     delete[] _voxelPacket;
+    delete[] _outputBuffer;
+    delete _packetEncoder;
 }
 
 bool VoxelAgentData::updateCurrentViewFrustum() {
@@ -65,6 +116,21 @@ bool VoxelAgentData::updateCurrentViewFrustum() {
     return currentViewFrustumChanged;
 }
 
+void VoxelAgentData::viewChanged() {
+    _viewChangedAt = usecTimestampNow();
+    _usefulViewSent = false;
+
+    // what the client has was chosen for the old view, so the next pass needs to send everything in the new one
+    _lastSentTime = 0;
+}
+
+long long VoxelAgentData::usefulViewSent() {
+    long long usecsSinceViewChanged = usecTimestampNow() - _viewChangedAt;
+    _usefulViewSent = true;
+    _timeToUsefulViewStats.updateAverage(usecsSinceViewChanged);
+    return usecsSinceViewChanged;
+}
+
 void VoxelAgentData::updateLastKnownViewFrustum() {
     bool frustumChanges = !_lastKnownViewFrustum.matches(_currentViewFrustum);
     
@@ -12,23 +12,32 @@
 #include <iostream>
 #include <AgentData.h>
 #include <AvatarData.h>
+#include <SharedUtil.h>
+#include <SimpleMovingAverage.h>
+#include <BandwidthPacer.h>
 #include "VoxelNodeBag.h"
 #include "VoxelConstants.h"
 #include "CoverageMap.h"
+#include "OcclusionBuffer.h"
+#include "VoxelPacketCoder.h"
 
 class VoxelAgentData : public AvatarData {
 public:
-    VoxelAgentData(Agent* owningAgent);
+    VoxelAgentData(Agent* owningAgent, float bytesPerSecond);
     ~VoxelAgentData();
 
-    void resetVoxelPacket();  // resets voxel packet to after "V" header
+    void resetVoxelPacket();  // resets voxel packet to after "V" header and its stamp
+    void stampPacket(long long now) { _pacer.stampPacket(&_voxelPacket[1], now); }; // just before sending it
 
-    void writeToPacket(unsigned char* buffer, int bytes); // writes to end of packet
+    // writes to end of packet, compressed if the agent wants it, false if it doesn't fit
+    bool writeToPacket(unsigned char* buffer, int bytes);
 
     const unsigned char* getPacket() const { return _voxelPacket; }
-    int getPacketLength() const { return (MAX_VOXEL_PACKET_SIZE - _voxelPacketAvailableBytes); }
+    int finishPacket(); // returns the packet's length, after which nothing more can be written to it
     bool isPacketWaiting() const { return _voxelPacketWaiting; }
-    int getAvailable() const { return _voxelPacketAvailableBytes; }
+
+    // scratch space for encoding this agent's voxels, each agent has its own so they can be encoded in parallel
+    unsigned char* getOutputBuffer() { return _outputBuffer; }
     int getMaxSearchLevel() const { return _maxSearchLevel; };
     void resetMaxSearchLevel() { _maxSearchLevel = 1; };
     void incrementMaxSearchLevel() { _maxSearchLevel++; };
@@ -38,6 +47,7 @@ public:
 
     VoxelNodeBag nodeBag;
     CoverageMap map;
+    OcclusionBuffer occlusionBuffer; // used instead of map with --rasterOcclusion
 
     ViewFrustum& getCurrentViewFrustum()     { return _currentViewFrustum; };
     ViewFrustum& getLastKnownViewFrustum()   { return _lastKnownViewFrustum; };
@@ -50,19 +60,53 @@ public:
     bool getViewSent() const        { return _viewSent; };
     void setViewSent(bool viewSent) { _viewSent = viewSent; }
 
+    // Time to useful view is how long it takes after the view changes until nothing that is big on screen is left in
+    // the nodeBag, see VoxelNode::lodDistanceToCamera()
+    void viewChanged();
+    bool isUsefulViewSent() const { return _usefulViewSent; };
+    long long usefulViewSent(); // returns usecs since the view changed
+    SimpleMovingAverage& getTimeToUsefulViewStats() { return _timeToUsefulViewStats; };
+
+    // Incremental sending: a pass starts when the root goes into the nodeBag and completes when the bag is empty. While
+    // the view doesn't change, nothing that hasn't changed since the last completed pass started needs to be sent again.
+    void passStarted() { _passStartedAt = usecTimestampNow(); };
+    void passCompleted() { _lastSentTime = _passStartedAt; };
+    long long getLastSentTime() const { return _lastSentTime; }; // 0 means the client needs everything in view
+
+    // time the distributor spent on this agent since the last call to takeDistributeUsecs(), for the send stats
+    void addDistributeUsecs(long long usecs) { _distributeUsecs += usecs; };
+    long long takeDistributeUsecs() { long long usecs = _distributeUsecs; _distributeUsecs = 0; return usecs; };
+
+    // how fast we send to this agent, adjusted by the reports it sends back, and what it can have of the server's
+    // egress budget
+    BandwidthPacer& getPacer() { return _pacer; };
+    float getEgressShare() const { return _egressShare; };
+    void setEgressShare(float egressShare) { _egressShare = egressShare; };
+
 private:
     VoxelAgentData(const VoxelAgentData &);
     VoxelAgentData& operator= (const VoxelAgentData&);
     
     bool _viewSent;
     unsigned char* _voxelPacket;
+    unsigned char* _outputBuffer;
     unsigned char* _voxelPacketAt;
     int _voxelPacketAvailableBytes;
     bool _voxelPacketWaiting;
+    bool _voxelPacketCompressed;
+    VoxelPacketEncoder* _packetEncoder;
     int _maxSearchLevel;
     int _maxLevelReachedInLastSearch;
     ViewFrustum _currentViewFrustum;
     ViewFrustum _lastKnownViewFrustum;
+    long long _viewChangedAt;
+    bool _usefulViewSent;
+    SimpleMovingAverage _timeToUsefulViewStats;
+    long long _passStartedAt;
+    long long _lastSentTime;
+    long long _distributeUsecs;
+    BandwidthPacer _pacer;
+    float _egressShare;
 
 };
 
@@ -0,0 +1,103 @@
+//
+//  VoxelDistributorPool.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include "VoxelDistributorPool.h"
+
+VoxelDistributorPool::VoxelDistributorPool(int threadCount, DistributeToAgentOperation operation, void* extraData) :
+    _operation(operation),
+    _extraData(extraData),
+    _threadCount(threadCount < 1 ? 1 : threadCount),
+    _threads(NULL),
+    _stopping(false),
+    _generation(0),
+    _agents(NULL),
+    _agentCount(0),
+    _nextAgent(0),
+    _agentsDone(0)
+{
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_workReady, NULL);
+    pthread_cond_init(&_workDone, NULL);
+
+    // the thread calling distribute() is one of our workers, so we only need to start the others
+    if (_threadCount > 1) {
+        _threads = new pthread_t[_threadCount - 1];
+        for (int i = 0; i < _threadCount - 1; i++) {
+            pthread_create(&_threads[i], NULL, workerThread, this);
+        }
+    }
+}
+
+VoxelDistributorPool::~VoxelDistributorPool() {
+    pthread_mutex_lock(&_mutex);
+    _stopping = true;
+    pthread_cond_broadcast(&_workReady);
+    pthread_mutex_unlock(&_mutex);
+
+    for (int i = 0; i < _threadCount - 1; i++) {
+        pthread_join(_threads[i], NULL);
+    }
+    delete[] _threads;
+
+    pthread_cond_destroy(&_workDone);
+    pthread_cond_destroy(&_workReady);
+    pthread_mutex_destroy(&_mutex);
+}
+
+void VoxelDistributorPool::distribute(Agent** agents, int agentCount) {
+    pthread_mutex_lock(&_mutex);
+    _agents = agents;
+    _agentCount = agentCount;
+    _nextAgent = 0;
+    _agentsDone = 0;
+    _generation++;
+    pthread_cond_broadcast(&_workReady);
+
+    runAgents();
+
+    while (_agentsDone < _agentCount) {
+        pthread_cond_wait(&_workDone, &_mutex);
+    }
+    _agents = NULL;
+    _agentCount = 0;
+    pthread_mutex_unlock(&_mutex);
+}
+
+void VoxelDistributorPool::runAgents() {
+    while (_nextAgent < _agentCount) {
+        Agent* agent = _agents[_nextAgent++];
+
+        pthread_mutex_unlock(&_mutex);
+        _operation(agent, _extraData);
+        pthread_mutex_lock(&_mutex);
+
+        if (++_agentsDone == _agentCount) {
+            pthread_cond_signal(&_workDone);
+        }
+    }
+}
+
+void* VoxelDistributorPool::workerThread(void* poolPointer) {
+    VoxelDistributorPool* pool = (VoxelDistributorPool*)poolPointer;
+    int lastGeneration = 0;
+
+    pthread_mutex_lock(&pool->_mutex);
+    while (true) {
+        while (!pool->_stopping && pool->_generation == lastGeneration) {
+            pthread_cond_wait(&pool->_workReady, &pool->_mutex);
+        }
+        if (pool->_stopping) {
+            break;
+        }
+        lastGeneration = pool->_generation;
+        pool->runAgents();
+    }
+    pthread_mutex_unlock(&pool->_mutex);
+
+    pthread_exit(0);
+    return NULL;
+}
@@ -0,0 +1,52 @@
+//
+//  VoxelDistributorPool.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A fixed set of threads that run the voxel distributor for many agents at once. The thread calling distribute()
+//  works too, so a pool of one thread runs everything on the caller just like the old serial distributor did.
+//
+
+#ifndef __hifi__VoxelDistributorPool__
+#define __hifi__VoxelDistributorPool__
+
+#include <pthread.h>
+#include <Agent.h>
+
+typedef void (*DistributeToAgentOperation)(Agent* agent, void* extraData);
+
+class VoxelDistributorPool {
+public:
+    VoxelDistributorPool(int threadCount, DistributeToAgentOperation operation, void* extraData = NULL);
+    ~VoxelDistributorPool();
+
+    // runs the operation once for each of the agents, spread across the pool, and returns when all of them are done
+    void distribute(Agent** agents, int agentCount);
+
+    int getThreadCount() const { return _threadCount; };
+
+private:
+    // disallow copying of VoxelDistributorPool objects
+    VoxelDistributorPool(const VoxelDistributorPool&);
+    VoxelDistributorPool& operator= (const VoxelDistributorPool&);
+
+    static void* workerThread(void* pool);
+    void runAgents(); // called with _mutex held, returns with it held
+
+    DistributeToAgentOperation _operation;
+    void*           _extraData;
+    int             _threadCount;
+    pthread_t*      _threads;
+    pthread_mutex_t _mutex;
+    pthread_cond_t  _workReady;
+    pthread_cond_t  _workDone;
+    bool            _stopping;
+    int             _generation;     // bumped for every call to distribute() so workers know there's new work
+    Agent**         _agents;
+    int             _agentCount;
+    int             _nextAgent;
+    int             _agentsDone;
+};
+
+#endif /* defined(__hifi__VoxelDistributorPool__) */
@@ -0,0 +1,122 @@
+//
+//  VoxelPersister.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstdio>
+#include <algorithm>
+#include <SharedUtil.h>
+#include <VoxelMappedFile.h>
+#include "VoxelPersister.h"
+
+#ifdef _WIN32
+#include "Systime.h"
+#else
+#include <unistd.h>
+#endif
+
+// Edits are on disk at most this long after they're made. Every edit that comes in during the interval is committed
+// with the same fsync, so the cost of syncing is shared by all of them
+const int GROUP_COMMIT_INTERVAL_USECS = 10 * 1000;
+
+// we take a new snapshot once the log has grown to this fraction of the last snapshot, so the disk writes stay
+// proportional to the edits, and replaying the logs on startup never takes much longer than loading the snapshot
+const float SNAPSHOT_LOG_FRACTION = 0.25f;
+const long MIN_LOG_BYTES_FOR_SNAPSHOT = 1024 * 1024;
+
+VoxelPersister::VoxelPersister(VoxelTree* tree, pthread_rwlock_t* treeLock, const char* fileName) :
+    _tree(tree),
+    _treeLock(treeLock),
+    _fileName(fileName),
+    _generation(0),
+    _snapshotBytes(0),
+    _snapshotRequested(false)
+{
+}
+
+bool VoxelPersister::loadSnapshot(int eagerLevels) {
+    VoxelMappedFile snapshot;
+    if (!snapshot.open(_fileName.c_str())) {
+        return false;
+    }
+    _generation = snapshot.getGeneration();
+    _snapshotBytes = snapshot.getFileSize();
+    snapshot.close();
+
+    return _tree->readFromMappedSVOFile(_fileName.c_str(), eagerLevels);
+}
+
+long VoxelPersister::replayEditLogs() {
+    // if writing a snapshot ever failed, there will be more than one log since the last good one
+    long edits = 0;
+    uint32_t generation = _generation;
+    long logEdits;
+    while ((logEdits = VoxelEditLog::replay(VoxelEditLog::fileNameFor(_fileName.c_str(), generation).c_str(),
+                                            _tree)) != VoxelEditLog::NO_LOG) {
+        printf("replayed %ld edits from %s\n", logEdits,
+               VoxelEditLog::fileNameFor(_fileName.c_str(), generation).c_str());
+        edits += logEdits;
+        _generation = generation++;
+    }
+    _editLog.open(VoxelEditLog::fileNameFor(_fileName.c_str(), _generation).c_str(), _generation);
+    return edits;
+}
+
+void VoxelPersister::start() {
+    pthread_create(&_thread, NULL, persistThread, this);
+}
+
+void* VoxelPersister::persistThread(void* persister) {
+    VoxelPersister* self = (VoxelPersister*)persister;
+    while (true) {
+        usleep(GROUP_COMMIT_INTERVAL_USECS);
+        if (self->_editLog.hasBufferedEdits()) {
+            self->_editLog.flush();
+        }
+
+        long logBytesForSnapshot = std::max(MIN_LOG_BYTES_FOR_SNAPSHOT,
+                                            (long)(self->_snapshotBytes * SNAPSHOT_LOG_FRACTION));
+        if (self->_snapshotRequested || self->_editLog.getFileSize() > logBytesForSnapshot) {
+            self->takeSnapshot();
+        }
+    }
+    return NULL;
+}
+
+void VoxelPersister::takeSnapshot() {
+    long long start = usecTimestampNow();
+    uint32_t generation = _generation + 1;
+    long bytes = 0;
+
+    // Edits are only logged with the write lock held, so while we hold the read lock the log we close has exactly the
+    // edits that are in the snapshot's image, and the new log will get exactly the ones that aren't
+    pthread_rwlock_rdlock(_treeLock);
+    if (_tree->hasNodesOnDisk()) {
+        // a snapshot now would lose whatever hasn't been loaded yet, we'll try again once it's all in memory
+        pthread_rwlock_unlock(_treeLock);
+        return;
+    }
+    _editLog.open(VoxelEditLog::fileNameFor(_fileName.c_str(), generation).c_str(), generation);
+    _generation = generation;
+    _snapshotRequested = false;
+    unsigned char* image = VoxelMappedFile::serialize(_tree->rootNode, generation, bytes);
+    pthread_rwlock_unlock(_treeLock);
+    long long locked = usecTimestampNow() - start;
+
+    // if this fails the old snapshot and its logs are still there, so we lose nothing, and we'll try again later
+    if (image && VoxelMappedFile::write(_fileName.c_str(), image, bytes)) {
+        _snapshotBytes = bytes;
+        removeEditLogsBefore(generation);
+        printf("saved voxels snapshot %u, %ld bytes, tree locked for %lld of %lld usecs\n",
+               generation, bytes, locked, usecTimestampNow() - start);
+    }
+    delete[] image;
+}
+
+void VoxelPersister::removeEditLogsBefore(uint32_t generation) {
+    while (generation > 0 && remove(VoxelEditLog::fileNameFor(_fileName.c_str(), --generation).c_str()) == 0) {
+        // keep going until we find one that's already gone
+    }
+}
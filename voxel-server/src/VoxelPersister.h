@@ -0,0 +1,64 @@
+//
+//  VoxelPersister.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Keeps the server's voxels on disk without stalling edits. Every edit is appended to an edit log, which a background
+//  thread commits to disk every few milliseconds. Once the log has grown big enough compared to the last snapshot, the same
+//  thread lays the tree out in memory under the tree's read lock, starts a new log, and writes the new snapshot to disk
+//  after letting go of the lock, then removes the logs the snapshot replaces. On startup the snapshot is loaded and the
+//  logs written since are replayed on top, so a crash loses at most the last few milliseconds of edits.
+//
+
+#ifndef __hifi__VoxelPersister__
+#define __hifi__VoxelPersister__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <VoxelEditLog.h>
+#include <VoxelTree.h>
+
+class VoxelPersister {
+public:
+    VoxelPersister(VoxelTree* tree, pthread_rwlock_t* treeLock, const char* fileName);
+
+    // loads the snapshot, only its top eagerLevels right away if there's more, see VoxelTree::readFromMappedSVOFile()
+    bool loadSnapshot(int eagerLevels);
+
+    // replays the edit logs written since the snapshot was taken, and opens the newest one to keep logging to. Returns
+    // the number of edits replayed
+    long replayEditLogs();
+
+    // starts the thread that writes the log and takes snapshots
+    void start();
+
+    // edits are logged by whoever makes them, with the tree's write lock held and after the edit has been applied
+    VoxelEditLog& getEditLog() { return _editLog; };
+
+    // for changes that don't go through the log, like adding a scene or loading a file, the next snapshot has them
+    void requestSnapshot() { _snapshotRequested = true; };
+
+    uint32_t getGeneration() const { return _generation; };
+
+private:
+    // disallow copying of VoxelPersister objects
+    VoxelPersister(const VoxelPersister&);
+    VoxelPersister& operator= (const VoxelPersister&);
+
+    static void* persistThread(void* persister);
+    void takeSnapshot();
+    void removeEditLogsBefore(uint32_t generation);
+
+    VoxelTree*          _tree;
+    pthread_rwlock_t*   _treeLock;
+    std::string         _fileName;
+    uint32_t            _generation;        // of the log we're writing, the next snapshot gets the one after it
+    long                _snapshotBytes;
+    volatile bool       _snapshotRequested;
+    VoxelEditLog        _editLog;
+    pthread_t           _thread;
+};
+
+#endif /* defined(__hifi__VoxelPersister__) */
@@ -10,12 +10,20 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <string>
 #include <OctalCode.h>
+#include <VoxelRegion.h>
 #include <AgentList.h>
 #include <AgentTypes.h>
 #include <EnvironmentData.h>
 #include <VoxelTree.h>
+#include <VoxelSendStats.h>
 #include "VoxelAgentData.h"
+#include "VoxelDistributorPool.h"
+#include "EncodedSubtreeCache.h"
+#include "VoxelPersister.h"
 #include <SharedUtil.h>
 #include <PacketHeaders.h>
 #include <SceneUtils.h>
@@ -28,11 +36,18 @@
 #include <sys/time.h>
 #include <arpa/inet.h>
 #include <ifaddrs.h>
+#include <unistd.h>
 #endif
 
-const char* LOCAL_VOXELS_PERSIST_FILE = "resources/voxels.svo";
-const char* VOXELS_PERSIST_FILE = "/etc/highfidelity/voxel-server/resources/voxels.svo";
-const long long VOXEL_PERSIST_INTERVAL = 1000 * 30; // every 30 seconds
+// we persist in the mapped SVO format, but we'll still load a wire format persist file if there's no mapped one
+const char* LOCAL_VOXELS_PERSIST_FILE = "resources/voxels.msvo";
+const char* VOXELS_PERSIST_FILE = "/etc/highfidelity/voxel-server/resources/voxels.msvo";
+const char* LOCAL_VOXELS_WIRE_FORMAT_PERSIST_FILE = "resources/voxels.svo";
+const char* VOXELS_WIRE_FORMAT_PERSIST_FILE = "/etc/highfidelity/voxel-server/resources/voxels.svo";
+
+// when loading a mapped persist file, we load this many levels before we start serving, and the rest in the background
+const int PERSIST_FILE_EAGER_LEVELS = 6;
+const int NODES_PER_MATERIALIZE = 64 * 1024;
 
 const int VOXEL_LISTEN_PORT = 40106;
 
@@ -45,13 +60,15 @@ const float DEATH_STAR_RADIUS = 4.0;
 const float MAX_CUBE = 0.05f;
 
 const int VOXEL_SEND_INTERVAL_USECS = 100 * 1000;
-int PACKETS_PER_CLIENT_PER_INTERVAL = 30;
+const int VOXEL_SEND_STATS_PACKET_INTERVALS = 10; // how often agents get a PACKET_HEADER_VOXEL_SEND_STATS
+int PACKETS_PER_CLIENT_PER_INTERVAL = 30; // what agents start out getting, their pacers adjust it from their reports
 
 const int MAX_VOXEL_TREE_DEPTH_LEVELS = 4;
 
 const int ENVIRONMENT_SEND_INTERVAL_USECS = 1000000;
 
 VoxelTree serverTree(true); // this IS a reaveraging tree 
+VoxelRegion voxelRegion;    // the part of the tree we own, all of it unless we're started with --shard
 bool wantVoxelPersist = true;
 bool wantLocalDomain = false;
 
@@ -60,9 +77,44 @@ bool wantColorRandomizer = false;
 bool debugVoxelSending = false;
 bool shouldShowAnimationDebug = false;
 bool wantSearchForColoredNodes = false;
+bool wantPrioritySending = true;
+bool wantIncrementalSending = true;
+
+// a view is useful once nothing left to send is within this fraction of its LOD boundary distance
+const float USEFUL_VIEW_LOD_DISTANCE = 0.25f;
 
 EnvironmentData environmentData[3];
 
+// Edits to serverTree take this for writing, the distributors and persister take it for reading. That way several
+// agents can be encoded at once, but never while the tree is changing underneath them.
+pthread_rwlock_t treeLock;
+VoxelPersister* persister = NULL; // NULL unless wantVoxelPersist
+
+// edit packets that were waiting at the same time are gathered up and applied together
+const int MAX_EDIT_PACKETS_PER_BATCH = 64;
+unsigned char* editPackets = new unsigned char[MAX_EDIT_PACKETS_PER_BATCH * MAX_PACKET_SIZE];
+ssize_t editPacketBytes[MAX_EDIT_PACKETS_PER_BATCH];
+std::vector<VoxelEdit> editBatch;
+
+const long long EDIT_STATS_INTERVAL_USECS = 5 * 1000 * 1000;
+bool showEditStats = false;
+struct {
+    long edits;
+    long packets;
+    long batches;
+    long long applyUsecs;
+    long long lastPrinted;
+} editStats;
+int encodingThreads = 1;
+
+// encoded subtrees that agents with similar views can share, NULL if turned off with --noSubtreeCache
+const int SUBTREE_CACHE_SLOTS = 64 * 1024;
+const long SUBTREE_CACHE_BYTES = 32 * 1024 * 1024;
+EncodedSubtreeCache* subtreeCache = NULL;
+bool showSendStats = false;
+bool wantRasterOcclusion = false;
+float maxEgressBytesPerSecond = 0.0f; // shared between the agents, 0 for no limit
+
 
 void randomlyFillVoxelTree(int levelsToGo, VoxelNode *currentRootNode) {
     // randomly generate children for this node
@@ -95,6 +147,58 @@ void randomlyFillVoxelTree(int levelsToGo, VoxelNode *currentRootNode) {
     }
 }
 
+// the nodes we send agents their voxels from, the root unless we only own part of the tree, returns how many
+int getRegionRoots(VoxelNode** roots) {
+    if (::voxelRegion.isWholeTree()) {
+        roots[0] = ::serverTree.rootNode;
+        return 1;
+    }
+    int rootCount = 0;
+    for (int i = 0; i < ::voxelRegion.getPrefixCount(); i++) {
+        VoxelNode* root = ::serverTree.getNodeAt(::voxelRegion.getPrefix(i));
+        if (root) {
+            roots[rootCount++] = root;
+        }
+    }
+    return rootCount;
+}
+
+void insertRegionRoots(VoxelNodeBag& bag) {
+    VoxelNode* roots[VoxelRegion::MAX_PREFIXES];
+    int rootCount = getRegionRoots(roots);
+    for (int i = 0; i < rootCount; i++) {
+        bag.insert(roots[i]);
+    }
+}
+
+void deleteNodesOutsideRegion(VoxelNode* node) {
+    MortonKey key = MortonKey::fromOctalCode(node->getOctalCode());
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* childNode = node->getChildAtIndex(i);
+        if (childNode) {
+            MortonKey childKey = key.getChild(i);
+            if (!::voxelRegion.overlaps(childKey)) {
+                node->deleteChildAtIndex(i);
+            } else if (!::voxelRegion.contains(childKey)) {
+                deleteNodesOutsideRegion(childNode);
+            }
+        }
+    }
+}
+
+// When we only own part of the tree, whatever an edit, a scene or a file put outside of it goes, and the roots of our
+// region are always there, even when they're empty, so that agents hear from us when everything in them is gone.
+// Called with the tree locked for writing.
+void keepTreeInRegion() {
+    if (::voxelRegion.isWholeTree()) {
+        return;
+    }
+    for (int i = 0; i < ::voxelRegion.getPrefixCount(); i++) {
+        ::serverTree.createNodeAt(::voxelRegion.getPrefix(i));
+    }
+    deleteNodesOutsideRegion(::serverTree.rootNode);
+}
+
 void eraseVoxelTreeAndCleanupAgentVisitData() {
 
     // As our tree to erase all it's voxels
@@ -110,10 +214,33 @@ void eraseVoxelTreeAndCleanupAgentVisitData() {
 }
 
 
+// sends our environment data to the agent, using outputBuffer as scratch space, returns the bytes sent
+int sendEnvironmentPacket(AgentList* agentList, Agent* agent, unsigned char* outputBuffer) {
+    int envPacketLength = 1;
+    *outputBuffer = PACKET_HEADER_ENVIRONMENT_DATA;
+    for (int i = 0; i < sizeof(environmentData) / sizeof(environmentData[0]); i++) {
+        envPacketLength += environmentData[i].getBroadcastData(outputBuffer + envPacketLength);
+    }
+    agentList->getAgentSocket()->send(agent->getActiveSocket(), outputBuffer, envPacketLength);
+    return envPacketLength;
+}
+
+// stamps the agent's voxel packet, sends it, and starts the next one, returns the bytes sent
+int sendVoxelPacket(AgentList* agentList, Agent* agent, VoxelAgentData* agentData) {
+    int packetLength = agentData->finishPacket();
+    agentData->stampPacket(usecTimestampNow());
+    agentList->getAgentSocket()->send(agent->getActiveSocket(), agentData->getPacket(), packetLength);
+    agentData->getPacer().sent(packetLength);
+    agentData->resetVoxelPacket();
+    return packetLength;
+}
+
 // Version of voxel distributor that sends each LOD level at a time
 void resInVoxelDistributor(AgentList* agentList, 
-                           AgentList::iterator& agent, 
+                           Agent* agent, 
                            VoxelAgentData* agentData) {
+    pthread_rwlock_rdlock(&::treeLock);
+
     ViewFrustum viewFrustum = agentData->getCurrentViewFrustum();
     bool searchReset = false;
     int  searchLoops = 0;
@@ -123,8 +250,14 @@ void resInVoxelDistributor(AgentList* agentList,
         searchLoops++;
 
         searchLevelWas = agentData->getMaxSearchLevel();
-        int maxLevelReached = serverTree.searchForColoredNodes(agentData->getMaxSearchLevel(), serverTree.rootNode, 
-                                                               viewFrustum, agentData->nodeBag);
+        VoxelNode* regionRoots[VoxelRegion::MAX_PREFIXES];
+        int regionRootCount = getRegionRoots(regionRoots);
+        int maxLevelReached = 0;
+        for (int i = 0; i < regionRootCount; i++) {
+            maxLevelReached = std::max(maxLevelReached, serverTree.searchForColoredNodes(agentData->getMaxSearchLevel(),
+                                                                                         regionRoots[i], viewFrustum,
+                                                                                         agentData->nodeBag));
+        }
         agentData->setMaxLevelReached(maxLevelReached);
         
         // If nothing got added, then we bump our levels.
@@ -156,56 +289,42 @@ void resInVoxelDistributor(AgentList* agentList,
 
     // If we have something in our nodeBag, then turn them into packets and send them out...
     if (!agentData->nodeBag.isEmpty()) {
-        static unsigned char tempOutputBuffer[MAX_VOXEL_PACKET_SIZE - 1]; // save on allocs by making this static
+        unsigned char* tempOutputBuffer = agentData->getOutputBuffer(); // not shared, agents are encoded in parallel
         int bytesWritten = 0;
-        int packetsSentThisInterval = 0;
+        bool moreToSend = true;
         int truePacketsSent = 0;
         int trueBytesSent = 0;
         long long start = usecTimestampNow();
 
         bool shouldSendEnvironments = shouldDo(ENVIRONMENT_SEND_INTERVAL_USECS, VOXEL_SEND_INTERVAL_USECS);
-        while (packetsSentThisInterval < PACKETS_PER_CLIENT_PER_INTERVAL - (shouldSendEnvironments ? 1 : 0)) {
+        while (moreToSend && agentData->getPacer().hasTokens()) {
             if (!agentData->nodeBag.isEmpty()) {
                 VoxelNode* subTree = agentData->nodeBag.extract();
 
                 EncodeBitstreamParams params(agentData->getMaxSearchLevel(), &viewFrustum, 
                                              agentData->getWantColor(), WANT_EXISTS_BITS);
 
-                bytesWritten = serverTree.encodeTreeBitstream(subTree, &tempOutputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1,
-                                                              agentData->nodeBag, params);
+                bytesWritten = serverTree.encodeTreeBitstream(subTree, &tempOutputBuffer[0],
+                                                              MAX_VOXEL_PACKET_DATA_BYTES, agentData->nodeBag, params);
 
-                if (agentData->getAvailable() >= bytesWritten) {
-                    agentData->writeToPacket(&tempOutputBuffer[0], bytesWritten);
-                } else {
-                    agentList->getAgentSocket()->send(agent->getActiveSocket(),
-                                                     agentData->getPacket(), agentData->getPacketLength());
-                    trueBytesSent += agentData->getPacketLength();
+                if (!agentData->writeToPacket(&tempOutputBuffer[0], bytesWritten)) {
+                    trueBytesSent += sendVoxelPacket(agentList, agent, agentData);
                     truePacketsSent++;
-                    packetsSentThisInterval++;
-                    agentData->resetVoxelPacket();
                     agentData->writeToPacket(&tempOutputBuffer[0], bytesWritten);
                 }
             } else {
                 if (agentData->isPacketWaiting()) {
-                    agentList->getAgentSocket()->send(agent->getActiveSocket(),
-                                                      agentData->getPacket(), agentData->getPacketLength());
-                    trueBytesSent += agentData->getPacketLength();
+                    trueBytesSent += sendVoxelPacket(agentList, agent, agentData);
                     truePacketsSent++;
-                    agentData->resetVoxelPacket();
-                    
                 }
-                packetsSentThisInterval = PACKETS_PER_CLIENT_PER_INTERVAL; // done for now, no nodes left
+                moreToSend = false; // done for now, no nodes left
             }
         }
-        // send the environment packets
+        // send the environment packet
         if (shouldSendEnvironments) {
-            int envPacketLength = 1;
-            *tempOutputBuffer = PACKET_HEADER_ENVIRONMENT_DATA;
-            for (int i = 0; i < sizeof(environmentData) / sizeof(environmentData[0]); i++) {
-                envPacketLength += environmentData[i].getBroadcastData(tempOutputBuffer + envPacketLength);
-            }
-            agentList->getAgentSocket()->send(agent->getActiveSocket(), tempOutputBuffer, envPacketLength);
-            trueBytesSent += envPacketLength;
+            int environmentBytes = sendEnvironmentPacket(agentList, agent, tempOutputBuffer);
+            agentData->getPacer().sent(environmentBytes);
+            trueBytesSent += environmentBytes;
             truePacketsSent++;
         }
         long long end = usecTimestampNow();
@@ -233,18 +352,18 @@ void resInVoxelDistributor(AgentList* agentList,
             }
         }        
     }
-}
 
-pthread_mutex_t treeLock;
+    pthread_rwlock_unlock(&::treeLock);
+}
 
 // Version of voxel distributor that sends the deepest LOD level at once
 void deepestLevelVoxelDistributor(AgentList* agentList, 
-                                  AgentList::iterator& agent,
+                                  Agent* agent,
                                   VoxelAgentData* agentData,
                                   bool viewFrustumChanged) {
 
 
-    pthread_mutex_lock(&::treeLock);
+    pthread_rwlock_rdlock(&::treeLock);
 
     int maxLevelReached = 0;
     long long start = usecTimestampNow();
@@ -260,9 +379,22 @@ void deepestLevelVoxelDistributor(AgentList* agentList,
             );
     }
     
+    // the bag's distances are from the old view, so bring them up to date, and start timing the new view
+    if (viewFrustumChanged) {
+        agentData->nodeBag.reprioritize();
+        agentData->viewChanged();
+        agentData->occlusionBuffer.erase(); // its occluders are where they were on the old screen
+    }
+
+    // When the view hasn't changed, and nothing in the tree has changed since our last pass over it, the client
+    // already has everything we'd send, so there's no need to walk the tree at all.
+    long long lastSentTime = ::wantIncrementalSending ? agentData->getLastSentTime() : IGNORE_LAST_SENT_TIME;
+    bool nothingChanged = (lastSentTime != IGNORE_LAST_SENT_TIME && !viewFrustumChanged &&
+                           !serverTree.rootNode->hasChangedSince(lastSentTime));
+
     // If the current view frustum has changed OR we have nothing to send, then search against 
     // the current view frustum for things to send.
-    if (viewFrustumChanged || agentData->nodeBag.isEmpty()) {
+    if (viewFrustumChanged || (agentData->nodeBag.isEmpty() && !nothingChanged)) {
 
         // For now, we're going to disable the "search for colored nodes" because that strategy doesn't work when we support
         // deletion of nodes. Instead if we just start at the root we get the correct behavior we want. We are keeping this
@@ -270,16 +402,24 @@ void deepestLevelVoxelDistributor(AgentList* agentList,
         // helps improve overall bitrate performance.
         if (::wantSearchForColoredNodes) {
             // If the bag was empty, then send everything in view, not just the delta
-            maxLevelReached = serverTree.searchForColoredNodes(INT_MAX, serverTree.rootNode, agentData->getCurrentViewFrustum(), 
-                                                               agentData->nodeBag, wantDelta, lastViewFrustum);
+            VoxelNode* regionRoots[VoxelRegion::MAX_PREFIXES];
+            int regionRootCount = getRegionRoots(regionRoots);
+            for (int i = 0; i < regionRootCount; i++) {
+                maxLevelReached = std::max(maxLevelReached,
+                                           serverTree.searchForColoredNodes(INT_MAX, regionRoots[i],
+                                                                            agentData->getCurrentViewFrustum(),
+                                                                            agentData->nodeBag, wantDelta,
+                                                                            lastViewFrustum));
+            }
 
             // if nothing was found in view, send the root node.
             if (agentData->nodeBag.isEmpty()){
-                agentData->nodeBag.insert(serverTree.rootNode);
+                insertRegionRoots(agentData->nodeBag);
             }
             agentData->setViewSent(false);
         } else {
-            agentData->nodeBag.insert(serverTree.rootNode);
+            insertRegionRoots(agentData->nodeBag);
+            agentData->passStarted();
         }
 
     }
@@ -301,60 +441,58 @@ void deepestLevelVoxelDistributor(AgentList* agentList,
 
     // If we have something in our nodeBag, then turn them into packets and send them out...
     if (!agentData->nodeBag.isEmpty()) {
-        static unsigned char tempOutputBuffer[MAX_VOXEL_PACKET_SIZE - 1]; // save on allocs by making this static
+        unsigned char* tempOutputBuffer = agentData->getOutputBuffer(); // not shared, agents are encoded in parallel
         int bytesWritten = 0;
-        int packetsSentThisInterval = 0;
+        bool moreToSend = true;
         int truePacketsSent = 0;
         int trueBytesSent = 0;
         long long start = usecTimestampNow();
 
         bool shouldSendEnvironments = shouldDo(ENVIRONMENT_SEND_INTERVAL_USECS, VOXEL_SEND_INTERVAL_USECS);
-        while (packetsSentThisInterval < PACKETS_PER_CLIENT_PER_INTERVAL - (shouldSendEnvironments ? 1 : 0)) {
+        while (moreToSend && agentData->getPacer().hasTokens()) {
             if (!agentData->nodeBag.isEmpty()) {
                 VoxelNode* subTree = agentData->nodeBag.extract();
 
                 bool wantOcclusionCulling = agentData->getWantOcclusionCulling();
-                CoverageMap* coverageMap = wantOcclusionCulling ? &agentData->map : IGNORE_COVERAGE_MAP;
+                CoverageMap* coverageMap = (wantOcclusionCulling && !::wantRasterOcclusion) ? &agentData->map
+                                                                                            : IGNORE_COVERAGE_MAP;
+                OcclusionBuffer* occlusionBuffer = (wantOcclusionCulling && ::wantRasterOcclusion) ?
+                                                   &agentData->occlusionBuffer : IGNORE_OCCLUSION_BUFFER;
                 
                 EncodeBitstreamParams params(INT_MAX, &agentData->getCurrentViewFrustum(), agentData->getWantColor(), 
                                              WANT_EXISTS_BITS, DONT_CHOP, wantDelta, lastViewFrustum,
-                                             wantOcclusionCulling, coverageMap);
-
-                bytesWritten = serverTree.encodeTreeBitstream(subTree, &tempOutputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1,
-                                                              agentData->nodeBag, params);
-                
-                if (agentData->getAvailable() >= bytesWritten) {
-                    agentData->writeToPacket(&tempOutputBuffer[0], bytesWritten);
+                                             wantOcclusionCulling, coverageMap, lastSentTime, occlusionBuffer);
+
+                // agents near each other mostly send the same subtrees, so if this one encodes the same way for
+                // everyone who can see all of it, maybe somebody already encoded it
+                int lodLevel = ::subtreeCache ? ::subtreeCache->lodLevelFor(subTree, params)
+                                              : EncodedSubtreeCache::NOT_CACHEABLE;
+                if (lodLevel != EncodedSubtreeCache::NOT_CACHEABLE) {
+                    bytesWritten = ::subtreeCache->encodeTreeBitstream(serverTree, subTree, lodLevel, &tempOutputBuffer[0],
+                                                                       agentData->nodeBag, params);
                 } else {
-                    agentList->getAgentSocket()->send(agent->getActiveSocket(),
-                                                     agentData->getPacket(), agentData->getPacketLength());
-                    trueBytesSent += agentData->getPacketLength();
+                    bytesWritten = serverTree.encodeTreeBitstream(subTree, &tempOutputBuffer[0],
+                                                                  MAX_VOXEL_PACKET_DATA_BYTES, agentData->nodeBag, params);
+                }
+                
+                if (!agentData->writeToPacket(&tempOutputBuffer[0], bytesWritten)) {
+                    trueBytesSent += sendVoxelPacket(agentList, agent, agentData);
                     truePacketsSent++;
-                    packetsSentThisInterval++;
-                    agentData->resetVoxelPacket();
                     agentData->writeToPacket(&tempOutputBuffer[0], bytesWritten);
                 }
             } else {
                 if (agentData->isPacketWaiting()) {
-                    agentList->getAgentSocket()->send(agent->getActiveSocket(),
-                                                     agentData->getPacket(), agentData->getPacketLength());
-                    trueBytesSent += agentData->getPacketLength();
+                    trueBytesSent += sendVoxelPacket(agentList, agent, agentData);
                     truePacketsSent++;
-                    agentData->resetVoxelPacket();
-                    
                 }
-                packetsSentThisInterval = PACKETS_PER_CLIENT_PER_INTERVAL; // done for now, no nodes left
+                moreToSend = false; // done for now, no nodes left
             }
         }
         // send the environment packet
         if (shouldSendEnvironments) {
-            int envPacketLength = 1;
-            *tempOutputBuffer = PACKET_HEADER_ENVIRONMENT_DATA;
-            for (int i = 0; i < sizeof(environmentData) / sizeof(environmentData[0]); i++) {
-                envPacketLength += environmentData[i].getBroadcastData(tempOutputBuffer + envPacketLength);
-            }
-            agentList->getAgentSocket()->send(agent->getActiveSocket(), tempOutputBuffer, envPacketLength);
-            trueBytesSent += envPacketLength;
+            int environmentBytes = sendEnvironmentPacket(agentList, agent, tempOutputBuffer);
+            agentData->getPacer().sent(environmentBytes);
+            trueBytesSent += environmentBytes;
             truePacketsSent++;
         }
         
@@ -374,74 +512,290 @@ void deepestLevelVoxelDistributor(AgentList* agentList,
                     elapsedmsec, trueBytesSent, truePacketsSent, agentData->nodeBag.count());
         }
         
+        if (!agentData->isUsefulViewSent() && agentData->nodeBag.getClosestDistance() > USEFUL_VIEW_LOD_DISTANCE) {
+            long long timeToUsefulView = agentData->usefulViewSent();
+            if (::debugVoxelSending) {
+                printf("useful view sent in %lld usecs, average %.0f usecs, prioritySending=%s\n", timeToUsefulView,
+                       agentData->getTimeToUsefulViewStats().getAverage(), debug::valueOf(::wantPrioritySending));
+            }
+        }
+
         // if after sending packets we've emptied our bag, then we want to remember that we've sent all 
         // the voxels from the current view frustum
         if (agentData->nodeBag.isEmpty()) {
             agentData->updateLastKnownViewFrustum();
             agentData->setViewSent(true);
             agentData->map.erase();
+            agentData->occlusionBuffer.erase();
+            agentData->passCompleted();
         }
         
         
+    } else if (shouldDo(ENVIRONMENT_SEND_INTERVAL_USECS, VOXEL_SEND_INTERVAL_USECS)) {
+        // we had no voxels to send, but the client still needs to hear about the environment
+        sendEnvironmentPacket(agentList, agent, agentData->getOutputBuffer());
     } // end if bag wasn't empty, and so we sent stuff...
 
-    pthread_mutex_unlock(&::treeLock);
+    pthread_rwlock_unlock(&::treeLock);
 }
 
-long long lastPersistVoxels = 0;
-void persistVoxelsWhenDirty() {
-    long long now = usecTimestampNow();
-    long long sinceLastTime = (now - ::lastPersistVoxels) / 1000;
+bool isVoxelEditPacket(unsigned char* packetData) {
+    return packetData[0] == PACKET_HEADER_SET_VOXEL || packetData[0] == PACKET_HEADER_SET_VOXEL_DESTRUCTIVE;
+}
 
-    // check the dirty bit and persist here...
-    if (::wantVoxelPersist && ::serverTree.isDirty() && sinceLastTime > VOXEL_PERSIST_INTERVAL) {
-        {
-            PerformanceWarning warn(::shouldShowAnimationDebug, 
-                                    "persistVoxelsWhenDirty() - writeToSVOFile()", ::shouldShowAnimationDebug);
+// Decodes the gathered edit packets into one batch, and applies it to the tree in a single walk, see
+// VoxelTree::readCodeColorBuffersToTree()
+void applyVoxelEditPackets(int editPacketCount) {
+    long long start = usecTimestampNow();
+    pthread_rwlock_wrlock(&::treeLock);
+    int editCount = 0;
+    for (int packet = 0; packet < editPacketCount; packet++) {
+        unsigned char* packetData = ::editPackets + packet * MAX_PACKET_SIZE;
+        ssize_t receivedBytes = ::editPacketBytes[packet];
+        bool destructive = (packetData[0] == PACKET_HEADER_SET_VOXEL_DESTRUCTIVE);
+        unsigned short int itemNumber = (*((unsigned short int*)&packetData[1]));
+        if (::shouldShowAnimationDebug) {
+            printf("got %s - command from client receivedBytes=%ld itemNumber=%d\n",
+                destructive ? "PACKET_HEADER_SET_VOXEL_DESTRUCTIVE" : "PACKET_HEADER_SET_VOXEL",
+                receivedBytes,itemNumber);
+        }
+        int atByte = sizeof(PACKET_HEADER) + sizeof(itemNumber);
+        unsigned char* voxelData = (unsigned char*)&packetData[atByte];
+        while (atByte < receivedBytes) {
+            unsigned char octets = (unsigned char)*voxelData;
+            const int COLOR_SIZE_IN_BYTES = 3;
+            int voxelDataSize = bytesRequiredForCodeLength(octets) + COLOR_SIZE_IN_BYTES;
+            int voxelCodeSize = bytesRequiredForCodeLength(octets);
+
+            // color randomization on insert
+            int colorRandomizer = ::wantColorRandomizer ? randIntInRange (-50, 50) : 0;
+            int red   = voxelData[voxelCodeSize + 0];
+            int green = voxelData[voxelCodeSize + 1];
+            int blue  = voxelData[voxelCodeSize + 2];
+
+            if (::shouldShowAnimationDebug) {
+                printf("insert voxels - wantColorRandomizer=%s old r=%d,g=%d,b=%d \n",
+                    (::wantColorRandomizer?"yes":"no"),red,green,blue);
+            }
+        
+            red   = std::max(0, std::min(255, red   + colorRandomizer));
+            green = std::max(0, std::min(255, green + colorRandomizer));
+            blue  = std::max(0, std::min(255, blue  + colorRandomizer));
 
-            printf("saving voxels to file...\n");
-            serverTree.writeToSVOFile(::wantLocalDomain ? LOCAL_VOXELS_PERSIST_FILE : VOXELS_PERSIST_FILE);
-            serverTree.clearDirtyBit(); // tree is clean after saving
-            printf("DONE saving voxels to file...\n");
+            if (::shouldShowAnimationDebug) {
+                printf("insert voxels - wantColorRandomizer=%s NEW r=%d,g=%d,b=%d \n",
+                    (::wantColorRandomizer?"yes":"no"),red,green,blue);
+            }
+            voxelData[voxelCodeSize + 0] = red;
+            voxelData[voxelCodeSize + 1] = green;
+            voxelData[voxelCodeSize + 2] = blue;
+
+            if (::shouldShowAnimationDebug) {
+                float* vertices = firstVertexForCode(voxelData);
+                printf("inserting voxel at: %f,%f,%f\n", vertices[0], vertices[1], vertices[2]);
+                delete []vertices;
+            }
+
+            if (editCount == (int)::editBatch.size()) {
+                ::editBatch.resize(editCount * 2 + 1);
+            }
+            ::editBatch[editCount].codeColorBuffer = voxelData;
+            ::editBatch[editCount].destructive = destructive;
+            editCount++;
+
+            // the log is replayed one edit at a time, in the order they came in
+            if (::persister) {
+                ::persister->getEditLog().logSetVoxel(voxelData, destructive);
+            }
+
+            // skip to next
+            voxelData += voxelDataSize;
+            atByte += voxelDataSize;
         }
-        ::lastPersistVoxels = usecTimestampNow();
     }
+    if (editCount) {
+        serverTree.readCodeColorBuffersToTree(&::editBatch[0], editCount);
+        keepTreeInRegion();
+    }
+    pthread_rwlock_unlock(&::treeLock);
+
+    ::editStats.edits += editCount;
+    ::editStats.packets += editPacketCount;
+    ::editStats.batches++;
+    ::editStats.applyUsecs += usecTimestampNow() - start;
+}
+
+void printEditStats() {
+    long long now = usecTimestampNow();
+    long long sinceLastPrint = now - ::editStats.lastPrinted;
+    if (sinceLastPrint >= EDIT_STATS_INTERVAL_USECS) {
+        if (::editStats.edits) {
+            printf("edits/sec received=%.0f applied=%.0f, %ld edits in %ld packets, %.1f packets per batch\n",
+                   ::editStats.edits * 1000000.0f / sinceLastPrint,
+                   ::editStats.applyUsecs ? ::editStats.edits * 1000000.0f / ::editStats.applyUsecs : 0.0f,
+                   ::editStats.edits, ::editStats.packets, (float)::editStats.packets / ::editStats.batches);
+        }
+        memset(&::editStats, 0, sizeof(::editStats));
+        ::editStats.lastPrinted = now;
+    }
+}
+
+// Loads the rest of a mapped persist file after we've started serving, a chunk at a time, so that edits and sending
+// carry on while it loads
+void *materializeVoxelsFromDisk(void *args) {
+    long long start = usecTimestampNow();
+    bool nodesOnDisk = true;
+    while (nodesOnDisk) {
+        pthread_rwlock_wrlock(&::treeLock);
+        ::serverTree.materializeNodesFromDisk(NODES_PER_MATERIALIZE);
+        nodesOnDisk = ::serverTree.hasNodesOnDisk();
+        pthread_rwlock_unlock(&::treeLock);
+
+        // the lock prefers writers, so give any waiting readers a chance before we take it again
+        usleep(1000);
+    }
+    printf("DONE loading the rest of the voxels from file in %lld usecs\n", usecTimestampNow() - start);
+    pthread_exit(0);
+}
+
+// called by the distributor pool, possibly on several threads at once, for each agent with linked data
+void distributeVoxelsToAgent(Agent* agent, void* extraData) {
+    AgentList* agentList = AgentList::getInstance();
+    VoxelAgentData* agentData = (VoxelAgentData*) agent->getLinkedData();
+    long long start = usecTimestampNow();
+    agentData->getPacer().refill(start, agentData->getEgressShare());
+
+    bool viewFrustumChanged = agentData->updateCurrentViewFrustum();
+    if (::debugVoxelSending) {
+        printf("agentData->updateCurrentViewFrustum() changed=%s\n", debug::valueOf(viewFrustumChanged));
+    }
+
+    if (agentData->getWantResIn()) { 
+        resInVoxelDistributor(agentList, agent, agentData);
+    } else {
+        deepestLevelVoxelDistributor(agentList, agent, agentData, viewFrustumChanged);
+    }
+    agentData->addDistributeUsecs(usecTimestampNow() - start);
 }
 
 void *distributeVoxelsToListeners(void *args) {
     
     AgentList* agentList = AgentList::getInstance();
     timeval lastSendTime;
+
+    VoxelDistributorPool distributorPool(::encodingThreads, distributeVoxelsToAgent);
+    static Agent* agentsToServe[MAX_NUM_AGENTS];
+
+    // how long it takes to serve all agents in one interval, so we can see how we scale with encodingThreads
+    const int SEND_STATS_INTERVALS = 100;
+    int intervalsSinceStats = 0;
+    long agentsServedSinceStats = 0;
+    long long usecsSendingSinceStats = 0;
+    long long maxUsecsSendingSinceStats = 0;
+    long long agentUsecsSinceStats = 0;
+
+    // how we're keeping up, since we started, for the agents
+    VoxelSendStats sendStats;
+    unsigned char sendStatsPacket[VoxelSendStats::PACKED_BYTES];
     
     while (true) {
         gettimeofday(&lastSendTime, NULL);
         
         // enumerate the agents to send 3 packets to each
+        // Sometimes the agent data has not yet been linked, in which case we can't really do anything
+        int agentCount = 0;
         for (AgentList::iterator agent = agentList->begin(); agent != agentList->end(); agent++) {
-            VoxelAgentData* agentData = (VoxelAgentData*) agent->getLinkedData();
+            if (agent->getLinkedData()) {
+                agentsToServe[agentCount++] = &(*agent);
+            }
+        }
 
-            // Sometimes the agent data has not yet been linked, in which case we can't really do anything
-            if (agentData) {
-                bool viewFrustumChanged = agentData->updateCurrentViewFrustum();
-                if (::debugVoxelSending) {
-                    printf("agentData->updateCurrentViewFrustum() changed=%s\n", debug::valueOf(viewFrustumChanged));
-                }
+        // if there's a limit on what we can send, share it out between the agents by what their pacers would send
+        if (::maxEgressBytesPerSecond > 0.0f) {
+            static float demands[MAX_NUM_AGENTS];
+            static float shares[MAX_NUM_AGENTS];
+            for (int i = 0; i < agentCount; i++) {
+                demands[i] = ((VoxelAgentData*)agentsToServe[i]->getLinkedData())->getPacer().getBytesPerSecond();
+            }
+            BandwidthPacer::shareBudget(::maxEgressBytesPerSecond, demands, shares, agentCount);
+            for (int i = 0; i < agentCount; i++) {
+                ((VoxelAgentData*)agentsToServe[i]->getLinkedData())->setEgressShare(shares[i]);
+            }
+        }
+        distributorPool.distribute(agentsToServe, agentCount);
 
-                if (agentData->getWantResIn()) { 
-                    resInVoxelDistributor(agentList, agent, agentData);
-                } else {
-                    deepestLevelVoxelDistributor(agentList, agent, agentData, viewFrustumChanged);
+        long long usecsSending = usecTimestampNow() - usecTimestamp(&lastSendTime);
+        agentsServedSinceStats += agentCount;
+        usecsSendingSinceStats += usecsSending;
+        maxUsecsSendingSinceStats = std::max(maxUsecsSendingSinceStats, usecsSending);
+
+        // the time spent on each agent, which with several encoding threads adds up to more than usecsSending
+        for (int i = 0; i < agentCount; i++) {
+            agentUsecsSinceStats += ((VoxelAgentData*)agentsToServe[i]->getLinkedData())->takeDistributeUsecs();
+        }
+
+        if (++intervalsSinceStats == SEND_STATS_INTERVALS) {
+            if (::debugVoxelSending || ::showSendStats) {
+                printf("served %.1f agents per interval in %lld usecs on average (max %lld usecs) with %d encoding threads, "
+                       "%.0f usecs per agent\n",
+                       (float)agentsServedSinceStats / intervalsSinceStats, usecsSendingSinceStats / intervalsSinceStats,
+                       maxUsecsSendingSinceStats, distributorPool.getThreadCount(),
+                       agentsServedSinceStats ? (float)agentUsecsSinceStats / agentsServedSinceStats : 0.0f);
+                int pacedAgents = 0;
+                float bytesPerSecond = 0.0f, loss = 0.0f, roundTripUsecs = 0.0f;
+                for (int i = 0; i < agentCount; i++) {
+                    BandwidthPacer& pacer = ((VoxelAgentData*)agentsToServe[i]->getLinkedData())->getPacer();
+                    if (pacer.hasFeedback()) {
+                        pacedAgents++;
+                        bytesPerSecond += pacer.getBytesPerSecond();
+                        loss += pacer.getLoss();
+                        roundTripUsecs += pacer.getRoundTripUsecs();
+                    }
+                }
+                if (pacedAgents) {
+                    printf("%d agents reporting back: %.0f bytes/sec, %.1f%% loss, %.1f msecs round trip on average\n",
+                           pacedAgents, bytesPerSecond / pacedAgents, loss * 100.0f / pacedAgents,
+                           roundTripUsecs / 1000.0f / pacedAgents);
+                }
+                if (::subtreeCache) {
+                    long hits = ::subtreeCache->getHits();
+                    long lookups = hits + ::subtreeCache->getMisses();
+                    printf("subtree cache: %ld of %ld lookups hit (%.1f%%), %ld bytes from cache, %ld subtrees not cacheable\n",
+                           hits, lookups, lookups ? hits * 100.0f / lookups : 0.0f, ::subtreeCache->getBytesFromCache(),
+                           ::subtreeCache->getUncacheable());
+                    ::subtreeCache->resetStats();
                 }
             }
+            intervalsSinceStats = 0;
+            agentsServedSinceStats = 0;
+            usecsSendingSinceStats = 0;
+            maxUsecsSendingSinceStats = 0;
+            agentUsecsSinceStats = 0;
         }
         
         // dynamically sleep until we need to fire off the next set of voxels
         long long usecToSleep =  VOXEL_SEND_INTERVAL_USECS - (usecTimestampNow() - usecTimestamp(&lastSendTime));
+
+        sendStats.intervals++;
+        sendStats.overruns += (usecToSleep > 0) ? 0 : 1;
+        sendStats.maxIntervalUsecs = std::max(sendStats.maxIntervalUsecs, (uint32_t)usecsSending);
+        sendStats.agents = agentCount;
+        if (sendStats.intervals % VOXEL_SEND_STATS_PACKET_INTERVALS == 0) {
+            int sendStatsBytes = sendStats.pack(sendStatsPacket);
+            for (int i = 0; i < agentCount; i++) {
+                if (agentsToServe[i]->getActiveSocket()) {
+                    agentList->getAgentSocket()->send(agentsToServe[i]->getActiveSocket(), sendStatsPacket,
+                                                      sendStatsBytes);
+                }
+            }
+            sendStats.maxIntervalUsecs = 0;
+        }
         
         if (usecToSleep > 0) {
             usleep(usecToSleep);
         } else {
-            std::cout << "Last send took too much time, not sleeping!\n";
+            printf("Last send took too much time, not sleeping! %d agents in %lld usecs with %d encoding threads\n",
+                   agentCount, usecsSending, distributorPool.getThreadCount());
         }
     }
     
@@ -450,17 +804,46 @@ void *distributeVoxelsToListeners(void *args) {
 
 void attachVoxelAgentDataToAgent(Agent* newAgent) {
     if (newAgent->getLinkedData() == NULL) {
-        newAgent->setLinkedData(new VoxelAgentData(newAgent));
+        float bytesPerSecond = (float)PACKETS_PER_CLIENT_PER_INTERVAL * MAX_VOXEL_PACKET_SIZE *
+                               (1000000.0f / VOXEL_SEND_INTERVAL_USECS);
+        VoxelAgentData* agentData = new VoxelAgentData(newAgent, bytesPerSecond);
+
+        // send what's biggest on screen first, without priority sending we still track the distances for our stats
+        agentData->nodeBag.setPrioritizeByDistanceFrom(&agentData->getCurrentViewFrustum(), ::wantPrioritySending);
+        newAgent->setLinkedData(agentData);
     }
 }
 
 int main(int argc, const char * argv[]) {
 
-    pthread_mutex_init(&::treeLock, NULL);
+    // prefer writers, otherwise a busy set of distributor threads could hold off voxel edits indefinitely
+    pthread_rwlockattr_t treeLockAttributes;
+    pthread_rwlockattr_init(&treeLockAttributes);
+#ifdef __linux__
+    pthread_rwlockattr_setkind_np(&treeLockAttributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&::treeLock, &treeLockAttributes);
+    pthread_rwlockattr_destroy(&treeLockAttributes);
 
-    AgentList* agentList = AgentList::createInstance(AGENT_TYPE_VOXEL_SERVER, VOXEL_LISTEN_PORT);
+    // several voxel servers on one machine each need their own port
+    const char* PORT = "--port";
+    const char* portOption = getCmdOption(argc, argv, PORT);
+    int listenPort = portOption ? atoi(portOption) : VOXEL_LISTEN_PORT;
+
+    AgentList* agentList = AgentList::createInstance(AGENT_TYPE_VOXEL_SERVER, listenPort);
     setvbuf(stdout, NULL, _IOLBF, 0);
 
+    // By default we own the whole tree, pass in this parameter with a list of octal code prefixes, see VoxelRegion, to
+    // split the tree with other voxel servers. Agents hear which server owns what from the domain server
+    const char* SHARD = "--shard";
+    const char* shardOption = getCmdOption(argc, argv, SHARD);
+    if (shardOption && !::voxelRegion.parse(shardOption)) {
+        printf("WARNING! --shard %s isn't a list of octal code prefixes like 0,1,27, we'll own the whole tree\n",
+               shardOption);
+    }
+    agentList->setOwnerVoxelRegion(::voxelRegion);
+    printf("port=%d shard=%s\n", listenPort, ::voxelRegion.isWholeTree() ? "whole tree" : shardOption);
+
     // Handle Local Domain testing with the --local command line
     const char* local = "--local";
     ::wantLocalDomain = cmdOptionExists(argc, argv,local);
@@ -483,6 +866,10 @@ int main(int argc, const char * argv[]) {
     ::shouldShowAnimationDebug = cmdOptionExists(argc, argv, WANT_ANIMATION_DEBUG);
     printf("shouldShowAnimationDebug=%s\n", debug::valueOf(::shouldShowAnimationDebug));
 
+    const char* SHOW_EDIT_STATS = "--showEditStats";
+    ::showEditStats = cmdOptionExists(argc, argv, SHOW_EDIT_STATS);
+    printf("showEditStats=%s\n", debug::valueOf(::showEditStats));
+
     const char* WANT_COLOR_RANDOMIZER = "--wantColorRandomizer";
     ::wantColorRandomizer = cmdOptionExists(argc, argv, WANT_COLOR_RANDOMIZER);
     printf("wantColorRandomizer=%s\n", debug::valueOf(::wantColorRandomizer));
@@ -491,6 +878,46 @@ int main(int argc, const char * argv[]) {
     ::wantSearchForColoredNodes = cmdOptionExists(argc, argv, WANT_SEARCH_FOR_NODES);
     printf("wantSearchForColoredNodes=%s\n", debug::valueOf(::wantSearchForColoredNodes));
 
+    // By default we send the voxels that are biggest on screen first, pass in this parameter to send in tree order
+    const char* NO_PRIORITY_SENDING = "--noPrioritySending";
+    ::wantPrioritySending = !cmdOptionExists(argc, argv, NO_PRIORITY_SENDING);
+    printf("wantPrioritySending=%s\n", debug::valueOf(::wantPrioritySending));
+
+    // By default we only resend the parts of the tree that changed since a client last got them, as long as the client's
+    // view hasn't changed. Pass in this parameter to resend everything in view every time
+    const char* NO_INCREMENTAL_SENDING = "--noIncrementalSending";
+    ::wantIncrementalSending = !cmdOptionExists(argc, argv, NO_INCREMENTAL_SENDING);
+    printf("wantIncrementalSending=%s\n", debug::valueOf(::wantIncrementalSending));
+
+    // By default agents whose views overlap share encoded subtrees, pass in this parameter to encode everything per agent
+    const char* NO_SUBTREE_CACHE = "--noSubtreeCache";
+    if (!cmdOptionExists(argc, argv, NO_SUBTREE_CACHE)) {
+        ::subtreeCache = new EncodedSubtreeCache(SUBTREE_CACHE_SLOTS, SUBTREE_CACHE_BYTES);
+    }
+    printf("subtreeCache=%s\n", debug::valueOf(::subtreeCache != NULL));
+
+    // Agents that ask for occlusion culling get it from the CoverageMap, pass in this parameter to use the raster
+    // OcclusionBuffer instead
+    const char* RASTER_OCCLUSION = "--rasterOcclusion";
+    ::wantRasterOcclusion = cmdOptionExists(argc, argv, RASTER_OCCLUSION);
+    printf("wantRasterOcclusion=%s\n", debug::valueOf(::wantRasterOcclusion));
+
+    const char* SHOW_SEND_STATS = "--showSendStats";
+    ::showSendStats = cmdOptionExists(argc, argv, SHOW_SEND_STATS);
+    printf("showSendStats=%s\n", debug::valueOf(::showSendStats));
+
+    // By default we encode on every core, pass in this parameter to use a specific number of threads
+    const char* ENCODING_THREADS = "--encodingThreads";
+    const char* encodingThreadsOption = getCmdOption(argc, argv, ENCODING_THREADS);
+#ifndef _WIN32
+    ::encodingThreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (encodingThreadsOption) {
+        ::encodingThreads = atoi(encodingThreadsOption);
+    }
+    ::encodingThreads = std::max(1, ::encodingThreads);
+    printf("encodingThreads=%d\n", ::encodingThreads);
+
     // By default we will voxel persist, if you want to disable this, then pass in this parameter
     const char* NO_VOXEL_PERSIST = "--NoVoxelPersist";
     if (cmdOptionExists(argc, argv, NO_VOXEL_PERSIST)) {
@@ -498,24 +925,52 @@ int main(int argc, const char * argv[]) {
     }
     printf("wantVoxelPersist=%s\n", debug::valueOf(::wantVoxelPersist));
 
-    // if we want Voxel Persistance, load the local file now...
+    // if we want Voxel Persistance, load the local file now... a mapped persist file only needs its top levels loaded
+    // before we can start serving, a wire format one has to be read in full and reaveraged
     bool persistantFileRead = false;
+    bool wireFormatFileRead = false;
     if (::wantVoxelPersist) {
         printf("loading voxels from file...\n");
-        persistantFileRead = ::serverTree.readFromSVOFile(::wantLocalDomain ? LOCAL_VOXELS_PERSIST_FILE : VOXELS_PERSIST_FILE);
-        if (persistantFileRead) {
+        // shards on the same machine each keep their own part of the tree, in their own file
+        std::string persistFile = ::wantLocalDomain ? LOCAL_VOXELS_PERSIST_FILE : VOXELS_PERSIST_FILE;
+        if (!::voxelRegion.isWholeTree()) {
+            std::string shardName = shardOption;
+            std::replace(shardName.begin(), shardName.end(), ',', '_');
+            persistFile.insert(persistFile.rfind('.'), "-shard-" + shardName);
+        }
+        printf("persisting to %s\n", persistFile.c_str());
+        ::persister = new VoxelPersister(&::serverTree, &::treeLock, persistFile.c_str());
+        persistantFileRead = ::persister->loadSnapshot(PERSIST_FILE_EAGER_LEVELS);
+        if (!persistantFileRead) {
+            wireFormatFileRead = ::serverTree.readFromSVOFile(::wantLocalDomain ? LOCAL_VOXELS_WIRE_FORMAT_PERSIST_FILE
+                                                                               : VOXELS_WIRE_FORMAT_PERSIST_FILE);
+            persistantFileRead = wireFormatFileRead;
+        }
+        if (wireFormatFileRead) {
             PerformanceWarning warn(::shouldShowAnimationDebug,
-                                    "persistVoxelsWhenDirty() - reaverageVoxelColors()", ::shouldShowAnimationDebug);
+                                    "persistVoxelsWhenDirty() - reaverageAndValidate()", ::shouldShowAnimationDebug);
             
-            // after done inserting all these voxels, then reaverage colors
-            serverTree.reaverageVoxelColors(serverTree.rootNode);
-            printf("Voxels reAveraged\n");
+            // after done inserting all these voxels, then reaverage colors, on as many threads as we'll encode with
+            // since nothing else is running yet
+            VoxelTreeStats reaveragedStats;
+            serverTree.reaverageAndValidate(::encodingThreads, true, reaveragedStats);
+            printf("Voxels reAveraged, %ld nodes collapsed\n", reaveragedStats.collapsedCount);
+
+            // from now on we'll keep it in the mapped format
+            ::persister->requestSnapshot();
         }
+
+        // then whatever was edited since the snapshot was taken
+        long editsReplayed = ::persister->replayEditLogs();
         
         ::serverTree.clearDirtyBit(); // the tree is clean since we just loaded it
-        printf("DONE loading voxels from file... fileRead=%s\n", debug::valueOf(persistantFileRead));
-        unsigned long nodeCount = ::serverTree.getVoxelCount();
-        printf("Nodes after loading scene %ld nodes\n", nodeCount);
+        printf("DONE loading voxels from file... fileRead=%s editsReplayed=%ld\n",
+               debug::valueOf(persistantFileRead), editsReplayed);
+        VoxelTreeStats loadedStats;
+        ::serverTree.reaverageAndValidate(::encodingThreads, false, loadedStats);
+        printf("Nodes after loading scene %ld nodes, %ld colored, %ld that fail validation%s\n", loadedStats.nodeCount,
+               loadedStats.coloredCount, loadedStats.problemCount,
+               ::serverTree.hasNodesOnDisk() ? ", the rest will load in the background" : "");
     }
 
     // Check to see if the user passed in a command line option for loading an old style local
@@ -523,7 +978,30 @@ int main(int argc, const char * argv[]) {
     const char* INPUT_FILE = "-i";
     const char* voxelsFilename = getCmdOption(argc, argv, INPUT_FILE);
     if (voxelsFilename) {
+        // the file is merged into the tree, so we need all of the tree first
+        while (serverTree.hasNodesOnDisk()) {
+            serverTree.materializeNodesFromDisk(NODES_PER_MATERIALIZE);
+        }
         serverTree.readFromSVOFile(voxelsFilename);
+        if (::persister) {
+            ::persister->requestSnapshot();
+        }
+    }
+
+    // whatever we loaded, we only keep our part of it, which means we need all of it first
+    if (!::voxelRegion.isWholeTree()) {
+        while (serverTree.hasNodesOnDisk()) {
+            serverTree.materializeNodesFromDisk(NODES_PER_MATERIALIZE);
+        }
+        keepTreeInRegion();
+        VoxelTreeStats shardStats;
+        ::serverTree.reaverageAndValidate(::encodingThreads, false, shardStats);
+        printf("Nodes in our shard %ld nodes\n", shardStats.nodeCount);
+    }
+
+    if (serverTree.hasNodesOnDisk()) {
+        pthread_t materializeVoxelsThread;
+        pthread_create(&materializeVoxelsThread, NULL, materializeVoxelsFromDisk, NULL);
     }
 
     // Check to see if the user passed in a command line option for setting packet send rate
@@ -536,12 +1014,24 @@ int main(int argc, const char * argv[]) {
         }
         printf("packetsPerSecond=%s PACKETS_PER_CLIENT_PER_INTERVAL=%d\n", packetsPerSecond, PACKETS_PER_CLIENT_PER_INTERVAL);
     }
+
+    // By default each agent is sent what its link can take, pass in this parameter to also cap what all of them get
+    const char* MAX_EGRESS_BYTES_PER_SECOND = "--maxEgressBytesPerSecond";
+    const char* maxEgressBytesPerSecond = getCmdOption(argc, argv, MAX_EGRESS_BYTES_PER_SECOND);
+    if (maxEgressBytesPerSecond) {
+        ::maxEgressBytesPerSecond = atof(maxEgressBytesPerSecond);
+        printf("maxEgressBytesPerSecond=%.0f\n", ::maxEgressBytesPerSecond);
+    }
     
     const char* ADD_RANDOM_VOXELS = "--AddRandomVoxels";
     if (cmdOptionExists(argc, argv, ADD_RANDOM_VOXELS)) {
         // create an octal code buffer and load it with 0 so that the recursive tree fill can give
         // octal codes to the tree nodes that it is creating
         randomlyFillVoxelTree(MAX_VOXEL_TREE_DEPTH_LEVELS, serverTree.rootNode);
+        keepTreeInRegion();
+        if (::persister) {
+            ::persister->requestSnapshot();
+        }
     }
 
     const char* ADD_SCENE = "--AddScene";
@@ -561,6 +1051,14 @@ int main(int argc, const char * argv[]) {
     bool actuallyAddScene = false; // !noAddScene && (addScene || (::wantVoxelPersist && !persistantFileRead));
     if (actuallyAddScene) {
         addSphereScene(&serverTree);
+        keepTreeInRegion();
+        if (::persister) {
+            ::persister->requestSnapshot();
+        }
+    }
+
+    if (::persister) {
+        ::persister->start();
     }
     
     // for now, initialize the environments with fixed values
@@ -595,71 +1093,40 @@ int main(int argc, const char * argv[]) {
             gettimeofday(&lastDomainServerCheckIn, NULL);
             AgentList::getInstance()->sendDomainServerCheckIn();
         }
-        
-        // check to see if we need to persist our voxel state
-        persistVoxelsWhenDirty();
-    
-        if (agentList->getAgentSocket()->receive(&agentPublicAddress, packetData, &receivedBytes)) {
-            if (packetData[0] == PACKET_HEADER_SET_VOXEL || packetData[0] == PACKET_HEADER_SET_VOXEL_DESTRUCTIVE) {
-                bool destructive = (packetData[0] == PACKET_HEADER_SET_VOXEL_DESTRUCTIVE);
-                PerformanceWarning warn(::shouldShowAnimationDebug,
-                                        destructive ? "PACKET_HEADER_SET_VOXEL_DESTRUCTIVE" : "PACKET_HEADER_SET_VOXEL",
-                                        ::shouldShowAnimationDebug);
-                unsigned short int itemNumber = (*((unsigned short int*)&packetData[1]));
-                if (::shouldShowAnimationDebug) {
-                    printf("got %s - command from client receivedBytes=%ld itemNumber=%d\n",
-                        destructive ? "PACKET_HEADER_SET_VOXEL_DESTRUCTIVE" : "PACKET_HEADER_SET_VOXEL",
-                        receivedBytes,itemNumber);
-                }
-                int atByte = sizeof(PACKET_HEADER) + sizeof(itemNumber);
-                unsigned char* voxelData = (unsigned char*)&packetData[atByte];
-                while (atByte < receivedBytes) {
-                    unsigned char octets = (unsigned char)*voxelData;
-                    const int COLOR_SIZE_IN_BYTES = 3;
-                    int voxelDataSize = bytesRequiredForCodeLength(octets) + COLOR_SIZE_IN_BYTES;
-                    int voxelCodeSize = bytesRequiredForCodeLength(octets);
-
-                    // color randomization on insert
-                    int colorRandomizer = ::wantColorRandomizer ? randIntInRange (-50, 50) : 0;
-                    int red   = voxelData[voxelCodeSize + 0];
-                    int green = voxelData[voxelCodeSize + 1];
-                    int blue  = voxelData[voxelCodeSize + 2];
-
-                    if (::shouldShowAnimationDebug) {
-                        printf("insert voxels - wantColorRandomizer=%s old r=%d,g=%d,b=%d \n",
-                            (::wantColorRandomizer?"yes":"no"),red,green,blue);
-                    }
-                
-                    red   = std::max(0, std::min(255, red   + colorRandomizer));
-                    green = std::max(0, std::min(255, green + colorRandomizer));
-                    blue  = std::max(0, std::min(255, blue  + colorRandomizer));
 
-                    if (::shouldShowAnimationDebug) {
-                        printf("insert voxels - wantColorRandomizer=%s NEW r=%d,g=%d,b=%d \n",
-                            (::wantColorRandomizer?"yes":"no"),red,green,blue);
-                    }
-                    voxelData[voxelCodeSize + 0] = red;
-                    voxelData[voxelCodeSize + 1] = green;
-                    voxelData[voxelCodeSize + 2] = blue;
-
-                    if (::shouldShowAnimationDebug) {
-                        float* vertices = firstVertexForCode(voxelData);
-                        printf("inserting voxel at: %f,%f,%f\n", vertices[0], vertices[1], vertices[2]);
-                        delete []vertices;
-                    }
-                
-                    serverTree.readCodeColorBufferToTree(voxelData, destructive);
-                    // skip to next
-                    voxelData += voxelDataSize;
-                    atByte += voxelDataSize;
-                }
+        bool packetReceived = agentList->getAgentSocket()->receive(&agentPublicAddress, packetData, &receivedBytes);
+        if (packetReceived && isVoxelEditPacket(packetData)) {
+            // gather up any other edits that are already waiting for us, so they can all go in with one walk of the tree
+            UDPSocket* agentSocket = agentList->getAgentSocket();
+            int editPacketCount = 0;
+            bool gathering = true;
+            agentSocket->setBlocking(false);
+            while (gathering) {
+                memcpy(::editPackets + editPacketCount * MAX_PACKET_SIZE, packetData, receivedBytes);
+                ::editPacketBytes[editPacketCount++] = receivedBytes;
+                packetReceived = editPacketCount < MAX_EDIT_PACKETS_PER_BATCH
+                    && agentSocket->receive(&agentPublicAddress, packetData, &receivedBytes);
+                gathering = packetReceived && isVoxelEditPacket(packetData);
             }
+            agentSocket->setBlocking(true);
+            applyVoxelEditPackets(editPacketCount);
+        }
+        if (::showEditStats) {
+            printEditStats();
+        }
+
+        // if gathering edits stopped at some other packet, it's still waiting for us in packetData
+        if (packetReceived) {
             if (packetData[0] == PACKET_HEADER_ERASE_VOXEL) {
 
                 // Send these bits off to the VoxelTree class to process them
-                pthread_mutex_lock(&::treeLock);
+                pthread_rwlock_wrlock(&::treeLock);
                 serverTree.processRemoveVoxelBitstream((unsigned char*)packetData, receivedBytes);
-                pthread_mutex_unlock(&::treeLock);
+                keepTreeInRegion();
+                if (::persister) {
+                    ::persister->getEditLog().logEraseVoxelBitstream((unsigned char*)packetData, receivedBytes);
+                }
+                pthread_rwlock_unlock(&::treeLock);
             }
             if (packetData[0] == PACKET_HEADER_Z_COMMAND) {
 
@@ -674,12 +1141,24 @@ int main(int argc, const char * argv[]) {
                 while (totalLength <= receivedBytes) {
                     if (strcmp(command, ERASE_ALL_COMMAND) == 0) {
                         printf("got Z message == erase all\n");
+                        pthread_rwlock_wrlock(&::treeLock);
                         eraseVoxelTreeAndCleanupAgentVisitData();
+                        keepTreeInRegion();
+                        if (::persister) {
+                            ::persister->getEditLog().logEraseAll();
+                        }
+                        pthread_rwlock_unlock(&::treeLock);
                         rebroadcast = false;
                     }
                     if (strcmp(command, ADD_SCENE_COMMAND) == 0) {
                         printf("got Z message == add scene\n");
+                        pthread_rwlock_wrlock(&::treeLock);
                         addSphereScene(&serverTree);
+                        keepTreeInRegion();
+                        if (::persister) {
+                            ::persister->requestSnapshot();
+                        }
+                        pthread_rwlock_unlock(&::treeLock);
                         rebroadcast = false;
                     }
                     if (strcmp(command, TEST_COMMAND) == 0) {
@@ -694,6 +1173,14 @@ int main(int argc, const char * argv[]) {
                     agentList->broadcastToAgents(packetData, receivedBytes, &AGENT_TYPE_AVATAR, 1);
                 }
             }
+            // agents tell us how our voxel packets are getting through, so we can send them as fast as they can take
+            if (packetData[0] == PACKET_HEADER_RECEIVE_REPORT) {
+                Agent* agent = agentList->agentWithAddress(&agentPublicAddress);
+                ReceiveReport report;
+                if (agent && agent->getLinkedData() && report.unpack(packetData, receivedBytes)) {
+                    ((VoxelAgentData*)agent->getLinkedData())->getPacer().processReport(report, usecTimestampNow());
+                }
+            }
             // If we got a PACKET_HEADER_HEAD_DATA, then we're talking to an AGENT_TYPE_AVATAR, and we
             // need to make sure we have it in our agentList.
             if (packetData[0] == PACKET_HEADER_HEAD_DATA) {
@@ -710,7 +1197,7 @@ int main(int argc, const char * argv[]) {
     }
     
     pthread_join(sendVoxelThread, NULL);
-    pthread_mutex_destroy(&::treeLock);
+    pthread_rwlock_destroy(&::treeLock);
 
     return 0;
 }